@@ -11,18 +11,117 @@
 #include "ippserver.h"
 #include "printer-png.h"
 #include "printer3d-png.h"
+#ifdef __linux__
+#  include <sched.h>
+#endif /* __linux__ */
+
+
+/*
+ * Local constants...
+ */
+
+#define WEB_CACHE_TIME	60		/* Maximum age of a cached web page */
+
+
+/*
+ * Local types...
+ */
+
+typedef struct server_accept_s		/**** Accept loop data ****/
+{
+  int			thread;		/* Accept thread number */
+  nfds_t		num_fds;	/* Number of listeners */
+  struct pollfd		*fds;		/* poll() data for listeners */
+  server_listener_t	**lis;		/* Listeners */
+} server_accept_t;
+
+typedef enum server_page_e		/**** Web page ****/
+{
+  SERVER_PAGE_MATERIALS,		/* Materials page */
+  SERVER_PAGE_MEDIA,			/* Media page */
+  SERVER_PAGE_STATUS,			/* Printer/system status page */
+  SERVER_PAGE_SUPPLIES			/* Supplies page */
+} server_page_t;
+
+typedef struct server_webpage_s		/**** Cached web page ****/
+{
+  int			printer_id;	/* Printer ID or 0 for the system */
+  server_page_t		page;		/* Page */
+  int			apple_client;	/* Rendered for an Apple client? */
+  time_t		config_time,	/* Printer config-change-time when rendered */
+			state_time,	/* Printer state-change-time when rendered */
+			rendered,	/* Time rendered */
+			modified;	/* Last Last-Modified time used */
+  bool			use_modified;	/* Send Last-Modified for current HTML? */
+  char			*data;		/* HTML or `NULL` if not current */
+  size_t		datalen;	/* Length of HTML */
+} server_webpage_t;
+
+
+/*
+ * Local globals...
+ */
+
+static cups_array_t	*web_pages = NULL;
+					/* Cached web pages */
+static cups_mutex_t	web_mutex = CUPS_MUTEX_INITIALIZER;
+					/* Mutex for cached web pages */
+static unsigned		web_serial = 0;	/* Web page invalidation counter */
+static cups_mutex_t	stats_mutex = CUPS_MUTEX_INITIALIZER;
+					/* Mutex for connection statistics */
+static unsigned		stats_connections = 0,
+					/* Number of connections accepted */
+			stats_requests = 0,
+					/* Number of HTTP requests */
+			stats_tls_handshakes = 0,
+					/* Number of TLS handshakes */
+			stats_keepalive_encrypted = 0;
+					/* Requests on encrypted keep-alive connections */
+static cups_mutex_t	pool_mutex = CUPS_MUTEX_INITIALIZER;
+					/* Mutex for client pool */
+static cups_cond_t	pool_cond = CUPS_COND_INITIALIZER;
+					/* Condition for queued clients */
+static cups_array_t	*pool_clients = NULL,
+					/* Idle client objects */
+			*pool_queue = NULL;
+					/* Clients waiting for a thread */
+static size_t		pool_threads = 0;
+					/* Number of idle client threads */
+static unsigned		pool_client_hits = 0,
+					/* Client objects reused */
+			pool_client_misses = 0,
+					/* Client objects allocated */
+			pool_thread_hits = 0,
+					/* Connections given to idle threads */
+			pool_thread_misses = 0;
+					/* Connections given to new threads */
 
 
 /*
  * Local functions...
  */
 
+static void		accept_client(server_listener_t *lis);
+static void		*accept_clients(server_accept_t *loop);
+static int		compare_webpages(server_webpage_t *a, server_webpage_t *b);
+static void		count_connection(unsigned connections, unsigned requests, unsigned handshakes, unsigned encrypted);
+static void		free_client(server_client_t *client);
 static void		html_escape(server_client_t *client, const char *s, size_t slen);
 static void		html_footer(server_client_t *client);
 static void		html_header(server_client_t *client, const char *title, int refresh);
 static void		html_printf(server_client_t *client, const char *format, ...) _CUPS_FORMAT(2, 3);
+static int		html_start(server_client_t *client, const char *encoding);
+static void		html_write(server_client_t *client, const char *data, size_t datalen);
+#ifdef SO_REUSEPORT
+static int		listen_addr(http_addr_t *addr, int port, int thread);
+#endif /* SO_REUSEPORT */
 static size_t		parse_options(server_client_t *client, cups_option_t **options);
+static int		parse_range(const char *range, off_t size, off_t *first, off_t *last);
+static bool		queue_client(server_client_t *client);
+static void		*run_client(void *data);
+static int		send_file(server_client_t *client, int fd, struct stat *fileinfo, const char *type);
 static int		send_mobile_config(server_client_t *client, server_printer_t *printer);
+static int		send_page(server_client_t *client, server_printer_t *printer, server_page_t page, const char *encoding);
 static void		send_printer_payload(server_client_t *client, server_printer_t *printer);
 static int		show_materials(server_client_t *client, server_printer_t *printer, const char *encoding);
 static int		show_media(server_client_t *client, server_printer_t *printer, const char *encoding);
@@ -30,6 +129,52 @@ static int		show_status(server_client_t *client, server_printer_t *printer, cons
 static int		show_supplies(server_client_t *client, server_printer_t *printer, const char *encoding);
 
 
+/*
+ * 'serverCopyClientStatus()' - Copy the client connection statistics.
+ */
+
+void
+serverCopyClientStatus(
+    ipp_t        *ipp,			/* I - IPP message */
+    cups_array_t *ra)			/* I - Requested attributes */
+{
+  cupsMutexLock(&stats_mutex);
+
+  if (!ra || cupsArrayFind(ra, "smi2699-connections"))
+    ippAddInteger(ipp, IPP_TAG_SYSTEM, IPP_TAG_INTEGER, "smi2699-connections", (int)stats_connections);
+
+  if (!ra || cupsArrayFind(ra, "smi2699-keep-alive-timeout"))
+    ippAddInteger(ipp, IPP_TAG_SYSTEM, IPP_TAG_INTEGER, "smi2699-keep-alive-timeout", KeepAliveTimeout);
+
+  if (!ra || cupsArrayFind(ra, "smi2699-requests"))
+    ippAddInteger(ipp, IPP_TAG_SYSTEM, IPP_TAG_INTEGER, "smi2699-requests", (int)stats_requests);
+
+  if (!ra || cupsArrayFind(ra, "smi2699-tls-handshakes"))
+    ippAddInteger(ipp, IPP_TAG_SYSTEM, IPP_TAG_INTEGER, "smi2699-tls-handshakes", (int)stats_tls_handshakes);
+
+  if (!ra || cupsArrayFind(ra, "smi2699-keepalive-encrypted-requests"))
+    ippAddInteger(ipp, IPP_TAG_SYSTEM, IPP_TAG_INTEGER, "smi2699-keepalive-encrypted-requests", (int)stats_keepalive_encrypted);
+
+  cupsMutexUnlock(&stats_mutex);
+
+  cupsMutexLock(&pool_mutex);
+
+  if (!ra || cupsArrayFind(ra, "smi2699-client-pool-hits"))
+    ippAddInteger(ipp, IPP_TAG_SYSTEM, IPP_TAG_INTEGER, "smi2699-client-pool-hits", (int)pool_client_hits);
+
+  if (!ra || cupsArrayFind(ra, "smi2699-client-pool-misses"))
+    ippAddInteger(ipp, IPP_TAG_SYSTEM, IPP_TAG_INTEGER, "smi2699-client-pool-misses", (int)pool_client_misses);
+
+  if (!ra || cupsArrayFind(ra, "smi2699-client-thread-hits"))
+    ippAddInteger(ipp, IPP_TAG_SYSTEM, IPP_TAG_INTEGER, "smi2699-client-thread-hits", (int)pool_thread_hits);
+
+  if (!ra || cupsArrayFind(ra, "smi2699-client-thread-misses"))
+    ippAddInteger(ipp, IPP_TAG_SYSTEM, IPP_TAG_INTEGER, "smi2699-client-thread-misses", (int)pool_thread_misses);
+
+  cupsMutexUnlock(&pool_mutex);
+}
+
+
 /*
  * 'serverCreateClient()' - Accept a new network connection and create a client object.
  */
@@ -38,17 +183,34 @@ server_client_t *			/* O - Client */
 serverCreateClient(int sock)		/* I - Listen socket */
 {
   server_client_t	*client;	/* Client */
+  int			number;		/* Client number */
   static int		next_client_number = 1;
 					/* Next client number */
 
 
-  if ((client = calloc(1, sizeof(server_client_t))) == NULL)
+  cupsMutexLock(&pool_mutex);
+
+  number = next_client_number ++;
+
+  if ((client = (server_client_t *)cupsArrayGetLast(pool_clients)) != NULL)
+  {
+    cupsArrayRemove(pool_clients, client);
+    pool_client_hits ++;
+  }
+  else
+  {
+    pool_client_misses ++;
+  }
+
+  cupsMutexUnlock(&pool_mutex);
+
+  if (!client && (client = calloc(1, sizeof(server_client_t))) == NULL)
   {
     perror("Unable to allocate memory for client");
     return (NULL);
   }
 
-  client->number     = next_client_number ++;
+  client->number     = number;
   client->fetch_file = -1;
 
  /*
@@ -59,7 +221,7 @@ serverCreateClient(int sock)		/* I - Listen socket */
   {
     serverLogClient(SERVER_LOGLEVEL_ERROR, client, "Unable to accept client connection: %s", cupsGetErrorString());
 
-    free(client);
+    free_client(client);
 
     return (NULL);
   }
@@ -68,6 +230,8 @@ serverCreateClient(int sock)		/* I - Listen socket */
 
   serverLogClient(SERVER_LOGLEVEL_INFO, client, "Accepted connection from \"%s\".", client->hostname);
 
+  count_connection(1, 0, 0, 0);
+
   return (client);
 }
 
@@ -81,12 +245,19 @@ serverCreateListeners(const char *host,	/* I - Hostname, IP address, or NULL for
                       int        port)	/* I - Port number */
 {
   int			count = 0;	/* Number of sockets */
-  int			sock;		/* Listener socket */
+  int			sock,		/* Listener socket */
+			thread;		/* Accept thread */
   http_addrlist_t	*addrlist,	/* Listen address(es) */
 			*addr;		/* Current address */
   char			service[32],	/* Service port */
 			local[256];	/* Local hostname */
   server_listener_t	*lis;		/* New listener */
+#ifdef SO_REUSEPORT
+  int			num_threads = AcceptThreads > 1 ? AcceptThreads : 1;
+					/* Number of accept threads */
+#else
+  int			num_threads = 1;/* No SO_REUSEPORT, one socket per address */
+#endif /* SO_REUSEPORT */
 
 
   if (host && !strcmp(host, "*"))
@@ -107,24 +278,40 @@ serverCreateListeners(const char *host,	/* I - Hostname, IP address, or NULL for
 
   for (addr = addrlist; addr; addr = addr->next)
   {
-    if ((sock = httpAddrListen(&(addr->addr), port)) < 0)
-      continue;
+   /*
+    * Open one socket per accept thread, sharing the address with
+    * SO_REUSEPORT...
+    */
 
-    if ((lis = calloc(1, sizeof(server_listener_t))) == NULL)
+    for (thread = 0; thread < num_threads; thread ++)
     {
-      httpAddrClose(&addr->addr, sock);
-      break;
-    }
+#ifdef SO_REUSEPORT
+      if (num_threads > 1)
+        sock = listen_addr(&(addr->addr), port, thread);
+      else
+#endif /* SO_REUSEPORT */
+      sock = httpAddrListen(&(addr->addr), port);
+
+      if (sock < 0)
+        break;
+
+      if ((lis = calloc(1, sizeof(server_listener_t))) == NULL)
+      {
+	httpAddrClose(&addr->addr, sock);
+	break;
+      }
 
-    lis->fd = sock;
-    cupsCopyString(lis->host, host, sizeof(lis->host));
-    lis->port = port;
+      lis->fd = sock;
+      cupsCopyString(lis->host, host, sizeof(lis->host));
+      lis->port   = port;
+      lis->thread = thread;
 
-    if (!Listeners)
-      Listeners = cupsArrayNew(NULL, NULL, NULL, 0, NULL, NULL);
+      if (!Listeners)
+	Listeners = cupsArrayNew(NULL, NULL, NULL, 0, NULL, NULL);
 
-    cupsArrayAdd(Listeners, lis);
-    count ++;
+      cupsArrayAdd(Listeners, lis);
+      count ++;
+    }
   }
 
   httpAddrFreeList(addrlist);
@@ -157,7 +344,63 @@ serverDeleteClient(server_client_t *client)	/* I - Client */
   ippDelete(client->request);
   ippDelete(client->response);
 
-  free(client);
+  free_client(client);
+}
+
+
+/*
+ * 'serverInvalidateWebPages()' - Invalidate the cached web pages for a printer.
+ *
+ * The system status page is always invalidated since it shows every printer.
+ */
+
+void
+serverInvalidateWebPages(
+    server_printer_t *printer,		/* I - Printer or `NULL` for the system */
+    bool             deleted)		/* I - Is the printer being deleted? */
+{
+  server_webpage_t	key,		/* Search key */
+			*wp;		/* Cached web page */
+  int			i,		/* Looping var */
+			page,		/* Current page */
+			ids[2];		/* Printer IDs to invalidate */
+
+
+  memset(&key, 0, sizeof(key));
+
+  ids[0] = 0;
+  ids[1] = printer ? printer->id : 0;
+
+  cupsMutexLock(&web_mutex);
+
+  web_serial ++;
+
+  for (i = 0; i < (printer ? 2 : 1); i ++)
+  {
+    key.printer_id = ids[i];
+
+    for (page = SERVER_PAGE_MATERIALS; page <= SERVER_PAGE_SUPPLIES; page ++)
+    {
+      key.page = (server_page_t)page;
+
+      for (key.apple_client = 0; key.apple_client < 2; key.apple_client ++)
+      {
+	if ((wp = (server_webpage_t *)cupsArrayFind(web_pages, &key)) == NULL)
+	  continue;
+
+	free(wp->data);
+	wp->data = NULL;
+
+	if (deleted && key.printer_id)
+	{
+	  cupsArrayRemove(web_pages, wp);
+	  free(wp);
+	}
+      }
+    }
+  }
+
+  cupsMutexUnlock(&web_mutex);
 }
 
 
@@ -170,12 +413,13 @@ serverProcessClient(
     server_client_t *client)		/* I - Client */
 {
  /*
-  * Loop until we are out of requests or timeout (30 seconds)...
+  * Loop until we are out of requests or timeout (KeepAliveTimeout seconds)...
   */
 
   int first_time = 1;			/* First time request? */
+  int requests = 0;			/* Number of requests on connection */
 
-  while (httpWait(client->http, 30000))
+  while (httpWait(client->http, 1000 * KeepAliveTimeout))
   {
     if (first_time && Encryption != HTTP_ENCRYPTION_NEVER)
     {
@@ -197,11 +441,19 @@ serverProcessClient(
         }
 
         serverLogClient(SERVER_LOGLEVEL_INFO, client, "Connection now encrypted.");
+        count_connection(0, 0, 1, 0);
       }
 
       first_time = 0;
     }
 
+   /*
+    * Count requests after the first on an encrypted keep-alive connection...
+    */
+
+    count_connection(0, 1, 0, requests > 0 && httpIsEncrypted(client->http));
+    requests ++;
+
     if (!serverProcessHTTP(client))
       break;
   }
@@ -247,9 +499,10 @@ serverProcessHTTP(
   ippDelete(client->request);
   ippDelete(client->response);
 
-  client->request   = NULL;
-  client->response  = NULL;
-  client->operation = HTTP_STATE_WAITING;
+  client->request     = NULL;
+  client->response    = NULL;
+  client->operation   = HTTP_STATE_WAITING;
+  client->retry_after = 0;
 
  /*
   * Read a request from the connection...
@@ -370,6 +623,7 @@ serverProcessHTTP(
       }
 
       serverLogClient(SERVER_LOGLEVEL_INFO, client, "Connection now encrypted.");
+      count_connection(0, 0, 1, 0);
     }
     else if (!serverRespondHTTP(client, HTTP_STATUS_NOT_IMPLEMENTED, NULL, NULL, 0))
       return (0);
@@ -420,6 +674,14 @@ serverProcessHTTP(
     return (0);
   }
 
+ /*
+  * Apply rate limits to web pages and resources.  IPP requests are checked
+  * once the operation is known...
+  */
+
+  if ((client->operation == HTTP_STATE_GET || client->operation == HTTP_STATE_HEAD) && !serverCheckRateLimit(client, SERVER_LIMIT_READ))
+    return (serverRespondHTTP(client, HTTP_STATUS_SERVICE_UNAVAILABLE, NULL, NULL, 0));
+
  /*
   * Handle new transfers...
   */
@@ -522,28 +784,26 @@ serverProcessHTTP(
 
               int		fd;		/* Icon file */
               struct stat	fileinfo;	/* Icon file information */
-              char		buffer[4096];	/* Copy buffer */
-              ssize_t		bytes;		/* Bytes */
 
               if (printer->icon_resource)
               {
                 serverLogClient(SERVER_LOGLEVEL_DEBUG, client, "Icon file is \"%s\".", printer->icon_resource->filename);
 
-                if (!stat(printer->icon_resource->filename, &fileinfo) && (fd = open(printer->icon_resource->filename, O_RDONLY | O_BINARY)) >= 0)
+                if ((fd = open(printer->icon_resource->filename, O_RDONLY | O_BINARY)) >= 0)
                 {
-                  if (!serverRespondHTTP(client, HTTP_STATUS_OK, NULL, "image/png", (size_t)fileinfo.st_size))
+                  int status;		/* Send status */
+
+                  if (fstat(fd, &fileinfo))
                   {
+                    serverRespondHTTP(client, HTTP_STATUS_SERVER_ERROR, NULL, NULL, 0);
                     close(fd);
                     return (0);
                   }
 
-                  while ((bytes = read(fd, buffer, sizeof(buffer))) > 0)
-                    httpWrite(client->http, buffer, (size_t)bytes);
-
-                  httpFlushWrite(client->http);
+                  status = send_file(client, fd, &fileinfo, "image/png");
 
                   close(fd);
-                  return (1);
+                  return (status);
                 }
               }
               else if (printer)
@@ -571,19 +831,19 @@ serverProcessHTTP(
             }
             else if (!*uriptr)
             {
-              return (show_status(client, printer, encoding));
+              return (send_page(client, printer, SERVER_PAGE_STATUS, encoding));
             }
             else if (!strcmp(uriptr, "materials"))
             {
-              return (show_materials(client, printer, encoding));
+              return (send_page(client, printer, SERVER_PAGE_MATERIALS, encoding));
             }
             else if (!strcmp(uriptr, "media"))
             {
-              return (show_media(client, printer, encoding));
+              return (send_page(client, printer, SERVER_PAGE_MEDIA, encoding));
             }
             else if (!strcmp(uriptr, "supplies"))
             {
-              return (show_supplies(client, printer, encoding));
+              return (send_page(client, printer, SERVER_PAGE_SUPPLIES, encoding));
             }
           }
 	}
@@ -593,10 +853,9 @@ serverProcessHTTP(
 	}
         else if ((res = serverFindResourceByPath(client->uri)) != NULL && res->state == IPP_RSTATE_INSTALLED)
         {
-	  int		fd;		/* Icon file */
-	  struct stat	fileinfo;	/* Icon file information */
-	  char		buffer[4096];	/* Copy buffer */
-	  ssize_t	bytes;		/* Bytes */
+	  int		fd;		/* Resource file */
+	  struct stat	fileinfo;	/* Resource file information */
+	  int		status;		/* Send status */
 
 	  serverLogClient(SERVER_LOGLEVEL_DEBUG, client, "Resource \"%s\" maps to \"%s\".", res->resource, res->filename);
 
@@ -608,24 +867,16 @@ serverProcessHTTP(
 	      close(fd);
 	      return (0);
 	    }
-	    else if (!serverRespondHTTP(client, HTTP_STATUS_OK, NULL, res->format, (size_t)fileinfo.st_size))
-	    {
-	      close(fd);
-	      return (0);
-	    }
 
-	    while ((bytes = read(fd, buffer, sizeof(buffer))) > 0)
-	      httpWrite(client->http, buffer, (size_t)bytes);
-
-	    httpFlushWrite(client->http);
+	    status = send_file(client, fd, &fileinfo, res->format);
 
 	    close(fd);
-	    return (1);
+	    return (status);
 	  }
 	}
 	else if (!strcmp(client->uri, "/"))
 	{
-          return (show_status(client, NULL, encoding));
+          return (send_page(client, NULL, SERVER_PAGE_STATUS, encoding));
 	}
 
         return (serverRespondHTTP(client, HTTP_STATUS_NOT_FOUND, NULL, NULL, 0));
@@ -717,6 +968,16 @@ serverRespondHTTP(
 
   httpClearFields(client->http);
 
+  if (client->retry_after > 0)
+  {
+    char retry_after[32];		/* Retry-After header value */
+
+    snprintf(retry_after, sizeof(retry_after), "%d", client->retry_after);
+    httpSetField(client->http, HTTP_FIELD_RETRY_AFTER, retry_after);
+
+    client->retry_after = 0;
+  }
+
   if (code == HTTP_STATUS_UNAUTHORIZED || code == HTTP_STATUS_FORBIDDEN)
   {
     char www_auth[256];		/* WWW-Authenicate header value */
@@ -816,11 +1077,10 @@ serverRespondHTTP(
 void
 serverRun(void)
 {
-  int			max_fd;		/* Number of file descriptors */
-  fd_set		input;		/* select() input set */
-  struct timeval	timeout;	/* Timeout for poll() */
+  int			thread;		/* Accept thread */
+  nfds_t		fdnum;		/* Looping var */
+  server_accept_t	*accepts;	/* Accept loops */
   server_listener_t	*lis;		/* Listener */
-  server_client_t	*client;	/* New client */
   time_t                next_clean = 0; /* Next time to clean old jobs */
 
 
@@ -828,55 +1088,100 @@ serverRun(void)
   serverLog(SERVER_LOGLEVEL_DEBUG, "serverRun: %u listeners configured.", (unsigned)cupsArrayGetCount(Listeners));
 
  /*
-  * Loop until we are killed or have a hard error...
+  * Start client threads...
   */
 
-  for (;;)
+  if (ClientThreads > 0)
   {
-   /*
-    * Setup select() data for the Bonjour service socket and listeners...
-    */
+    int		j;			/* Looping var */
+    cups_thread_t t;			/* Client thread */
+
+    pool_clients = cupsArrayNew(NULL, NULL, NULL, 0, NULL, NULL);
+    pool_queue   = cupsArrayNew(NULL, NULL, NULL, 0, NULL, NULL);
+
+    for (j = 0; j < ClientThreads; j ++)
+    {
+      if ((t = cupsThreadCreate((cups_thread_func_t)run_client, NULL)) == 0)
+      {
+        serverLog(SERVER_LOGLEVEL_ERROR, "Unable to create client thread (%s)", strerror(errno));
+        break;
+      }
+
+      cupsThreadDetach(t);
+    }
+
+    serverLog(SERVER_LOGLEVEL_DEBUG, "serverRun: %d client threads started.", j);
+  }
+
+ /*
+  * Setup poll() data for each accept loop.  The main loop handles the
+  * listeners for accept thread 0...
+  */
 
-    FD_ZERO(&input);
-    max_fd = 0;
+  if (AcceptThreads < 1)
+    AcceptThreads = 1;
 
-    for (lis = (server_listener_t *)cupsArrayGetFirst(Listeners); lis; lis = (server_listener_t *)cupsArrayGetNext(Listeners))
+  if ((accepts = calloc((size_t)AcceptThreads, sizeof(server_accept_t))) == NULL)
+  {
+    serverLog(SERVER_LOGLEVEL_ERROR, "Unable to allocate memory for accept loops (%s)", strerror(errno));
+    return;
+  }
+
+  for (thread = 0; thread < AcceptThreads; thread ++)
+  {
+    accepts[thread].thread = thread;
+
+    if ((accepts[thread].fds = calloc(cupsArrayGetCount(Listeners) + 1, sizeof(struct pollfd))) == NULL || (accepts[thread].lis = calloc(cupsArrayGetCount(Listeners) + 1, sizeof(server_listener_t *))) == NULL)
+    {
+      serverLog(SERVER_LOGLEVEL_ERROR, "Unable to allocate memory for accept loops (%s)", strerror(errno));
+      return;
+    }
+  }
+
+  for (lis = (server_listener_t *)cupsArrayGetFirst(Listeners); lis; lis = (server_listener_t *)cupsArrayGetNext(Listeners))
+  {
+    server_accept_t *loop = accepts + (lis->thread < AcceptThreads ? lis->thread : 0);
+					/* Accept loop for listener */
+
+    loop->fds[loop->num_fds].fd     = lis->fd;
+    loop->fds[loop->num_fds].events = POLLIN;
+    loop->lis[loop->num_fds]        = lis;
+    loop->num_fds ++;
+  }
+
+ /*
+  * Start accept threads for the SO_REUSEPORT listeners...
+  */
+
+  for (thread = 1; thread < AcceptThreads; thread ++)
+  {
+    cups_thread_t t;			/* Accept thread */
+
+    if ((t = cupsThreadCreate((cups_thread_func_t)accept_clients, accepts + thread)) == 0)
     {
-      FD_SET(lis->fd, &input);
-      if (max_fd < lis->fd)
-        max_fd = lis->fd;
+      serverLog(SERVER_LOGLEVEL_ERROR, "Unable to create accept thread (%s)", strerror(errno));
+      return;
     }
 
-    timeout.tv_sec  = DNSSDUpdate ? 1 : 10;
-    timeout.tv_usec = 0;
+    cupsThreadDetach(t);
+  }
+
+ /*
+  * Loop until we are killed or have a hard error...
+  */
 
-    if (select(max_fd + 1, &input, NULL, NULL, &timeout) < 0 && errno != EINTR)
+  for (;;)
+  {
+    if (poll(accepts[0].fds, accepts[0].num_fds, DNSSDUpdate ? 1000 : 10000) < 0 && errno != EINTR)
     {
       serverLog(SERVER_LOGLEVEL_ERROR, "Main loop failed (%s)", strerror(errno));
       break;
     }
 
-    for (lis = (server_listener_t *)cupsArrayGetFirst(Listeners); lis; lis = (server_listener_t *)cupsArrayGetNext(Listeners))
+    for (fdnum = 0; fdnum < accepts[0].num_fds; fdnum ++)
     {
-      if (FD_ISSET(lis->fd, &input))
-      {
-        serverLog(SERVER_LOGLEVEL_DEBUG, "serverRun: Incoming connection on listener %s:%d.", lis->host, lis->port);
-
-        if ((client = serverCreateClient(lis->fd)) != NULL)
-        {
-          cups_thread_t t = cupsThreadCreate((cups_thread_func_t)serverProcessClient, client);
-
-          if (t)
-          {
-            cupsThreadDetach(t);
-          }
-          else
-          {
-            serverLog(SERVER_LOGLEVEL_ERROR, "Unable to create client thread (%s)", strerror(errno));
-            serverDeleteClient(client);
-          }
-        }
-      }
+      if (accepts[0].fds[fdnum].revents & POLLIN)
+        accept_client(accepts[0].lis[fdnum]);
     }
 
     if (DNSSDUpdate)
@@ -903,6 +1208,7 @@ serverRun(void)
     if (time(NULL) >= next_clean)
     {
       serverCleanAllJobs();
+      serverCleanRateLimits();
 
       next_clean = time(NULL) + 30;
     }
@@ -910,6 +1216,152 @@ serverRun(void)
 }
 
 
+/*
+ * 'accept_client()' - Accept a new connection and start processing it.
+ */
+
+static void
+accept_client(server_listener_t *lis)	/* I - Listener */
+{
+  server_client_t	*client;	/* New client */
+
+
+  serverLog(SERVER_LOGLEVEL_DEBUG, "serverRun: Incoming connection on listener %s:%d.", lis->host, lis->port);
+
+  if ((client = serverCreateClient(lis->fd)) != NULL && !queue_client(client))
+  {
+    cups_thread_t t = cupsThreadCreate((cups_thread_func_t)serverProcessClient, client);
+
+    if (t)
+    {
+      cupsThreadDetach(t);
+    }
+    else
+    {
+      serverLog(SERVER_LOGLEVEL_ERROR, "Unable to create client thread (%s)", strerror(errno));
+      serverDeleteClient(client);
+    }
+  }
+}
+
+
+/*
+ * 'accept_clients()' - Accept new connections on an accept thread.
+ */
+
+static void *				/* O - Thread exit status */
+accept_clients(
+    server_accept_t *loop)		/* I - Accept loop data */
+{
+  nfds_t	i;			/* Looping var */
+
+
+#ifdef __linux__
+ /*
+  * Bind this thread to its own CPU...
+  */
+
+  long		num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+					/* Number of online CPUs */
+  cpu_set_t	cpus;			/* CPU set for thread */
+
+  if (num_cpus > 1)
+  {
+    CPU_ZERO(&cpus);
+    CPU_SET((int)(loop->thread % num_cpus), &cpus);
+
+    if (sched_setaffinity(0, sizeof(cpus), &cpus))
+      serverLog(SERVER_LOGLEVEL_ERROR, "Unable to bind accept thread %d to a CPU (%s)", loop->thread, strerror(errno));
+  }
+#endif /* __linux__ */
+
+  serverLog(SERVER_LOGLEVEL_DEBUG, "accept_clients: Accept thread %d handling %u listeners.", loop->thread, (unsigned)loop->num_fds);
+
+  for (;;)
+  {
+    if (poll(loop->fds, loop->num_fds, -1) < 0 && errno != EINTR)
+    {
+      serverLog(SERVER_LOGLEVEL_ERROR, "Accept thread %d failed (%s)", loop->thread, strerror(errno));
+      break;
+    }
+
+    for (i = 0; i < loop->num_fds; i ++)
+    {
+      if (loop->fds[i].revents & POLLIN)
+        accept_client(loop->lis[i]);
+    }
+  }
+
+  return (NULL);
+}
+
+
+/*
+ * 'compare_webpages()' - Compare two cached web pages.
+ */
+
+static int				/* O - Result of comparison */
+compare_webpages(server_webpage_t *a,	/* I - First page */
+                 server_webpage_t *b)	/* I - Second page */
+{
+  if (a->printer_id != b->printer_id)
+    return (a->printer_id - b->printer_id);
+  else if (a->page != b->page)
+    return ((int)a->page - (int)b->page);
+  else
+    return (a->apple_client - b->apple_client);
+}
+
+
+/*
+ * 'count_connection()' - Update the client connection statistics.
+ */
+
+static void
+count_connection(
+    unsigned connections,		/* I - New connections */
+    unsigned requests,			/* I - New requests */
+    unsigned handshakes,		/* I - New TLS handshakes */
+    unsigned encrypted)			/* I - New requests on encrypted keep-alive connections */
+{
+  cupsMutexLock(&stats_mutex);
+
+  stats_connections    += connections;
+  stats_requests       += requests;
+  stats_tls_handshakes      += handshakes;
+  stats_keepalive_encrypted += encrypted;
+
+  cupsMutexUnlock(&stats_mutex);
+}
+
+
+/*
+ * 'free_client()' - Free a client object or keep it for reuse.
+ */
+
+static void
+free_client(server_client_t *client)	/* I - Client */
+{
+  cupsMutexLock(&pool_mutex);
+
+  if (pool_clients && cupsArrayGetCount(pool_clients) < (size_t)ClientThreads)
+  {
+   /*
+    * Keep the client object...
+    */
+
+    memset(client, 0, sizeof(server_client_t));
+
+    cupsArrayAdd(pool_clients, client);
+    client = NULL;
+  }
+
+  cupsMutexUnlock(&pool_mutex);
+
+  free(client);
+}
+
+
 /*
  * 'html_escape()' - Write a HTML-safe string.
  */
@@ -931,12 +1383,12 @@ html_escape(server_client_t *client,	/* I - Client */
     if (*s == '&' || *s == '<')
     {
       if (s > start)
-        httpWrite(client->http, start, (size_t)(s - start));
+        html_write(client, start, (size_t)(s - start));
 
       if (*s == '&')
-        httpWrite(client->http, "&amp;", 5);
+        html_write(client, "&amp;", 5);
       else
-        httpWrite(client->http, "&lt;", 4);
+        html_write(client, "&lt;", 4);
 
       start = s + 1;
     }
@@ -945,14 +1397,15 @@ html_escape(server_client_t *client,	/* I - Client */
   }
 
   if (s > start)
-    httpWrite(client->http, start, (size_t)(s - start));
+    html_write(client, start, (size_t)(s - start));
 }
 
 
 /*
  * 'html_footer()' - Show the web interface footer.
  *
- * This function also writes the trailing 0-length chunk.
+ * This function also writes the trailing 0-length chunk unless the page is
+ * being cached.
  */
 
 static void
@@ -964,7 +1417,9 @@ html_footer(server_client_t *client)	/* I - Client */
 	      "ippserver is part of the <a href=\"https://github.com/istopwg/ippsample\" target=\"_blank\">ippsample</a> project and is provided on an \"AS IS\" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. It is <em>not</em> intended for production use.</div>\n"
 	      "</body>\n"
 	      "</html>\n");
-  httpWrite(client->http, "", 0);
+
+  if (!client->page)
+    httpWrite(client->http, "", 0);
 }
 
 
@@ -1052,14 +1507,14 @@ html_printf(server_client_t *client,	/* I - Client */
     if (*format == '%')
     {
       if (format > start)
-        httpWrite(client->http, start, (size_t)(format - start));
+        html_write(client, start, (size_t)(format - start));
 
       tptr    = tformat;
       *tptr++ = *format++;
 
       if (*format == '%')
       {
-        httpWrite(client->http, "%", 1);
+        html_write(client, "%", 1);
         format ++;
 	start = format;
 	continue;
@@ -1173,7 +1628,7 @@ html_printf(server_client_t *client,	/* I - Client */
 
 	    snprintf(temp, sizeof(temp), tformat, va_arg(ap, double));
 
-            httpWrite(client->http, temp, strlen(temp));
+            html_write(client, temp, strlen(temp));
 	    break;
 
         case 'B' : /* Integer formats */
@@ -1197,7 +1652,7 @@ html_printf(server_client_t *client,	/* I - Client */
 	    else
 	      snprintf(temp, sizeof(temp), tformat, va_arg(ap, int));
 
-            httpWrite(client->http, temp, strlen(temp));
+            html_write(client, temp, strlen(temp));
 	    break;
 
 	case 'p' : /* Pointer value */
@@ -1206,7 +1661,7 @@ html_printf(server_client_t *client,	/* I - Client */
 
 	    snprintf(temp, sizeof(temp), tformat, va_arg(ap, void *));
 
-            httpWrite(client->http, temp, strlen(temp));
+            html_write(client, temp, strlen(temp));
 	    break;
 
         case 'c' : /* Character or character array */
@@ -1233,21 +1688,170 @@ html_printf(server_client_t *client,	/* I - Client */
   }
 
   if (format > start)
-    httpWrite(client->http, start, (size_t)(format - start));
+    html_write(client, start, (size_t)(format - start));
 
   va_end(ap);
 }
 
 
 /*
- * 'parse_options()' - Parse URL options into CUPS options.
+ * 'html_start()' - Start a web page response.
  *
- * The client->options string is destroyed by this function.
+ * Nothing is sent when the page is being rendered for the cache.
  */
 
-static size_t				/* O - Number of options */
-parse_options(server_client_t *client,	/* I - Client */
-              cups_option_t   **options)/* O - Options */
+static int				/* O - 1 on success, 0 on failure */
+html_start(server_client_t *client,	/* I - Client */
+           const char      *encoding)	/* I - Content-Encoding to use */
+{
+  if (client->page)
+    return (1);
+
+  return (serverRespondHTTP(client, HTTP_STATUS_OK, encoding, "text/html", 0));
+}
+
+
+/*
+ * 'html_write()' - Write web page data to the client or the page buffer.
+ */
+
+static void
+html_write(server_client_t *client,	/* I - Client */
+           const char      *data,	/* I - Data */
+           size_t          datalen)	/* I - Length of data */
+{
+  if (!client->page)
+  {
+    httpWrite(client->http, data, datalen);
+    return;
+  }
+  else if (client->page_size == 0)
+  {
+    return;				/* Out of memory */
+  }
+
+  if ((client->page_used + datalen) > client->page_size)
+  {
+    size_t	page_size = client->page_size;
+					/* New size of buffer */
+    char	*page;			/* New buffer */
+
+    while ((client->page_used + datalen) > page_size)
+      page_size *= 2;
+
+    if ((page = realloc(client->page, page_size)) == NULL)
+    {
+      client->page_size = 0;
+      return;
+    }
+
+    client->page      = page;
+    client->page_size = page_size;
+  }
+
+  memcpy(client->page + client->page_used, data, datalen);
+  client->page_used += datalen;
+}
+
+
+#ifdef SO_REUSEPORT
+/*
+ * 'listen_addr()' - Create a listener socket that shares its address with
+ *                   other listener sockets.
+ */
+
+static int				/* O - Socket or -1 on error */
+listen_addr(http_addr_t *addr,		/* I - Address */
+            int         port,		/* I - Port number */
+            int         thread)		/* I - Accept thread */
+{
+  int		fd;			/* Listener socket */
+  int		val = 1;		/* Socket option value */
+  socklen_t	addrlen;		/* Length of address */
+
+
+  if (addr->addr.sa_family == AF_INET)
+  {
+    addr->ipv4.sin_port = htons(port);
+    addrlen             = sizeof(addr->ipv4);
+  }
+#  ifdef AF_INET6
+  else if (addr->addr.sa_family == AF_INET6)
+  {
+    addr->ipv6.sin6_port = htons(port);
+    addrlen              = sizeof(addr->ipv6);
+  }
+#  endif /* AF_INET6 */
+  else
+  {
+   /*
+    * Domain sockets cannot be shared, so only the first accept thread gets
+    * one...
+    */
+
+    return (thread == 0 ? httpAddrListen(addr, port) : -1);
+  }
+
+  if (thread == 0)
+  {
+   /*
+    * SO_REUSEPORT lets another process owned by the same user join an
+    * existing group, so make sure the port is really free with a plain bind
+    * before opening the first socket of the group...
+    */
+
+    if ((fd = socket(addr->addr.sa_family, SOCK_STREAM, 0)) < 0)
+      return (-1);
+
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
+
+#  ifdef IPV6_V6ONLY
+    if (addr->addr.sa_family == AF_INET6)
+      setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &val, sizeof(val));
+#  endif /* IPV6_V6ONLY */
+
+    if (bind(fd, (struct sockaddr *)addr, addrlen))
+    {
+      close(fd);
+      return (-1);
+    }
+
+    close(fd);
+  }
+
+  if ((fd = socket(addr->addr.sa_family, SOCK_STREAM, 0)) < 0)
+    return (-1);
+
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
+  setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val));
+
+#  ifdef IPV6_V6ONLY
+  if (addr->addr.sa_family == AF_INET6)
+    setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &val, sizeof(val));
+#  endif /* IPV6_V6ONLY */
+
+  if (bind(fd, (struct sockaddr *)addr, addrlen) || listen(fd, 128))
+  {
+    close(fd);
+    return (-1);
+  }
+
+  fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
+
+  return (fd);
+}
+#endif /* SO_REUSEPORT */
+
+
+/*
+ * 'parse_options()' - Parse URL options into CUPS options.
+ *
+ * The client->options string is destroyed by this function.
+ */
+
+static size_t				/* O - Number of options */
+parse_options(server_client_t *client,	/* I - Client */
+              cups_option_t   **options)/* O - Options */
 {
   char		*post_data = NULL,	/* POST form data */
 		*name,			/* Name */
@@ -1306,6 +1910,229 @@ parse_options(server_client_t *client,	/* I - Client */
 }
 
 
+/*
+ * 'parse_range()' - Parse a HTTP Range header value.
+ *
+ * Only a single byte range is supported.  Returns 1 for a satisfiable range,
+ * 0 if the range should be ignored (multiple or malformed ranges), and -1 if
+ * the range is not satisfiable.
+ */
+
+static int				/* O - 1 = partial, 0 = ignore, -1 = unsatisfiable */
+parse_range(const char *range,		/* I - Range header value */
+            off_t      size,		/* I - Size of file */
+            off_t      *first,		/* O - First byte */
+            off_t      *last)		/* O - Last byte */
+{
+  char		*ptr;			/* Pointer into value */
+  long long	value;			/* Number value */
+
+
+  if (strncmp(range, "bytes=", 6) || strchr(range, ','))
+    return (0);
+
+  range += 6;
+
+  if (*range == '-')
+  {
+   /*
+    * Suffix range "bytes=-N" for the last N bytes...
+    */
+
+    if (!isdigit(range[1] & 255) || (value = strtoll(range + 1, &ptr, 10)) < 0 || *ptr)
+      return (0);
+    else if (value == 0 || size == 0)
+      return (-1);
+
+    *first = value >= size ? 0 : size - (off_t)value;
+    *last  = size - 1;
+
+    return (1);
+  }
+
+  if (!isdigit(*range & 255) || (value = strtoll(range, &ptr, 10)) < 0 || *ptr != '-')
+    return (0);
+
+  *first = (off_t)value;
+  range  = ptr + 1;
+
+  if (!*range)
+  {
+    *last = size - 1;
+  }
+  else
+  {
+    if (!isdigit(*range & 255) || (value = strtoll(range, &ptr, 10)) < 0 || *ptr || (off_t)value < *first)
+      return (0);
+
+    *last = (off_t)value >= size ? size - 1 : (off_t)value;
+  }
+
+  if (*first >= size)
+    return (-1);
+
+  return (1);
+}
+
+
+/*
+ * 'queue_client()' - Give a new client to an idle client thread.
+ */
+
+static bool				/* O - `true` if queued, `false` if no thread is available */
+queue_client(server_client_t *client)	/* I - Client */
+{
+  bool	ret = false;			/* Return value */
+
+
+  cupsMutexLock(&pool_mutex);
+
+  if (pool_queue && pool_threads > cupsArrayGetCount(pool_queue))
+  {
+    cupsArrayAdd(pool_queue, client);
+    cupsCondSignal(&pool_cond);
+
+    pool_thread_hits ++;
+    ret = true;
+  }
+  else
+  {
+    pool_thread_misses ++;
+  }
+
+  cupsMutexUnlock(&pool_mutex);
+
+  return (ret);
+}
+
+
+/*
+ * 'run_client()' - Process clients on a pre-started thread.
+ */
+
+static void *				/* O - Thread exit status */
+run_client(void *data)			/* I - Thread data (unused) */
+{
+  server_client_t	*client;	/* Current client */
+
+
+  (void)data;
+
+  cupsMutexLock(&pool_mutex);
+
+  for (;;)
+  {
+    pool_threads ++;
+
+    while ((client = (server_client_t *)cupsArrayGetFirst(pool_queue)) == NULL)
+      cupsCondWait(&pool_cond, &pool_mutex, 0.0);
+
+    cupsArrayRemove(pool_queue, client);
+    pool_threads --;
+
+    cupsMutexUnlock(&pool_mutex);
+
+    serverProcessClient(client);
+
+    cupsMutexLock(&pool_mutex);
+  }
+
+  return (NULL);
+}
+
+
+/*
+ * 'send_file()' - Send a file, honoring any byte range in the request.
+ */
+
+static int				/* O - 1 on success, 0 on failure */
+send_file(server_client_t *client,	/* I - Client connection */
+          int             fd,		/* I - File to send */
+          struct stat     *fileinfo,	/* I - File information */
+          const char      *type)	/* I - MIME media type */
+{
+  const char	*range;			/* Range header value */
+  off_t		first = 0,		/* First byte to send */
+		last = fileinfo->st_size - 1;
+					/* Last byte to send */
+  int		partial = 0;		/* Send a byte range? */
+  http_status_t	status = HTTP_STATUS_OK;/* Response status */
+  char		content_range[256],	/* Content-Range header value */
+		date[256],		/* Last-Modified header value */
+		buffer[32768];		/* Copy buffer */
+  size_t	length;			/* Bytes remaining */
+  ssize_t	bytes;			/* Bytes read */
+
+
+  if ((range = httpGetField(client->http, HTTP_FIELD_RANGE)) != NULL && *range)
+  {
+    if ((partial = parse_range(range, fileinfo->st_size, &first, &last)) < 0)
+    {
+      static const char *message = "416 - Requested Range Not Satisfiable\n";
+					/* Text message */
+
+      serverLogClient(SERVER_LOGLEVEL_INFO, client, "%s", httpStatusString(HTTP_STATUS_REQUESTED_RANGE));
+
+      snprintf(content_range, sizeof(content_range), "bytes */%lld", (long long)fileinfo->st_size);
+
+      httpClearFields(client->http);
+      httpSetField(client->http, HTTP_FIELD_CONTENT_RANGE, content_range);
+      httpSetField(client->http, HTTP_FIELD_CONTENT_TYPE, "text/plain");
+      httpSetLength(client->http, strlen(message));
+
+      if (!httpWriteResponse(client->http, HTTP_STATUS_REQUESTED_RANGE) || httpPrintf(client->http, "%s", message) < 0)
+        return (0);
+
+      return (1);
+    }
+    else if (partial)
+    {
+      serverLogClient(SERVER_LOGLEVEL_DEBUG, client, "Sending bytes %lld-%lld of %lld.", (long long)first, (long long)last, (long long)fileinfo->st_size);
+
+      status = HTTP_STATUS_PARTIAL_CONTENT;
+    }
+  }
+
+  serverLogClient(SERVER_LOGLEVEL_INFO, client, "%s", httpStatusString(status));
+
+  length = (size_t)(last - first + 1);
+
+  httpClearFields(client->http);
+  httpSetField(client->http, HTTP_FIELD_ACCEPT_RANGES, "bytes");
+  httpSetField(client->http, HTTP_FIELD_CONTENT_TYPE, type);
+  httpSetField(client->http, HTTP_FIELD_LAST_MODIFIED, httpGetDateString(fileinfo->st_mtime, date, sizeof(date)));
+
+  if (partial)
+  {
+    snprintf(content_range, sizeof(content_range), "bytes %lld-%lld/%lld", (long long)first, (long long)last, (long long)fileinfo->st_size);
+    httpSetField(client->http, HTTP_FIELD_CONTENT_RANGE, content_range);
+  }
+
+  httpSetLength(client->http, length);
+
+  if (!httpWriteResponse(client->http, status))
+    return (0);
+
+  if (first > 0 && lseek(fd, first, SEEK_SET) != first)
+    return (0);
+
+  while (length > 0 && (bytes = read(fd, buffer, length < sizeof(buffer) ? length : sizeof(buffer))) > 0)
+  {
+    if (httpWrite(client->http, buffer, (size_t)bytes) < 0)
+      return (0);
+
+    length -= (size_t)bytes;
+  }
+
+  if (fileinfo->st_size == 0)
+    httpWrite(client->http, "", 0);	/* Empty files are sent chunked */
+
+  httpFlushWrite(client->http);
+
+  return (1);
+}
+
+
 /*
  * 'send_mobile_config()' - Send an Apple mobile configuration file for one or
  *                          more printers.
@@ -1364,6 +2191,213 @@ send_mobile_config(
 }
 
 
+/*
+ * 'send_page()' - Send a web page, using the cached copy when possible.
+ *
+ * Pages are rendered once and cached until the printer (or any printer, for
+ * the system status page) reports an event, changes state, or changes its
+ * configuration.  Requests with form data are always rendered since they may
+ * change the printer.
+ */
+
+static int				/* O - 1 on success, 0 on failure */
+send_page(server_client_t  *client,	/* I - Client connection */
+          server_printer_t *printer,	/* I - Printer or `NULL` for the system */
+          server_page_t    page,	/* I - Page to send */
+          const char       *encoding)	/* I - Content-Encoding to use */
+{
+  int			(*show)(server_client_t *, server_printer_t *, const char *);
+					/* Page rendering function */
+  server_webpage_t	key,		/* Search key */
+			*wp;		/* Cached web page */
+  unsigned		serial;		/* Invalidation counter before rendering */
+  time_t		curtime = time(NULL),
+					/* Current time */
+			modified = 0,	/* Last-Modified time, if any */
+			if_modified;	/* If-Modified-Since time */
+  char			*data = NULL;	/* Page data to send */
+  size_t		datalen = 0;	/* Length of page data */
+  char			date[256];	/* Date string */
+
+
+  switch (page)
+  {
+    case SERVER_PAGE_MATERIALS :
+        show = show_materials;
+        break;
+    case SERVER_PAGE_MEDIA :
+        show = show_media;
+        break;
+    case SERVER_PAGE_SUPPLIES :
+        show = show_supplies;
+        break;
+    default :
+        show = show_status;
+        break;
+  }
+
+  if (client->options && *client->options)
+    return ((show)(client, printer, encoding));
+
+ /*
+  * See if there is a current copy of the page...
+  */
+
+  memset(&key, 0, sizeof(key));
+
+  key.printer_id   = printer ? printer->id : 0;
+  key.page         = page;
+  key.apple_client = page == SERVER_PAGE_STATUS && strstr(httpGetField(client->http, HTTP_FIELD_USER_AGENT), "Mac OS X") != NULL;
+
+  if (printer)
+  {
+    key.config_time = printer->config_time;
+    key.state_time  = printer->state_time;
+  }
+
+  cupsMutexLock(&web_mutex);
+
+  if ((wp = (server_webpage_t *)cupsArrayFind(web_pages, &key)) != NULL && wp->data && (curtime - wp->rendered) < WEB_CACHE_TIME && wp->config_time == key.config_time && wp->state_time == key.state_time && (data = malloc(wp->datalen)) != NULL)
+  {
+    memcpy(data, wp->data, wp->datalen);
+    datalen = wp->datalen;
+
+    if (wp->use_modified)
+      modified = wp->modified;
+  }
+
+  serial = web_serial;
+
+  cupsMutexUnlock(&web_mutex);
+
+  if (!data)
+  {
+   /*
+    * Render the page into a buffer...
+    */
+
+    if ((client->page = malloc(65536)) == NULL)
+      return ((show)(client, printer, encoding));
+
+    client->page_size = 65536;
+    client->page_used = 0;
+
+    (show)(client, printer, encoding);
+
+    data              = client->page;
+    datalen           = client->page_used;
+    client->page      = NULL;
+
+    if (client->page_size == 0)
+    {
+      serverLogClient(SERVER_LOGLEVEL_ERROR, client, "Unable to allocate memory for web page.");
+      free(data);
+      return (serverRespondHTTP(client, HTTP_STATUS_SERVER_ERROR, NULL, NULL, 0));
+    }
+
+   /*
+    * Then cache it, unless the page was invalidated while rendering...
+    */
+
+    cupsMutexLock(&web_mutex);
+
+    if (serial == web_serial)
+    {
+      if (!web_pages)
+        web_pages = cupsArrayNew((cups_array_cb_t)compare_webpages, NULL, NULL, 0, NULL, NULL);
+
+      if ((wp = (server_webpage_t *)cupsArrayFind(web_pages, &key)) == NULL && (wp = (server_webpage_t *)calloc(1, sizeof(server_webpage_t))) != NULL)
+      {
+        wp->printer_id   = key.printer_id;
+        wp->page         = key.page;
+        wp->apple_client = key.apple_client;
+
+        cupsArrayAdd(web_pages, wp);
+      }
+
+      if (wp)
+      {
+        free(wp->data);
+
+        if ((wp->data = malloc(datalen)) != NULL)
+          memcpy(wp->data, data, datalen);
+
+        wp->datalen     = datalen;
+        wp->config_time = key.config_time;
+        wp->state_time  = key.state_time;
+        wp->rendered    = curtime;
+
+       /*
+        * If-Modified-Since only has a resolution of one second, so a page
+        * rendered again in the same second gets no Last-Modified...
+        */
+
+        if (curtime > wp->modified)
+        {
+          wp->modified     = modified = curtime;
+          wp->use_modified = true;
+        }
+        else
+          wp->use_modified = false;
+      }
+    }
+
+    cupsMutexUnlock(&web_mutex);
+  }
+
+ /*
+  * Send the page or a "not modified" response...
+  */
+
+  if_modified = httpGetDateTime(httpGetField(client->http, HTTP_FIELD_IF_MODIFIED_SINCE));
+
+  httpClearFields(client->http);
+
+  if (modified)
+  {
+    httpSetField(client->http, HTTP_FIELD_LAST_MODIFIED, httpGetDateString(modified, date, sizeof(date)));
+
+    if (if_modified > 0 && if_modified >= modified)
+    {
+      free(data);
+
+      serverLogClient(SERVER_LOGLEVEL_INFO, client, "%s", httpStatusString(HTTP_STATUS_NOT_MODIFIED));
+
+      httpSetField(client->http, HTTP_FIELD_CONTENT_LENGTH, "0");
+
+      return (httpWriteResponse(client->http, HTTP_STATUS_NOT_MODIFIED) ? 1 : 0);
+    }
+  }
+
+  serverLogClient(SERVER_LOGLEVEL_INFO, client, "%s", httpStatusString(HTTP_STATUS_OK));
+
+  httpSetField(client->http, HTTP_FIELD_CONTENT_TYPE, "text/html; charset=utf-8");
+
+  if (encoding)
+  {
+    httpSetField(client->http, HTTP_FIELD_CONTENT_ENCODING, encoding);
+    httpSetLength(client->http, 0);
+  }
+  else
+    httpSetLength(client->http, datalen);
+
+  if (!httpWriteResponse(client->http, HTTP_STATUS_OK) || httpWrite(client->http, data, datalen) < 0)
+  {
+    free(data);
+    return (0);
+  }
+
+  free(data);
+
+  if (encoding)
+    httpWrite(client->http, "", 0);
+
+  httpFlushWrite(client->http);
+
+  return (1);
+}
+
+
 /*
  * 'send_printer_payload()' - Send the mobile configuration payload for a
  *                            printer.
@@ -1450,7 +2484,7 @@ show_materials(
   * Grab the available, ready, and number of materials from the printer.
   */
 
-  if (!serverRespondHTTP(client, HTTP_STATUS_OK, encoding, "text/html", 0))
+  if (!html_start(client, encoding))
     return (0);
 
   html_header(client, printer->dns_sd_name, 0);
@@ -1649,7 +2683,7 @@ show_media(server_client_t  *client,	/* I - Client connection */
   };
 
 
-  if (!serverRespondHTTP(client, HTTP_STATUS_OK, encoding, "text/html", 0))
+  if (!html_start(client, encoding))
     return (0);
 
   html_header(client, printer->name, 0);
@@ -1977,7 +3011,7 @@ show_status(server_client_t  *client,	/* I - Client connection */
 
   apple_client = strstr(httpGetField(client->http, HTTP_FIELD_USER_AGENT), "Mac OS X") != NULL;
 
-  if (!serverRespondHTTP(client, HTTP_STATUS_OK, encoding, "text/html", 0))
+  if (!html_start(client, encoding))
     return (0);
 
   if (printer)
@@ -2181,7 +3215,7 @@ show_supplies(
   };
 
 
-  if (!serverRespondHTTP(client, HTTP_STATUS_OK, encoding, "text/html", 0))
+  if (!html_start(client, encoding))
     return (0);
 
   html_header(client, printer->name, 0);
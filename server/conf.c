@@ -11,20 +11,79 @@
 #include "ippserver.h"
 #include <cups/file.h>
 #include <cups/dir.h>
+#include <math.h>
 #if _WIN32
 #  define PATH_MAX 256
 #else
 #  include <fnmatch.h>
 #  include <pwd.h>
 #  include <grp.h>
+#  include <sys/mman.h>
 #endif /* _WIN32 */
 
 
+/*
+ * Local types...
+ */
+
+typedef struct server_pindex_s		/**** Printer index bucket ****/
+{
+  char			*key;		/* Index key */
+  cups_array_t		*printers;	/* Printers with this key */
+} server_pindex_t;
+
+typedef struct server_pload_s		/**** Printer to load ****/
+{
+  char			*filename,	/* Configuration file */
+			*icon,		/* Icon file, if any */
+			*name,		/* Printer name */
+			*resource;	/* Resource path */
+} server_pload_t;
+
+
 /*
  * Local globals...
  */
 
 static char		*default_printer = NULL;
+static cups_mutex_t	load_mutex = CUPS_MUTEX_INITIALIZER;
+					/* Mutex for printer load queue */
+static cups_array_t	*load_queue = NULL;
+					/* Printers to load */
+static cups_array_t	*printer_index = NULL;
+					/* Printers by geo cell, location, and type */
+static bool		save_active = false;
+					/* Is a save pending? */
+static cups_cond_t	save_cond = CUPS_COND_INITIALIZER;
+					/* Condition for save delay */
+static server_printer_t	*save_current = NULL;
+					/* Printer being written */
+static cups_cond_t	save_current_cond = CUPS_COND_INITIALIZER;
+					/* Condition for printer being written */
+static cups_mutex_t	save_mutex = CUPS_MUTEX_INITIALIZER;
+					/* Mutex for save state and dirty flags */
+static cups_array_t	*save_printers = NULL;
+					/* Printers waiting to be written */
+static time_t		save_time = 0;	/* Time to save system state */
+static cups_mutex_t	save_write_mutex = CUPS_MUTEX_INITIALIZER;
+					/* Mutex for writing state files */
+
+
+/*
+ * Local constants...
+ */
+
+#ifndef M_PI				/* Should never happen, but happens on Windows... */
+#  define M_PI		3.14159265358979323846
+#endif /* !M_PI */
+#define M_PER_DEG	111120.0	/* Meters per degree of latitude */
+#define GEO_CELL	0.01		/* Size of geo index cells in degrees */
+#define GEO_MAX_CELLS	4096		/* Maximum number of cells to search */
+#define LOAD_MAX_THREADS 16		/* Maximum number of printer loading threads */
+#define REGISTER_BATCH	64		/* Number of printers to register with DNS-SD at a time */
+#define SAVE_DELAY	2		/* Seconds to wait for more changes before saving */
+#define SNAPSHOT_MAGIC	"IPPSNAP1"	/* Printer snapshot magic/version */
+#define SNAPSHOT_HEADER	16		/* Size of printer snapshot header */
 
 
 /*
@@ -33,9 +92,12 @@ static char		*default_printer = NULL;
 
 static void		add_document_privacy(void);
 static void		add_job_privacy(void);
+static void		add_profile(server_pinfo_t *pinfo, const char *name, const char *filename, ipp_t *attrs);
+static void		add_strings(server_pinfo_t *pinfo, const char *lang, const char *filename);
 static void		add_subscription_privacy(void);
 static int		attr_cb(ipp_file_t *f, server_pinfo_t *pinfo, const char *attr);
 static int		compare_lang(server_lang_t *a, server_lang_t *b);
+static int		compare_pindex(server_pindex_t *a, server_pindex_t *b);
 static int		compare_printers(server_printer_t *a, server_printer_t *b);
 static server_icc_t	*copy_icc(server_icc_t *a);
 static server_lang_t	*copy_lang(server_lang_t *a);
@@ -46,12 +108,27 @@ static int		error_cb(ipp_file_t *f, server_pinfo_t *pinfo, const char *error);
 static int		finalize_system(void);
 static void		free_icc(server_icc_t *a);
 static void		free_lang(server_lang_t *a);
+static void		free_pindex(server_pindex_t *a);
+static bool		get_geo(const char *uri, double *lat, double *lon, double *alt);
+#ifndef _WIN32
+static bool		get_group(const char *name, gid_t *gid);
+#endif /* !_WIN32 */
+static bool		get_size(const char *value, size_t *size);
 static const char	*get_temp_dir(void);
+static void		index_printer(server_printer_t *printer, bool add);
+static void		*load_printer(void *data);
+static void		*load_printers(void *data);
+static bool		load_snapshot(const char *conffile, server_pinfo_t *pinfo);
 static int		load_system(const char *conf);
 static void		print_escaped_string(cups_file_t *fp, const char *s, size_t len);
 static void		print_ipp_attr(cups_file_t *fp, ipp_attribute_t *attr, int indent);
-static void		save_printer(server_printer_t *printer, const char *directory);
+static void		queue_printers(const char *directory, const char *type);
+static void		register_printers(void);
+static bool		save_printer(server_printer_t *printer, const char *directory);
+static void		save_snapshot(server_printer_t *printer, const char *directory);
+static void		*save_system(void *data);
 static int		token_cb(ipp_file_t *f, server_pinfo_t *pinfo, const char *token);
+static double		wgs84_distance(double a_lat, double a_lon, double a_alt, double b_lat, double b_lon, double b_alt);
 
 
 /*
@@ -62,14 +139,20 @@ void
 serverAddPrinter(
     server_printer_t *printer)		/* I - Printer to add */
 {
-  cupsRWLockWrite(&SystemRWLock);
+  cupsRWLockWrite(&PrintersRWLock);
 
   if (!Printers)
     Printers = cupsArrayNew((cups_array_cb_t)compare_printers, NULL, NULL, 0, NULL, NULL);
 
   cupsArrayAdd(Printers, printer);
 
-  cupsRWUnlock(&SystemRWLock);
+  cupsRWLockRead(&printer->rwlock);
+  printer->has_geo = get_geo(ippGetString(ippFindAttribute(printer->pinfo.attrs, "printer-geo-location", IPP_TAG_URI), 0, NULL), &printer->geo_lat, &printer->geo_lon, &printer->geo_alt);
+  cupsRWUnlock(&printer->rwlock);
+
+  index_printer(printer, true);
+
+  cupsRWUnlock(&PrintersRWLock);
 }
 
 
@@ -123,21 +206,18 @@ serverCleanAllJobs(void)
 /*
  * 'serverCreateSystem()' - Load the server configuration file and create the
  *                          System object..
+ *
+ * Printers are loaded by a pool of background threads; `PrintersLoading` is
+ * `true` until they have all been created.  The system state is saved and the
+ * printers are registered with DNS-SD once loading completes.
  */
 
 int					/* O - 1 if successful, 0 on error */
 serverCreateSystem(
     const char *directory)		/* I - Configuration directory */
 {
-  cups_dir_t	*dir;			/* Directory pointer */
-  cups_dentry_t	*dent;			/* Directory entry */
-  char		confdir[1024],		/* Configuration directory */
-  		filename[1024],		/* Configuration file */
-                iconname[1024],		/* Icon file */
-		resource[1024],		/* Resource path */
-                *ptr;			/* Pointer into filename */
-  server_printer_t *printer;		/* Printer */
-  server_pinfo_t pinfo;			/* Printer information */
+  char		filename[1024];		/* Configuration file */
+  cups_thread_t	t;			/* Loader thread */
 
 
   SystemStartTime = SystemConfigChangeTime = time(NULL);
@@ -169,174 +249,20 @@ serverCreateSystem(
   * Then see if there are any print queues...
   */
 
-  if (StateDirectory)
-  {
-   /*
-    * See if we have saved printer state information...
-    */
-
-    snprintf(confdir, sizeof(confdir), "%s/print", StateDirectory);
-
-    if (access(confdir, 0))
-      snprintf(confdir, sizeof(confdir), "%s/print", directory);
-  }
-  else
-    snprintf(confdir, sizeof(confdir), "%s/print", directory);
-
-  if ((dir = cupsDirOpen(confdir)) != NULL)
-  {
-    serverLog(SERVER_LOGLEVEL_INFO, "Loading printers from '%s'.", confdir);
-
-    while ((dent = cupsDirRead(dir)) != NULL)
-    {
-      if ((ptr = strrchr(dent->filename, '.')) == NULL)
-        ptr = "";
-
-      if (!strcmp(ptr, ".conf"))
-      {
-       /*
-        * Load the conf file, with any associated icon image.
-        */
-
-        snprintf(filename, sizeof(filename), "%s/%s", confdir, dent->filename);
-        *ptr = '\0';
-
-        serverLog(SERVER_LOGLEVEL_INFO, "Loading printer from '%s'.", filename);
-
-        memset(&pinfo, 0, sizeof(pinfo));
-
-        pinfo.print_group       = SERVER_GROUP_NONE;
-	pinfo.proxy_group       = SERVER_GROUP_NONE;
-	pinfo.initial_accepting = 1;
-	pinfo.initial_state     = IPP_PSTATE_IDLE;
-	pinfo.initial_reasons   = SERVER_PREASON_NONE;
-        pinfo.web_forms         = 1;
-
-        snprintf(iconname, sizeof(iconname), "%s/%s.png", confdir, dent->filename);
-        if (!access(iconname, R_OK))
-        {
-          pinfo.icon = strdup(iconname);
-	}
-	else if (StateDirectory)
-	{
-	  snprintf(iconname, sizeof(iconname), "%s/print/%s.png", directory, dent->filename);
-	  if (!access(iconname, R_OK))
-	    pinfo.icon = strdup(iconname);
-	}
-
-        if (serverLoadAttributes(filename, &pinfo))
-	{
-          snprintf(resource, sizeof(resource), "/ipp/print/%s", dent->filename);
-
-	  if ((printer = serverCreatePrinter(resource, dent->filename, dent->filename, &pinfo, 0)) == NULL)
-            continue;
-
-          printer->state         = pinfo.initial_state;
-          printer->state_reasons = pinfo.initial_reasons;
-          printer->is_accepting  = pinfo.initial_accepting;
-
-          serverAddPrinter(printer);
-	}
-      }
-      else if (strcmp(ptr, ".png") && strcmp(ptr, ".strings"))
-        serverLog(SERVER_LOGLEVEL_INFO, "Skipping \"%s\".", dent->filename);
-    }
-
-    cupsDirClose(dir);
-  }
+  queue_printers(directory, "print");
+  queue_printers(directory, "print3d");
 
  /*
-  * Finally, see if there are any 3D print queues...
+  * Load the printers in the background so that we can start accepting
+  * connections right away...
   */
 
-  if (StateDirectory)
-  {
-   /*
-    * See if we have saved printer state information...
-    */
-
-    snprintf(confdir, sizeof(confdir), "%s/print3d", StateDirectory);
+  PrintersLoading = true;
 
-    if (access(confdir, 0))
-      snprintf(confdir, sizeof(confdir), "%s/print3d", directory);
-  }
-  else
-    snprintf(confdir, sizeof(confdir), "%s/print3d", directory);
-
-  if ((dir = cupsDirOpen(confdir)) != NULL)
-  {
-    serverLog(SERVER_LOGLEVEL_INFO, "Loading 3D printers from \"%s\".", confdir);
-
-    while ((dent = cupsDirRead(dir)) != NULL)
-    {
-      if ((ptr = strrchr(dent->filename, '.')) == NULL)
-        ptr = "";
-
-      if (!strcmp(ptr, ".conf"))
-      {
-       /*
-        * Load the conf file, with any associated icon image.
-        */
-
-        snprintf(filename, sizeof(filename), "%s/%s", confdir, dent->filename);
-        *ptr = '\0';
-
-        serverLog(SERVER_LOGLEVEL_INFO, "Loading 3D printer from \"%s\".", filename);
-
-        memset(&pinfo, 0, sizeof(pinfo));
-
-        pinfo.print_group       = SERVER_GROUP_NONE;
-	pinfo.proxy_group       = SERVER_GROUP_NONE;
-	pinfo.initial_accepting = 1;
-	pinfo.initial_state     = IPP_PSTATE_IDLE;
-	pinfo.initial_reasons   = SERVER_PREASON_NONE;
-        pinfo.web_forms         = 1;
-
-        snprintf(iconname, sizeof(iconname), "%s/%s.png", confdir, dent->filename);
-        if (!access(iconname, R_OK))
-        {
-          pinfo.icon = strdup(iconname);
-	}
-	else if (StateDirectory)
-	{
-	  snprintf(iconname, sizeof(iconname), "%s/print3d/%s.png", directory, dent->filename);
-	  if (!access(iconname, R_OK))
-	    pinfo.icon = strdup(iconname);
-	}
-
-        if (serverLoadAttributes(filename, &pinfo))
-	{
-          snprintf(resource, sizeof(resource), "/ipp/print3d/%s", dent->filename);
-
-	  if ((printer = serverCreatePrinter(resource, dent->filename, dent->filename, &pinfo, 0)) == NULL)
-          continue;
-
-          printer->state         = pinfo.initial_state;
-          printer->state_reasons = pinfo.initial_reasons;
-          printer->is_accepting  = pinfo.initial_accepting;
-
-          serverAddPrinter(printer);
-	}
-      }
-      else if (strcmp(ptr, ".png") && strcmp(ptr, ".strings"))
-        serverLog(SERVER_LOGLEVEL_INFO, "Skipping \"%s\".", dent->filename);
-    }
-
-    cupsDirClose(dir);
-  }
-
-  if (default_printer)
-  {
-    for (printer = (server_printer_t *)cupsArrayGetFirst(Printers); printer; printer = (server_printer_t *)cupsArrayGetNext(Printers))
-      if (!strcmp(printer->name, default_printer))
-        break;
-
-    DefaultPrinter = printer;
-  }
+  if ((t = cupsThreadCreate((cups_thread_func_t)load_printers, NULL)) != 0)
+    cupsThreadDetach(t);
   else
-  {
-    DefaultPrinter = NULL;
-  }
+    load_printers(NULL);
 
   return (1);
 }
@@ -378,6 +304,142 @@ serverFindPrinter(const char *resource)	/* I - Resource path */
 }
 
 
+/*
+ * 'serverFindPrintersNoLock()' - Find printers using the printer indexes.
+ *
+ * This function returns a new array of printers, in resource order, that
+ * match the given location, service type, and geo-location filters.  `NULL`
+ * is returned if no filters are specified.  The array is freed with
+ * `cupsArrayDelete`.
+ *
+ * Note: Caller MUST hold a read lock on PrintersRWLock.
+ */
+
+cups_array_t *				/* O - Matching printers or `NULL` */
+serverFindPrintersNoLock(
+    const char *geo_location,		/* I - printer-geo-location value or `NULL` */
+    double     geo_distance,		/* I - Maximum distance in meters */
+    const char *location,		/* I - printer-location value or `NULL` */
+    const char *service_type)		/* I - printer-service-type value or `NULL` */
+{
+  cups_array_t		*printers,	/* Matching printers */
+			*best = NULL,	/* Smallest candidate list */
+			*geo_printers = NULL;
+					/* Printers in nearby geo cells */
+  server_printer_t	*printer;	/* Current printer */
+  server_pindex_t	key,		/* Search key */
+			*match;		/* Matching bucket */
+  char			keybuf[1024];	/* Key buffer */
+  server_type_t		type = SERVER_TYPE_PRINT;
+					/* Service type */
+  double		lat = 0.0,	/* Latitude */
+			lon = 0.0,	/* Longitude */
+			alt = 0.0,	/* Altitude */
+			dlat,		/* Latitude search distance */
+			dlon;		/* Longitude search distance */
+  int			y, x,		/* Current cell */
+			ymin, ymax,	/* Cell latitude range */
+			xmin, xmax;	/* Cell longitude range */
+
+
+  if (!geo_location && !location && !service_type)
+    return (NULL);
+
+  printers = cupsArrayNew((cups_array_cb_t)compare_printers, NULL, NULL, 0, NULL, NULL);
+  key.key  = keybuf;
+
+  if (location)
+  {
+    snprintf(keybuf, sizeof(keybuf), "location:%s", location);
+
+    if ((match = (server_pindex_t *)cupsArrayFind(printer_index, &key)) == NULL)
+      return (printers);
+
+    best = match->printers;
+  }
+
+  if (service_type)
+  {
+    if (!strcmp(service_type, "print3d"))
+      type = SERVER_TYPE_PRINT3D;
+    else if (strcmp(service_type, "print"))
+      return (printers);
+
+    snprintf(keybuf, sizeof(keybuf), "type:%d", (int)type);
+
+    if ((match = (server_pindex_t *)cupsArrayFind(printer_index, &key)) == NULL)
+      return (printers);
+
+    if (!best || cupsArrayGetCount(match->printers) < cupsArrayGetCount(best))
+      best = match->printers;
+  }
+
+  if (geo_location)
+  {
+    if (!get_geo(geo_location, &lat, &lon, &alt))
+      return (printers);
+
+    dlat = geo_distance / M_PER_DEG;
+    dlon = dlat / fmax(cos(lat * M_PI / 180.0), 0.01);
+    ymin = (int)floor((lat - dlat) / GEO_CELL);
+    ymax = (int)floor((lat + dlat) / GEO_CELL);
+    xmin = (int)floor((lon - dlon) / GEO_CELL);
+    xmax = (int)floor((lon + dlon) / GEO_CELL);
+
+    if ((double)(ymax - ymin + 1) * (double)(xmax - xmin + 1) <= GEO_MAX_CELLS)
+    {
+     /*
+      * Collect the printers in the nearby cells...
+      */
+
+      geo_printers = cupsArrayNew((cups_array_cb_t)compare_printers, NULL, NULL, 0, NULL, NULL);
+
+      for (y = ymin; y <= ymax; y ++)
+      {
+        for (x = xmin; x <= xmax; x ++)
+        {
+          snprintf(keybuf, sizeof(keybuf), "geo:%d,%d", y, x);
+
+          if ((match = (server_pindex_t *)cupsArrayFind(printer_index, &key)) != NULL)
+          {
+            for (printer = (server_printer_t *)cupsArrayGetFirst(match->printers); printer; printer = (server_printer_t *)cupsArrayGetNext(match->printers))
+              cupsArrayAdd(geo_printers, printer);
+          }
+        }
+      }
+
+      if (!best || cupsArrayGetCount(geo_printers) < cupsArrayGetCount(best))
+        best = geo_printers;
+    }
+  }
+
+  if (!best)
+    best = Printers;
+
+ /*
+  * Check the remaining filters against the smallest candidate list...
+  */
+
+  for (printer = (server_printer_t *)cupsArrayGetFirst(best); printer; printer = (server_printer_t *)cupsArrayGetNext(best))
+  {
+    if (location && (!printer->pinfo.location || strcmp(printer->pinfo.location, location)))
+      continue;
+
+    if (service_type && printer->type != type)
+      continue;
+
+    if (geo_location && (!printer->has_geo || wgs84_distance(printer->geo_lat, printer->geo_lon, printer->geo_alt, lat, lon, alt) > geo_distance))
+      continue;
+
+    cupsArrayAdd(printers, printer);
+  }
+
+  cupsArrayDelete(geo_printers);
+
+  return (printers);
+}
+
+
 /*
  * 'serverLoadAttributes()' - Load printer attributes from a file.
  *
@@ -447,26 +509,117 @@ serverLoadAttributes(
 }
 
 
+/*
+ * 'serverRemovePrinterNoLock()' - Remove a printer from the list of printers.
+ *
+ * The printer's saved configuration and snapshot files are also removed from
+ * the state directory.
+ *
+ * Note: Caller MUST hold a write lock on PrintersRWLock.
+ */
+
+void
+serverRemovePrinterNoLock(
+    server_printer_t *printer)		/* I - Printer to remove */
+{
+  char	filename[1024];			/* State file */
+
+
+  index_printer(printer, false);
+
+  cupsArrayRemove(Printers, printer);
+
+  if (StateDirectory)
+  {
+    const char *type = strncmp(printer->resource, "/ipp/print/", 11) ? "print3d" : "print";
+					/* Printer type directory */
+
+   /*
+    * Make sure a save in progress doesn't write the printer again...
+    */
+
+    cupsMutexLock(&save_mutex);
+
+    cupsArrayRemove(save_printers, printer);
+
+    while (save_current == printer)
+      cupsCondWait(&save_current_cond, &save_mutex, 0.0);
+
+    cupsMutexUnlock(&save_mutex);
+
+    snprintf(filename, sizeof(filename), "%s/%s/%s.conf", StateDirectory, type, printer->name);
+    if (unlink(filename) && errno != ENOENT)
+      serverLog(SERVER_LOGLEVEL_ERROR, "Unable to remove \"%s\": %s", filename, strerror(errno));
+
+    snprintf(filename, sizeof(filename), "%s/%s/%s.snapshot", StateDirectory, type, printer->name);
+    if (unlink(filename) && errno != ENOENT)
+      serverLog(SERVER_LOGLEVEL_ERROR, "Unable to remove \"%s\": %s", filename, strerror(errno));
+  }
+}
+
+
 /*
  * 'serverSaveSystem()' - Save the state of the system.
+ *
+ * Unless `all` is `true`, only printers whose configuration has changed since
+ * the last save are written.  The list of printers is collected first so that
+ * `PrintersRWLock` is not held while writing files.
  */
 
 void
-serverSaveSystem(void)
+serverSaveSystem(bool all)		/* I - Save all printers? */
 {
   server_printer_t	*printer;	/* Current printer */
   char			filename[1024];	/* Output file/directory */
+  bool			saved;		/* Was the printer saved? */
+  size_t		count = 0;	/* Number of printers saved */
 
 
   if (!StateDirectory)
     return;
 
-  serverLog(SERVER_LOGLEVEL_INFO, "Saving system state to \"%s\".", StateDirectory);
+  cupsMutexLock(&save_write_mutex);
+
+ /*
+  * Collect the printers that need to be saved...
+  */
 
   cupsRWLockRead(&PrintersRWLock);
+  cupsMutexLock(&save_mutex);
+
+  save_printers = cupsArrayNew(NULL, NULL, NULL, 0, NULL, NULL);
 
   for (printer = (server_printer_t *)cupsArrayGetFirst(Printers); printer; printer = (server_printer_t *)cupsArrayGetNext(Printers))
   {
+    if (all || printer->config_dirty)
+    {
+      printer->config_dirty = false;
+      cupsArrayAdd(save_printers, printer);
+    }
+  }
+
+  cupsMutexUnlock(&save_mutex);
+  cupsRWUnlock(&PrintersRWLock);
+
+ /*
+  * Then write them - serverRemovePrinterNoLock() removes deleted printers from
+  * the list and waits for the current printer to be written...
+  */
+
+  for (;;)
+  {
+    cupsMutexLock(&save_mutex);
+
+    if ((printer = (server_printer_t *)cupsArrayGetFirst(save_printers)) != NULL)
+      cupsArrayRemove(save_printers, printer);
+
+    save_current = printer;
+
+    cupsMutexUnlock(&save_mutex);
+
+    if (!printer)
+      break;
+
     if (!strncmp(printer->resource, "/ipp/print/", 11))
       snprintf(filename, sizeof(filename), "%s/print", StateDirectory);
     else
@@ -475,9 +628,95 @@ serverSaveSystem(void)
     if (access(filename, 0))
       mkdir(filename, 0777);
 
-    save_printer(printer, filename);
+    saved = save_printer(printer, filename);
+
+    cupsMutexLock(&save_mutex);
+
+    if (saved)
+      count ++;
+    else
+      printer->config_dirty = true;
+
+    save_current = NULL;
+    cupsCondBroadcast(&save_current_cond);
+
+    cupsMutexUnlock(&save_mutex);
+  }
+
+  cupsMutexLock(&save_mutex);
+  cupsArrayDelete(save_printers);
+  save_printers = NULL;
+  cupsMutexUnlock(&save_mutex);
+
+  cupsMutexUnlock(&save_write_mutex);
+
+  if (count > 0)
+    serverLog(SERVER_LOGLEVEL_INFO, "Saved %u printers to \"%s\".", (unsigned)count, StateDirectory);
+}
+
+
+/*
+ * 'serverSaveSystemLater()' - Save the state of the system after a change.
+ *
+ * Changes are coalesced and saved by a background thread once no further
+ * changes have been made for `SAVE_DELAY` seconds.
+ */
+
+void
+serverSaveSystemLater(
+    server_printer_t *printer)		/* I - Changed printer or `NULL` for none */
+{
+  cups_thread_t	t;			/* Save thread */
+  bool		started = true;		/* Is the save thread running? */
+
+
+  if (!StateDirectory)
+    return;
+
+  cupsMutexLock(&save_mutex);
+
+  if (printer)
+    printer->config_dirty = true;
+
+  save_time = time(NULL) + SAVE_DELAY;
+
+  if (!save_active)
+  {
+    if ((t = cupsThreadCreate((cups_thread_func_t)save_system, NULL)) != 0)
+    {
+      cupsThreadDetach(t);
+      save_active = true;
+    }
+    else
+      started = false;
   }
 
+  cupsMutexUnlock(&save_mutex);
+
+  if (!started)
+    serverSaveSystem(false);
+}
+
+
+/*
+ * 'serverUpdatePrinterIndex()' - Update the indexes after a printer's
+ *                                "printer-geo-location" changes.
+ */
+
+void
+serverUpdatePrinterIndex(
+    server_printer_t *printer)		/* I - Printer */
+{
+  cupsRWLockWrite(&PrintersRWLock);
+
+  index_printer(printer, false);
+
+  cupsRWLockRead(&printer->rwlock);
+  printer->has_geo = get_geo(ippGetString(ippFindAttribute(printer->pinfo.attrs, "printer-geo-location", IPP_TAG_URI), 0, NULL), &printer->geo_lat, &printer->geo_lon, &printer->geo_alt);
+  cupsRWUnlock(&printer->rwlock);
+
+  index_printer(printer, true);
+
   cupsRWUnlock(&PrintersRWLock);
 }
 
@@ -983,7 +1222,66 @@ add_job_privacy(void)
 
 
 /*
- * 'add_subscription_privacy()' - Add subscription privacy attributes.
+ * 'add_profile()' - Add an ICC color profile to a printer.
+ *
+ * The attributes are owned by the printer information after this call.
+ */
+
+static void
+add_profile(server_pinfo_t *pinfo,	/* I - Printer information */
+            const char     *name,	/* I - Profile name */
+            const char     *filename,	/* I - ICC file */
+            ipp_t          *attrs)	/* I - Profile attributes */
+{
+  server_icc_t	icc;			/* ICC profile data */
+  char		uri[1024];		/* profile-uri value */
+
+
+  icc.attrs = attrs;
+
+  if ((icc.resource = serverFindResourceByFilename(filename)) == NULL)
+    icc.resource = serverCreateResource(NULL, filename, "application/icc", name, name, "static-icc-profile", NULL);
+
+  ippAddString(icc.attrs, IPP_TAG_PRINTER, IPP_TAG_NAME, "profile-name", NULL, name);
+  httpAssembleURI(HTTP_URI_CODING_ALL, uri, sizeof(uri), Encryption != HTTP_ENCRYPTION_NEVER ? SERVER_HTTPS_SCHEME : SERVER_HTTP_SCHEME, NULL, ServerName, DefaultPort, icc.resource->resource);
+  ippAddString(icc.attrs, IPP_TAG_PRINTER, IPP_TAG_URI, "profile-uri", NULL, uri);
+
+  if (!pinfo->profiles)
+    pinfo->profiles = cupsArrayNew(NULL, NULL, NULL, 0, (cups_acopy_cb_t)copy_icc, (cups_afree_cb_t)free_icc);
+
+  cupsArrayAdd(pinfo->profiles, &icc);
+
+  serverLog(SERVER_LOGLEVEL_DEBUG, "Added ICC profile \"%s\".", filename);
+}
+
+
+/*
+ * 'add_strings()' - Add a strings file to a printer.
+ */
+
+static void
+add_strings(server_pinfo_t *pinfo,	/* I - Printer information */
+            const char     *lang,	/* I - Language */
+            const char     *filename)	/* I - Strings file */
+{
+  server_lang_t	temp;			/* New localization */
+
+
+  temp.lang = (char *)lang;
+  if ((temp.resource = serverFindResourceByFilename(filename)) == NULL)
+    temp.resource = serverCreateResource(NULL, filename, "text/strings", lang, lang, "static-strings", lang);
+
+  if (!pinfo->strings)
+    pinfo->strings = cupsArrayNew((cups_array_cb_t)compare_lang, NULL, NULL, 0, (cups_acopy_cb_t)copy_lang, (cups_afree_cb_t)free_lang);
+
+  cupsArrayAdd(pinfo->strings, &temp);
+
+  serverLog(SERVER_LOGLEVEL_DEBUG, "Added strings file \"%s\" for language \"%s\".", filename, lang);
+}
+
+
+/*
+ * 'add_subscription_privacy()' - Add subscription privacy attributes.
  */
 
 static void
@@ -1187,6 +1485,18 @@ compare_lang(server_lang_t *a,		/* I - First localization */
 }
 
 
+/*
+ * 'compare_pindex()' - Compare two printer index buckets.
+ */
+
+static int				/* O - Result of comparison */
+compare_pindex(server_pindex_t *a,	/* I - First bucket */
+               server_pindex_t *b)	/* I - Second bucket */
+{
+  return (strcmp(a->key, b->key));
+}
+
+
 /*
  * 'compare_printers()' - Compare two printers.
  */
@@ -2196,6 +2506,12 @@ finalize_system(void)
   add_job_privacy();
   add_subscription_privacy();
 
+ /*
+  * Initialize the transform scheduler...
+  */
+
+  serverInitTransforms();
+
  /*
   * Initialize DNS-SD...
   */
@@ -2272,6 +2588,121 @@ free_lang(server_lang_t *a)		/* I - Localization */
 }
 
 
+/*
+ * 'free_pindex()' - Free a printer index bucket.
+ */
+
+static void
+free_pindex(server_pindex_t *a)		/* I - Bucket */
+{
+  free(a->key);
+  cupsArrayDelete(a->printers);
+  free(a);
+}
+
+
+/*
+ * 'get_geo()' - Get the latitude, longitude, and altitude from a geo: URI.
+ */
+
+static bool				/* O - `true` on success, `false` on error */
+get_geo(const char *uri,		/* I - geo: URI */
+        double     *lat,		/* O - Latitude */
+        double     *lon,		/* O - Longitude */
+        double     *alt)		/* O - Altitude */
+{
+  char	*ptr;				/* Pointer into string */
+
+
+  *lat = *lon = *alt = 0.0;
+
+  if (!uri || strncmp(uri, "geo:", 4))
+    return (false);
+
+  *lat = strtod(uri + 4, &ptr);
+  if (*ptr != ',')
+    return (false);
+
+  *lon = strtod(ptr + 1, &ptr);
+  if (*ptr == ',')
+    *alt = strtod(ptr + 1, NULL);
+
+  return (true);
+}
+
+
+#ifndef _WIN32
+/*
+ * 'get_group()' - Look up a group ID by name.
+ *
+ * This uses getgrnam_r() since printers are loaded by multiple threads.
+ */
+
+static bool				/* O - `true` if found, `false` otherwise */
+get_group(const char *name,		/* I - Group name */
+          gid_t      *gid)		/* O - Group ID */
+{
+  struct group	grpbuf,			/* Group buffer */
+		*grp = NULL;		/* Group information */
+  char		*buffer;		/* String buffer */
+  size_t	bufsize = 16384;	/* Size of string buffer */
+  int		error;			/* Lookup error, if any */
+
+
+  while ((buffer = malloc(bufsize)) != NULL)
+  {
+    if ((error = getgrnam_r(name, &grpbuf, buffer, bufsize, &grp)) != ERANGE || bufsize >= 1048576)
+      break;
+
+    free(buffer);
+    bufsize *= 4;
+  }
+
+  if (!buffer)
+    return (false);
+
+  if (grp)
+    *gid = grp->gr_gid;
+
+  free(buffer);
+
+  return (grp != NULL);
+}
+#endif /* !_WIN32 */
+
+
+/*
+ * 'get_size()' - Get a size value with an optional "k", "m", or "g" suffix.
+ */
+
+static bool				/* O - `true` on success, `false` on error */
+get_size(const char *value,		/* I - Value string */
+         size_t     *size)		/* O - Size in bytes */
+{
+  char			*ptr;		/* Pointer to suffix */
+  unsigned long long	number;		/* Number */
+
+
+  if (!isdigit(*value & 255))
+    return (false);
+
+  number = strtoull(value, &ptr, 10);
+
+  if (!strcasecmp(ptr, "k"))
+    number *= 1024;
+  else if (!strcasecmp(ptr, "m"))
+    number *= 1024 * 1024;
+  else if (!strcasecmp(ptr, "g"))
+    number *= 1024 * 1024 * 1024;
+  else if (*ptr)
+    return (false);
+
+  *size = (size_t)number;
+
+  return (true);
+}
+
+
 //
 // 'get_temp_dir()' - Get the temporary directory.
 //
@@ -2347,159 +2778,575 @@ get_temp_dir(void)
 
 
 /*
- * 'load_system()' - Load the system configuration file.
+ * 'index_printer()' - Add or remove a printer from the printer indexes.
+ *
+ * Note: Caller MUST hold a write lock on PrintersRWLock.
  */
 
-static int				/* O - 1 on success, 0 on failure */
-load_system(const char *conf)		/* I - Configuration file */
+static void
+index_printer(
+    server_printer_t *printer,		/* I - Printer */
+    bool             add)		/* I - `true` to add, `false` to remove */
 {
-  cups_file_t	*fp;			/* File pointer */
-  int		status = 1,		/* Return value */
-		linenum = 0;		/* Current line number */
-  char		line[1024],		/* Line from file */
-		*value,			/* Pointer to value on line */
-		temp[1024];		/* Temporary string */
-  const char	*setting;		/* Current setting */
-#ifndef _WIN32
-  struct group	*group;			/* Group information */
-#endif /* !_WIN32 */
-  int		i;			/* Looping var */
-  static const char * const settings[] =/* List of directives */
-  {
-    "Authentication",
-    "AuthAdminGroup",
-    "AuthGroups",
-    "AuthName",
-    "AuthOperatorGroup",
-    "AuthProxyGroup",
-    "AuthService",
-    "AuthTestPassword",
-    "AuthType",
-    "BinDir",
-    "DataDir",
-    "DefaultPrinter",
-    "DocumentPrivacyAttributes",
-    "DocumentPrivacyScope",
-    "Encryption",
-    "FileDirectory",
-    "GeoLocation",
-    "Info",
-    "JobPrivacyAttributes",
-    "JobPrivacyScope",
-    "KeepFiles",
-    "Listen",
-    "Location",
-    "LogFile",
-    "LogLevel",
-    "MakeAndModel",
-    "MaxCompletedJobs",
-    "MaxJobs",
-    "Name",
-    "OwnerEmail",
-    "OwnerLocation",
-    "OwnerName",
-    "OwnerPhone",
-    "SpoolDir",
-    "StateDir",
-    "SubscriptionPrivacyAttributes",
-    "SubscriptionPrivacyScope",
-    "UUID"
-  };
+  int			i,		/* Looping var */
+			num_keys = 0;	/* Number of keys */
+  char			keys[3][1024];	/* Index keys */
+  server_pindex_t	key,		/* Search key */
+			*match;		/* Matching bucket */
 
 
-  if ((fp = cupsFileOpen(conf, "r")) == NULL)
-    return (errno == ENOENT);
+  if (!printer_index)
+    printer_index = cupsArrayNew((cups_array_cb_t)compare_pindex, NULL, NULL, 0, NULL, (cups_afree_cb_t)free_pindex);
 
-  while (cupsFileGetConf(fp, line, sizeof(line), &value, &linenum))
+  snprintf(keys[num_keys ++], sizeof(keys[0]), "type:%d", (int)printer->type);
+
+  if (printer->pinfo.location)
+    snprintf(keys[num_keys ++], sizeof(keys[0]), "location:%s", printer->pinfo.location);
+
+  if (printer->has_geo)
+    snprintf(keys[num_keys ++], sizeof(keys[0]), "geo:%d,%d", (int)floor(printer->geo_lat / GEO_CELL), (int)floor(printer->geo_lon / GEO_CELL));
+
+  for (i = 0; i < num_keys; i ++)
   {
-    if (!value)
+    key.key = keys[i];
+    match   = (server_pindex_t *)cupsArrayFind(printer_index, &key);
+
+    if (add)
     {
-      fprintf(stderr, "ippserver: Missing value on line %d of \"%s\".\n", linenum, conf);
-      status = 0;
-      break;
-    }
+      if (!match)
+      {
+        if ((match = calloc(1, sizeof(server_pindex_t))) == NULL)
+          return;
 
-    for (i = 0; i < (int)(sizeof(settings) / sizeof(settings[0])); i ++)
-      if (!strcasecmp(line, settings[i]))
-        break;
+        match->key      = strdup(keys[i]);
+        match->printers = cupsArrayNew((cups_array_cb_t)compare_printers, NULL, NULL, 0, NULL, NULL);
 
-    if (i >= (int)(sizeof(settings) / sizeof(settings[0])))
+        cupsArrayAdd(printer_index, match);
+      }
+
+      cupsArrayAdd(match->printers, printer);
+    }
+    else if (match)
     {
-      fprintf(stderr, "ippserver: Unknown \"%s\" directive on line %d.\n", line, linenum);
-      continue;
+      cupsArrayRemove(match->printers, printer);
+
+      if (cupsArrayGetCount(match->printers) == 0)
+        cupsArrayRemove(printer_index, match);
     }
+  }
+}
 
-    if ((setting = cupsGetOption(line, SystemNumSettings, SystemSettings)) != NULL)
-    {
-     /*
-      * Already have this setting, check whether this is OK...
-      */
 
-      if (!strcasecmp(line, "FileDirectory") || !strcasecmp(line, "Listen"))
-      {
-       /*
-        * Listen allows multiple values, others do not...
-        */
+/*
+ * 'load_printer()' - Load printers from the load queue.
+ *
+ * This is the main entry for each printer loading thread.
+ */
 
-	snprintf(temp, sizeof(temp), "%s %s", setting, value);
-	SystemNumSettings = cupsAddOption(line, temp, SystemNumSettings, &SystemSettings);
-      }
-      else
-      {
-	fprintf(stderr, "ippserver: Duplicate \"%s\" directive on line %d.\n", line, linenum);
-	continue;
-      }
-    }
-    else
+static void *				/* O - Thread exit status */
+load_printer(void *data)		/* I - Thread data (unused) */
+{
+  server_pload_t	*pload;		/* Printer to load */
+  server_printer_t	*printer;	/* Printer */
+  server_pinfo_t	pinfo;		/* Printer information */
+
+
+  (void)data;
+
+  for (;;)
+  {
+    cupsMutexLock(&load_mutex);
+    if ((pload = (server_pload_t *)cupsArrayGetFirst(load_queue)) != NULL)
+      cupsArrayRemove(load_queue, pload);
+    cupsMutexUnlock(&load_mutex);
+
+    if (!pload)
+      break;
+
+    serverLog(SERVER_LOGLEVEL_INFO, "Loading printer from '%s'.", pload->filename);
+
+    memset(&pinfo, 0, sizeof(pinfo));
+
+    pinfo.print_group       = SERVER_GROUP_NONE;
+    pinfo.proxy_group       = SERVER_GROUP_NONE;
+    pinfo.initial_accepting = 1;
+    pinfo.initial_state     = IPP_PSTATE_IDLE;
+    pinfo.initial_reasons   = SERVER_PREASON_NONE;
+    pinfo.web_forms         = 1;
+    pinfo.icon              = pload->icon;
+
+    if ((load_snapshot(pload->filename, &pinfo) || serverLoadAttributes(pload->filename, &pinfo)) && (printer = serverCreatePrinter(pload->resource, pload->name, pload->name, &pinfo, 0)) != NULL)
     {
+      printer->state         = pinfo.initial_state;
+      printer->state_reasons = pinfo.initial_reasons;
+      printer->is_accepting  = pinfo.initial_accepting;
+
      /*
-      * First time we've seen this setting...
+      * Printers loaded from the state directory are already saved...
       */
 
-      SystemNumSettings = cupsAddOption(line, value, SystemNumSettings, &SystemSettings);
-    }
+      if (StateDirectory && !strncmp(pload->filename, StateDirectory, strlen(StateDirectory)) && pload->filename[strlen(StateDirectory)] == '/')
+        printer->config_dirty = false;
 
-    if (!strcasecmp(line, "Authentication"))
-    {
-      if (!strcasecmp(value, "on") || !strcasecmp(value, "yes"))
-      {
-        Authentication = 1;
-      }
-      else if (!strcasecmp(value, "off") || !strcasecmp(value, "no"))
-      {
-        Authentication = 0;
-      }
-      else
-      {
-        fprintf(stderr, "ippserver: Unknown Authentication \"%s\" on line %d of \"%s\".\n", value, linenum, conf);
-        status = 0;
-        break;
-      }
-    }
-#ifndef _WIN32
-    else if (!strcasecmp(line, "AuthAdminGroup"))
-    {
-      if (!strcasecmp(value, "@system"))
-      {
-        AuthAdminGroup = getgid();
-      }
-      else if ((group = getgrnam(value)) == NULL)
-      {
-        fprintf(stderr, "ippserver: Unable to find AuthAdminGroup \"%s\" on line %d of \"%s\".\n", value, linenum, conf);
-        status = 0;
-        break;
-      }
-      else
-      {
-        AuthAdminGroup = group->gr_gid;
-      }
-    }
-#endif /* !_WIN32 */
-    else if (!strcasecmp(line, "AuthName"))
-    {
-      AuthName = strdup(value);
+      serverAddPrinter(printer);
     }
-#ifndef _WIN32
+
+    free(pload->filename);
+    free(pload->name);
+    free(pload->resource);
+    free(pload);
+  }
+
+  return (NULL);
+}
+
+
+/*
+ * 'load_printers()' - Load all queued printers.
+ *
+ * The printers are loaded by a pool of `load_printer` threads.  Once they
+ * are all loaded the default printer is set, the system state is saved, and
+ * the printers are registered with DNS-SD.
+ */
+
+static void *				/* O - Thread exit status */
+load_printers(void *data)		/* I - Thread data (unused) */
+{
+  size_t		i,		/* Looping var */
+			num_threads;	/* Number of threads */
+  cups_thread_t		threads[LOAD_MAX_THREADS];
+					/* Loading threads */
+  server_printer_t	*printer = NULL;/* Default printer */
+  time_t		start = time(NULL);
+					/* Start time */
+
+
+  (void)data;
+
+#ifdef _WIN32
+  num_threads = 4;
+#else
+  num_threads = (size_t)sysconf(_SC_NPROCESSORS_ONLN);
+#endif /* _WIN32 */
+
+  if (num_threads > LOAD_MAX_THREADS)
+    num_threads = LOAD_MAX_THREADS;
+  if (num_threads > cupsArrayGetCount(load_queue))
+    num_threads = cupsArrayGetCount(load_queue);
+
+  for (i = 0; i < num_threads; i ++)
+  {
+    if ((threads[i] = cupsThreadCreate((cups_thread_func_t)load_printer, NULL)) == 0)
+      break;
+  }
+
+  num_threads = i;
+
+  load_printer(NULL);
+
+  for (i = 0; i < num_threads; i ++)
+    cupsThreadWait(threads[i]);
+
+  cupsArrayDelete(load_queue);
+  load_queue = NULL;
+
+  if (default_printer)
+  {
+    cupsRWLockRead(&PrintersRWLock);
+
+    for (printer = (server_printer_t *)cupsArrayGetFirst(Printers); printer; printer = (server_printer_t *)cupsArrayGetNext(Printers))
+      if (!strcmp(printer->name, default_printer))
+        break;
+
+    cupsRWUnlock(&PrintersRWLock);
+  }
+
+  DefaultPrinter  = printer;
+  PrintersLoading = false;
+
+  serverLog(SERVER_LOGLEVEL_INFO, "Loaded %u printers in %ld seconds.", (unsigned)cupsArrayGetCount(Printers), (long)(time(NULL) - start));
+
+  if (StateDirectory)
+    serverSaveSystem(false);
+
+  register_printers();
+
+  return (NULL);
+}
+
+
+/*
+ * 'load_snapshot()' - Load printer information from a binary snapshot.
+ *
+ * The snapshot is only used when it is at least as new as the printer's
+ * configuration file and has a valid header and checksum.  Otherwise `false`
+ * is returned and the caller parses the configuration file.
+ */
+
+static bool				/* O - `true` on success, `false` to use the .conf file */
+load_snapshot(const char     *conffile,	/* I - Printer configuration file */
+              server_pinfo_t *pinfo)	/* I - Printer information */
+{
+#ifndef _WIN32
+  char			snapfile[1024];	/* Snapshot file */
+  size_t		conflen;	/* Length of conffile */
+  struct stat		confinfo,	/* Configuration file information */
+			snapinfo;	/* Snapshot file information */
+  int			fd;		/* Snapshot file descriptor */
+  unsigned char		*data;		/* Mapped snapshot */
+  size_t		datalen;	/* Length of IPP data */
+  uint32_t		checksum;	/* Stored checksum */
+  ipp_t			*ipp;		/* Snapshot attributes */
+  ipp_attribute_t	*attr;		/* Current attribute */
+  const char		*name;		/* Attribute name */
+  gid_t			print_group = SERVER_GROUP_NONE,
+			proxy_group = SERVER_GROUP_NONE;
+					/* Print and proxy groups */
+  size_t		i,		/* Looping var */
+			count;		/* Number of values */
+
+
+  if ((conflen = strlen(conffile)) < 5 || strcmp(conffile + conflen - 5, ".conf"))
+    return (false);
+
+  snprintf(snapfile, sizeof(snapfile), "%.*s.snapshot", (int)(conflen - 5), conffile);
+
+  if (stat(conffile, &confinfo) || stat(snapfile, &snapinfo) || snapinfo.st_mtime < confinfo.st_mtime || snapinfo.st_size <= SNAPSHOT_HEADER)
+    return (false);
+
+ /*
+  * Map the snapshot and validate the header and checksum...
+  */
+
+  if ((fd = open(snapfile, O_RDONLY)) < 0)
+    return (false);
+
+  data = mmap(NULL, (size_t)snapinfo.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (data == MAP_FAILED)
+    return (false);
+
+  datalen  = ((size_t)data[8] << 24) | ((size_t)data[9] << 16) | ((size_t)data[10] << 8) | (size_t)data[11];
+  checksum = ((uint32_t)data[12] << 24) | ((uint32_t)data[13] << 16) | ((uint32_t)data[14] << 8) | (uint32_t)data[15];
+
+  if (memcmp(data, SNAPSHOT_MAGIC, 8) || datalen != ((size_t)snapinfo.st_size - SNAPSHOT_HEADER) || checksum != serverHashString((const char *)data + SNAPSHOT_HEADER, (ssize_t)datalen, false))
+  {
+    serverLog(SERVER_LOGLEVEL_ERROR, "Ignoring bad printer snapshot '%s'.", snapfile);
+    munmap(data, (size_t)snapinfo.st_size);
+    return (false);
+  }
+
+  ipp = serverUnpackAttributes(data + SNAPSHOT_HEADER, datalen);
+
+  munmap(data, (size_t)snapinfo.st_size);
+
+  if (!ipp)
+    return (false);
+
+ /*
+  * Resolve the groups first since a missing group makes the snapshot stale...
+  */
+
+  if ((attr = ippFindAttribute(ipp, "auth-print-group", IPP_TAG_NAME)) != NULL && !get_group(ippGetString(attr, 0, NULL), &print_group))
+  {
+    ippDelete(ipp);
+    return (false);
+  }
+
+  if ((attr = ippFindAttribute(ipp, "auth-proxy-group", IPP_TAG_NAME)) != NULL && !get_group(ippGetString(attr, 0, NULL), &proxy_group))
+  {
+    ippDelete(ipp);
+    return (false);
+  }
+
+  pinfo->print_group = print_group;
+  pinfo->proxy_group = proxy_group;
+
+ /*
+  * Apply the printer information, which is stored in the operation group
+  * ahead of the printer attributes...
+  */
+
+  while ((attr = ippGetFirstAttribute(ipp)) != NULL && ippGetGroupTag(attr) == IPP_TAG_OPERATION)
+  {
+    name  = ippGetName(attr);
+    count = ippGetCount(attr);
+
+    if (!strcmp(name, "command"))
+    {
+      pinfo->command = strdup(ippGetString(attr, 0, NULL));
+    }
+    else if (!strcmp(name, "device-uri"))
+    {
+      pinfo->device_uri = strdup(ippGetString(attr, 0, NULL));
+    }
+    else if (!strcmp(name, "initial-state") && count == 3)
+    {
+      pinfo->initial_accepting = (char)ippGetInteger(attr, 0);
+      pinfo->initial_state     = (ipp_pstate_t)ippGetInteger(attr, 1);
+      pinfo->initial_reasons   = (server_preason_t)ippGetInteger(attr, 2);
+    }
+    else if (!strcmp(name, "max-output-devices"))
+    {
+      pinfo->max_devices = ippGetInteger(attr, 0);
+    }
+    else if (!strcmp(name, "output-device"))
+    {
+      for (i = 0; i < count; i ++)
+        serverCreateDevicePinfo(pinfo, ippGetString(attr, i, NULL));
+    }
+    else if (!strcmp(name, "output-format"))
+    {
+      pinfo->output_format = strdup(ippGetString(attr, 0, NULL));
+    }
+    else if (!strcmp(name, "profile"))
+    {
+      for (i = 0; i < count; i ++)
+      {
+        ipp_t		*col = ippGetCollection(attr, i),
+					/* Profile collection */
+			*attrs = ippNew();
+					/* Profile attributes */
+	ipp_attribute_t	*member;	/* Current member attribute */
+	const char	*mname;		/* Member name */
+
+        for (member = ippGetFirstAttribute(col); member; member = ippGetNextAttribute(col))
+        {
+          if ((mname = ippGetName(member)) != NULL && strcmp(mname, "profile-file") && strcmp(mname, "profile-name"))
+            ippCopyAttribute(attrs, member, false);
+	}
+
+        add_profile(pinfo, ippGetString(ippFindAttribute(col, "profile-name", IPP_TAG_NAME), 0, NULL), ippGetString(ippFindAttribute(col, "profile-file", IPP_TAG_TEXT), 0, NULL), attrs);
+      }
+    }
+    else if (!strcmp(name, "streaming"))
+    {
+      pinfo->streaming = (char)ippGetBoolean(attr, 0);
+    }
+    else if (!strcmp(name, "strings"))
+    {
+      for (i = 0; i < count; i ++)
+      {
+        ipp_t *col = ippGetCollection(attr, i);
+					/* Strings collection */
+
+        add_strings(pinfo, ippGetString(ippFindAttribute(col, "strings-language", IPP_TAG_TEXT), 0, NULL), ippGetString(ippFindAttribute(col, "strings-file", IPP_TAG_TEXT), 0, NULL));
+      }
+    }
+    else if (!strcmp(name, "web-forms"))
+    {
+      pinfo->web_forms = (char)ippGetBoolean(attr, 0);
+    }
+
+    ippDeleteAttribute(ipp, attr);
+  }
+
+ /*
+  * What is left are the printer attributes...
+  */
+
+  pinfo->attrs = ipp;
+
+  serverLog(SERVER_LOGLEVEL_DEBUG, "Loaded printer snapshot '%s'.", snapfile);
+
+  return (true);
+
+#else
+  (void)conffile;
+  (void)pinfo;
+
+  return (false);
+#endif /* !_WIN32 */
+}
+
+
+/*
+ * 'load_system()' - Load the system configuration file.
+ */
+
+static int				/* O - 1 on success, 0 on failure */
+load_system(const char *conf)		/* I - Configuration file */
+{
+  cups_file_t	*fp;			/* File pointer */
+  int		status = 1,		/* Return value */
+		linenum = 0;		/* Current line number */
+  char		line[1024],		/* Line from file */
+		*value,			/* Pointer to value on line */
+		temp[1024];		/* Temporary string */
+  const char	*setting;		/* Current setting */
+#ifndef _WIN32
+  struct group	*group;			/* Group information */
+#endif /* !_WIN32 */
+  int		i;			/* Looping var */
+  static const char * const settings[] =/* List of directives */
+  {
+    "AcceptThreads",
+    "ArchiveJobs",
+    "Authentication",
+    "AuthAdminGroup",
+    "AuthGroups",
+    "AuthName",
+    "AuthOperatorGroup",
+    "AuthProxyGroup",
+    "AuthService",
+    "AuthTestPassword",
+    "AuthType",
+    "BinDir",
+    "ClientThreads",
+    "DataDir",
+    "DefaultPrinter",
+    "DocumentPrivacyAttributes",
+    "DocumentPrivacyScope",
+    "Encryption",
+    "FileDirectory",
+    "GeoLocation",
+    "Info",
+    "JobPrivacyAttributes",
+    "JobPrivacyScope",
+    "KeepAliveTimeout",
+    "KeepFiles",
+    "Listen",
+    "Location",
+    "LogFile",
+    "LogLevel",
+    "MakeAndModel",
+    "MaxCompletedJobs",
+    "MaxJobs",
+    "MaxReadRequests",
+    "MaxTransforms",
+    "Name",
+    "OwnerEmail",
+    "OwnerLocation",
+    "OwnerName",
+    "OwnerPhone",
+    "RateLimit",
+    "SpoolDir",
+    "SpoolMemory",
+    "SpoolMemoryThreshold",
+    "StateDir",
+    "SubscriptionPrivacyAttributes",
+    "SubscriptionPrivacyScope",
+    "TransformCPUs",
+    "TransformNice",
+    "UUID"
+  };
+
+
+  if ((fp = cupsFileOpen(conf, "r")) == NULL)
+    return (errno == ENOENT);
+
+  while (cupsFileGetConf(fp, line, sizeof(line), &value, &linenum))
+  {
+    if (!value)
+    {
+      fprintf(stderr, "ippserver: Missing value on line %d of \"%s\".\n", linenum, conf);
+      status = 0;
+      break;
+    }
+
+    for (i = 0; i < (int)(sizeof(settings) / sizeof(settings[0])); i ++)
+      if (!strcasecmp(line, settings[i]))
+        break;
+
+    if (i >= (int)(sizeof(settings) / sizeof(settings[0])))
+    {
+      fprintf(stderr, "ippserver: Unknown \"%s\" directive on line %d.\n", line, linenum);
+      continue;
+    }
+
+    if ((setting = cupsGetOption(line, SystemNumSettings, SystemSettings)) != NULL)
+    {
+     /*
+      * Already have this setting, check whether this is OK...
+      */
+
+      if (!strcasecmp(line, "FileDirectory") || !strcasecmp(line, "Listen"))
+      {
+       /*
+        * Listen allows multiple values, others do not...
+        */
+
+	snprintf(temp, sizeof(temp), "%s %s", setting, value);
+	SystemNumSettings = cupsAddOption(line, temp, SystemNumSettings, &SystemSettings);
+      }
+      else
+      {
+	fprintf(stderr, "ippserver: Duplicate \"%s\" directive on line %d.\n", line, linenum);
+	continue;
+      }
+    }
+    else
+    {
+     /*
+      * First time we've seen this setting...
+      */
+
+      SystemNumSettings = cupsAddOption(line, value, SystemNumSettings, &SystemSettings);
+    }
+
+    if (!strcasecmp(line, "AcceptThreads"))
+    {
+      if (!isdigit(*value & 255) || atoi(value) < 1 || atoi(value) > 256)
+      {
+        fprintf(stderr, "ippserver: Bad AcceptThreads value \"%s\" on line %d of \"%s\".\n", value, linenum, conf);
+        status = 0;
+        break;
+      }
+      else if (Listeners)
+      {
+        fprintf(stderr, "ippserver: AcceptThreads must appear before Listen on line %d of \"%s\".\n", linenum, conf);
+        status = 0;
+        break;
+      }
+
+      AcceptThreads = atoi(value);
+    }
+    else if (!strcasecmp(line, "ArchiveJobs"))
+    {
+      ArchiveJobs = !strcasecmp(value, "yes") || !strcasecmp(value, "true") || !strcasecmp(value, "on");
+    }
+    else if (!strcasecmp(line, "Authentication"))
+    {
+      if (!strcasecmp(value, "on") || !strcasecmp(value, "yes"))
+      {
+        Authentication = 1;
+      }
+      else if (!strcasecmp(value, "off") || !strcasecmp(value, "no"))
+      {
+        Authentication = 0;
+      }
+      else
+      {
+        fprintf(stderr, "ippserver: Unknown Authentication \"%s\" on line %d of \"%s\".\n", value, linenum, conf);
+        status = 0;
+        break;
+      }
+    }
+#ifndef _WIN32
+    else if (!strcasecmp(line, "AuthAdminGroup"))
+    {
+      if (!strcasecmp(value, "@system"))
+      {
+        AuthAdminGroup = getgid();
+      }
+      else if ((group = getgrnam(value)) == NULL)
+      {
+        fprintf(stderr, "ippserver: Unable to find AuthAdminGroup \"%s\" on line %d of \"%s\".\n", value, linenum, conf);
+        status = 0;
+        break;
+      }
+      else
+      {
+        AuthAdminGroup = group->gr_gid;
+      }
+    }
+#endif /* !_WIN32 */
+    else if (!strcasecmp(line, "AuthName"))
+    {
+      AuthName = strdup(value);
+    }
+#ifndef _WIN32
     else if (!strcasecmp(line, "AuthOperatorGroup"))
     {
       if (!strcasecmp(value, "@system"))
@@ -2558,6 +3405,17 @@ load_system(const char *conf)		/* I - Configuration file */
 
       BinDir = strdup(value);
     }
+    else if (!strcasecmp(line, "ClientThreads"))
+    {
+      if (!isdigit(*value & 255) || atoi(value) > 1024)
+      {
+        fprintf(stderr, "ippserver: Bad ClientThreads value \"%s\" on line %d of \"%s\".\n", value, linenum, conf);
+        status = 0;
+        break;
+      }
+
+      ClientThreads = atoi(value);
+    }
     else if (!strcasecmp(line, "DataDir"))
     {
       if (access(value, R_OK))
@@ -2688,16 +3546,27 @@ load_system(const char *conf)		/* I - Configuration file */
 
       JobPrivacyAttributes = strdup(value);
     }
-    else if (!strcasecmp(line, "JobPrivacyScope"))
+    else if (!strcasecmp(line, "JobPrivacyScope"))
+    {
+      if (JobPrivacyScope)
+      {
+        fprintf(stderr, "ippserver: Extra JobPrivacyScope seen on line %d of \"%s\".\n", linenum, conf);
+        status = 0;
+        break;
+      }
+
+      JobPrivacyScope = strdup(value);
+    }
+    else if (!strcasecmp(line, "KeepAliveTimeout"))
     {
-      if (JobPrivacyScope)
+      if (!isdigit(*value & 255) || atoi(value) < 1 || atoi(value) > 3600)
       {
-        fprintf(stderr, "ippserver: Extra JobPrivacyScope seen on line %d of \"%s\".\n", linenum, conf);
+        fprintf(stderr, "ippserver: Bad KeepAliveTimeout value \"%s\" on line %d of \"%s\".\n", value, linenum, conf);
         status = 0;
         break;
       }
 
-      JobPrivacyScope = strdup(value);
+      KeepAliveTimeout = atoi(value);
     }
     else if (!strcasecmp(line, "KeepFiles"))
     {
@@ -2823,6 +3692,67 @@ load_system(const char *conf)		/* I - Configuration file */
 
       MaxJobs = atoi(value);
     }
+    else if (!strcasecmp(line, "MaxReadRequests"))
+    {
+      if (!isdigit(*value & 255))
+      {
+        fprintf(stderr, "ippserver: Bad MaxReadRequests value \"%s\" on line %d of \"%s\".\n", value, linenum, conf);
+        status = 0;
+        break;
+      }
+
+      MaxReadRequests = atoi(value);
+    }
+    else if (!strcasecmp(line, "MaxTransforms"))
+    {
+      if (!isdigit(*value & 255))
+      {
+        fprintf(stderr, "ippserver: Bad MaxTransforms value \"%s\" on line %d of \"%s\".\n", value, linenum, conf);
+        status = 0;
+        break;
+      }
+
+      MaxTransforms = atoi(value);
+    }
+    else if (!strcasecmp(line, "RateLimit"))
+    {
+      char		name[16];	/* Limit class name */
+      double		rate,		/* Requests per second */
+			burst = 0.0;	/* Maximum burst */
+      server_limit_t	limit;		/* Limit class */
+
+      if (sscanf(value, "%15s%lf%lf", name, &rate, &burst) < 2 || rate < 0.0 || burst < 0.0)
+      {
+        fprintf(stderr, "ippserver: Bad RateLimit value \"%s\" on line %d of \"%s\".\n", value, linenum, conf);
+        status = 0;
+        break;
+      }
+
+      if (!strcasecmp(name, "admin"))
+      {
+        limit = SERVER_LIMIT_ADMIN;
+      }
+      else if (!strcasecmp(name, "job"))
+      {
+        limit = SERVER_LIMIT_JOB;
+      }
+      else if (!strcasecmp(name, "read"))
+      {
+        limit = SERVER_LIMIT_READ;
+      }
+      else
+      {
+        fprintf(stderr, "ippserver: Unknown RateLimit class \"%s\" on line %d of \"%s\".\n", name, linenum, conf);
+        status = 0;
+        break;
+      }
+
+      if (burst < 1.0)
+        burst = rate < 1.0 ? 1.0 : rate;
+
+      RateLimits[limit].rate  = rate;
+      RateLimits[limit].burst = burst;
+    }
     else if (!strcasecmp(line, "SpoolDir"))
     {
       if (access(value, R_OK))
@@ -2834,6 +3764,24 @@ load_system(const char *conf)		/* I - Configuration file */
 
       SpoolDirectory = strdup(value);
     }
+    else if (!strcasecmp(line, "SpoolMemory"))
+    {
+      if (!get_size(value, &SpoolMemory))
+      {
+        fprintf(stderr, "ippserver: Bad SpoolMemory value \"%s\" on line %d of \"%s\".\n", value, linenum, conf);
+        status = 0;
+        break;
+      }
+    }
+    else if (!strcasecmp(line, "SpoolMemoryThreshold"))
+    {
+      if (!get_size(value, &SpoolMemoryThreshold))
+      {
+        fprintf(stderr, "ippserver: Bad SpoolMemoryThreshold value \"%s\" on line %d of \"%s\".\n", value, linenum, conf);
+        status = 0;
+        break;
+      }
+    }
     else if (!strcasecmp(line, "StateDir"))
     {
       if (access(value, R_OK) && mkdir(value, 0700))
@@ -2867,6 +3815,31 @@ load_system(const char *conf)		/* I - Configuration file */
 
       SubscriptionPrivacyScope = strdup(value);
     }
+    else if (!strcasecmp(line, "TransformCPUs"))
+    {
+      if (strspn(value, "0123456789,-") != strlen(value) || !isdigit(*value & 255))
+      {
+        fprintf(stderr, "ippserver: Bad TransformCPUs value \"%s\" on line %d of \"%s\".\n", value, linenum, conf);
+        status = 0;
+        break;
+      }
+
+      if (TransformCPUs)
+        free(TransformCPUs);
+
+      TransformCPUs = strdup(value);
+    }
+    else if (!strcasecmp(line, "TransformNice"))
+    {
+      if (!isdigit(*value & 255) || atoi(value) > 19)
+      {
+        fprintf(stderr, "ippserver: Bad TransformNice value \"%s\" on line %d of \"%s\".\n", value, linenum, conf);
+        status = 0;
+        break;
+      }
+
+      TransformNice = atoi(value);
+    }
   }
 
   cupsFileClose(fp);
@@ -3035,15 +4008,144 @@ print_ipp_attr(
 
 
 /*
- * 'save_printer()' - Save printer configuration information to disk.
+ * 'queue_printers()' - Queue the printers in a configuration directory for
+ *                      loading.
+ */
+
+static void
+queue_printers(const char *directory,	/* I - Configuration directory */
+               const char *type)	/* I - Printer type ("print" or "print3d") */
+{
+  cups_dir_t		*dir;		/* Directory pointer */
+  cups_dentry_t		*dent;		/* Directory entry */
+  char			confdir[1024],	/* Configuration directory */
+			filename[1024],	/* Configuration file */
+			iconname[1024],	/* Icon file */
+			resource[1024],	/* Resource path */
+			*ptr;		/* Pointer into filename */
+  server_pload_t	*pload;		/* Printer to load */
+
+
+  if (StateDirectory)
+  {
+   /*
+    * See if we have saved printer state information...
+    */
+
+    snprintf(confdir, sizeof(confdir), "%s/%s", StateDirectory, type);
+
+    if (access(confdir, 0))
+      snprintf(confdir, sizeof(confdir), "%s/%s", directory, type);
+  }
+  else
+    snprintf(confdir, sizeof(confdir), "%s/%s", directory, type);
+
+  if ((dir = cupsDirOpen(confdir)) == NULL)
+    return;
+
+  serverLog(SERVER_LOGLEVEL_INFO, "Loading %s from '%s'.", strcmp(type, "print3d") ? "printers" : "3D printers", confdir);
+
+  if (!load_queue)
+    load_queue = cupsArrayNew(NULL, NULL, NULL, 0, NULL, NULL);
+
+  while ((dent = cupsDirRead(dir)) != NULL)
+  {
+    if ((ptr = strrchr(dent->filename, '.')) == NULL)
+      ptr = "";
+
+    if (!strcmp(ptr, ".conf"))
+    {
+     /*
+      * Queue the conf file, with any associated icon image.
+      */
+
+      snprintf(filename, sizeof(filename), "%s/%s", confdir, dent->filename);
+      *ptr = '\0';
+
+      if ((pload = calloc(1, sizeof(server_pload_t))) == NULL)
+        break;
+
+      snprintf(resource, sizeof(resource), "/ipp/%s/%s", type, dent->filename);
+
+      pload->filename = strdup(filename);
+      pload->name     = strdup(dent->filename);
+      pload->resource = strdup(resource);
+
+      snprintf(iconname, sizeof(iconname), "%s/%s.png", confdir, dent->filename);
+      if (!access(iconname, R_OK))
+      {
+        pload->icon = strdup(iconname);
+      }
+      else if (StateDirectory)
+      {
+	snprintf(iconname, sizeof(iconname), "%s/%s/%s.png", directory, type, dent->filename);
+	if (!access(iconname, R_OK))
+	  pload->icon = strdup(iconname);
+      }
+
+      cupsArrayAdd(load_queue, pload);
+    }
+    else if (strcmp(ptr, ".png") && strcmp(ptr, ".snapshot") && strcmp(ptr, ".strings"))
+      serverLog(SERVER_LOGLEVEL_INFO, "Skipping \"%s\".", dent->filename);
+  }
+
+  cupsDirClose(dir);
+}
+
+
+/*
+ * 'register_printers()' - Register printers with DNS-SD.
+ *
+ * Printers created while loading are registered in batches so that the
+ * printer list is not locked for the whole registration.
  */
 
 static void
+register_printers(void)
+{
+  size_t		i,		/* Current printer */
+			num_batch;	/* Number of printers in batch */
+  server_printer_t	*printer;	/* Current printer */
+
+
+  if (!DNSSDEnabled)
+    return;
+
+  for (i = 0;;)
+  {
+    cupsRWLockRead(&PrintersRWLock);
+
+    for (num_batch = 0; num_batch < REGISTER_BATCH && (printer = (server_printer_t *)cupsArrayGetElement(Printers, i)) != NULL; i ++)
+    {
+      if (printer->dns_sd_service)
+        continue;
+
+      num_batch ++;
+
+      if (!serverRegisterPrinter(printer))
+        serverLog(SERVER_LOGLEVEL_ERROR, "Unable to register printer '%s' with DNS-SD.", printer->name);
+    }
+
+    cupsRWUnlock(&PrintersRWLock);
+
+    if (num_batch < REGISTER_BATCH)
+      break;
+  }
+}
+
+
+/*
+ * 'save_printer()' - Save printer configuration information to disk.
+ */
+
+static bool				/* O - `true` on success, `false` on error */
 save_printer(
     server_printer_t *printer,		/* I - Printer */
     const char       *directory)	/* I - Directory for conf files */
 {
-  char		filename[1024];		/* Filename */
+  char		filename[1024],		/* Filename */
+		tempfile[1024];		/* Temporary filename */
+  bool		ret = false;		/* Return value */
   cups_file_t	*fp;			/* File pointer */
   ipp_attribute_t *attr;		/* Current attribute */
   const char	*aname;			/* Attribute name */
@@ -3058,8 +4160,15 @@ save_printer(
 
   cupsRWLockRead(&printer->rwlock);
 
+ /*
+  * Write to a temporary file and then rename it so that a crash or full disk
+  * never leaves a partial configuration file...
+  */
+
   snprintf(filename, sizeof(filename), "%s/%s.conf", directory, printer->name);
-  if ((fp = cupsFileOpen(filename, "w")) != NULL)
+  snprintf(tempfile, sizeof(tempfile), "%s/%s.conf.N", directory, printer->name);
+
+  if ((fp = cupsFileOpen(tempfile, "w")) != NULL)
   {
     cupsFilePrintf(fp, "# Written by ippserver on %s\n", httpGetDateString(time(NULL), datestr, sizeof(datestr)));
 
@@ -3077,7 +4186,7 @@ save_printer(
     if (printer->pinfo.device_uri)
       cupsFilePutConf(fp, "DeviceURI", printer->pinfo.device_uri);
 
-    cupsFilePrintf(fp, "InitialState %d %d %u", printer->is_accepting, (int)printer->state, printer->state_reasons);
+    cupsFilePrintf(fp, "InitialState %d %d %u\n", printer->is_accepting, (int)printer->state, printer->state_reasons);
 
     if (printer->pinfo.output_format)
       cupsFilePutConf(fp, "OutputFormat", printer->pinfo.output_format);
@@ -3103,6 +4212,9 @@ save_printer(
       cupsFilePuts(fp, "}\n");
     }
 
+    if (printer->pinfo.streaming)
+      cupsFilePutConf(fp, "Streaming", "Yes");
+
     for (lang = (server_lang_t *)cupsArrayGetFirst(printer->pinfo.strings); lang; lang = (server_lang_t *)cupsArrayGetNext(printer->pinfo.strings))
       cupsFilePrintf(fp, "Strings %s %s\n", lang->lang, lang->resource->filename);
 
@@ -3121,10 +4233,220 @@ save_printer(
       print_ipp_attr(fp, attr, 0);
     }
 
-    cupsFileClose(fp);
+    if (!cupsFileClose(fp))
+      serverLog(SERVER_LOGLEVEL_ERROR, "Unable to write \"%s\": %s", tempfile, strerror(errno));
+    else if (rename(tempfile, filename))
+      serverLog(SERVER_LOGLEVEL_ERROR, "Unable to rename \"%s\" to \"%s\": %s", tempfile, filename, strerror(errno));
+    else
+      ret = true;
+
+    if (!ret)
+      unlink(tempfile);
   }
+  else
+    serverLog(SERVER_LOGLEVEL_ERROR, "Unable to create \"%s\": %s", tempfile, strerror(errno));
+
+  if (ret)
+    save_snapshot(printer, directory);
 
   cupsRWUnlock(&printer->rwlock);
+
+  return (ret);
+}
+
+
+/*
+ * 'save_snapshot()' - Save a binary snapshot of a printer's configuration.
+ *
+ * The snapshot holds the same information as the .conf file, encoded as an
+ * IPP message with a 16-byte header containing the magic/version string, the
+ * length of the IPP data, and a checksum.  The printer must be locked by the
+ * caller.
+ */
+
+static void
+save_snapshot(
+    server_printer_t *printer,		/* I - Printer */
+    const char       *directory)	/* I - Directory for snapshot files */
+{
+#ifndef _WIN32
+  char			filename[1024],	/* Snapshot file */
+			tempfile[1024];	/* Temporary file */
+  ipp_t			*ipp,		/* Snapshot attributes */
+			*col;		/* Collection value */
+  ipp_attribute_t	*attr,		/* Current attribute */
+			*list = NULL;	/* List attribute */
+  const char		*aname;		/* Attribute name */
+  struct group		*grp;		/* Group information */
+  server_icc_t		*icc;		/* Current ICC profile */
+  server_lang_t		*lang;		/* Current language */
+  server_device_t	*device;	/* Current device */
+  int			state[3];	/* InitialState values */
+  unsigned char		*data,		/* Encoded IPP data */
+			header[SNAPSHOT_HEADER];
+					/* Snapshot header */
+  size_t		datalen;	/* Length of IPP data */
+  uint32_t		checksum;	/* Checksum of IPP data */
+  cups_file_t		*fp;		/* Snapshot file */
+  bool			ret = false;	/* Did the snapshot get written? */
+
+
+  ipp = ippNew();
+
+  if (printer->pinfo.print_group != SERVER_GROUP_NONE && (grp = getgrgid(printer->pinfo.print_group)) != NULL)
+    ippAddString(ipp, IPP_TAG_OPERATION, IPP_TAG_NAME, "auth-print-group", NULL, grp->gr_name);
+  if (printer->pinfo.proxy_group != SERVER_GROUP_NONE && (grp = getgrgid(printer->pinfo.proxy_group)) != NULL)
+    ippAddString(ipp, IPP_TAG_OPERATION, IPP_TAG_NAME, "auth-proxy-group", NULL, grp->gr_name);
+  if (printer->pinfo.command)
+    ippAddString(ipp, IPP_TAG_OPERATION, IPP_TAG_TEXT, "command", NULL, printer->pinfo.command);
+  if (printer->pinfo.device_uri)
+    ippAddString(ipp, IPP_TAG_OPERATION, IPP_TAG_TEXT, "device-uri", NULL, printer->pinfo.device_uri);
+
+  state[0] = printer->is_accepting;
+  state[1] = (int)printer->state;
+  state[2] = (int)printer->state_reasons;
+  ippAddIntegers(ipp, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "initial-state", 3, state);
+
+  if (printer->pinfo.max_devices)
+    ippAddInteger(ipp, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "max-output-devices", printer->pinfo.max_devices);
+
+  for (device = (server_device_t *)cupsArrayGetFirst(printer->pinfo.devices), list = NULL; device; device = (server_device_t *)cupsArrayGetNext(printer->pinfo.devices))
+  {
+    if (list)
+      ippSetString(ipp, &list, ippGetCount(list), device->uuid);
+    else
+      list = ippAddString(ipp, IPP_TAG_OPERATION, IPP_TAG_TEXT, "output-device", NULL, device->uuid);
+  }
+
+  if (printer->pinfo.output_format)
+    ippAddString(ipp, IPP_TAG_OPERATION, IPP_TAG_TEXT, "output-format", NULL, printer->pinfo.output_format);
+
+  for (icc = (server_icc_t *)cupsArrayGetFirst(printer->pinfo.profiles), list = NULL; icc; icc = (server_icc_t *)cupsArrayGetNext(printer->pinfo.profiles))
+  {
+    col = ippNew();
+
+    for (attr = ippGetFirstAttribute(icc->attrs); attr; attr = ippGetNextAttribute(icc->attrs))
+    {
+      if ((aname = ippGetName(attr)) != NULL && strcmp(aname, "profile-uri"))
+        ippCopyAttribute(col, attr, true);
+    }
+
+    ippAddString(col, IPP_TAG_ZERO, IPP_TAG_TEXT, "profile-file", NULL, icc->resource->filename);
+
+    if (list)
+      ippSetCollection(ipp, &list, ippGetCount(list), col);
+    else
+      list = ippAddCollection(ipp, IPP_TAG_OPERATION, "profile", col);
+
+    ippDelete(col);
+  }
+
+  if (printer->pinfo.streaming)
+    ippAddBoolean(ipp, IPP_TAG_OPERATION, "streaming", 1);
+
+  for (lang = (server_lang_t *)cupsArrayGetFirst(printer->pinfo.strings), list = NULL; lang; lang = (server_lang_t *)cupsArrayGetNext(printer->pinfo.strings))
+  {
+    col = ippNew();
+
+    ippAddString(col, IPP_TAG_ZERO, IPP_TAG_TEXT, "strings-file", NULL, lang->resource->filename);
+    ippAddString(col, IPP_TAG_ZERO, IPP_TAG_TEXT, "strings-language", NULL, lang->lang);
+
+    if (list)
+      ippSetCollection(ipp, &list, ippGetCount(list), col);
+    else
+      list = ippAddCollection(ipp, IPP_TAG_OPERATION, "strings", col);
+
+    ippDelete(col);
+  }
+
+  ippAddBoolean(ipp, IPP_TAG_OPERATION, "web-forms", (char)printer->pinfo.web_forms);
+
+  for (attr = ippGetFirstAttribute(printer->pinfo.attrs); attr; attr = ippGetNextAttribute(printer->pinfo.attrs))
+  {
+    if (ippGetGroupTag(attr) != IPP_TAG_PRINTER || (aname = ippGetName(attr)) == NULL || !attr_cb(NULL, NULL, aname))
+      continue;
+
+    ippCopyAttribute(ipp, attr, true);
+  }
+
+  data = serverPackAttributes(ipp, &datalen);
+  ippDelete(ipp);
+
+  if (!data)
+    return;
+
+ /*
+  * Write the header and data to a temporary file and rename it...
+  */
+
+  checksum = serverHashString((const char *)data, (ssize_t)datalen, false);
+
+  memcpy(header, SNAPSHOT_MAGIC, 8);
+  header[8]  = (unsigned char)(datalen >> 24);
+  header[9]  = (unsigned char)(datalen >> 16);
+  header[10] = (unsigned char)(datalen >> 8);
+  header[11] = (unsigned char)datalen;
+  header[12] = (unsigned char)(checksum >> 24);
+  header[13] = (unsigned char)(checksum >> 16);
+  header[14] = (unsigned char)(checksum >> 8);
+  header[15] = (unsigned char)checksum;
+
+  snprintf(filename, sizeof(filename), "%s/%s.snapshot", directory, printer->name);
+  snprintf(tempfile, sizeof(tempfile), "%s/%s.snapshot.N", directory, printer->name);
+
+  if ((fp = cupsFileOpen(tempfile, "w")) != NULL)
+  {
+    ret = cupsFileWrite(fp, (char *)header, sizeof(header)) && cupsFileWrite(fp, (char *)data, datalen);
+
+    if (!cupsFileClose(fp))
+      ret = false;
+
+    if (ret && rename(tempfile, filename))
+      ret = false;
+
+    if (!ret)
+    {
+      serverLog(SERVER_LOGLEVEL_ERROR, "Unable to save printer snapshot \"%s\": %s", filename, strerror(errno));
+      unlink(tempfile);
+      unlink(filename);
+    }
+  }
+
+  free(data);
+
+#else
+  (void)printer;
+  (void)directory;
+#endif /* !_WIN32 */
+}
+
+
+/*
+ * 'save_system()' - Save the system state once changes have settled.
+ *
+ * This is the main entry for the background save thread.
+ */
+
+static void *				/* O - Thread exit status */
+save_system(void *data)			/* I - Thread data (unused) */
+{
+  time_t	delay;			/* Time to wait */
+
+
+  (void)data;
+
+  cupsMutexLock(&save_mutex);
+
+  while ((delay = save_time - time(NULL)) > 0)
+    cupsCondWait(&save_cond, &save_mutex, (double)delay);
+
+  save_active = false;
+
+  cupsMutexUnlock(&save_mutex);
+
+  serverSaveSystem(false);
+
+  return (NULL);
 }
 
 
@@ -3144,8 +4466,6 @@ token_cb(ipp_file_t     *f,		/* I - IPP file data */
 #ifndef _WIN32
   if (!strcasecmp(token, "AuthPrintGroup"))
   {
-    struct group	*group;		/* Group information */
-
     if (!ippFileReadToken(f, temp, sizeof(temp)))
     {
       serverLog(SERVER_LOGLEVEL_ERROR, "Missing AuthPrintGroup value on line %d of '%s'.", ippFileGetLineNumber(f), ippFileGetFilename(f));
@@ -3158,20 +4478,14 @@ token_cb(ipp_file_t     *f,		/* I - IPP file data */
     {
       pinfo->print_group = getgid();
     }
-    else if ((group = getgrnam(value)) == NULL)
+    else if (!get_group(value, &pinfo->print_group))
     {
       serverLog(SERVER_LOGLEVEL_ERROR, "Unknown AuthPrintGroup \"%s\" on line %d of '%s'.", value, ippFileGetLineNumber(f), ippFileGetFilename(f));
       return (0);
     }
-    else
-    {
-      pinfo->print_group = group->gr_gid;
-    }
   }
   else if (!strcasecmp(token, "AuthProxyGroup"))
   {
-    struct group	*group;		/* Group information */
-
     if (!ippFileReadToken(f, temp, sizeof(temp)))
     {
       serverLog(SERVER_LOGLEVEL_ERROR, "Missing AuthProxyGroup value on line %d of '%s'.", ippFileGetLineNumber(f), ippFileGetFilename(f));
@@ -3184,15 +4498,11 @@ token_cb(ipp_file_t     *f,		/* I - IPP file data */
     {
       pinfo->proxy_group = getgid();
     }
-    else if ((group = getgrnam(value)) == NULL)
+    else if (!get_group(value, &pinfo->proxy_group))
     {
       serverLog(SERVER_LOGLEVEL_ERROR, "Unknown AuthProxyGroup \"%s\" on line %d of '%s'.", value, ippFileGetLineNumber(f), ippFileGetFilename(f));
       return (0);
     }
-    else
-    {
-      pinfo->proxy_group = group->gr_gid;
-    }
   }
   else
 #endif /* !_WIN32 */
@@ -3304,8 +4614,8 @@ token_cb(ipp_file_t     *f,		/* I - IPP file data */
   }
   else if (!strcasecmp(token, "Profile"))
   {
-    server_icc_t	icc;		/* ICC profile data */
-    char		filename[1024];	/* ICC file */
+    ipp_t	*attrs;			/* ICC profile attributes */
+    char	filename[1024];		/* ICC file */
 
     if (!ippFileReadToken(f, temp, sizeof(temp)))
     {
@@ -3323,26 +4633,13 @@ token_cb(ipp_file_t     *f,		/* I - IPP file data */
 
     ippFileExpandVars(f, filename, temp, sizeof(filename));
 
-    if ((icc.attrs = ippFileReadCollection(f)) == NULL)
+    if ((attrs = ippFileReadCollection(f)) == NULL)
       return (0);
 
-    if ((icc.resource = serverFindResourceByFilename(filename)) == NULL)
-      icc.resource = serverCreateResource(NULL, filename, "application/icc", value, value, "static-icc-profile", NULL);
-
-    ippAddString(icc.attrs, IPP_TAG_PRINTER, IPP_TAG_NAME, "profile-name", NULL, value);
-    httpAssembleURI(HTTP_URI_CODING_ALL, temp, sizeof(temp), Encryption != HTTP_ENCRYPTION_NEVER ? SERVER_HTTPS_SCHEME : SERVER_HTTP_SCHEME, NULL, ServerName, DefaultPort, icc.resource->resource);
-    ippAddString(icc.attrs, IPP_TAG_PRINTER, IPP_TAG_URI, "profile-uri", NULL, temp);
-
-    if (!pinfo->profiles)
-      pinfo->profiles = cupsArrayNew(NULL, NULL, NULL, 0, (cups_acopy_cb_t)copy_icc, (cups_afree_cb_t)free_icc);
-
-    cupsArrayAdd(pinfo->profiles, &icc);
-
-    serverLog(SERVER_LOGLEVEL_DEBUG, "Added ICC profile \"%s\".", filename);
+    add_profile(pinfo, value, filename, attrs);
   }
   else if (!strcasecmp(token, "Strings"))
   {
-    server_lang_t lang;			/* New localization */
     char	stringsfile[1024];	/* Strings filename */
 
     if (!ippFileReadToken(f, temp, sizeof(temp)))
@@ -3361,16 +4658,17 @@ token_cb(ipp_file_t     *f,		/* I - IPP file data */
 
     ippFileExpandVars(f, stringsfile, temp, sizeof(stringsfile));
 
-    lang.lang = value;
-    if ((lang.resource = serverFindResourceByFilename(stringsfile)) == NULL)
-      lang.resource = serverCreateResource(NULL, stringsfile, "text/strings", value, value, "static-strings", value);
-
-    if (!pinfo->strings)
-      pinfo->strings = cupsArrayNew((cups_array_cb_t)compare_lang, NULL, NULL, 0, (cups_acopy_cb_t)copy_lang, (cups_afree_cb_t)free_lang);
-
-    cupsArrayAdd(pinfo->strings, &lang);
+    add_strings(pinfo, value, stringsfile);
+  }
+  else if (!strcasecmp(token, "Streaming"))
+  {
+    if (!ippFileReadToken(f, temp, sizeof(temp)))
+    {
+      serverLog(SERVER_LOGLEVEL_ERROR, "Missing Streaming value on line %d of '%s'.", ippFileGetLineNumber(f), ippFileGetFilename(f));
+      return (0);
+    }
 
-    serverLog(SERVER_LOGLEVEL_DEBUG, "Added strings file \"%s\" for language \"%s\".", stringsfile, value);
+    pinfo->streaming = !strcasecmp(temp, "yes") || !strcasecmp(temp, "on") || !strcasecmp(temp, "true");
   }
   else if (!strcasecmp(token, "WebForms"))
   {
@@ -3390,3 +4688,35 @@ token_cb(ipp_file_t     *f,		/* I - IPP file data */
 
   return (1);
 }
+
+
+/*
+ * 'wgs84_distance()' - Approximate the distance between two positions.
+ *
+ * Note: This calculation is not meant to be used for navigation or other
+ * serious uses of WGS-84 coordinates.  Rather, we are simply calculating the
+ * angular distance between the two coordinates on a sphere (vs. the WGS-84
+ * ellipsoid) and then multiplying by an approximate number of meters between
+ * each degree of latitude and longitude.  The error bars on this calculation
+ * are reasonable for local comparisons (<1m error over 1 degree of latitude
+ * change) and completely unreasonable for distant comparisons.  You have been
+ * warned! :)
+ */
+
+static double				/* O - Distance in meters */
+wgs84_distance(double a_lat,		/* I - First latitude */
+               double a_lon,		/* I - First longitude */
+               double a_alt,		/* I - First altitude */
+               double b_lat,		/* I - Second latitude */
+               double b_lon,		/* I - Second longitude */
+               double b_alt)		/* I - Second altitude */
+{
+  double	d_lat, d_lon, d_alt;	/* Difference in positions */
+
+
+  d_lat = M_PER_DEG * (a_lat - b_lat);
+  d_lon = M_PER_DEG * cos((a_lat + b_lat) * M_PI / 360.0) * (a_lon - b_lon);
+  d_alt = a_alt - b_alt;
+
+  return (sqrt(d_lat * d_lat + d_lon * d_lon + d_alt * d_alt));
+}
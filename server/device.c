@@ -163,6 +163,8 @@ serverUpdateDeviceAttributesNoLock(
   ippDelete(printer->dev_attrs);
   printer->dev_attrs   = dev_attrs;
   printer->config_time = time(NULL);
+
+  serverUpdatePrinterSupportedNoLock(printer);
 }
 
 
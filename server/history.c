@@ -0,0 +1,479 @@
+/*
+ * Job history archive for sample IPP server implementation.
+ *
+ * Copyright © 2026 by the Printer Working Group
+ *
+ * Licensed under Apache License v2.0.  See the file "LICENSE" for more
+ * information.
+ *
+ * Completed jobs that are removed from a printer's in-memory job history are
+ * appended to an archive in the state directory.  The archive consists of two
+ * files per printer:
+ *
+ *   NAME.jobs      IPP-encoded job records, appended in completion order
+ *   NAME.jobindex  Fixed-size index entries sorted by job-id, memory-mapped
+ *
+ * Index entries hold the job-id, job-state, completion time, and a hash of the
+ * job-originating-user-name so that Get-Jobs can page through the archive
+ * without decoding records that don't match.  The printer lock protects the
+ * archive: appends require the write lock and reads the read lock.
+ */
+
+#include "ippserver.h"
+#ifndef _WIN32
+#  include <stdint.h>
+#  include <sys/mman.h>
+#endif /* !_WIN32 */
+
+
+#ifndef _WIN32
+/*
+ * Constants...
+ */
+
+#  define SERVER_HISTORY_MAGIC	"IPPJOBS1"
+					/* Index file magic */
+#  define SERVER_HISTORY_ALLOC	1024	/* Index entries to allocate at a time */
+
+
+/*
+ * Local types...
+ */
+
+typedef struct server_hentry_s		/**** Archive index entry ****/
+{
+  int32_t		job_id;		/* job-id */
+  int32_t		state;		/* job-state */
+  uint32_t		user_hash;	/* Hash of job-originating-user-name */
+  uint32_t		length;		/* Length of job record */
+  int64_t		completed;	/* time-at-completed */
+  uint64_t		offset;		/* Offset of job record */
+} server_hentry_t;
+
+typedef struct server_hheader_s		/**** Archive index header ****/
+{
+  char			magic[8];	/* SERVER_HISTORY_MAGIC */
+  uint64_t		count;		/* Number of entries */
+  uint64_t		reserved[2];	/* Reserved for future use */
+} server_hheader_t;
+
+struct server_history_s			/**** Job history archive ****/
+{
+  int			data_fd,	/* Job records file */
+			index_fd;	/* Index file */
+  off_t			data_size;	/* Size of job records file */
+  server_hheader_t	*header;	/* Mapped index file */
+  server_hentry_t	*entries;	/* Index entries */
+  size_t		alloc_entries,	/* Allocated index entries */
+			map_size;	/* Size of mapped index file */
+};
+
+
+/*
+ * Local functions...
+ */
+
+static ipp_t		*create_record(server_job_t *job);
+static bool		map_index(server_history_t *history, size_t alloc_entries);
+#endif /* !_WIN32 */
+
+
+/*
+ * 'serverArchiveJobNoLock()' - Append a completed job to the printer's job
+ *                              history archive.
+ *
+ * The caller must hold the printer write lock.
+ */
+
+void
+serverArchiveJobNoLock(
+    server_job_t *job)			/* I - Job */
+{
+#ifndef _WIN32
+  server_history_t	*history = job->printer->history;
+					/* Job history archive */
+  ipp_t			*record;	/* Job record */
+  unsigned char		*packed;	/* Packed job record */
+  size_t		packedlen,	/* Length of packed job record */
+			count,		/* Number of index entries */
+			pos;		/* Position of new entry */
+  ssize_t		bytes;		/* Bytes written */
+  server_hentry_t	*entry;		/* New index entry */
+
+
+  if (!history || job->state < IPP_JSTATE_CANCELED)
+    return;
+
+ /*
+  * Append the job record...
+  */
+
+  cupsRWLockRead(&job->rwlock);
+  record = create_record(job);
+  cupsRWUnlock(&job->rwlock);
+
+  packed = serverPackAttributes(record, &packedlen);
+  ippDelete(record);
+
+  if (!packed)
+  {
+    serverLogJob(SERVER_LOGLEVEL_ERROR, job, "Unable to archive job: %s", cupsGetErrorString());
+    return;
+  }
+
+  if ((bytes = pwrite(history->data_fd, packed, packedlen, history->data_size)) != (ssize_t)packedlen)
+  {
+    serverLogJob(SERVER_LOGLEVEL_ERROR, job, "Unable to archive job: %s", bytes < 0 ? strerror(errno) : "Short write.");
+    free(packed);
+    return;
+  }
+
+  free(packed);
+
+ /*
+  * Insert the index entry, keeping the index sorted by job-id.  Jobs complete
+  * in roughly job-id order so new entries are almost always at the end...
+  */
+
+  if ((count = (size_t)history->header->count) >= history->alloc_entries && !map_index(history, history->alloc_entries + SERVER_HISTORY_ALLOC))
+  {
+    serverLogJob(SERVER_LOGLEVEL_ERROR, job, "Unable to grow job history index: %s", strerror(errno));
+    return;
+  }
+
+  for (pos = count; pos > 0 && history->entries[pos - 1].job_id > job->id; pos --);
+
+  if (pos < count)
+    memmove(history->entries + pos + 1, history->entries + pos, (count - pos) * sizeof(server_hentry_t));
+
+  entry = history->entries + pos;
+
+  entry->job_id    = job->id;
+  entry->state     = (int32_t)job->state;
+  entry->user_hash = job->username ? serverHashString(job->username, -1, true) : 0;
+  entry->length    = (uint32_t)packedlen;
+  entry->completed = (int64_t)job->completed;
+  entry->offset    = (uint64_t)history->data_size;
+
+  history->data_size += (off_t)packedlen;
+  history->header->count ++;
+
+  serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Archived job (%u bytes).", (unsigned)packedlen);
+#else
+  (void)job;
+#endif /* !_WIN32 */
+}
+
+
+/*
+ * 'serverCloseHistory()' - Close a printer's job history archive.
+ */
+
+void
+serverCloseHistory(
+    server_printer_t *printer)		/* I - Printer */
+{
+#ifndef _WIN32
+  server_history_t	*history = printer->history;
+					/* Job history archive */
+
+
+  if (!history)
+    return;
+
+  printer->history = NULL;
+
+  if (history->header)
+    munmap(history->header, history->map_size);
+
+  close(history->data_fd);
+  close(history->index_fd);
+
+  free(history);
+#else
+  (void)printer;
+#endif /* !_WIN32 */
+}
+
+
+/*
+ * 'serverOpenHistory()' - Open a printer's job history archive.
+ *
+ * The archive is only used when "ArchiveJobs" is enabled and a state directory
+ * is configured.
+ */
+
+void
+serverOpenHistory(
+    server_printer_t *printer)		/* I - Printer */
+{
+#ifndef _WIN32
+  server_history_t	*history;	/* Job history archive */
+  char			filename[1024];	/* Archive filename */
+  struct stat		fileinfo;	/* Archive file information */
+  size_t		count;		/* Number of index entries */
+
+
+  if (!ArchiveJobs || !StateDirectory || printer->history)
+    return;
+
+  if ((history = (server_history_t *)calloc(1, sizeof(server_history_t))) == NULL)
+  {
+    serverLogPrinter(SERVER_LOGLEVEL_ERROR, printer, "Unable to allocate memory for job history: %s", strerror(errno));
+    return;
+  }
+
+  history->index_fd = -1;
+
+  snprintf(filename, sizeof(filename), "%s/%s.jobs", StateDirectory, printer->name);
+  if ((history->data_fd = open(filename, O_RDWR | O_CREAT | O_BINARY | O_NOFOLLOW | O_CLOEXEC, 0600)) < 0 || fstat(history->data_fd, &fileinfo))
+  {
+    serverLogPrinter(SERVER_LOGLEVEL_ERROR, printer, "Unable to open job history \"%s\": %s", filename, strerror(errno));
+    goto error;
+  }
+
+  history->data_size = fileinfo.st_size;
+
+  snprintf(filename, sizeof(filename), "%s/%s.jobindex", StateDirectory, printer->name);
+  if ((history->index_fd = open(filename, O_RDWR | O_CREAT | O_BINARY | O_NOFOLLOW | O_CLOEXEC, 0600)) < 0 || fstat(history->index_fd, &fileinfo))
+  {
+    serverLogPrinter(SERVER_LOGLEVEL_ERROR, printer, "Unable to open job history index \"%s\": %s", filename, strerror(errno));
+    goto error;
+  }
+
+  if (fileinfo.st_size < (off_t)sizeof(server_hheader_t))
+  {
+   /*
+    * New index file...
+    */
+
+    if (!map_index(history, SERVER_HISTORY_ALLOC))
+    {
+      serverLogPrinter(SERVER_LOGLEVEL_ERROR, printer, "Unable to create job history index \"%s\": %s", filename, strerror(errno));
+      goto error;
+    }
+
+    memcpy(history->header->magic, SERVER_HISTORY_MAGIC, sizeof(history->header->magic));
+    history->header->count = 0;
+  }
+  else if (!map_index(history, ((size_t)fileinfo.st_size - sizeof(server_hheader_t)) / sizeof(server_hentry_t)))
+  {
+    serverLogPrinter(SERVER_LOGLEVEL_ERROR, printer, "Unable to map job history index \"%s\": %s", filename, strerror(errno));
+    goto error;
+  }
+  else if (memcmp(history->header->magic, SERVER_HISTORY_MAGIC, sizeof(history->header->magic)) || history->header->count > history->alloc_entries)
+  {
+    serverLogPrinter(SERVER_LOGLEVEL_ERROR, printer, "Bad job history index \"%s\".", filename);
+    goto error;
+  }
+
+ /*
+  * Job IDs must not be reused, so start numbering after the last archived
+  * job...
+  */
+
+  if ((count = (size_t)history->header->count) > 0 && printer->next_job_id <= history->entries[count - 1].job_id)
+    printer->next_job_id = history->entries[count - 1].job_id + 1;
+
+  printer->history = history;
+
+  serverLogPrinter(SERVER_LOGLEVEL_DEBUG, printer, "Opened job history with %u archived jobs.", (unsigned)count);
+  return;
+
+ /*
+  * If we get here something went wrong...
+  */
+
+  error:
+
+  if (history->header)
+    munmap(history->header, history->map_size);
+  if (history->data_fd >= 0)
+    close(history->data_fd);
+  if (history->index_fd >= 0)
+    close(history->index_fd);
+
+  free(history);
+#else
+  (void)printer;
+#endif /* !_WIN32 */
+}
+
+
+/*
+ * 'serverReadHistoryNoLock()' - Read the next matching job from a printer's job
+ *                               history archive.
+ *
+ * Jobs are returned in decreasing job-id order.  "last_id" is the job-id of
+ * the last index entry examined and should be 0 for the first call; since it
+ * does not depend on the number of archived jobs the caller may release the
+ * printer lock between calls.  The caller must hold the printer read lock and
+ * free the returned attributes with `ippDelete`.
+ */
+
+ipp_t *					/* O - Job attributes or `NULL` if none */
+serverReadHistoryNoLock(
+    server_printer_t *printer,		/* I  - Printer */
+    int              *last_id,		/* IO - Last job-id examined */
+    int              first_job_id,	/* I  - Lowest job-id to return */
+    const char       *username,		/* I  - Owner to match or `NULL` for any */
+    ipp_jstate_t     job_state,		/* I  - job-state to match */
+    int              job_comparison)	/* I  - Comparison: -1 for <=, 0 for ==, 1 for >= */
+{
+#ifndef _WIN32
+  server_history_t	*history = printer->history;
+					/* Job history archive */
+  size_t		left,		/* Left side of search */
+			right,		/* Right side of search */
+			current;	/* Current entry */
+  uint32_t		user_hash;	/* Hash of username */
+  server_hentry_t	*entry;		/* Current index entry */
+  unsigned char		*packed;	/* Packed job record */
+  ipp_t			*record;	/* Job record */
+  const char		*owner;		/* job-originating-user-name value */
+
+
+  if (!history)
+    return (NULL);
+
+  user_hash = username ? serverHashString(username, -1, true) : 0;
+
+ /*
+  * Find the first entry after the last one we looked at; the index is sorted
+  * by increasing job-id...
+  */
+
+  right = (size_t)history->header->count;
+
+  if (*last_id > 0)
+  {
+    for (left = 0; left < right;)
+    {
+      current = (left + right) / 2;
+
+      if (history->entries[current].job_id < *last_id)
+        left = current + 1;
+      else
+        right = current;
+    }
+  }
+
+  while (right > 0)
+  {
+    entry    = history->entries + (-- right);
+    *last_id = entry->job_id;
+
+    if (entry->job_id < first_job_id)
+      break;
+
+    if ((job_comparison < 0 && entry->state > (int32_t)job_state) || (job_comparison == 0 && entry->state != (int32_t)job_state) || (job_comparison > 0 && entry->state < (int32_t)job_state) || (username && entry->user_hash != user_hash))
+      continue;
+
+    if ((packed = malloc(entry->length)) == NULL)
+      break;
+
+    if (pread(history->data_fd, packed, entry->length, (off_t)entry->offset) != (ssize_t)entry->length)
+    {
+      serverLogPrinter(SERVER_LOGLEVEL_ERROR, printer, "Unable to read archived job #%d: %s", entry->job_id, strerror(errno));
+      free(packed);
+      continue;
+    }
+
+    record = serverUnpackAttributes(packed, entry->length);
+    free(packed);
+
+    if (!record)
+      continue;
+
+    if (username && ((owner = ippGetString(ippFindAttribute(record, "job-originating-user-name", IPP_TAG_NAME), 0, NULL)) == NULL || strcasecmp(username, owner)))
+    {
+      ippDelete(record);
+      continue;
+    }
+
+    return (record);
+  }
+
+#else
+  (void)printer;
+  (void)last_id;
+  (void)first_job_id;
+  (void)username;
+  (void)job_state;
+  (void)job_comparison;
+#endif /* !_WIN32 */
+
+  return (NULL);
+}
+
+
+#ifndef _WIN32
+/*
+ * 'create_record()' - Create the archived attributes for a job.
+ */
+
+static ipp_t *				/* O - Job record */
+create_record(server_job_t *job)	/* I - Job */
+{
+  ipp_t		*record,		/* Job record */
+		*packed;		/* Packed job attributes */
+
+
+  record = ippNew();
+
+  ippCopyAttributes(record, job->attrs, false, NULL, NULL);
+
+  if ((packed = serverUnpackAttributes(job->packed, job->packedlen)) != NULL)
+  {
+    ippCopyAttributes(record, packed, false, NULL, NULL);
+    ippDelete(packed);
+  }
+
+  if (job->completed)
+    ippAddDate(record, IPP_TAG_JOB, "date-time-at-completed", ippTimeToDate(job->completed));
+  if (job->processing)
+    ippAddDate(record, IPP_TAG_JOB, "date-time-at-processing", ippTimeToDate(job->processing));
+
+  ippAddInteger(record, IPP_TAG_JOB, IPP_TAG_INTEGER, "job-impressions", job->impressions);
+  ippAddInteger(record, IPP_TAG_JOB, IPP_TAG_INTEGER, "job-impressions-completed", job->impcompleted);
+  ippAddInteger(record, IPP_TAG_JOB, IPP_TAG_ENUM, "job-state", (int)job->state);
+  serverCopyJobStateReasons(record, IPP_TAG_JOB, job);
+  ippAddInteger(record, IPP_TAG_JOB, IPP_TAG_INTEGER, "number-of-documents", (int)cupsArrayGetCount(job->documents));
+
+  return (record);
+}
+
+
+/*
+ * 'map_index()' - Map (or remap) the index file with the given capacity.
+ */
+
+static bool				/* O - `true` on success, `false` on error */
+map_index(
+    server_history_t *history,		/* I - Job history archive */
+    size_t           alloc_entries)	/* I - Number of entries to allocate */
+{
+  size_t	map_size;		/* New size of mapping */
+  void		*map;			/* New mapping */
+  struct stat	fileinfo;		/* Index file information */
+
+
+  map_size = sizeof(server_hheader_t) + alloc_entries * sizeof(server_hentry_t);
+
+  if (fstat(history->index_fd, &fileinfo) || ((size_t)fileinfo.st_size < map_size && ftruncate(history->index_fd, (off_t)map_size)))
+    return (false);
+
+  if ((map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, history->index_fd, 0)) == MAP_FAILED)
+    return (false);
+
+  if (history->header)
+    munmap(history->header, history->map_size);
+
+  history->header        = (server_hheader_t *)map;
+  history->entries       = (server_hentry_t *)(history->header + 1);
+  history->alloc_entries = alloc_entries;
+  history->map_size      = map_size;
+
+  return (true);
+}
+#endif /* !_WIN32 */
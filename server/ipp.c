@@ -12,7 +12,6 @@
 #ifndef _WIN32
 #  include <grp.h>
 #endif /* !_WIN32 */
-#include <math.h>
 
 
 /*
@@ -36,12 +35,15 @@ typedef struct server_value_s		/**** Value Validation ****/
  * Local functions...
  */
 
+static void		abort_document(server_job_t *job, server_document_t *doc);
 static bool		apply_template_attributes(ipp_t *to, ipp_tag_t to_group_tag, server_resource_t *resource, ipp_attribute_t *supported, size_t num_values, server_value_t *values);
+static bool		authorize_job(server_client_t *client, server_job_t *job, const char *scope);
 static inline int	check_attribute(const char *name, cups_array_t *ra, cups_array_t *pa)
 {
   return ((!pa || !cupsArrayFind(pa, (void *)name)) && (!ra || cupsArrayFind(ra, (void *)name)));
 }
-static void		copy_doc_attributes(server_client_t *client, server_job_t *job, cups_array_t *ra, cups_array_t *pa);
+static bool		check_packed(const unsigned char *packed, size_t packedlen, cups_array_t *ra);
+static void		copy_doc_attributes(server_client_t *client, server_job_t *job, server_document_t *doc, cups_array_t *ra, cups_array_t *pa);
 static int		copy_document_uri(server_client_t *client, server_job_t *job, const char *uri);
 static void		copy_job_attributes(server_client_t *client, server_job_t *job, cups_array_t *ra, cups_array_t *pa);
 static void		copy_printer_attributes(server_client_t *client, server_printer_t *printer, cups_array_t *ra);
@@ -49,9 +51,13 @@ static void		copy_printer_state(ipp_t *ipp, server_printer_t *printer, cups_arra
 static void		copy_resource_attributes(server_client_t *client, server_resource_t *resource, cups_array_t *ra);
 static void		copy_subscription_attributes(server_client_t *client, server_subscription_t *sub, cups_array_t *ra, cups_array_t *pa);
 static void		copy_system_state(ipp_t *ipp, cups_array_t *ra);
+static server_document_t *create_document(server_client_t *client, server_job_t *job, const char *format, bool streaming);
 static const char	*detect_format(const unsigned char *header);
 static int		filter_cb(server_filter_t *filter, ipp_t *dst, ipp_attribute_t *attr);
+static server_document_t *find_document(server_client_t *client, server_job_t *job);
+static void		finish_stream(server_client_t *client);
 static const char	*get_document_uri(server_client_t *client);
+static bool		in_job_list(server_joblist_t *list, int job_id);
 static void		ipp_acknowledge_document(server_client_t *client);
 static void		ipp_acknowledge_identify_printer(server_client_t *client);
 static void		ipp_acknowledge_job(server_client_t *client);
@@ -126,15 +132,17 @@ static void		ipp_update_job_status(server_client_t *client);
 static void		ipp_update_output_device_attributes(server_client_t *client);
 static void		ipp_validate_document(server_client_t *client);
 static void		ipp_validate_job(server_client_t *client);
+static void		mark_document_fetched(server_job_t *job, server_document_t *doc);
 static void		respond_unsettable(server_client_t *client, ipp_attribute_t *attr);
+static bool		start_stream(server_client_t *client);
 static bool		valid_doc_attributes(server_client_t *client);
 static bool		valid_filename(const char *filename);
 static bool		valid_job_attributes(server_client_t *client);
 static bool		valid_media(server_client_t *client, ipp_attribute_t *attr);
 static bool		valid_media_col(server_client_t *client, ipp_attribute_t *attr);
 static bool		valid_orientation(server_client_t *client, ipp_attribute_t *attr);
-static bool		valid_values(server_client_t *client, ipp_tag_t group_tag, ipp_attribute_t *supported, size_t num_values, server_value_t *values);
-static float		wgs84_distance(const char *a, const char *b);
+static bool		valid_values(server_client_t *client, ipp_tag_t group_tag, server_printer_t *printer, ipp_attribute_t *supported, size_t num_values, server_value_t *values);
+static bool		write_stream(server_client_t *client);
 
 
 /*
@@ -448,6 +456,35 @@ serverCopyAttributes(
 }
 
 
+/*
+ * 'abort_document()' - Abort a job after a document could not be received.
+ */
+
+static void
+abort_document(
+    server_job_t      *job,		/* I - Job */
+    server_document_t *doc)		/* I - Document */
+{
+  serverStopDocument(job, doc);
+
+  cupsRWLockWrite(&job->rwlock);
+
+  job->state = IPP_JSTATE_ABORTED;
+
+  if (doc->state < IPP_JSTATE_CANCELED)
+  {
+    doc->state     = IPP_JSTATE_ABORTED;
+    doc->completed = time(NULL);
+
+    serverAddDocumentEventNoLock(job, doc, SERVER_EVENT_DOCUMENT_STATE_CHANGED | SERVER_EVENT_DOCUMENT_COMPLETED, "Document #%d aborted.", doc->number);
+  }
+
+  cupsRWUnlock(&job->rwlock);
+
+  serverUpdateJobData(job, doc, 0, true);
+}
+
+
 /*
  * 'apply_template_attributes()' - Apply attributes from a template resource.
  */
@@ -526,19 +563,92 @@ apply_template_attributes(
 }
 
 
+/*
+ * 'authorize_job()' - Authorize access to a job.
+ *
+ * The job read lock is held while checking the owner since the cached
+ * username is re-pointed when a completed job is compacted.
+ */
+
+static bool				/* O - `true` if authorized, `false` otherwise */
+authorize_job(
+    server_client_t *client,		/* I - Client */
+    server_job_t    *job,		/* I - Job */
+    const char      *scope)		/* I - Privacy scope */
+{
+  bool	ret;				/* Return value */
+
+
+  cupsRWLockRead(&job->rwlock);
+  ret = serverAuthorizeUser(client, job->username, SERVER_GROUP_NONE, scope);
+  cupsRWUnlock(&job->rwlock);
+
+  return (ret);
+}
+
+
+/*
+ * 'check_packed() - Check whether packed attributes might contain any of the
+ *                    requested attributes.
+ *
+ * Attribute names are stored in the IPP encoding as a 16-bit length followed
+ * by the name, so a byte search avoids decoding for the common Get-Jobs case
+ * where only Job Status attributes are requested.
+ */
+
+static bool				/* O - `true` if unpacking is needed */
+check_packed(
+    const unsigned char *packed,	/* I - Packed attributes */
+    size_t              packedlen,	/* I - Length of packed attributes */
+    cups_array_t        *ra)		/* I - requested-attributes */
+{
+  const char		*name;		/* Current requested attribute */
+  size_t		namelen;	/* Length of name */
+  const unsigned char	*ptr,		/* Pointer into packed attributes */
+			*end;		/* End of packed attributes */
+
+
+  if (!packed)
+    return (false);
+  else if (!ra)
+    return (true);
+
+  for (name = (const char *)cupsArrayGetFirst(ra); name; name = (const char *)cupsArrayGetNext(ra))
+  {
+    if ((namelen = strlen(name)) == 0 || (namelen + 2) > packedlen)
+      continue;
+
+    for (ptr = packed + 2, end = packed + packedlen - namelen; ptr <= end; ptr ++)
+    {
+      if (*ptr == (unsigned char)*name && ptr[-2] == (unsigned char)(namelen >> 8) && ptr[-1] == (unsigned char)namelen && !memcmp(ptr, name, namelen))
+        return (true);
+    }
+  }
+
+  return (false);
+}
+
+
 /*
  * 'copy_doc_attrs()' - Copy document attributes to the response.
  */
 
 static void
 copy_doc_attributes(
-    server_client_t *client,		/* I - Client */
-    server_job_t    *job,		/* I - Job */
-    cups_array_t    *ra,		/* I - requested-attributes */
-    cups_array_t    *pa)		/* I - Private attributes */
+    server_client_t   *client,		/* I - Client */
+    server_job_t      *job,		/* I - Job */
+    server_document_t *doc,		/* I - Document */
+    cups_array_t      *ra,		/* I - requested-attributes */
+    cups_array_t      *pa)		/* I - Private attributes */
 {
   const char		*name;		/* Attribute name */
   ipp_attribute_t	*srcattr;	/* Source attribute */
+  ipp_jstate_t		state;		/* document-state value */
+  bool			single = cupsArrayGetCount(job->documents) == 1;
+					/* Single document job? */
+  char			uuid[64];	/* document-uuid value */
+  ipp_t			*jattrs[2];	/* Job attributes */
+  int			i;		/* Looping var */
 
 
  /*
@@ -551,104 +661,138 @@ copy_doc_attributes(
   *   document-job-uri (from job-uri)
   *   document-printer-uri (from job-printer-uri)
   *   document-metadata
-  *   document-number (1)
+  *   document-number
   *   document-name
   *   document-uri
   *   document-uuid (from job-uuid)
-  *   impressions (from job-impressions)
-  *   impressions-col (from job-impressions-col)
-  *   impressions-completed (from job-impressions-completed)
-  *   impressions-completed-col (from job-impressions-completed-col)
-  *   k-octets (from job-k-octets)
-  *   last-document (true)
-  *   media-sheets (from job-media-sheets)
-  *   media-sheets-col (from job-media-sheets-col)
-  *   media-sheets-completed (from job-media-sheets-completed)
-  *   media-sheets-completed-col (from job-media-sheets-completed-col)
-  *   pages (from job-pages)
-  *   pages-col (from job-pages-col)
-  *   pages-completed (from job-pages-completed)
-  *   pages-completed-col (from job-pages-completed-col)
+  *   impressions (from job-impressions, single document jobs)
+  *   impressions-col (from job-impressions-col, single document jobs)
+  *   impressions-completed (from job-impressions-completed, single document jobs)
+  *   impressions-completed-col (from job-impressions-completed-col, single document jobs)
+  *   k-octets (from job-k-octets, single document jobs)
+  *   last-document
+  *   media-sheets (from job-media-sheets, single document jobs)
+  *   media-sheets-col (from job-media-sheets-col, single document jobs)
+  *   media-sheets-completed (from job-media-sheets-completed, single document jobs)
+  *   media-sheets-completed-col (from job-media-sheets-completed-col, single document jobs)
+  *   pages (from job-pages, single document jobs)
+  *   pages-col (from job-pages-col, single document jobs)
+  *   pages-completed (from job-pages-completed, single document jobs)
+  *   pages-completed-col (from job-pages-completed-col, single document jobs)
   *   time-at-xxx
   */
 
-  serverCopyAttributes(client->response, job->doc_attrs, ra, pa, IPP_TAG_DOCUMENT, false);
-
-  for (srcattr = ippGetFirstAttribute(job->attrs); srcattr; srcattr = ippGetNextAttribute(job->attrs))
+  if (doc->packed)
   {
-    if (ippGetGroupTag(srcattr) != IPP_TAG_JOB || (name = ippGetName(srcattr)) == NULL)
-      continue;
+    ipp_t *packed = serverUnpackAttributes(doc->packed, doc->packedlen);
+					/* Attributes of completed document */
+
+    serverCopyAttributes(client->response, packed, ra, pa, IPP_TAG_DOCUMENT, false);
+    ippDelete(packed);
+  }
+  else
+    serverCopyAttributes(client->response, doc->attrs, ra, pa, IPP_TAG_DOCUMENT, false);
+
+  jattrs[0] = job->attrs;
+  jattrs[1] = serverUnpackAttributes(job->packed, job->packedlen);
 
-    if ((!strncmp(name, "job-impressions", 15) || !strncmp(name, "job-k-octets", 12) || !strncmp(name, "job-media-sheets", 16) || !strncmp(name, "job-pages", 9)) && check_attribute(name + 4, ra, pa))
+  for (i = 0; i < 2; i ++)
+  {
+    for (srcattr = ippGetFirstAttribute(jattrs[i]); srcattr; srcattr = ippGetNextAttribute(jattrs[i]))
     {
-      name += 4;
+      if (ippGetGroupTag(srcattr) != IPP_TAG_JOB || (name = ippGetName(srcattr)) == NULL)
+        continue;
 
-      if (strstr(name, "-col"))
-        ippAddCollection(client->response, IPP_TAG_DOCUMENT, name, ippGetCollection(srcattr, 0));
-      else
-        ippAddInteger(client->response, IPP_TAG_DOCUMENT, IPP_TAG_INTEGER, name, ippGetInteger(srcattr, 0));
+      if (single && (!strncmp(name, "job-impressions", 15) || !strncmp(name, "job-k-octets", 12) || !strncmp(name, "job-media-sheets", 16) || !strncmp(name, "job-pages", 9)) && check_attribute(name + 4, ra, pa))
+      {
+        name += 4;
+
+        if (strstr(name, "-col"))
+          ippAddCollection(client->response, IPP_TAG_DOCUMENT, name, ippGetCollection(srcattr, 0));
+        else
+          ippAddInteger(client->response, IPP_TAG_DOCUMENT, IPP_TAG_INTEGER, name, ippGetInteger(srcattr, 0));
+      }
+      else if (!strcmp(name, "document-uri") && check_attribute("document-uri", ra, pa))
+        ippAddString(client->response, IPP_TAG_DOCUMENT, IPP_TAG_URI, "document-uri", NULL, ippGetString(srcattr, 0, NULL));
+      else if (!strcmp(name, "job-printer-uri") && check_attribute("document-printer-uri", ra, pa))
+        ippAddString(client->response, IPP_TAG_DOCUMENT, IPP_TAG_URI, "document-printer-uri", NULL, ippGetString(srcattr, 0, NULL));
+      else if (!strcmp(name, "job-uri") && check_attribute("document-job-uri", ra, pa))
+        ippAddString(client->response, IPP_TAG_DOCUMENT, IPP_TAG_URI, "document-job-uri", NULL, ippGetString(srcattr, 0, NULL));
+      else if (!strcmp(name, "job-uuid") && check_attribute("document-uuid", ra, pa))
+      {
+        if (doc->number == 1)
+          ippAddString(client->response, IPP_TAG_DOCUMENT, IPP_TAG_URI, "document-uuid", NULL, ippGetString(srcattr, 0, NULL));
+        else
+          ippAddString(client->response, IPP_TAG_DOCUMENT, IPP_TAG_URI, "document-uuid", NULL, httpAssembleUUID(ServerName, DefaultPort, ippGetString(srcattr, 0, NULL), doc->number, uuid, sizeof(uuid)));
+      }
     }
-    else if (!strcmp(name, "document-uri") && check_attribute("document-uri", ra, pa))
-      ippAddString(client->response, IPP_TAG_DOCUMENT, IPP_TAG_URI, "document-uri", NULL, ippGetString(srcattr, 0, NULL));
-    else if (!strcmp(name, "job-printer-uri") && check_attribute("document-printer-uri", ra, pa))
-      ippAddString(client->response, IPP_TAG_DOCUMENT, IPP_TAG_URI, "document-printer-uri", NULL, ippGetString(srcattr, 0, NULL));
-    else if (!strcmp(name, "job-uri") && check_attribute("document-job-uri", ra, pa))
-      ippAddString(client->response, IPP_TAG_DOCUMENT, IPP_TAG_URI, "document-job-uri", NULL, ippGetString(srcattr, 0, NULL));
-    else if (!strcmp(name, "job-uuid") && check_attribute("document-uuid", ra, pa))
-      ippAddString(client->response, IPP_TAG_DOCUMENT, IPP_TAG_URI, "document-uuid", NULL, ippGetString(srcattr, 0, NULL));
   }
 
+  ippDelete(jattrs[1]);
+
+ /*
+  * Documents that were never processed follow the final job state...
+  */
+
+  if ((state = doc->state) < IPP_JSTATE_CANCELED && job->state >= IPP_JSTATE_CANCELED)
+    state = job->state;
+
   if (check_attribute("date-time-at-completed", ra, pa))
   {
-    if (job->completed)
-      ippAddDate(client->response, IPP_TAG_DOCUMENT, "date-time-at-completed", ippTimeToDate(job->completed));
+    if (doc->completed)
+      ippAddDate(client->response, IPP_TAG_DOCUMENT, "date-time-at-completed", ippTimeToDate(doc->completed));
     else
       ippAddOutOfBand(client->response, IPP_TAG_DOCUMENT, IPP_TAG_NOVALUE, "date-time-at-completed");
   }
 
   if (check_attribute("date-time-at-created", ra, pa))
-    ippAddDate(client->response, IPP_TAG_DOCUMENT, "date-time-at-created", ippTimeToDate(job->created));
+    ippAddDate(client->response, IPP_TAG_DOCUMENT, "date-time-at-created", ippTimeToDate(doc->created));
 
   if (check_attribute("date-time-at-processing", ra, pa))
   {
-    if (job->processing)
-      ippAddDate(client->response, IPP_TAG_DOCUMENT, "date-time-at-processing", ippTimeToDate(job->processing));
+    if (doc->processing)
+      ippAddDate(client->response, IPP_TAG_DOCUMENT, "date-time-at-processing", ippTimeToDate(doc->processing));
     else
       ippAddOutOfBand(client->response, IPP_TAG_DOCUMENT, IPP_TAG_NOVALUE, "date-time-at-processing");
   }
 
   if (check_attribute("document-format", ra, pa))
-    ippAddString(client->response, IPP_TAG_DOCUMENT, IPP_TAG_MIMETYPE, "document-format", NULL, job->format);
+    ippAddString(client->response, IPP_TAG_DOCUMENT, IPP_TAG_MIMETYPE, "document-format", NULL, doc->format);
 
   if (check_attribute("document-job-id", ra, pa))
     ippAddInteger(client->response, IPP_TAG_DOCUMENT, IPP_TAG_INTEGER, "document-job-id", job->id);
 
   if (check_attribute("document-number", ra, pa))
-    ippAddInteger(client->response, IPP_TAG_DOCUMENT, IPP_TAG_INTEGER, "document-number", 1);
+    ippAddInteger(client->response, IPP_TAG_DOCUMENT, IPP_TAG_INTEGER, "document-number", doc->number);
 
   if (check_attribute("document-state", ra, pa))
-    ippAddInteger(client->response, IPP_TAG_DOCUMENT, IPP_TAG_ENUM, "document-state", (int)job->state);
+    ippAddInteger(client->response, IPP_TAG_DOCUMENT, IPP_TAG_ENUM, "document-state", (int)state);
 
   if (check_attribute("document-state-reasons", ra, pa))
-    serverCopyJobStateReasons(client->response, IPP_TAG_DOCUMENT, job);
+  {
+    if (state == IPP_JSTATE_PROCESSING || (single && state != IPP_JSTATE_PENDING))
+      serverCopyJobStateReasons(client->response, IPP_TAG_DOCUMENT, job);
+    else
+      ippAddString(client->response, IPP_TAG_DOCUMENT, IPP_TAG_KEYWORD, "document-state-reasons", NULL, doc->incoming ? "document-incoming" : "none");
+  }
 
-  if (check_attribute("impressions", ra, pa))
+  if (single && check_attribute("impressions", ra, pa))
     ippAddInteger(client->response, IPP_TAG_DOCUMENT, IPP_TAG_INTEGER, "impressions", job->impressions);
 
-  if (check_attribute("impressions-completed", ra, pa))
+  if (single && check_attribute("impressions-completed", ra, pa))
     ippAddInteger(client->response, IPP_TAG_DOCUMENT, IPP_TAG_INTEGER, "impressions-completed", job->impcompleted);
 
   if (check_attribute("last-document", ra, pa))
-    ippAddBoolean(client->response, IPP_TAG_DOCUMENT, "last-document", 1);
+    ippAddBoolean(client->response, IPP_TAG_DOCUMENT, "last-document", job->last_document && doc->number == (int)cupsArrayGetCount(job->documents));
 
   if (check_attribute("time-at-completed", ra, pa))
-    ippAddInteger(client->response, IPP_TAG_DOCUMENT, job->completed ? IPP_TAG_INTEGER : IPP_TAG_NOVALUE, "time-at-completed", (int)(job->completed - client->printer->start_time));
+    ippAddInteger(client->response, IPP_TAG_DOCUMENT, doc->completed ? IPP_TAG_INTEGER : IPP_TAG_NOVALUE, "time-at-completed", (int)(doc->completed - client->printer->start_time));
 
   if (check_attribute("time-at-created", ra, pa))
-    ippAddInteger(client->response, IPP_TAG_DOCUMENT, IPP_TAG_INTEGER, "time-at-created", (int)(job->created - client->printer->start_time));
+    ippAddInteger(client->response, IPP_TAG_DOCUMENT, IPP_TAG_INTEGER, "time-at-created", (int)(doc->created - client->printer->start_time));
 
   if (check_attribute("time-at-processing", ra, pa))
-    ippAddInteger(client->response, IPP_TAG_DOCUMENT, job->processing ? IPP_TAG_INTEGER : IPP_TAG_NOVALUE, "time-at-processing", (int)(job->processing - client->printer->start_time));
+    ippAddInteger(client->response, IPP_TAG_DOCUMENT, doc->processing ? IPP_TAG_INTEGER : IPP_TAG_NOVALUE, "time-at-processing", (int)(doc->processing - client->printer->start_time));
 }
 
 
@@ -662,6 +806,7 @@ copy_document_uri(
     server_job_t    *job,		/* I - Print job */
     const char      *uri)		/* I - Document URI */
 {
+  server_document_t	*doc = NULL;	/* Document */
   ipp_attribute_t	*attr;		/* document-format-detected attribute */
   char			redirect[1024],	/* Redirect URI */
 			scheme[256],	/* URI scheme */
@@ -724,13 +869,19 @@ copy_document_uri(
     * Create a file for the request data...
     */
 
-    serverCreateJobFilename(job, job->format, filename, sizeof(filename));
+    if ((doc = create_document(client, job, job->format, false)) == NULL)
+    {
+      close(infile);
+      return (0);
+    }
+
+    cupsCopyString(filename, doc->filename, sizeof(filename));
 
-    if ((job->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0600)) < 0)
+    if ((job->fd = serverOpenDocument(job, doc)) < 0)
     {
       close(infile);
 
-      job->state = IPP_JSTATE_ABORTED;
+      abort_document(job, doc);
 
       serverRespondIPP(client, IPP_STATUS_ERROR_INTERNAL, "Unable to create print file: %s", strerror(errno));
       return (0);
@@ -754,17 +905,19 @@ copy_document_uri(
       {
 	int error = errno;		/* Write error */
 
-	job->state = IPP_JSTATE_ABORTED;
-
 	close(job->fd);
 	job->fd = -1;
 
+	abort_document(job, doc);
+
 	unlink(filename);
 	close(infile);
 
 	serverRespondIPP(client, IPP_STATUS_ERROR_INTERNAL, "Unable to write print file: %s", strerror(error));
 	return (0);
       }
+      else if (bytes > 0)
+        serverUpdateJobData(job, doc, (size_t)bytes, false);
     }
     while (bytes > 0);
 
@@ -873,11 +1026,17 @@ copy_document_uri(
     else
       content_type = job->format;
 
-    serverCreateJobFilename(job, content_type, filename, sizeof(filename));
+    if ((doc = create_document(client, job, content_type, false)) == NULL)
+    {
+      httpClose(http);
+      return (0);
+    }
+
+    cupsCopyString(filename, doc->filename, sizeof(filename));
 
-    if ((job->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0600)) < 0)
+    if ((job->fd = serverOpenDocument(job, doc)) < 0)
     {
-      job->state = IPP_JSTATE_ABORTED;
+      abort_document(job, doc);
 
       httpClose(http);
 
@@ -892,17 +1051,19 @@ copy_document_uri(
       {
 	int error = errno;		/* Write error */
 
-	job->state = IPP_JSTATE_ABORTED;
-
 	close(job->fd);
 	job->fd = -1;
 
+	abort_document(job, doc);
+
 	unlink(filename);
 	httpClose(http);
 
 	serverRespondIPP(client, IPP_STATUS_ERROR_INTERNAL, "Unable to write print file: %s", strerror(error));
 	return (0);
       }
+
+      serverUpdateJobData(job, doc, (size_t)bytes, false);
     }
 
     httpClose(http);
@@ -919,16 +1080,18 @@ copy_document_uri(
   {
     serverRespondIPP(client, IPP_STATUS_ERROR_INTERNAL, "Unable to write print file: %s", strerror(errno));
 
-    job->state = IPP_JSTATE_ABORTED;
-    job->fd    = -1;
+    job->fd = -1;
+
+    abort_document(job, doc);
 
     unlink(filename);
 
     return (0);
   }
 
-  job->fd       = -1;
-  job->filename = strdup(filename);
+  job->fd = -1;
+
+  serverUpdateJobData(job, doc, 0, true);
 
   return (1);
 }
@@ -947,6 +1110,15 @@ copy_job_attributes(
 {
   serverCopyAttributes(client->response, job->attrs, ra, pa, IPP_TAG_JOB, false);
 
+  if (check_packed(job->packed, job->packedlen, ra))
+  {
+    ipp_t *packed = serverUnpackAttributes(job->packed, job->packedlen);
+					/* Attributes of completed job */
+
+    serverCopyAttributes(client->response, packed, ra, pa, IPP_TAG_JOB, false);
+    ippDelete(packed);
+  }
+
   if (check_attribute("date-time-at-completed", ra, pa))
   {
     if (job->completed)
@@ -1037,7 +1209,10 @@ copy_job_attributes(
     serverCopyJobStateReasons(client->response, IPP_TAG_JOB, job);
 
   if (check_attribute("number-of-documents", ra, pa))
-    ippAddInteger(client->response, IPP_TAG_JOB, IPP_TAG_INTEGER, "number-of-documents", job->filename ? 1 : 0);
+    ippAddInteger(client->response, IPP_TAG_JOB, IPP_TAG_INTEGER, "number-of-documents", (int)cupsArrayGetCount(job->documents));
+
+  if (check_attribute("smi2699-transform-wait-time", ra, pa))
+    ippAddInteger(client->response, IPP_TAG_JOB, IPP_TAG_INTEGER, "smi2699-transform-wait-time", (int)(1000.0 * job->transform_wait));
 
   if (check_attribute("time-at-completed", ra, pa))
     ippAddInteger(client->response, IPP_TAG_JOB, job->completed ? IPP_TAG_INTEGER : IPP_TAG_NOVALUE, "time-at-completed", (int)(job->completed - client->printer->start_time));
@@ -1393,6 +1568,68 @@ copy_system_state(ipp_t        *ipp,	/* I - IPP message */
 }
 
 
+/*
+ * 'create_document()' - Create a document for a Print-xxx or Send-xxx request.
+ *
+ * On error the response is set and the job is aborted, unless the job has just
+ * stopped accepting documents.
+ */
+
+static server_document_t *		/* O - Document or `NULL` on error */
+create_document(
+    server_client_t *client,		/* I - Client */
+    server_job_t    *job,		/* I - Job */
+    const char      *format,		/* I - MIME media type */
+    bool            streaming)		/* I - Process while receiving data? */
+{
+  server_document_t	*doc;		/* Document */
+  ipp_attribute_t	*doc_name;	/* document-name attribute, if any */
+  ipp_op_t		op = ippGetOperation(client->request);
+					/* Operation code */
+
+
+  if ((doc = serverCreateDocument(job, format, streaming)) == NULL)
+  {
+    bool closed;			/* Job no longer accepting documents? */
+
+    cupsMutexLock(&StreamMutex);
+    closed = job->last_document;
+    cupsMutexUnlock(&StreamMutex);
+
+    if (closed)
+    {
+      serverRespondIPP(client, IPP_STATUS_ERROR_NOT_POSSIBLE, "Job is not accepting documents.");
+    }
+    else
+    {
+      job->state = IPP_JSTATE_ABORTED;
+
+      serverRespondIPP(client, IPP_STATUS_ERROR_INTERNAL, "Unable to create document.");
+    }
+
+    return (NULL);
+  }
+
+  cupsRWLockWrite(&job->rwlock);
+
+  if (op == IPP_OP_SEND_DOCUMENT || op == IPP_OP_SEND_URI)
+    serverCopyAttributes(doc->attrs, client->request, NULL, NULL, IPP_TAG_JOB, false);
+
+  if ((doc_name = ippFindAttribute(client->request, "document-name", IPP_TAG_NAME)) != NULL)
+  {
+    doc_name = ippCopyAttribute(doc->attrs, doc_name, 0);
+
+    ippSetGroupTag(doc->attrs, &doc_name, IPP_TAG_DOCUMENT);
+  }
+
+  cupsRWUnlock(&job->rwlock);
+
+  serverLogJob(SERVER_LOGLEVEL_INFO, job, "Creating job file \"%s\", format \"%s\".", doc->filename, doc->format);
+
+  return (doc);
+}
+
+
 /*
  * 'detect_format()' - Auto-detect the file format from the initial header
  *                     bytes.
@@ -1449,6 +1686,54 @@ filter_cb(server_filter_t   *filter,	/* I - Filter parameters */
 }
 
 
+/*
+ * 'find_document()' - Find the document specified in a request.
+ *
+ * An error response is sent when the document-number attribute is bad or the
+ * document does not exist.
+ */
+
+static server_document_t *		/* O - Document or `NULL` on error */
+find_document(server_client_t *client,	/* I - Client */
+              server_job_t    *job)	/* I - Job */
+{
+  ipp_attribute_t	*attr;		/* document-number attribute */
+  server_document_t	*doc;		/* Document */
+
+
+  if ((attr = ippFindAttribute(client->request, "document-number", IPP_TAG_ZERO)) == NULL || ippGetGroupTag(attr) != IPP_TAG_OPERATION || ippGetValueTag(attr) != IPP_TAG_INTEGER || ippGetCount(attr) != 1)
+  {
+    serverRespondIPP(client, IPP_STATUS_ERROR_BAD_REQUEST, attr ? "Bad document-number attribute." : "Missing document-number attribute.");
+    return (NULL);
+  }
+
+  if ((doc = serverFindDocument(job, ippGetInteger(attr, 0))) == NULL)
+    serverRespondIPP(client, IPP_STATUS_ERROR_NOT_FOUND, "Document #%d does not exist.", ippGetInteger(attr, 0));
+
+  return (doc);
+}
+
+
+/*
+ * 'finish_stream()' - Finish a streamed IPP response.
+ */
+
+static void
+finish_stream(server_client_t *client)	/* I - Client */
+{
+  ipp_uchar_t	end = IPP_TAG_END;	/* End-of-attributes tag */
+
+
+  httpWrite(client->http, (char *)&end, 1);
+
+  serverLogClient(SERVER_LOGLEVEL_DEBUG, client, "finish_stream: Sending 0-length chunk.");
+  httpWrite(client->http, "", 0);
+
+  serverLogClient(SERVER_LOGLEVEL_DEBUG, client, "finish_stream: Flushing write buffer.");
+  httpFlushWrite(client->http);
+}
+
+
 /*
  * 'get_document_uri()' - Get and validate the document-uri for printing.
  */
@@ -1511,6 +1796,38 @@ get_document_uri(
 }
 
 
+/*
+ * 'in_job_list()' - Determine whether a job is in a job list snapshot.
+ */
+
+static bool				/* O - `true` if present, `false` otherwise */
+in_job_list(server_joblist_t *list,	/* I - Job list */
+            int              job_id)	/* I - Job ID */
+{
+  size_t	left,			/* Left side of search */
+		right,			/* Right side of search */
+		current;		/* Current element */
+
+
+  if (!list)
+    return (false);
+
+  for (left = 0, right = list->num_jobs; left < right;)
+  {
+    current = (left + right) / 2;
+
+    if (list->jobs[current]->id == job_id)
+      return (true);
+    else if (list->jobs[current]->id > job_id)
+      left = current + 1;
+    else
+      right = current;
+  }
+
+  return (false);
+}
+
+
 /*
  * 'ipp_acknowledge_document()' - Acknowledge receipt of a document.
  */
@@ -1521,7 +1838,6 @@ ipp_acknowledge_document(
 {
   server_device_t	*device;	/* Device */
   server_job_t		*job;		/* Job */
-  ipp_attribute_t	*attr;		/* Attribute */
 
 
   if (Authentication)
@@ -1561,11 +1877,8 @@ ipp_acknowledge_document(
     return;
   }
 
-  if ((attr = ippFindAttribute(client->request, "document-number", IPP_TAG_ZERO)) == NULL || ippGetGroupTag(attr) != IPP_TAG_OPERATION || ippGetValueTag(attr) != IPP_TAG_INTEGER || ippGetCount(attr) != 1 || ippGetInteger(attr, 0) != 1)
-  {
-    serverRespondIPP(client, IPP_STATUS_ERROR_BAD_REQUEST, attr ? "Bad document-number attribute." : "Missing document-number attribute.");
+  if (!find_document(client, job))
     return;
-  }
 
   serverRespondIPP(client, IPP_STATUS_OK, NULL);
 }
@@ -1803,6 +2116,8 @@ ipp_allocate_printer_resources(
     serverAllocatePrinterResource(printer, resource);
   }
 
+  serverSaveSystemLater(printer);
+
   serverRespondIPP(client, IPP_STATUS_OK, NULL);
 }
 
@@ -1878,7 +2193,7 @@ ipp_cancel_document(
     server_client_t *client)		/* I - Client */
 {
   server_job_t		*job;		/* Job information */
-  ipp_attribute_t	*attr;		/* Document number attribute */
+  server_document_t	*doc;		/* Document */
   int			doc_number;	/* Document number value */
 
 
@@ -1902,20 +2217,51 @@ ipp_cancel_document(
     return;
   }
 
-  if (Authentication && !serverAuthorizeUser(client, job->username, SERVER_GROUP_NONE, JobPrivacyScope))
+  if (Authentication && !authorize_job(client, job, JobPrivacyScope))
   {
     serverRespondIPP(client, IPP_STATUS_ERROR_NOT_AUTHORIZED, "Not authorized to access this job.");
     return;
   }
 
-  if ((attr = ippFindAttribute(client->request, "document-number", IPP_TAG_ZERO)) == NULL || ippGetGroupTag(attr) != IPP_TAG_OPERATION || ippGetValueTag(attr) != IPP_TAG_INTEGER || ippGetCount(attr) != 1)
-  {
-    serverRespondIPP(client, IPP_STATUS_ERROR_BAD_REQUEST, attr ? "Bad 'document-number' attribute in request." : "Missing 'document-number' attribute in request.");
+  if ((doc = find_document(client, job)) == NULL)
     return;
-  }
-  else if ((doc_number = ippGetInteger(attr, 0)) != 1)
+
+  doc_number = doc->number;
+
+  if (cupsArrayGetCount(job->documents) > 1 || !job->last_document)
   {
-    serverRespondIPP(client, IPP_STATUS_ERROR_NOT_FOUND, "Document #%d does not exist.", doc_number);
+   /*
+    * Cancel just this document in a multiple document job...
+    */
+
+    cupsRWLockWrite(&job->rwlock);
+
+    if (doc->state >= IPP_JSTATE_CANCELED || job->state >= IPP_JSTATE_CANCELED)
+    {
+      cupsRWUnlock(&job->rwlock);
+
+      serverRespondIPP(client, IPP_STATUS_ERROR_NOT_POSSIBLE, "Document #%d is already %s - can\'t cancel.", doc_number, doc->state == IPP_JSTATE_CANCELED || job->state == IPP_JSTATE_CANCELED ? "canceled" : doc->state == IPP_JSTATE_ABORTED || job->state == IPP_JSTATE_ABORTED ? "aborted" : "completed");
+      return;
+    }
+
+    if (doc->state == IPP_JSTATE_PROCESSING)
+    {
+      cupsRWUnlock(&job->rwlock);
+
+      serverStopDocument(job, doc);
+    }
+    else
+    {
+      doc->cancel    = true;
+      doc->state     = IPP_JSTATE_CANCELED;
+      doc->completed = time(NULL);
+
+      serverAddDocumentEventNoLock(job, doc, SERVER_EVENT_DOCUMENT_STATE_CHANGED | SERVER_EVENT_DOCUMENT_COMPLETED, "Document #%d canceled.", doc_number);
+
+      cupsRWUnlock(&job->rwlock);
+    }
+
+    serverRespondIPP(client, IPP_STATUS_OK, NULL);
     return;
   }
 
@@ -1998,7 +2344,7 @@ ipp_cancel_job(server_client_t *client)	/* I - Client */
     return;
   }
 
-  if (Authentication && !serverAuthorizeUser(client, job->username, SERVER_GROUP_NONE, JobPrivacyScope))
+  if (Authentication && !authorize_job(client, job, JobPrivacyScope))
   {
     serverRespondIPP(client, IPP_STATUS_ERROR_NOT_AUTHORIZED, "Not authorized to access this job.");
     return;
@@ -2127,13 +2473,9 @@ ipp_cancel_jobs(
     * Look for the specified jobs...
     */
 
-    server_job_t	key;		/* Search key for jobs */
-
     for (i = 0, count = ippGetCount(job_ids); i < count; i ++)
     {
-      key.id = ippGetInteger(job_ids, i);
-
-      if ((job = (server_job_t *)cupsArrayFind(client->printer->jobs, &key)) != NULL)
+      if ((job = serverFindJobNoLock(client->printer, ippGetInteger(job_ids, i))) != NULL)
       {
        /*
 	* Validate this job...
@@ -2166,12 +2508,12 @@ ipp_cancel_jobs(
       }
       else if (!bad_job_ids)
       {
-	serverRespondIPP(client, IPP_STATUS_ERROR_NOT_POSSIBLE, "Job #%d does not exist.", key.id);
+	serverRespondIPP(client, IPP_STATUS_ERROR_NOT_POSSIBLE, "Job #%d does not exist.", ippGetInteger(job_ids, i));
 
-	bad_job_ids = ippAddInteger(client->response, IPP_TAG_UNSUPPORTED_GROUP, IPP_TAG_INTEGER, "job-ids", key.id);
+	bad_job_ids = ippAddInteger(client->response, IPP_TAG_UNSUPPORTED_GROUP, IPP_TAG_INTEGER, "job-ids", ippGetInteger(job_ids, i));
       }
       else
-	ippSetInteger(client->response, &bad_job_ids, ippGetCount(bad_job_ids), key.id);
+	ippSetInteger(client->response, &bad_job_ids, ippGetCount(bad_job_ids), ippGetInteger(job_ids, i));
     }
   }
   else
@@ -2375,7 +2717,7 @@ ipp_close_job(server_client_t *client)	/* I - Client */
     return;
   }
 
-  if (Authentication && !serverAuthorizeUser(client, job->username, SERVER_GROUP_NONE, JobPrivacyScope))
+  if (Authentication && !authorize_job(client, job, JobPrivacyScope))
   {
     serverRespondIPP(client, IPP_STATUS_ERROR_NOT_AUTHORIZED, "Not authorized to access this job.");
     return;
@@ -2404,6 +2746,13 @@ ipp_close_job(server_client_t *client)	/* I - Client */
         break;
 
     default :
+       /*
+        * No more documents will be added, so the job can finish once the
+        * documents it already has are processed...
+	*/
+
+        serverCloseJob(job);
+
 	serverRespondIPP(client, IPP_STATUS_OK, NULL);
         break;
   }
@@ -2490,7 +2839,10 @@ ipp_create_job(server_client_t *client)	/* I - Client */
   cupsArrayAdd(ra, "job-state-reasons");
   cupsArrayAdd(ra, "job-uri");
 
+  cupsRWLockRead(&job->rwlock);
   copy_job_attributes(client, job, ra, NULL);
+  cupsRWUnlock(&job->rwlock);
+
   cupsArrayDelete(ra);
 
  /*
@@ -2637,7 +2989,7 @@ ipp_create_printer(
     return;
   }
 
-  if (!valid_values(client, IPP_TAG_PRINTER, ippFindAttribute(SystemAttributes, "printer-creation-attributes-supported", IPP_TAG_KEYWORD), sizeof(printer_values) / sizeof(printer_values[0]), printer_values))
+  if (!valid_values(client, IPP_TAG_PRINTER, NULL, ippFindAttribute(SystemAttributes, "printer-creation-attributes-supported", IPP_TAG_KEYWORD), sizeof(printer_values) / sizeof(printer_values[0]), printer_values))
     return;
 
 #ifndef _WIN32
@@ -2780,6 +3132,7 @@ ipp_create_printer(
   }
 
   serverAddPrinter(client->printer);
+  serverSaveSystemLater(client->printer);
 
   serverRespondIPP(client, IPP_STATUS_OK, NULL);
 
@@ -3310,6 +3663,8 @@ ipp_deallocate_printer_resources(
 
   cupsRWUnlock(&printer->rwlock);
 
+  serverSaveSystemLater(printer);
+
   serverRespondIPP(client, IPP_STATUS_OK, NULL);
 }
 
@@ -3351,7 +3706,7 @@ ipp_delete_printer(
 
   serverLogPrinter(SERVER_LOGLEVEL_DEBUG, client->printer, "Removing printer %d from printers list.", client->printer->id);
 
-  cupsArrayRemove(Printers, client->printer);
+  serverRemovePrinterNoLock(client->printer);
 
   client->printer->is_deleted = 1;
 
@@ -3651,10 +4006,16 @@ ipp_fetch_document(
 {
   server_device_t	*device;	/* Device */
   server_job_t		*job;		/* Job */
-  ipp_attribute_t	*attr;		/* Attribute */
+  server_document_t	*doc,		/* Document */
+			*next;		/* Next document */
+  ipp_attribute_t	*attr,		/* Attribute */
+			*offset_attr = NULL;
+					/* smi2699-document-data-offset */
   int			compression;	/* compression */
+  off_t			offset = 0;	/* smi2699-document-data-offset value */
   char			filename[1024];	/* Job filename */
   const char		*format = NULL;	/* document-format */
+  bool			prepared = false;/* Use prepared document file? */
 
 
   if (Authentication)
@@ -3694,11 +4055,8 @@ ipp_fetch_document(
     return;
   }
 
-  if ((attr = ippFindAttribute(client->request, "document-number", IPP_TAG_ZERO)) == NULL || ippGetGroupTag(attr) != IPP_TAG_OPERATION || ippGetValueTag(attr) != IPP_TAG_INTEGER || ippGetCount(attr) != 1 || ippGetInteger(attr, 0) != 1)
-  {
-    serverRespondIPP(client, IPP_STATUS_ERROR_BAD_REQUEST, attr ? "Bad document-number attribute." : "Missing document-number attribute.");
+  if ((doc = find_document(client, job)) == NULL)
     return;
-  }
 
   if ((attr = ippFindAttribute(client->request, "compression-accepted", IPP_TAG_KEYWORD)) != NULL)
     compression = !strcmp(ippGetString(attr, 0, NULL), "gzip");
@@ -3708,7 +4066,7 @@ ipp_fetch_document(
   if ((attr = ippFindAttribute(client->request, "document-format-accepted", IPP_TAG_MIMETYPE)) == NULL)
     attr = ippFindAttribute(client->printer->dev_attrs, "document-format-supported", IPP_TAG_MIMETYPE);
 
-  if (attr && !ippContainsString(attr, job->format))
+  if (attr && !ippContainsString(attr, doc->format))
   {
     if (ippContainsString(attr, "image/urf"))
       format = "image/urf";
@@ -3720,6 +4078,35 @@ ipp_fetch_document(
       format = NULL;
 
     if (format)
+    {
+     /*
+      * Wait for any background transform of this document, then start
+      * preparing the next one while this one is being fetched...
+      */
+
+      cupsMutexLock(&StreamMutex);
+      while (doc->preparing)
+        cupsCondWait(&StreamCondition, &StreamMutex, 1.0);
+      prepared = doc->prepared && doc->prepared_format && !strcmp(doc->prepared_format, format);
+      cupsMutexUnlock(&StreamMutex);
+
+      mark_document_fetched(job, doc);
+
+      if ((next = serverFindDocument(job, doc->number + 1)) != NULL)
+        serverPrepareDocument(job, next, format);
+    }
+
+    if (format && prepared)
+    {
+     /*
+      * Send the prepared document file...
+      */
+
+      serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Sending prepared document #%d.", doc->number);
+
+      cupsCopyString(filename, doc->prepared, sizeof(filename));
+    }
+    else if (format)
     {
      /*
       * Transform and stream document as raster...
@@ -3759,7 +4146,7 @@ ipp_fetch_document(
 	httpSetField(client->http, HTTP_FIELD_CONTENT_ENCODING, "gzip");
 
       job->state = IPP_JSTATE_PROCESSING;
-      serverTransformJob(client, job, "ipptransform", format, SERVER_TRANSFORM_TO_CLIENT);
+      serverTransformJob(client, job, doc, "ipptransform", format, SERVER_TRANSFORM_TO_CLIENT);
 
       serverLogClient(SERVER_LOGLEVEL_DEBUG, client, "ipp_fetch_document: Sending 0-length chunk.");
       httpWrite(client->http, "", 0);
@@ -3774,18 +4161,48 @@ ipp_fetch_document(
       return;
     }
   }
-
-  if (job->format)
+  else if (doc->format)
   {
-    serverCreateJobFilename(job, job->format, filename, sizeof(filename));
+    struct stat	fileinfo;		/* Document file information */
+
+    cupsCopyString(filename, doc->filename, sizeof(filename));
 
-    if (access(filename, R_OK))
+    if (stat(filename, &fileinfo) || access(filename, R_OK))
     {
       serverRespondIPP(client, IPP_STATUS_ERROR_NOT_FETCHABLE, "Document not available in requested format.");
       return;
     }
 
-    format = job->format;
+   /*
+    * A proxy that lost its connection can resume a stored document from a
+    * byte offset, but only once all of the document data has been received
+    * (IPP integers limit the offset to 2^31-1)...
+    */
+
+    if ((offset_attr = ippFindAttribute(client->request, "smi2699-document-data-offset", IPP_TAG_ZERO)) != NULL)
+    {
+      bool incoming;			/* Still receiving document data? */
+
+      cupsMutexLock(&StreamMutex);
+      incoming = doc->incoming;
+      cupsMutexUnlock(&StreamMutex);
+
+      if (incoming)
+      {
+        serverRespondIPP(client, IPP_STATUS_ERROR_NOT_POSSIBLE, "Document is still being received and cannot be resumed.");
+        return;
+      }
+
+      if (stat(filename, &fileinfo) || ippGetGroupTag(offset_attr) != IPP_TAG_OPERATION || ippGetValueTag(offset_attr) != IPP_TAG_INTEGER || ippGetCount(offset_attr) != 1 || (offset = (off_t)ippGetInteger(offset_attr, 0)) < 0 || offset > fileinfo.st_size)
+      {
+        serverRespondUnsupported(client, offset_attr);
+        return;
+      }
+    }
+
+    format = doc->format;
+
+    mark_document_fetched(job, doc);
   }
   else
   {
@@ -3798,6 +4215,22 @@ ipp_fetch_document(
   ippAddString(client->response, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "compression", NULL, compression ? "gzip" : "none");
 
   client->fetch_file = open(filename, O_RDONLY | O_BINARY);
+
+  if (offset_attr && client->fetch_file >= 0)
+  {
+    if (offset > 0 && lseek(client->fetch_file, offset, SEEK_SET) != offset)
+    {
+      close(client->fetch_file);
+      client->fetch_file = -1;
+
+      serverRespondIPP(client, IPP_STATUS_ERROR_INTERNAL, "Unable to seek in document: %s", strerror(errno));
+      return;
+    }
+
+    serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Sending document #%d from offset %ld.", doc->number, (long)offset);
+
+    ippAddInteger(client->response, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "smi2699-document-data-offset", (int)offset);
+  }
 }
 
 
@@ -3856,15 +4289,15 @@ ipp_fetch_job(server_client_t *client)	/* I - Client */
   }
 
   serverRespondIPP(client, IPP_STATUS_OK, NULL);
+
+  cupsRWLockRead(&job->rwlock);
   copy_job_attributes(client, job, NULL, NULL);
+  cupsRWUnlock(&job->rwlock);
 }
 
 
 /*
  * 'ipp_get_document_attributes()' - Get the attributes for a document object.
- *
- * Note: This implementation only supports single document jobs so we
- *       synthesize the information for a single document from the job.
  */
 
 static void
@@ -3872,7 +4305,7 @@ ipp_get_document_attributes(
     server_client_t *client)		/* I - Client */
 {
   server_job_t	*job;			/* Job */
-  ipp_attribute_t *number;		/* document-number attribute */
+  server_document_t *doc;		/* Document */
   cups_array_t	*ra;			/* requested-attributes */
 
 
@@ -3892,38 +4325,38 @@ ipp_get_document_attributes(
     return;
   }
 
-  if (Authentication && !serverAuthorizeUser(client, job->username, SERVER_GROUP_NONE, JobPrivacyScope))
+  if (Authentication && !authorize_job(client, job, JobPrivacyScope))
   {
     serverRespondIPP(client, IPP_STATUS_ERROR_NOT_AUTHORIZED, "Not authorized to access this job.");
     return;
   }
 
-  if ((number = ippFindAttribute(client->request, "document-number", IPP_TAG_INTEGER)) == NULL || ippGetInteger(number, 0) != 1)
-  {
-    serverRespondIPP(client, IPP_STATUS_ERROR_NOT_FOUND, "Document #%d not found.", ippGetInteger(number, 0));
+  if ((doc = find_document(client, job)) == NULL)
     return;
-  }
 
   serverRespondIPP(client, IPP_STATUS_OK, NULL);
 
   ra = ippCreateRequestedArray(client->request);
-  copy_doc_attributes(client, job, ra, serverAuthorizeUser(client, job->username, SERVER_GROUP_NONE, DocumentPrivacyScope) ? NULL : DocumentPrivacyArray);
+
+  cupsRWLockRead(&job->rwlock);
+  copy_doc_attributes(client, job, doc, ra, serverAuthorizeUser(client, job->username, SERVER_GROUP_NONE, DocumentPrivacyScope) ? NULL : DocumentPrivacyArray);
+  cupsRWUnlock(&job->rwlock);
+
   cupsArrayDelete(ra);
 }
 
 
 /*
  * 'ipp_get_documents()' - Get the list of documents in a job.
- *
- * Note: This implementation only supports single document jobs so we
- *       synthesize the information for a single document from the job.
  */
 
 static void
 ipp_get_documents(server_client_t *client)/* I - Client */
 {
   server_job_t	*job;			/* Job */
-  cups_array_t	*ra;			/* requested-attributes */
+  server_document_t *doc;		/* Current document */
+  cups_array_t	*ra,			/* requested-attributes */
+		*pa;			/* Private attributes */
 
 
   if (Authentication && !client->username[0])
@@ -3942,7 +4375,7 @@ ipp_get_documents(server_client_t *client)/* I - Client */
     return;
   }
 
-  if (Authentication && !serverAuthorizeUser(client, job->username, SERVER_GROUP_NONE, JobPrivacyScope))
+  if (Authentication && !authorize_job(client, job, JobPrivacyScope))
   {
     serverRespondIPP(client, IPP_STATUS_ERROR_NOT_AUTHORIZED, "Not authorized to access this job.");
     return;
@@ -3951,7 +4384,21 @@ ipp_get_documents(server_client_t *client)/* I - Client */
   serverRespondIPP(client, IPP_STATUS_OK, NULL);
 
   ra = ippCreateRequestedArray(client->request);
-  copy_doc_attributes(client, job, ra, serverAuthorizeUser(client, job->username, SERVER_GROUP_NONE, DocumentPrivacyScope) ? NULL : DocumentPrivacyArray);
+
+  cupsRWLockRead(&job->rwlock);
+
+  pa = serverAuthorizeUser(client, job->username, SERVER_GROUP_NONE, DocumentPrivacyScope) ? NULL : DocumentPrivacyArray;
+
+  for (doc = (server_document_t *)cupsArrayGetFirst(job->documents); doc; doc = (server_document_t *)cupsArrayGetNext(job->documents))
+  {
+    if (doc->number > 1)
+      ippAddSeparator(client->response);
+
+    copy_doc_attributes(client, job, doc, ra, pa);
+  }
+
+  cupsRWUnlock(&job->rwlock);
+
   cupsArrayDelete(ra);
 }
 
@@ -3994,12 +4441,18 @@ ipp_get_job_attributes(
   serverRespondIPP(client, IPP_STATUS_OK, NULL);
 
   ra = ippCreateRequestedArray(client->request);
+
+  cupsRWLockRead(&job->rwlock);
+
   if (serverAuthorizeUser(client, job->username, SERVER_GROUP_NONE, JobPrivacyScope))
     serverLogClient(SERVER_LOGLEVEL_INFO, client, "%s Job #%d attributes accessed by \"%s\".", job->printer->name, job->id, client->username);
   else
     pa = JobPrivacyArray;
 
   copy_job_attributes(client, job, ra, pa);
+
+  cupsRWUnlock(&job->rwlock);
+
   cupsArrayDelete(ra);
 }
 
@@ -4021,8 +4474,12 @@ ipp_get_jobs(server_client_t *client)	/* I - Client */
   size_t		i,		/* Looping var */
 			count,		/* Number of jobs that match */
 			limit;		/* Maximum number of jobs to return */
+  int			job_id;		/* Last job-id sent */
+  bool			ok;		/* Still sending? */
   const char		*username;	/* Username */
+  server_joblist_t	*joblist;	/* Snapshot of jobs */
   server_job_t		*job;		/* Current job pointer */
+  ipp_t			*record;	/* Archived job attributes */
   cups_array_t		*ra,		/* Requested attributes array */
 			*pa;		/* Privacy attributes array */
 
@@ -4168,38 +4625,47 @@ ipp_get_jobs(server_client_t *client)	/* I - Client */
 
   serverRespondIPP(client, IPP_STATUS_OK, NULL);
 
-  cupsRWLockRead(&(client->printer->rwlock));
+ /*
+  * Stream the response so that large job lists are not buffered in memory...
+  */
 
-  count = cupsArrayGetCount(client->printer->jobs);
-  if (limit == 0 || limit > count)
-    limit = count;
+  if (!start_stream(client))
+  {
+    cupsArrayDelete(ra);
+    return;
+  }
 
-  for (count = 0, i = 0; i < limit; i ++)
+ /*
+  * Use a snapshot of the job list so that the printer lock is not held while
+  * we copy attributes and send them...
+  */
+
+  joblist = serverGetJobList(client->printer);
+
+  for (ok = true, count = 0, i = 0; ok && joblist && i < joblist->num_jobs && (limit == 0 || count < limit); i ++)
   {
    /*
-    * Filter out jobs that don't match...
+    * Filter out jobs that don't match...  Jobs are sorted by decreasing job-id.
     */
 
-    job = (server_job_t *)cupsArrayGetElement(client->printer->jobs, i);
+    job = joblist->jobs[i];
 
-    if (job->id < first_job_id || (username && job->username && strcasecmp(username, job->username)))
-      continue;
+    if (job->id < first_job_id)
+      break;
 
-    if (job_reasons != SERVER_JREASON_NONE)
-    {
-      if (!(job->state_reasons & job_reasons))
-        continue;
-    }
-    else if ((job_comparison < 0 && job->state > job_state) ||
-             (job_comparison == 0 && job->state != job_state) ||
-             (job_comparison > 0 && job->state < job_state))
+    cupsRWLockRead(&job->rwlock);
+
+    if ((username && job->username && strcasecmp(username, job->username)) ||
+        (job_reasons != SERVER_JREASON_NONE && !(job->state_reasons & job_reasons)) ||
+        (job_reasons == SERVER_JREASON_NONE &&
+         ((job_comparison < 0 && job->state > job_state) ||
+          (job_comparison == 0 && job->state != job_state) ||
+          (job_comparison > 0 && job->state < job_state))))
     {
+      cupsRWUnlock(&job->rwlock);
       continue;
     }
 
-    if (count > 0)
-      ippAddSeparator(client->response);
-
     count ++;
 
     if (serverAuthorizeUser(client, job->username, job->printer->pinfo.proxy_group, JobPrivacyScope))
@@ -4213,11 +4679,54 @@ ipp_get_jobs(server_client_t *client)	/* I - Client */
     }
 
     copy_job_attributes(client, job, ra, pa);
+
+    cupsRWUnlock(&job->rwlock);
+
+    ok = write_stream(client);
   }
 
+ /*
+  * Then page through any archived jobs...
+  */
+
+  if (ok && job_reasons == SERVER_JREASON_NONE && (job_comparison > 0 || (job_comparison == 0 && job_state >= IPP_JSTATE_CANCELED)))
+  {
+    cupsRWLockRead(&(client->printer->rwlock));
+
+    for (job_id = 0; ok && (limit == 0 || count < limit) && (record = serverReadHistoryNoLock(client->printer, &job_id, first_job_id, username, job_state, job_comparison)) != NULL; ippDelete(record))
+    {
+     /*
+      * Skip jobs that were archived after we took the snapshot...
+      */
+
+      if (in_job_list(joblist, ippGetInteger(ippFindAttribute(record, "job-id", IPP_TAG_INTEGER), 0)))
+        continue;
+
+      count ++;
+
+      if (serverAuthorizeUser(client, ippGetString(ippFindAttribute(record, "job-originating-user-name", IPP_TAG_NAME), 0, NULL), client->printer->pinfo.proxy_group, JobPrivacyScope))
+	pa = NULL;
+      else
+	pa = JobPrivacyArray;
+
+      serverCopyAttributes(client->response, record, ra, pa, IPP_TAG_JOB, false);
+
+      cupsRWUnlock(&(client->printer->rwlock));
+
+      ok = write_stream(client);
+
+      cupsRWLockRead(&(client->printer->rwlock));
+    }
+
+    cupsRWUnlock(&(client->printer->rwlock));
+  }
+
+  serverReleaseJobList(joblist);
+
   cupsArrayDelete(ra);
 
-  cupsRWUnlock(&(client->printer->rwlock));
+  if (ok)
+    finish_stream(client);
 }
 
 
@@ -4633,9 +5142,12 @@ ipp_get_printers(
 {
   size_t		i,		/* Looping var */
 			count,		/* Number of printers returned */
+			matched,	/* Number of matching printers */
 			pcount,		/* Number of printers */
 			limit;		/* limit operation attribute value, if any */
   server_printer_t	*printer;	/* Current printer */
+  cups_array_t		*candidates,	/* Printers from the indexes */
+			*printers;	/* Printers to check */
   ipp_attribute_t	*printer_ids;	/* printer-ids operation attribute, if any */
   int			first_index;	/* first-index operation attribute value, if any */
   const char		*geo_location,	/* printer-geo-location value, if any */
@@ -4643,8 +5155,9 @@ ipp_get_printers(
 			*service_type,	/* printer-service-type value, if any */
 			*document_format,/* document-format value, if any */
 			*which_printers;/* which-printers value, if any */
-  float			geo_distance = 30.0;
+  double		geo_distance = 30.0;
 					/* Distance for geographic filter */
+  bool			ok;		/* Still sending? */
   cups_array_t		*ra;		/* requested-attributes */
 
 
@@ -4680,7 +5193,7 @@ ipp_get_printers(
 					/* Uncertainty value from URI */
 
     if (u)
-      geo_distance = (float)atof(u + 2);
+      geo_distance = atof(u + 2);
   }
 
   if (which_printers)
@@ -4700,53 +5213,59 @@ ipp_get_printers(
 
   serverRespondIPP(client, IPP_STATUS_OK, NULL);
 
+  if (!start_stream(client))
+  {
+    cupsArrayDelete(ra);
+    return;
+  }
+
   cupsRWLockRead(&PrintersRWLock);
 
-  pcount = cupsArrayGetCount(Printers);
+ /*
+  * Use the indexes to narrow down the list of printers for the location,
+  * geo-location, and service type filters...
+  */
+
+  if ((candidates = serverFindPrintersNoLock(geo_location, geo_distance, location, service_type)) != NULL)
+    printers = candidates;
+  else
+    printers = Printers;
+
+  pcount = cupsArrayGetCount(printers);
   if (limit == 0 || limit > pcount)
     limit = pcount;
 
-  for (count = 0, i = 0; i < pcount && count < limit; i ++)
+  if (!printer_ids && !document_format && !which_printers && !Authentication)
   {
-    const char	*printer_geo_location;	/* Printer's geo-location value */
-
-    printer = (server_printer_t *)cupsArrayGetElement(Printers, i);
+   /*
+    * No per-printer filters, so seek to the first requested printer...
+    */
 
-    cupsRWLockRead(&printer->rwlock);
+    i       = (size_t)first_index - 1;
+    matched = i;
+  }
+  else
+  {
+    i       = 0;
+    matched = 0;
+  }
 
-    if (Authentication && printer->pinfo.print_group != SERVER_GROUP_NONE && !serverAuthorizeUser(client, NULL, printer->pinfo.print_group, SERVER_SCOPE_DEFAULT))
-    {
-      cupsRWUnlock(&printer->rwlock);
-      continue;
-    }
+  for (ok = true, count = 0; ok && i < pcount && count < limit; i ++)
+  {
+    printer = (server_printer_t *)cupsArrayGetElement(printers, i);
 
     if (printer_ids && !ippContainsInteger(printer_ids, printer->id))
-    {
-      cupsRWUnlock(&printer->rwlock);
-      continue;
-    }
-
-    printer_geo_location = ippGetString(ippFindAttribute(printer->pinfo.attrs, "printer-geo-location", IPP_TAG_URI), 0, NULL);
-
-    if (geo_location && (!printer_geo_location || wgs84_distance(printer_geo_location, geo_location) > geo_distance))
-    {
-      cupsRWUnlock(&printer->rwlock);
       continue;
-    }
 
-    if (location && (!printer->pinfo.location || strcmp(printer->pinfo.location, location)))
-    {
-      cupsRWUnlock(&printer->rwlock);
-      continue;
-    }
+    cupsRWLockRead(&printer->rwlock);
 
-    if (document_format && !ippContainsString(ippFindAttribute(printer->pinfo.attrs, "document-format-supported", IPP_TAG_MIMETYPE), document_format))
+    if (Authentication && printer->pinfo.print_group != SERVER_GROUP_NONE && !serverAuthorizeUser(client, NULL, printer->pinfo.print_group, SERVER_SCOPE_DEFAULT))
     {
       cupsRWUnlock(&printer->rwlock);
       continue;
     }
 
-    if (service_type && ((!strcmp(service_type, "print") && printer->type != SERVER_TYPE_PRINT) || (!strcmp(service_type, "print3d") && printer->type != SERVER_TYPE_PRINT3D) || (strcmp(service_type, "print") && strcmp(service_type, "print3d"))))
+    if (document_format && !serverIsSupportedStringNoLock(printer, "document-format-supported", document_format))
     {
       cupsRWUnlock(&printer->rwlock);
       continue;
@@ -4776,23 +5295,31 @@ ipp_get_printers(
     * Check whether the client specifies first-index/limit...
     */
 
-    i ++;
-    if (i >= first_index)
+    matched ++;
+    if (matched >= (size_t)first_index)
     {
-      if (count)
-	ippAddSeparator(client->response);
-
       copy_printer_attributes(client, printer, ra);
 
       count ++;
     }
 
     cupsRWUnlock(&printer->rwlock);
+
+   /*
+    * Send the printer group without holding the printer lock...
+    */
+
+    if (ippGetFirstAttribute(client->response))
+      ok = write_stream(client);
   }
 
   cupsRWUnlock(&PrintersRWLock);
 
+  cupsArrayDelete(candidates);
   cupsArrayDelete(ra);
+
+  if (ok)
+    finish_stream(client);
 }
 
 
@@ -5366,6 +5893,10 @@ ipp_get_system_attributes(
   }
 
   copy_system_state(client->response, ra);
+  serverCopyClientStatus(client->response, ra);
+  serverCopyRateLimitStatus(client->response, ra);
+  serverCopyRequestStatus(client->response, ra);
+  serverCopyTransformStatus(client->response, ra);
 
   if (!ra || cupsArrayFind(ra, "system-up-time"))
     ippAddInteger(client->response, IPP_TAG_SYSTEM, IPP_TAG_INTEGER, "system-up-time", (int)(time(NULL) - SystemStartTime));
@@ -5556,7 +6087,7 @@ ipp_hold_job(server_client_t *client)	/* I - Client */
     return;
   }
 
-  if (Authentication && !serverAuthorizeUser(client, job->username, SERVER_GROUP_NONE, JobPrivacyScope))
+  if (Authentication && !authorize_job(client, job, JobPrivacyScope))
   {
     serverRespondIPP(client, IPP_STATUS_ERROR_NOT_AUTHORIZED, "Not authorized to access this job.");
     return;
@@ -5852,12 +6383,12 @@ static void
 ipp_print_job(server_client_t *client)	/* I - Client */
 {
   server_job_t		*job;		/* New job */
-  char			filename[1024],	/* Filename buffer */
-			buffer[4096];	/* Copy buffer */
+  server_document_t	*doc;		/* Document */
+  bool			streaming;	/* Process while receiving data? */
+  char			buffer[4096];	/* Copy buffer */
   ssize_t		bytes;		/* Bytes read */
   cups_array_t		*ra;		/* Attributes to send in response */
-  ipp_attribute_t	*hold_until,	/* job-hold-until-xxx attribute, if any */
-			*doc_name;	/* document-name attribute, if any */
+  ipp_attribute_t	*hold_until;	/* job-hold-until-xxx attribute, if any */
 
 
   if (Authentication && !client->username[0])
@@ -5909,16 +6440,6 @@ ipp_print_job(server_client_t *client)	/* I - Client */
     return;
   }
 
-  if ((doc_name = ippFindAttribute(client->request, "document-name", IPP_TAG_NAME)) != NULL)
-  {
-    if (!job->doc_attrs)
-      job->doc_attrs = ippNew();
-
-    doc_name = ippCopyAttribute(job->doc_attrs, doc_name, 0);
-
-    ippSetGroupTag(job->doc_attrs, &doc_name, IPP_TAG_DOCUMENT);
-  }
-
   if ((hold_until = ippFindAttribute(client->request, "job-hold-until", IPP_TAG_KEYWORD)) == NULL)
     hold_until = ippFindAttribute(client->request, "job-hold-until-time", IPP_TAG_DATE);
 
@@ -5929,36 +6450,62 @@ ipp_print_job(server_client_t *client)	/* I - Client */
   * Create a file for the request data...
   */
 
-  serverCreateJobFilename(job, NULL, filename, sizeof(filename));
+  streaming = client->printer->pinfo.streaming && job->state == IPP_JSTATE_HELD && !job->hold_until;
 
-  serverLogJob(SERVER_LOGLEVEL_INFO, job, "Creating job file \"%s\", format \"%s\".", filename, job->format);
+  if ((doc = create_document(client, job, job->format, streaming)) == NULL)
+    return;
+
+  serverCloseJob(job);
 
-  if ((job->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0600)) < 0)
+  if ((job->fd = serverOpenDocument(job, doc)) < 0)
   {
-    job->state = IPP_JSTATE_ABORTED;
+    int error = errno;		/* Open error */
+
+    abort_document(job, doc);
 
     serverRespondIPP(client, IPP_STATUS_ERROR_INTERNAL,
-                "Unable to create print file: %s", strerror(errno));
+                "Unable to create print file: %s", strerror(error));
     return;
   }
 
+  if (streaming)
+  {
+   /*
+    * Start processing the job while we receive the document data...
+    */
+
+    cupsRWLockWrite(&job->rwlock);
+
+    job->state         = IPP_JSTATE_PENDING;
+    job->state_reasons |= SERVER_JREASON_JOB_INCOMING;
+
+    cupsRWUnlock(&job->rwlock);
+
+    serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Streaming job file.");
+
+    serverCheckJobs(client->printer);
+  }
+
   while ((bytes = httpRead(client->http, buffer, sizeof(buffer))) > 0)
   {
     if (write(job->fd, buffer, (size_t)bytes) < bytes)
     {
       int error = errno;		/* Write error */
 
-      job->state = IPP_JSTATE_ABORTED;
-
       close(job->fd);
       job->fd = -1;
 
-      unlink(filename);
+      abort_document(job, doc);
+
+      if (!streaming)
+        unlink(doc->filename);
 
       serverRespondIPP(client, IPP_STATUS_ERROR_INTERNAL,
                   "Unable to write print file: %s", strerror(error));
       return;
     }
+
+    serverUpdateJobData(job, doc, (size_t)bytes, false);
   }
 
   if (bytes < 0)
@@ -5967,12 +6514,13 @@ ipp_print_job(server_client_t *client)	/* I - Client */
     * Got an error while reading the print data, so abort this job.
     */
 
-    job->state = IPP_JSTATE_ABORTED;
-
     close(job->fd);
     job->fd = -1;
 
-    unlink(filename);
+    abort_document(job, doc);
+
+    if (!streaming)
+      unlink(doc->filename);
 
     serverRespondIPP(client, IPP_STATUS_ERROR_INTERNAL,
                 "Unable to read print file.");
@@ -5983,25 +6531,46 @@ ipp_print_job(server_client_t *client)	/* I - Client */
   {
     int error = errno;		/* Write error */
 
-    job->state = IPP_JSTATE_ABORTED;
-    job->fd    = -1;
+    job->fd = -1;
 
-    unlink(filename);
+    abort_document(job, doc);
+
+    if (!streaming)
+      unlink(doc->filename);
 
     serverRespondIPP(client, IPP_STATUS_ERROR_INTERNAL,
                 "Unable to write print file: %s", strerror(error));
     return;
   }
 
-  job->fd       = -1;
-  job->filename = strdup(filename);
-  job->state    = IPP_JSTATE_PENDING;
+  if (streaming)
+  {
+   /*
+    * Let the processing thread know that all of the data has arrived...
+    */
+
+    cupsRWLockWrite(&job->rwlock);
 
- /*
-  * Process the job, if possible...
-  */
+    job->fd            = -1;
+    job->state_reasons &= (server_jreason_t)~SERVER_JREASON_JOB_INCOMING;
 
-  serverCheckJobs(client->printer);
+    cupsRWUnlock(&job->rwlock);
+
+    serverUpdateJobData(job, doc, 0, true);
+  }
+  else
+  {
+    job->fd    = -1;
+    job->state = IPP_JSTATE_PENDING;
+
+    serverUpdateJobData(job, doc, 0, true);
+
+   /*
+    * Process the job, if possible...
+    */
+
+    serverCheckJobs(client->printer);
+  }
 
  /*
   * Return the job info...
@@ -6016,7 +6585,10 @@ ipp_print_job(server_client_t *client)	/* I - Client */
   cupsArrayAdd(ra, "job-state-reasons");
   cupsArrayAdd(ra, "job-uri");
 
+  cupsRWLockRead(&job->rwlock);
   copy_job_attributes(client, job, ra, NULL);
+  cupsRWUnlock(&job->rwlock);
+
   cupsArrayDelete(ra);
 
  /*
@@ -6038,8 +6610,7 @@ ipp_print_uri(server_client_t *client)	/* I - Client */
   server_job_t		*job;		/* New job */
   const char		*uri;		/* document-uri */
   cups_array_t		*ra;		/* Attributes to send in response */
-  ipp_attribute_t	*hold_until,	/* job-hold-until-xxx attribute, if any */
-			*doc_name;	/* document-name attribute, if any */
+  ipp_attribute_t	*hold_until;	/* job-hold-until-xxx attribute, if any */
 
 
   if (Authentication && !client->username[0])
@@ -6099,16 +6670,6 @@ ipp_print_uri(server_client_t *client)	/* I - Client */
     return;
   }
 
-  if ((doc_name = ippFindAttribute(client->request, "document-name", IPP_TAG_NAME)) != NULL)
-  {
-    if (!job->doc_attrs)
-      job->doc_attrs = ippNew();
-
-    doc_name = ippCopyAttribute(job->doc_attrs, doc_name, 0);
-
-    ippSetGroupTag(job->doc_attrs, &doc_name, IPP_TAG_DOCUMENT);
-  }
-
   if ((hold_until = ippFindAttribute(client->request, "job-hold-until", IPP_TAG_KEYWORD)) == NULL)
     hold_until = ippFindAttribute(client->request, "job-hold-until-time", IPP_TAG_DATE);
 
@@ -6118,6 +6679,8 @@ ipp_print_uri(server_client_t *client)	/* I - Client */
   if (copy_document_uri(client, job, uri) && job->hold_until == 0)
     job->state = IPP_JSTATE_PENDING;
 
+  serverCloseJob(job);
+
  /*
   * Process the job...
   */
@@ -6137,7 +6700,10 @@ ipp_print_uri(server_client_t *client)	/* I - Client */
   cupsArrayAdd(ra, "job-state-reasons");
   cupsArrayAdd(ra, "job-uri");
 
+  cupsRWLockRead(&job->rwlock);
   copy_job_attributes(client, job, ra, NULL);
+  cupsRWUnlock(&job->rwlock);
+
   cupsArrayDelete(ra);
 
  /*
@@ -6264,6 +6830,7 @@ ipp_register_output_device(
       printer = client->printer = serverCreatePrinter(path, uuid + 9, uuid + 9, &pinfo, 0);
 
       serverAddPrinter(printer);
+      serverSaveSystemLater(printer);
     }
   }
 
@@ -6381,7 +6948,7 @@ ipp_release_job(server_client_t *client)	/* I - Client */
     return;
   }
 
-  if (Authentication && !serverAuthorizeUser(client, job->username, SERVER_GROUP_NONE, JobPrivacyScope))
+  if (Authentication && !authorize_job(client, job, JobPrivacyScope))
   {
     serverRespondIPP(client, IPP_STATUS_ERROR_NOT_AUTHORIZED, "Not authorized to access this job.");
     return;
@@ -6536,7 +7103,7 @@ ipp_restart_system(
   }
 
   /* TODO: Actually do a full restart of the system... */
-  serverSaveSystem();
+  serverSaveSystem(true);
 
   cupsRWLockRead(&SystemRWLock);
 
@@ -6640,8 +7207,11 @@ static void
 ipp_send_document(server_client_t *client)/* I - Client */
 {
   server_job_t		*job;		/* Job information */
-  char			filename[1024],	/* Filename buffer */
-			buffer[4096];	/* Copy buffer */
+  server_document_t	*doc;		/* Document */
+  const char		*format;	/* Document format */
+  bool			last_document,	/* Last document in job? */
+			streaming;	/* Process while receiving data? */
+  char			buffer[4096];	/* Copy buffer */
   ssize_t		bytes;		/* Bytes read */
   ipp_attribute_t	*attr;		/* Current attribute */
   cups_array_t		*ra;		/* Attributes to send in response */
@@ -6668,7 +7238,7 @@ ipp_send_document(server_client_t *client)/* I - Client */
     return;
   }
 
-  if (Authentication && !serverAuthorizeUser(client, job->username, SERVER_GROUP_NONE, JobPrivacyScope))
+  if (Authentication && !authorize_job(client, job, JobPrivacyScope))
   {
     serverRespondIPP(client, IPP_STATUS_ERROR_NOT_AUTHORIZED, "Not authorized to access this job.");
     httpFlush(client->http);
@@ -6676,21 +7246,13 @@ ipp_send_document(server_client_t *client)/* I - Client */
   }
 
  /*
-  * See if we already have a document for this job or the job has already
-  * in a non-pending state...
+  * See if the job can accept another document...
   */
 
-  if (job->state > IPP_JSTATE_HELD)
+  if (job->state > IPP_JSTATE_PROCESSING || job->last_document)
   {
     serverRespondIPP(client, IPP_STATUS_ERROR_NOT_POSSIBLE,
-                "Job is not in a pending state.");
-    httpFlush(client->http);
-    return;
-  }
-  else if (job->filename || job->fd >= 0)
-  {
-    serverRespondIPP(client, IPP_STATUS_ERROR_MULTIPLE_JOBS_NOT_SUPPORTED,
-                "Multiple document jobs are not supported.");
+                "Job is not accepting documents.");
     httpFlush(client->http);
     return;
   }
@@ -6703,14 +7265,15 @@ ipp_send_document(server_client_t *client)/* I - Client */
     httpFlush(client->http);
     return;
   }
-  else if (ippGetValueTag(attr) != IPP_TAG_BOOLEAN || ippGetCount(attr) != 1 ||
-           !ippGetBoolean(attr, 0))
+  else if (ippGetValueTag(attr) != IPP_TAG_BOOLEAN || ippGetCount(attr) != 1)
   {
     serverRespondUnsupported(client, attr);
     httpFlush(client->http);
     return;
   }
 
+  last_document = ippGetBoolean(attr, 0);
+
  /*
   * Validate document attributes...
   */
@@ -6721,62 +7284,103 @@ ipp_send_document(server_client_t *client)/* I - Client */
     return;
   }
 
-  if (!job->doc_attrs)
-    job->doc_attrs = ippNew();
-
-  serverCopyAttributes(job->doc_attrs, client->request, NULL, NULL, IPP_TAG_JOB, false);
-
  /*
-  * Get the document format for the job...
+  * Get the document format...
   */
 
-  cupsRWLockWrite(&(client->printer->rwlock));
-
-  if ((attr = ippFindAttribute(job->attrs, "document-format-detected", IPP_TAG_MIMETYPE)) != NULL)
-    job->format = ippGetString(attr, 0, NULL);
+  if ((attr = ippFindAttribute(client->request, "document-format-detected", IPP_TAG_MIMETYPE)) != NULL)
+    format = ippGetString(attr, 0, NULL);
+  else if ((attr = ippFindAttribute(client->request, "document-format-supplied", IPP_TAG_MIMETYPE)) != NULL)
+    format = ippGetString(attr, 0, NULL);
+  else if ((attr = ippFindAttribute(job->attrs, "document-format-detected", IPP_TAG_MIMETYPE)) != NULL)
+    format = ippGetString(attr, 0, NULL);
   else if ((attr = ippFindAttribute(job->attrs, "document-format", IPP_TAG_MIMETYPE)) != NULL)
-    job->format = ippGetString(attr, 0, NULL);
+    format = ippGetString(attr, 0, NULL);
   else
-    job->format = "application/octet-stream";
+    format = "application/octet-stream";
 
  /*
   * Create a file for the request data...
   */
 
-  serverCreateJobFilename(job, NULL, filename, sizeof(filename));
+  streaming = client->printer->pinfo.streaming && !job->hold_until;
+
+  cupsRWLockWrite(&(client->printer->rwlock));
+
+  if (job->fd >= 0)
+  {
+    cupsRWUnlock(&(client->printer->rwlock));
 
-  serverLogJob(SERVER_LOGLEVEL_INFO, job, "Creating job file \"%s\", format \"%s\".", filename, job->format);
+    serverRespondIPP(client, IPP_STATUS_ERROR_BUSY,
+                "Another document is being received for this job.");
+    httpFlush(client->http);
+    return;
+  }
 
-  job->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0600);
+  if ((doc = create_document(client, job, format, streaming)) != NULL)
+    job->fd = serverOpenDocument(job, doc);
 
   cupsRWUnlock(&(client->printer->rwlock));
 
-  if (job->fd < 0)
+  if (!doc)
+  {
+    httpFlush(client->http);
+    return;
+  }
+  else if (job->fd < 0)
   {
-    job->state = IPP_JSTATE_ABORTED;
+    int error = errno;			/* Open error */
+
+    abort_document(job, doc);
 
     serverRespondIPP(client, IPP_STATUS_ERROR_INTERNAL,
-                "Unable to create print file: %s", strerror(errno));
+                "Unable to create print file: %s", strerror(error));
     return;
   }
 
+  if (last_document)
+    serverCloseJob(job);
+
+  if (streaming)
+  {
+   /*
+    * Start processing the job while we receive the document data...
+    */
+
+    cupsRWLockWrite(&job->rwlock);
+
+    if (job->state == IPP_JSTATE_HELD)
+      job->state = IPP_JSTATE_PENDING;
+
+    job->state_reasons |= SERVER_JREASON_JOB_INCOMING;
+
+    cupsRWUnlock(&job->rwlock);
+
+    serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Streaming job file.");
+
+    serverCheckJobs(client->printer);
+  }
+
   while ((bytes = httpRead(client->http, buffer, sizeof(buffer))) > 0)
   {
     if (write(job->fd, buffer, (size_t)bytes) < bytes)
     {
       int error = errno;		/* Write error */
 
-      job->state = IPP_JSTATE_ABORTED;
-
       close(job->fd);
       job->fd = -1;
 
-      unlink(filename);
+      abort_document(job, doc);
+
+      if (!streaming)
+        unlink(doc->filename);
 
       serverRespondIPP(client, IPP_STATUS_ERROR_INTERNAL,
                   "Unable to write print file: %s", strerror(error));
       return;
     }
+
+    serverUpdateJobData(job, doc, (size_t)bytes, false);
   }
 
   if (bytes < 0)
@@ -6785,12 +7389,13 @@ ipp_send_document(server_client_t *client)/* I - Client */
     * Got an error while reading the print data, so abort this job.
     */
 
-    job->state = IPP_JSTATE_ABORTED;
-
     close(job->fd);
     job->fd = -1;
 
-    unlink(filename);
+    abort_document(job, doc);
+
+    if (!streaming)
+      unlink(doc->filename);
 
     serverRespondIPP(client, IPP_STATUS_ERROR_INTERNAL,
                 "Unable to read print file.");
@@ -6801,31 +7406,52 @@ ipp_send_document(server_client_t *client)/* I - Client */
   {
     int error = errno;			/* Write error */
 
-    job->state = IPP_JSTATE_ABORTED;
-    job->fd    = -1;
+    job->fd = -1;
 
-    unlink(filename);
+    abort_document(job, doc);
+
+    if (!streaming)
+      unlink(doc->filename);
 
     serverRespondIPP(client, IPP_STATUS_ERROR_INTERNAL,
                 "Unable to write print file: %s", strerror(error));
     return;
   }
 
-  cupsRWLockWrite(&(client->printer->rwlock));
+  if (streaming)
+  {
+   /*
+    * Let the processing thread know that all of the data has arrived...
+    */
 
-  job->fd       = -1;
-  job->filename = strdup(filename);
+    cupsRWLockWrite(&job->rwlock);
 
-  if (job->hold_until == 0)
-    job->state = IPP_JSTATE_PENDING;
+    job->fd            = -1;
+    job->state_reasons &= (server_jreason_t)~SERVER_JREASON_JOB_INCOMING;
 
-  cupsRWUnlock(&(client->printer->rwlock));
+    cupsRWUnlock(&job->rwlock);
 
- /*
-  * Process the job, if possible...
-  */
+    serverUpdateJobData(job, doc, 0, true);
+  }
+  else
+  {
+    cupsRWLockWrite(&(client->printer->rwlock));
 
-  serverCheckJobs(client->printer);
+    job->fd = -1;
+
+    if (job->hold_until == 0 && job->state == IPP_JSTATE_HELD)
+      job->state = IPP_JSTATE_PENDING;
+
+    cupsRWUnlock(&(client->printer->rwlock));
+
+    serverUpdateJobData(job, doc, 0, true);
+
+   /*
+    * Process the job, if possible...
+    */
+
+    serverCheckJobs(client->printer);
+  }
 
  /*
   * Return the job info...
@@ -6839,7 +7465,10 @@ ipp_send_document(server_client_t *client)/* I - Client */
   cupsArrayAdd(ra, "job-state-reasons");
   cupsArrayAdd(ra, "job-uri");
 
+  cupsRWLockRead(&job->rwlock);
   copy_job_attributes(client, job, ra, NULL);
+  cupsRWUnlock(&job->rwlock);
+
   cupsArrayDelete(ra);
 }
 
@@ -6861,6 +7490,8 @@ ipp_send_resource_data(
   char			filename[1024],	/* Filename buffer */
 			buffer[4096];	/* Copy buffer */
   ssize_t		bytes;		/* Bytes read */
+  server_sha256_t	sha256;		/* SHA-256 hash state */
+  unsigned char		digest[32];	/* SHA-256 digest of data */
 
 
   if (Authentication)
@@ -6955,6 +7586,8 @@ ipp_send_resource_data(
     return;
   }
 
+  serverSHA256Init(&sha256);
+
   while ((bytes = httpRead(client->http, buffer, sizeof(buffer))) > 0)
   {
     if (write(resource->fd, buffer, (size_t)bytes) < bytes)
@@ -6970,6 +7603,8 @@ ipp_send_resource_data(
       httpFlush(client->http);
       return;
     }
+
+    serverSHA256Update(&sha256, buffer, (size_t)bytes);
   }
 
   if (bytes < 0)
@@ -7001,7 +7636,14 @@ ipp_send_resource_data(
 
   resource->fd = -1;
 
-  serverAddResourceFile(resource, filename, format);
+ /*
+  * Add the file, sharing any identical data already stored for another
+  * resource...
+  */
+
+  serverSHA256Finish(&sha256, digest);
+
+  serverAddResourceFile(resource, filename, format, digest);
 
   if (signature)
   {
@@ -7041,6 +7683,7 @@ ipp_send_uri(server_client_t *client)	/* I - Client */
   server_job_t		*job;		/* Job information */
   const char		*uri;		/* document-uri */
   ipp_attribute_t	*attr;		/* Current attribute */
+  bool			last_document;	/* Last document in job? */
   cups_array_t		*ra;		/* Attributes to send in response */
 
 
@@ -7065,7 +7708,7 @@ ipp_send_uri(server_client_t *client)	/* I - Client */
     return;
   }
 
-  if (Authentication && !serverAuthorizeUser(client, job->username, SERVER_GROUP_NONE, JobPrivacyScope))
+  if (Authentication && !authorize_job(client, job, JobPrivacyScope))
   {
     serverRespondIPP(client, IPP_STATUS_ERROR_NOT_AUTHORIZED, "Not authorized to access this job.");
     return;
@@ -7076,17 +7719,17 @@ ipp_send_uri(server_client_t *client)	/* I - Client */
   * in a non-pending state...
   */
 
-  if (job->state > IPP_JSTATE_HELD)
+  if (job->state > IPP_JSTATE_PROCESSING || job->last_document)
   {
     serverRespondIPP(client, IPP_STATUS_ERROR_NOT_POSSIBLE,
-                "Job is not in a pending state.");
+                "Job is not accepting documents.");
     httpFlush(client->http);
     return;
   }
-  else if (job->filename || job->fd >= 0)
+  else if (job->fd >= 0)
   {
-    serverRespondIPP(client, IPP_STATUS_ERROR_MULTIPLE_JOBS_NOT_SUPPORTED,
-                "Multiple document jobs are not supported.");
+    serverRespondIPP(client, IPP_STATUS_ERROR_BUSY,
+                "Another document is being received for this job.");
     httpFlush(client->http);
     return;
   }
@@ -7099,14 +7742,15 @@ ipp_send_uri(server_client_t *client)	/* I - Client */
     httpFlush(client->http);
     return;
   }
-  else if (ippGetValueTag(attr) != IPP_TAG_BOOLEAN || ippGetCount(attr) != 1 ||
-           !ippGetBoolean(attr, 0))
+  else if (ippGetValueTag(attr) != IPP_TAG_BOOLEAN || ippGetCount(attr) != 1)
   {
     serverRespondUnsupported(client, attr);
     httpFlush(client->http);
     return;
   }
 
+  last_document = ippGetBoolean(attr, 0);
+
  /*
   * Validate document attributes...
   */
@@ -7117,11 +7761,6 @@ ipp_send_uri(server_client_t *client)	/* I - Client */
     return;
   }
 
-  if (!job->doc_attrs)
-    job->doc_attrs = ippNew();
-
-  serverCopyAttributes(job->doc_attrs, client->request, NULL, NULL, IPP_TAG_JOB, false);
-
  /*
   * Do we have a file to print?
   */
@@ -7157,9 +7796,12 @@ ipp_send_uri(server_client_t *client)	/* I - Client */
   else
     job->format = "application/octet-stream";
 
-  if (copy_document_uri(client, job, uri) && job->hold_until == 0)
+  if (copy_document_uri(client, job, uri) && job->hold_until == 0 && job->state == IPP_JSTATE_HELD)
     job->state = IPP_JSTATE_PENDING;
 
+  if (last_document)
+    serverCloseJob(job);
+
  /*
   * Process the job, if possible...
   */
@@ -7179,7 +7821,10 @@ ipp_send_uri(server_client_t *client)	/* I - Client */
   cupsArrayAdd(ra, "job-state-reasons");
   cupsArrayAdd(ra, "job-uri");
 
+  cupsRWLockRead(&job->rwlock);
   copy_job_attributes(client, job, ra, NULL);
+  cupsRWUnlock(&job->rwlock);
+
   cupsArrayDelete(ra);
 }
 
@@ -7195,7 +7840,7 @@ ipp_set_document_attributes(
   server_job_t		*job;		/* Job information */
   const char		*name;		/* Name of attribute */
   ipp_attribute_t	*attr;		/* Current attribute */
-  int			doc_number;	/* Document number value */
+  server_document_t	*doc;		/* Document */
 
 
   if (Authentication && !client->username[0])
@@ -7218,26 +7863,18 @@ ipp_set_document_attributes(
     return;
   }
 
-  if (Authentication && !serverAuthorizeUser(client, job->username, SERVER_GROUP_NONE, JobPrivacyScope))
+  if (Authentication && !authorize_job(client, job, JobPrivacyScope))
   {
     serverRespondIPP(client, IPP_STATUS_ERROR_NOT_AUTHORIZED, "Not authorized to access this job.");
     return;
   }
 
-  if ((attr = ippFindAttribute(client->request, "document-number", IPP_TAG_ZERO)) == NULL || ippGetGroupTag(attr) != IPP_TAG_OPERATION || ippGetValueTag(attr) != IPP_TAG_INTEGER || ippGetCount(attr) != 1)
-  {
-    serverRespondIPP(client, IPP_STATUS_ERROR_BAD_REQUEST, attr ? "Bad 'document-number' attribute in request." : "Missing 'document-number' attribute in request.");
-    return;
-  }
-  else if ((doc_number = ippGetInteger(attr, 0)) != 1)
-  {
-    serverRespondIPP(client, IPP_STATUS_ERROR_NOT_FOUND, "Document #%d does not exist.", doc_number);
+  if ((doc = find_document(client, job)) == NULL)
     return;
-  }
 
-  if (job->state >= IPP_JSTATE_PROCESSING)
+  if (job->state >= IPP_JSTATE_PROCESSING && doc->state >= IPP_JSTATE_PROCESSING)
   {
-    serverRespondIPP(client, IPP_STATUS_ERROR_NOT_POSSIBLE, "Job is not in a pending/pending-held state.");
+    serverRespondIPP(client, IPP_STATUS_ERROR_NOT_POSSIBLE, "Document is not in a pending state.");
     return;
   }
 
@@ -7263,15 +7900,14 @@ ipp_set_document_attributes(
     if (ippGetGroupTag(attr) != IPP_TAG_DOCUMENT || !name)
       continue;
 
-    if ((old_attr = ippFindAttribute(job->doc_attrs, name, IPP_TAG_ZERO)) != NULL)
-      ippDeleteAttribute(job->doc_attrs, old_attr);
+    if ((old_attr = ippFindAttribute(doc->attrs, name, IPP_TAG_ZERO)) != NULL)
+      ippDeleteAttribute(doc->attrs, old_attr);
 
-    if (!job->doc_attrs)
-      job->doc_attrs = ippNew();
-
-    ippCopyAttribute(job->doc_attrs, attr, 0);
+    ippCopyAttribute(doc->attrs, attr, 0);
   }
 
+  serverAddDocumentEventNoLock(job, doc, SERVER_EVENT_DOCUMENT_CONFIG_CHANGED, "Document #%d attributes changed.", doc->number);
+
   cupsRWUnlock(&job->rwlock);
 
   serverRespondIPP(client, IPP_STATUS_OK, NULL);
@@ -7311,7 +7947,7 @@ ipp_set_job_attributes(
     return;
   }
 
-  if (Authentication && !serverAuthorizeUser(client, job->username, SERVER_GROUP_NONE, JobPrivacyScope))
+  if (Authentication && !authorize_job(client, job, JobPrivacyScope))
   {
     serverRespondIPP(client, IPP_STATUS_ERROR_NOT_AUTHORIZED, "Not authorized to access this job.");
     return;
@@ -7400,6 +8036,8 @@ ipp_set_printer_attributes(
   ipp_attribute_t	*attr,		/* Current attribute */
 			*settable;	/* Settable values */
   const char		*value;		/* Attribute value */
+  bool			geo_changed = false;
+					/* Did printer-geo-location change? */
 
 
   if (Authentication)
@@ -7431,7 +8069,7 @@ ipp_set_printer_attributes(
 
   settable = ippFindAttribute(printer->pinfo.attrs, "printer-settable-attributes-supported", IPP_TAG_KEYWORD);
 
-  if (!valid_values(client, IPP_TAG_PRINTER, settable, sizeof(printer_values) / sizeof(printer_values[0]), printer_values))
+  if (!valid_values(client, IPP_TAG_PRINTER, printer, settable, sizeof(printer_values) / sizeof(printer_values[0]), printer_values))
   {
     cupsRWUnlock(&printer->rwlock);
     return;
@@ -7537,6 +8175,7 @@ ipp_set_printer_attributes(
 
       printer->dns_sd_update = true;
       DNSSDUpdate            = true;
+      geo_changed            = true;
     }
     else if (!strcmp(name, "printer-name"))
     {
@@ -7551,6 +8190,11 @@ ipp_set_printer_attributes(
     }
     else
     {
+     /*
+      * Capability values may be shared with other printers, so always replace
+      * the attribute rather than updating it in place...
+      */
+
       if (old_attr)
         ippDeleteAttribute(printer->pinfo.attrs, old_attr);
 
@@ -7558,8 +8202,15 @@ ipp_set_printer_attributes(
     }
   }
 
+  serverUpdatePrinterSupportedNoLock(printer);
+
   cupsRWUnlock(&printer->rwlock);
 
+  if (geo_changed)
+    serverUpdatePrinterIndex(printer);
+
+  serverSaveSystemLater(printer);
+
   serverRespondIPP(client, IPP_STATUS_OK, NULL);
 }
 
@@ -7625,7 +8276,7 @@ ipp_set_resource_attributes(
 
   settable = ippFindAttribute(SystemAttributes, "resource-settable-attributes-supported", IPP_TAG_KEYWORD);
 
-  if (!valid_values(client, IPP_TAG_RESOURCE, settable, sizeof(values) / sizeof(values[0]), values))
+  if (!valid_values(client, IPP_TAG_RESOURCE, NULL, settable, sizeof(values) / sizeof(values[0]), values))
     return;
 
   cupsRWLockWrite(&resource->rwlock);
@@ -7703,7 +8354,7 @@ ipp_set_system_attributes(
 
   settable = ippFindAttribute(SystemAttributes, "system-settable-attributes-supported", IPP_TAG_KEYWORD);
 
-  if (!valid_values(client, IPP_TAG_SYSTEM, settable, sizeof(values) / sizeof(values[0]), values))
+  if (!valid_values(client, IPP_TAG_SYSTEM, NULL, settable, sizeof(values) / sizeof(values[0]), values))
     goto unlock_system;
 
   if ((attr = ippFindAttribute(client->request, "system-owner-col", IPP_TAG_BEGIN_COLLECTION)) != NULL)
@@ -7843,6 +8494,8 @@ ipp_shutdown_all_printers(
 
   cupsRWUnlock(&PrintersRWLock);
 
+  serverSaveSystem(true);
+
   serverRespondIPP(client, IPP_STATUS_OK, NULL);
 }
 
@@ -7886,6 +8539,8 @@ ipp_shutdown_printer(
 
   cupsRWUnlock(&client->printer->rwlock);
 
+  serverSaveSystemLater(client->printer);
+
   serverRespondIPP(client, IPP_STATUS_OK, NULL);
 }
 
@@ -7954,11 +8609,17 @@ ipp_startup_all_printers(
 	cupsRWUnlock(&printer->rwlock);
 	serverCheckJobs(printer);
       }
+      else
+      {
+	cupsRWUnlock(&printer->rwlock);
+      }
     }
   }
 
   cupsRWUnlock(&PrintersRWLock);
 
+  serverSaveSystem(true);
+
   serverRespondIPP(client, IPP_STATUS_OK, NULL);
 }
 
@@ -8018,8 +8679,14 @@ ipp_startup_printer(
 
       serverCheckJobs(client->printer);
     }
+    else
+    {
+      cupsRWUnlock(&client->printer->rwlock);
+    }
   }
 
+  serverSaveSystemLater(client->printer);
+
   serverRespondIPP(client, IPP_STATUS_OK, NULL);
 }
 
@@ -8160,6 +8827,7 @@ ipp_update_document_status(
 {
   server_device_t	*device;	/* Device */
   server_job_t		*job;		/* Job */
+  server_document_t	*doc;		/* Document */
   ipp_attribute_t	*attr;		/* Attribute */
 
 
@@ -8200,11 +8868,8 @@ ipp_update_document_status(
     return;
   }
 
-  if ((attr = ippFindAttribute(client->request, "document-number", IPP_TAG_ZERO)) == NULL || ippGetGroupTag(attr) != IPP_TAG_OPERATION || ippGetValueTag(attr) != IPP_TAG_INTEGER || ippGetCount(attr) != 1 || ippGetInteger(attr, 0) != 1)
-  {
-    serverRespondIPP(client, IPP_STATUS_ERROR_BAD_REQUEST, attr ? "Bad document-number attribute." : "Missing document-number attribute.");
+  if ((doc = find_document(client, job)) == NULL)
     return;
-  }
 
   if ((attr = ippFindAttribute(client->request, "impressions-completed", IPP_TAG_INTEGER)) != NULL)
   {
@@ -8212,6 +8877,24 @@ ipp_update_document_status(
     serverAddEventNoLock(client->printer, job, NULL, SERVER_EVENT_JOB_PROGRESS, NULL);
   }
 
+  if ((attr = ippFindAttribute(client->request, "output-device-document-state", IPP_TAG_ENUM)) != NULL && ippGetInteger(attr, 0) >= IPP_JSTATE_PENDING && ippGetInteger(attr, 0) <= IPP_JSTATE_COMPLETED)
+  {
+    cupsRWLockWrite(&job->rwlock);
+
+    doc->state = (ipp_jstate_t)ippGetInteger(attr, 0);
+
+    if (doc->state >= IPP_JSTATE_CANCELED)
+    {
+      doc->completed = time(NULL);
+
+      serverAddDocumentEventNoLock(job, doc, SERVER_EVENT_DOCUMENT_STATE_CHANGED | SERVER_EVENT_DOCUMENT_COMPLETED, NULL);
+    }
+    else
+      serverAddDocumentEventNoLock(job, doc, SERVER_EVENT_DOCUMENT_STATE_CHANGED, NULL);
+
+    cupsRWUnlock(&job->rwlock);
+  }
+
   serverRespondIPP(client, IPP_STATUS_OK, NULL);
 }
 
@@ -8294,6 +8977,8 @@ ipp_update_job_status(
       cupsArrayAdd(job->printer->completed_jobs, job);
       cupsArrayRemove(job->printer->active_jobs, job);
 
+      serverCompactJobNoLock(job);
+
       if (MaxCompletedJobs > 0)
       {
         // Make sure the job history doesn't go over the limit...
@@ -8304,9 +8989,12 @@ ipp_update_job_status(
 	  if (tjob == job)
 	    tjob = (server_job_t *)cupsArrayGetNext(job->printer->completed_jobs);
 
+	  serverArchiveJobNoLock(tjob);
 	  cupsArrayRemove(job->printer->completed_jobs, tjob);
 	  cupsArrayRemove(job->printer->jobs, tjob); /* Removing here calls serverDeleteJob */
 	}
+
+	serverUpdateJobListNoLock(job->printer);
       }
     }
   }
@@ -8733,6 +9421,23 @@ serverProcessIPP(
   client->operation_id = ippGetOperation(client->request);
   client->response     = ippNewResponse(client->request);
 
+ /*
+  * Apply rate limits and wait for our turn - job control and administrative
+  * requests don't wait behind queries...
+  */
+
+  if (!serverCheckRateLimit(client, serverGetOperationLimit(client->operation_id)))
+  {
+    serverRespondIPP(client, IPP_STATUS_ERROR_BUSY, "Too many requests, try again in %d seconds.", client->retry_after);
+    goto send_response;
+  }
+
+  if (!serverStartRequest(client))
+  {
+    serverRespondIPP(client, IPP_STATUS_ERROR_BUSY, "Too many requests, try again in %d seconds.", client->retry_after);
+    goto send_response;
+  }
+
  /*
   * Then validate the request header and required attributes...
   */
@@ -8890,7 +9595,10 @@ serverProcessIPP(
 
 	  if ((client->printer = serverFindPrinter(resource)) == NULL)
 	  {
-	    serverRespondIPP(client, IPP_STATUS_ERROR_NOT_FOUND, "\"%s\" '%s' not found.", name, ippGetString(uri, 0, NULL));
+	    if (PrintersLoading)
+	      serverRespondIPP(client, IPP_STATUS_ERROR_SERVICE_UNAVAILABLE, "Printers are still loading, try again later.");
+	    else
+	      serverRespondIPP(client, IPP_STATUS_ERROR_NOT_FOUND, "\"%s\" '%s' not found.", name, ippGetString(uri, 0, NULL));
 	    goto send_response;
 	  }
 	}
@@ -8899,7 +9607,10 @@ serverProcessIPP(
       {
 	if (strcmp(resource, "/ipp/system"))
 	{
-	  serverRespondIPP(client, IPP_STATUS_ERROR_NOT_FOUND, "\"%s\" '%s' not found.", name, ippGetString(uri, 0, NULL));
+	  if (PrintersLoading)
+	    serverRespondIPP(client, IPP_STATUS_ERROR_SERVICE_UNAVAILABLE, "Printers are still loading, try again later.");
+	  else
+	    serverRespondIPP(client, IPP_STATUS_ERROR_NOT_FOUND, "\"%s\" '%s' not found.", name, ippGetString(uri, 0, NULL));
 	  goto send_response;
 	}
       }
@@ -9348,6 +10059,8 @@ serverProcessIPP(
 
   send_response:
 
+  serverFinishRequest(client);
+
   if (httpGetState(client->http) != HTTP_STATE_WAITING)
   {
     if (httpGetState(client->http) != HTTP_STATE_POST_SEND)
@@ -9422,6 +10135,30 @@ serverRespondUnsupported(
 }
 
 
+/*
+ * 'mark_document_fetched()' - Mark a pending document as being processed by
+ *                             an output device.
+ */
+
+static void
+mark_document_fetched(
+    server_job_t      *job,		/* I - Job */
+    server_document_t *doc)		/* I - Document */
+{
+  cupsRWLockWrite(&job->rwlock);
+
+  if (doc->state == IPP_JSTATE_PENDING)
+  {
+    doc->state      = IPP_JSTATE_PROCESSING;
+    doc->processing = time(NULL);
+
+    serverAddDocumentEventNoLock(job, doc, SERVER_EVENT_DOCUMENT_STATE_CHANGED, "Document #%d fetched.", doc->number);
+  }
+
+  cupsRWUnlock(&job->rwlock);
+}
+
+
 /*
  * 'respond_unsettable()' - Respond with an unsettable attribute.
  */
@@ -9442,6 +10179,58 @@ respond_unsettable(
 }
 
 
+/*
+ * 'start_stream()' - Start a streamed IPP response.
+ *
+ * The HTTP response header and the IPP message header and operation
+ * attributes are sent immediately using chunked encoding.  Each object group
+ * is then added to an empty "client->response" and sent with `write_stream`,
+ * and `finish_stream` sends the end-of-attributes tag.
+ */
+
+static bool				/* O - `true` on success, `false` on error */
+start_stream(server_client_t *client)	/* I - Client */
+{
+  unsigned char	*data;			/* Encoded IPP message */
+  size_t	datalen;		/* Length of encoded IPP message */
+  bool		ret;			/* Return value */
+
+
+  if (httpGetState(client->http) != HTTP_STATE_POST_SEND)
+    httpFlush(client->http);		/* Flush trailing (junk) data */
+
+  serverLogAttributes(client, "Response:", client->response, 2);
+
+  serverLogClient(SERVER_LOGLEVEL_INFO, client, "%s", httpStatusString(HTTP_STATUS_OK));
+
+  if ((data = serverPackAttributes(client->response, &datalen)) == NULL)
+    return (false);
+
+  httpClearFields(client->http);
+  httpSetField(client->http, HTTP_FIELD_CONTENT_TYPE, "application/ipp");
+
+  httpSetLength(client->http, 0);
+  if (!httpWriteResponse(client->http, HTTP_STATUS_OK))
+  {
+    free(data);
+    return (false);
+  }
+
+ /*
+  * Send everything but the end-of-attributes tag...
+  */
+
+  ret = httpWrite(client->http, (char *)data, datalen - 1) >= 0;
+
+  free(data);
+
+  ippDelete(client->response);
+  client->response = ippNew();
+
+  return (ret);
+}
+
+
 /*
  * 'valid_doc_attributes()' - Determine whether the document attributes are
  *                            valid.
@@ -9454,13 +10243,13 @@ static bool				/* O - `true` if valid, `false` if not */
 valid_doc_attributes(
     server_client_t *client)		/* I - Client */
 {
-  bool			valid = true;	/* Valid attributes? */
+  bool			valid = true,	/* Valid attributes? */
+			is_supported;	/* Is the value supported? */
   ipp_op_t		op = ippGetOperation(client->request);
 					/* IPP operation */
   const char		*op_name = ippOpString(op);
 					/* IPP operation name */
-  ipp_attribute_t	*attr,		/* Current attribute */
-			*supported;	/* xxx-supported attribute */
+  ipp_attribute_t	*attr;		/* Current attribute */
   const char		*compression = NULL,
 					/* compression value */
 			*format = NULL;	/* document-format value */
@@ -9478,14 +10267,16 @@ valid_doc_attributes(
     */
 
     compression = ippGetString(attr, 0, NULL);
-    supported   = ippFindAttribute(client->printer->pinfo.attrs,
-                                   "compression-supported", IPP_TAG_KEYWORD);
+
+    cupsRWLockRead(&client->printer->rwlock);
+    is_supported = serverIsSupportedStringNoLock(client->printer, "compression-supported", compression);
+    cupsRWUnlock(&client->printer->rwlock);
 
     if (ippGetCount(attr) != 1 || ippGetValueTag(attr) != IPP_TAG_KEYWORD ||
         ippGetGroupTag(attr) != IPP_TAG_OPERATION ||
         (op != IPP_OP_PRINT_JOB && op != IPP_OP_SEND_DOCUMENT &&
          op != IPP_OP_VALIDATE_JOB) ||
-        !ippContainsString(supported, compression))
+        !is_supported)
     {
       serverRespondUnsupported(client, attr);
       valid = false;
@@ -9550,10 +10341,17 @@ valid_doc_attributes(
     }
   }
 
-  if ((op == IPP_OP_PRINT_JOB || op == IPP_OP_SEND_DOCUMENT) && (supported = ippFindAttribute(client->printer->pinfo.attrs, "document-format-supported", IPP_TAG_MIMETYPE)) != NULL && !ippContainsString(supported, format) && attr && ippGetGroupTag(attr) == IPP_TAG_OPERATION)
+  if ((op == IPP_OP_PRINT_JOB || op == IPP_OP_SEND_DOCUMENT) && attr && ippGetGroupTag(attr) == IPP_TAG_OPERATION)
   {
-    serverRespondUnsupported(client, attr);
-    valid = false;
+    cupsRWLockRead(&client->printer->rwlock);
+    is_supported = !cupsArrayFind(client->printer->supported, "document-format-supported") || serverIsSupportedStringNoLock(client->printer, "document-format-supported", format);
+    cupsRWUnlock(&client->printer->rwlock);
+
+    if (!is_supported)
+    {
+      serverRespondUnsupported(client, attr);
+      valid = false;
+    }
   }
 
   return (valid);
@@ -9686,7 +10484,7 @@ valid_job_attributes(
     }
   }
 
-  if (!valid_values(client, IPP_TAG_JOB, supported, sizeof(job_values) / sizeof(job_values[0]), job_values))
+  if (!valid_values(client, IPP_TAG_JOB, client->printer, supported, sizeof(job_values) / sizeof(job_values[0]), job_values))
   {
     cupsRWUnlock(&client->printer->rwlock);
     return (false);
@@ -9704,6 +10502,8 @@ valid_job_attributes(
   * Check the various job template attributes...
   */
 
+  cupsRWLockRead(&client->printer->rwlock);
+
   if ((attr = ippFindAttribute(client->request, "copies", IPP_TAG_ZERO)) != NULL)
   {
     if (ippGetCount(attr) != 1 || ippGetValueTag(attr) != IPP_TAG_INTEGER ||
@@ -9725,9 +10525,7 @@ valid_job_attributes(
 
   if ((attr = ippFindAttribute(client->request, "job-hold-until", IPP_TAG_ZERO)) != NULL)
   {
-    supported = ippFindAttribute(client->printer->pinfo.attrs, "job-hold-until-supported", IPP_TAG_ZERO);
-
-    if (!ippContainsString(supported, ippGetString(attr, 0, NULL)))
+    if (!serverIsSupportedStringNoLock(client->printer, "job-hold-until-supported", ippGetString(attr, 0, NULL)))
     {
       serverRespondUnsupported(client, attr);
       valid = false;
@@ -9770,9 +10568,7 @@ valid_job_attributes(
 
   if ((attr = ippFindAttribute(client->request, "job-sheets", IPP_TAG_ZERO)) != NULL)
   {
-    supported = ippFindAttribute(client->printer->pinfo.attrs, "job-sheets-supported", IPP_TAG_ZERO);
-
-    if (!ippContainsString(supported, ippGetString(attr, 0, NULL)))
+    if (!serverIsSupportedStringNoLock(client->printer, "job-sheets-supported", ippGetString(attr, 0, NULL)))
     {
       serverRespondUnsupported(client, attr);
       valid = false;
@@ -9793,9 +10589,7 @@ valid_job_attributes(
 
   if ((attr = ippFindAttribute(client->request, "multiple-document-handling", IPP_TAG_ZERO)) != NULL)
   {
-    supported = ippFindAttribute(client->printer->pinfo.attrs, "multiple-document-handling-supported", IPP_TAG_KEYWORD);
-
-    if (!ippContainsString(supported, ippGetString(attr, 0, NULL)))
+    if (!serverIsSupportedStringNoLock(client->printer, "multiple-document-handling-supported", ippGetString(attr, 0, NULL)))
     {
       serverRespondUnsupported(client, attr);
       valid = false;
@@ -9876,37 +10670,17 @@ valid_job_attributes(
 
   if ((attr = ippFindAttribute(client->request, "printer-resolution", IPP_TAG_ZERO)) != NULL)
   {
-    if ((supported = ippFindAttribute(client->printer->dev_attrs, "printer-resolution-supported", IPP_TAG_RESOLUTION)) == NULL)
-      supported = ippFindAttribute(client->printer->pinfo.attrs, "printer-resolution-supported", IPP_TAG_RESOLUTION);
+    int		xdpi,			/* Horizontal resolution for job template attribute */
+		ydpi;			/* Vertical resolution for job template attribute */
+    ipp_res_t	units;			/* Units for job template attribute */
 
-    if (!supported)
+    xdpi = ippGetResolution(attr, 0, &ydpi, &units);
+
+    if (!serverIsSupportedResolutionNoLock(client->printer, xdpi, ydpi, units))
     {
       serverRespondUnsupported(client, attr);
       valid = false;
     }
-    else
-    {
-      int	xdpi,			/* Horizontal resolution for job template attribute */
-		ydpi,			/* Vertical resolution for job template attribute */
-		sydpi;			/* Vertical resolution for supported value */
-      ipp_res_t	units,			/* Units for job template attribute */
-		sunits;			/* Units for supported value */
-
-      xdpi  = ippGetResolution(attr, 0, &ydpi, &units);
-      count = ippGetCount(supported);
-
-      for (i = 0; i < count; i ++)
-      {
-        if (xdpi == ippGetResolution(supported, i, &sydpi, &sunits) && ydpi == sydpi && units == sunits)
-          break;
-      }
-
-      if (i >= count)
-      {
-	serverRespondUnsupported(client, attr);
-	valid = false;
-      }
-    }
   }
 
   if ((attr = ippFindAttribute(client->request, "sides", IPP_TAG_ZERO)) != NULL)
@@ -9914,19 +10688,15 @@ valid_job_attributes(
     const char *sides = ippGetString(attr, 0, NULL);
 					/* "sides" value... */
 
-    if ((supported = ippFindAttribute(client->printer->dev_attrs, "sides-supported", IPP_TAG_KEYWORD)) == NULL)
-      supported = ippFindAttribute(client->printer->pinfo.attrs, "sides-supported", IPP_TAG_KEYWORD);
-
-    if (!ippContainsString(supported, sides) && strcmp(sides, "one-sided"))
+    if (!serverIsSupportedStringNoLock(client->printer, "sides-supported", sides) && (!sides || strcmp(sides, "one-sided")))
     {
-      if (!ippContainsString(supported, sides))
-      {
-	serverRespondUnsupported(client, attr);
-	valid = false;
-      }
+      serverRespondUnsupported(client, attr);
+      valid = false;
     }
   }
 
+  cupsRWUnlock(&client->printer->rwlock);
+
   return (valid);
 }
 
@@ -9940,13 +10710,7 @@ valid_media(
     server_client_t *client,		// I - Client connection
     ipp_attribute_t *attr)		// I - Attribute
 {
-  ipp_attribute_t	*supported;	// "orientation-requested-supported" attribute
-
-
-  if ((supported = ippFindAttribute(client->printer->dev_attrs, "media-supported", IPP_TAG_KEYWORD)) == NULL)
-    supported = ippFindAttribute(client->printer->pinfo.attrs, "media-supported", IPP_TAG_KEYWORD);
-
-  if (!ippContainsString(supported, ippGetString(attr, 0, NULL)))
+  if (!serverIsSupportedStringNoLock(client->printer, "media-supported", ippGetString(attr, 0, NULL)))
   {
     serverRespondUnsupported(client, attr);
     return (false);
@@ -9967,16 +10731,11 @@ valid_media_col(
     server_client_t *client,		// I - Client connection
     ipp_attribute_t *attr)		// I - Attribute
 {
-  size_t	i,			// Looping var
-		count;			// Number of values
-  ipp_attribute_t *supported;		// "xxx-supported" attribute
   ipp_t		*col,			// media-col collection
 		*size;			// media-size collection
   ipp_attribute_t *member,		// Member attribute
 		*x_dim,			// x-dimension
 		*y_dim;			// y-dimension
-  int		x_value,		// y-dimension value
-		y_value;		// x-dimension value
 
 
   if (ippGetCount(attr) != 1 || ippGetValueTag(attr) != IPP_TAG_BEGIN_COLLECTION)
@@ -9999,10 +10758,7 @@ valid_media_col(
     }
     else
     {
-      if ((supported = ippFindAttribute(client->printer->dev_attrs, "media-supported", IPP_TAG_KEYWORD)) == NULL)
-	supported = ippFindAttribute(client->printer->pinfo.attrs, "media-supported", IPP_TAG_KEYWORD);
-
-      if (!ippContainsString(supported, ippGetString(member, 0, NULL)))
+      if (!serverIsSupportedStringNoLock(client->printer, "media-supported", ippGetString(member, 0, NULL)))
       {
 	serverRespondUnsupported(client, attr);
 	return (false);
@@ -10020,36 +10776,16 @@ valid_media_col(
     {
       size = ippGetCollection(member, 0);
 
-      if ((supported = ippFindAttribute(client->printer->dev_attrs, "media-size-supported", IPP_TAG_BEGIN_COLLECTION)) == NULL)
-	supported = ippFindAttribute(client->printer->pinfo.attrs, "media-size-supported", IPP_TAG_BEGIN_COLLECTION);
-
       if ((x_dim = ippFindAttribute(size, "x-dimension", IPP_TAG_INTEGER)) == NULL || ippGetCount(x_dim) != 1 ||
 	  (y_dim = ippFindAttribute(size, "y-dimension", IPP_TAG_INTEGER)) == NULL || ippGetCount(y_dim) != 1)
       {
 	serverRespondUnsupported(client, attr);
 	return (false);
       }
-      else if (supported)
+      else if (!serverIsSupportedMediaSizeNoLock(client->printer, ippGetInteger(x_dim, 0), ippGetInteger(y_dim, 0)))
       {
-	x_value   = ippGetInteger(x_dim, 0);
-	y_value   = ippGetInteger(y_dim, 0);
-	count     = ippGetCount(supported);
-
-	for (i = 0; i < count ; i ++)
-	{
-	  size  = ippGetCollection(supported, i);
-	  x_dim = ippFindAttribute(size, "x-dimension", IPP_TAG_ZERO);
-	  y_dim = ippFindAttribute(size, "y-dimension", IPP_TAG_ZERO);
-
-	  if (ippContainsInteger(x_dim, x_value) && ippContainsInteger(y_dim, y_value))
-	    break;
-	}
-
-	if (i >= count)
-	{
-	  serverRespondUnsupported(client, attr);
-	  return (false);
-	}
+	serverRespondUnsupported(client, attr);
+	return (false);
       }
     }
   }
@@ -10067,12 +10803,7 @@ valid_orientation(
     server_client_t *client,		// I - Client connection
     ipp_attribute_t *attr)		// I - Attribute
 {
-  ipp_attribute_t	*supported;	// "orientation-requested-supported" attribute
-
-
-  supported = ippFindAttribute(client->printer->pinfo.attrs, "orientation-requested-supported", IPP_TAG_ENUM);
-
-  if (ippGetCount(attr) != 1 || ippGetValueTag(attr) != IPP_TAG_ENUM || !ippContainsInteger(supported, ippGetInteger(attr, 0)))
+  if (ippGetCount(attr) != 1 || ippGetValueTag(attr) != IPP_TAG_ENUM || !serverIsSupportedIntegerNoLock(client->printer, "orientation-requested-supported", ippGetInteger(attr, 0)))
   {
     serverRespondUnsupported(client, attr);
     return (false);
@@ -10090,11 +10821,12 @@ valid_orientation(
 
 static bool				/* O - `true` if valid, `false` if not */
 valid_values(
-    server_client_t *client,		/* I - Client connection */
-    ipp_tag_t       group_tag,		/* I - Group to check */
-    ipp_attribute_t *supported,		/* I - List of supported attributes */
-    size_t          num_values,		/* I - Number of values to check */
-    server_value_t  *values)		/* I - Values to check */
+    server_client_t  *client,		/* I - Client connection */
+    ipp_tag_t        group_tag,		/* I - Group to check */
+    server_printer_t *printer,		/* I - Printer with "supported" in its index or `NULL` */
+    ipp_attribute_t  *supported,	/* I - List of supported attributes */
+    size_t           num_values,	/* I - Number of values to check */
+    server_value_t   *values)		/* I - Values to check */
 {
   ipp_attribute_t	*attr;		/* Current attribute */
   ipp_tag_t		value_tag;	/* Value tag for attribute */
@@ -10116,7 +10848,7 @@ valid_values(
       if (!name || ippGetGroupTag(attr) != group_tag)
         continue;
 
-      if (!ippContainsString(supported, name))
+      if (printer ? !serverIsSupportedStringNoLock(printer, ippGetName(supported), name) : !ippContainsString(supported, name))
       {
         if (set_op)
 	  respond_unsettable(client, attr);
@@ -10162,62 +10894,41 @@ valid_values(
 
 
 /*
- * 'wgs84_distance()' - Approximate the distance between two geo: values.
+ * 'write_stream()' - Send the attributes in "client->response" as part of a
+ *                    streamed IPP response.
+ *
+ * The read lane slot is released while writing so that a slow client doesn't
+ * keep other queries waiting.
  */
 
-#ifndef M_PI				/* Should never happen, but happens on Windows... */
-#  define M_PI		3.14159265358979323846
-#endif /* !M_PI */
-#define M_PER_DEG	111120.0	/* Meters per degree of latitude */
-
-static float				/* O - Distance in meters */
-wgs84_distance(const char *a,		/* I - First geo: value */
-               const char *b)		/* I - Second geo: value */
+static bool				/* O - `true` on success, `false` on error */
+write_stream(server_client_t *client)	/* I - Client */
 {
-  char		*ptr;			/* Pointer into string */
-  double	a_lat, a_lon, a_alt;	/* First latitude, longitude, altitude */
-  double	b_lat, b_lon, b_alt;	/* First latitude, longitude, altitude */
-  double	d_lat, d_lon, d_alt;	/* Difference in positions */
+  unsigned char	*data;			/* Encoded IPP message */
+  size_t	datalen;		/* Length of encoded IPP message */
+  bool		ret;			/* Return value */
 
 
+  if ((data = serverPackAttributes(client->response, &datalen)) == NULL)
+    return (false);
+
  /*
-  * Decode the geo: values...
+  * Skip the 8-byte message header and the end-of-attributes tag...
   */
 
-  a_lat = strtod(a + 4, &ptr);
-  if (*ptr != ',')
-    return (999999.0);			/* Large value = error */
-  a_lon = strtod(ptr + 1, &ptr);
-  if (*ptr != ',')
-    a_alt = 0.0;
-  else
-    a_alt = strtod(ptr + 1, NULL);
-
-  b_lat = strtod(b + 4, &ptr);
-  if (*ptr != ',')
-    return (999999.0);			/* Large value = error */
-  b_lon = strtod(ptr + 1, &ptr);
-  if (*ptr != ',')
-    b_alt = 0.0;
+  serverFinishRequest(client);
+
+  if (datalen > 9)
+    ret = httpWrite(client->http, (char *)data + 8, datalen - 9) >= 0;
   else
-    b_alt = strtod(ptr + 1, NULL);
+    ret = true;
 
- /*
-  * Approximate the distance between the two points.
-  *
-  * Note: This calculation is not meant to be used for navigation or other
-  * serious uses of WGS-84 coordinates.  Rather, we are simply calculating the
-  * angular distance between the two coordinates on a sphere (vs. the WGS-84
-  * ellipsoid) and then multiplying by an approximate number of meters between
-  * each degree of latitude and longitude.  The error bars on this calculation
-  * are reasonable for local comparisons (<1m error over 1 degree of latitude
-  * change) and completely unreasonable for distant comparisons.  You have been
-  * warned! :)
-  */
+  free(data);
+
+  serverResumeRequest(client);
 
-  d_lat = M_PER_DEG * (a_lat - b_lat);
-  d_lon = M_PER_DEG * cos((a_lat + b_lat) * M_PI / 360.0) * (a_lon - b_lon);
-  d_alt = a_alt - b_alt;
+  ippDelete(client->response);
+  client->response = ippNew();
 
-  return ((float)sqrt(d_lat * d_lat + d_lon * d_lon + d_alt * d_alt));
+  return (ret);
 }
@@ -83,6 +83,9 @@ extern char **environ;
 /* ippget event lifetime is 5 minutes */
 #  define SERVER_IPPGET_EVENT_LIFE			300
 
+/* Multiple document jobs are aborted after 1 minute without a new document */
+#  define SERVER_MULTIPLE_OPERATION_TIME_OUT		60
+
 /* URL schemes and DNS-SD types for IPP and web resources... */
 #  define SERVER_IPP_SCHEME "ipp"
 #  define SERVER_IPP_TYPE "_ipp._tcp"
@@ -354,6 +357,22 @@ VALUE({					/* Strings for bits */
   "hold-new-jobs"
 });
 
+typedef enum server_lane_e		/* Request lanes */
+{
+  SERVER_LANE_READ,			/* Queries */
+  SERVER_LANE_JOB,			/* Job submission */
+  SERVER_LANE_CONTROL,			/* Job control and administration */
+  SERVER_LANE_MAX			/* Number of lanes */
+} server_lane_t;
+
+typedef enum server_limit_e		/* Rate limit classes */
+{
+  SERVER_LIMIT_READ,			/* Queries and web pages */
+  SERVER_LIMIT_JOB,			/* Job submission */
+  SERVER_LIMIT_ADMIN,			/* Printer and system administration */
+  SERVER_LIMIT_MAX			/* Number of limit classes */
+} server_limit_t;
+
 typedef enum server_transform_e		/* Transform modes for server */
 {
   SERVER_TRANSFORM_COMMAND,		/* Run command for print job processing */
@@ -374,6 +393,12 @@ typedef enum server_type_e		/* Service types */
  * Structures...
  */
 
+typedef struct server_rate_s		/**** Rate limit ****/
+{
+  double		rate,		/* Requests per second, 0.0 for no limit */
+			burst;		/* Maximum number of requests at once */
+} server_rate_t;
+
 typedef struct server_filter_s		/**** Attribute filter ****/
 {
   cups_array_t		*ra;		/* Requested attributes */
@@ -383,6 +408,31 @@ typedef struct server_filter_s		/**** Attribute filter ****/
 
 typedef struct server_job_s server_job_t;
 
+typedef struct server_document_s	/**** Document data ****/
+{
+  int			number;		/* document-number */
+  char			*format,	/* document-format */
+			*filename;	/* Document file name */
+  ipp_t			*attrs;		/* Document attributes */
+  ipp_jstate_t		state;		/* document-state value */
+  time_t		created,	/* time-at-created value */
+			processing,	/* time-at-processing value */
+			completed;	/* time-at-completed value */
+  bool			cancel,		/* Cancel this document? */
+			incoming,	/* Still receiving data? */
+			streaming;	/* Process while receiving? */
+  off_t			received;	/* Bytes of data received */
+  int			memfd;		/* Memory spool file or -1 for disk */
+  bool			spill_failed;	/* Unable to move memory spool file to disk? */
+  int			transform_pid;	/* Transform process ID, if any (StreamMutex) */
+  bool			preparing;	/* Transform for fetching in progress? */
+  char			*prepared;	/* Transformed document file, if any */
+  const char		*prepared_format;
+					/* MIME media type of transformed file */
+  unsigned char		*packed;	/* Packed attributes of completed document */
+  size_t		packedlen;	/* Length of packed attributes */
+} server_document_t;
+
 typedef struct server_device_s		/**** Output Device data ****/
 {
   cups_rwlock_t		rwlock;		/* Printer lock */
@@ -395,6 +445,27 @@ typedef struct server_device_s		/**** Output Device data ****/
 
 typedef struct server_resource_s server_resource_t;
 
+typedef struct server_blob_s server_blob_t;
+
+typedef struct server_caps_s server_caps_t;
+
+typedef struct server_history_s server_history_t;
+
+typedef struct server_sha256_s		/**** SHA-256 hash state ****/
+{
+  uint32_t		state[8];	/* Hash state */
+  uint64_t		length;		/* Length of data in bytes */
+  unsigned char		block[64];	/* Current block */
+  size_t		used;		/* Bytes used in current block */
+} server_sha256_t;
+
+typedef struct server_joblist_s		/**** Job list snapshot ****/
+{
+  int			refcount;	/* Reference count */
+  size_t		num_jobs;	/* Number of jobs */
+  server_job_t		**jobs;		/* Jobs, sorted by decreasing job-id */
+} server_joblist_t;
+
 typedef struct server_lang_s		/**** Localization data ****/
 {
   char			*lang;		/* Language code */
@@ -422,6 +493,7 @@ typedef struct server_pinfo_s		/**** Printer information ****/
 			proxy_group;	/* Proxy group, if any */
   char			duplex,		/* Duplex mode */
 			pin,		/* PIN printing mode? */
+			streaming,	/* Process jobs while receiving? */
 			web_forms;	/* Enable web interface forms? */
   int			ppm,		/* Pages per minute for mono */
 			ppm_color;	/* Pages per minute for color */
@@ -453,8 +525,16 @@ typedef struct server_printer_s		/**** Printer data ****/
   server_pinfo_t	pinfo;		/* Printer information */
   server_resource_t	*icon_resource;	/* Printer icon resource */
   ipp_t			*dev_attrs;	/* Current device attributes */
+  server_caps_t		*caps;		/* Shared capability attributes */
+  server_history_t	*history;	/* Job history archive, if any */
+  cups_array_t		*supported;	/* Index of "xxx-supported" values */
+  bool			has_geo;	/* Is printer-geo-location set? */
+  double		geo_lat,	/* printer-geo-location latitude */
+			geo_lon,	/* printer-geo-location longitude */
+			geo_alt;	/* printer-geo-location altitude */
   time_t		start_time;	/* Startup time */
   time_t		config_time;	/* printer-config-change-time */
+  bool			config_dirty;	/* Configuration needs to be saved? */
   char			is_accepting,	/* printer-is-accepting-jobs value */
 			is_deleted,	/* Is the printer being deleted? */
 			is_shutdown;	/* Is the printer shutdown? */
@@ -466,7 +546,12 @@ typedef struct server_printer_s		/**** Printer data ****/
   cups_array_t		*jobs,		/* Jobs */
 			*active_jobs,	/* Active jobs */
 			*completed_jobs;/* Completed jobs */
+  server_joblist_t	*joblist;	/* Snapshot of jobs for readers */
+  server_job_t		**job_index;	/* Jobs indexed by job-id */
+  int			job_index_base;	/* job-id of first job_index entry */
+  size_t		job_index_alloc;/* Allocated job_index entries */
   server_job_t		*processing_job;/* Current processing job */
+  int			num_preparing;	/* Number of background document transforms (StreamMutex) */
   int			next_job_id;	/* Next job-id value */
   server_identify_t	identify_actions;
 					/* identify-actions value, if any */
@@ -481,6 +566,7 @@ struct server_job_s			/**** Job data ****/
 {
   int			id;		/* job-id */
   cups_rwlock_t		rwlock;		/* Job lock */
+  int			refcount;	/* Number of job array and job list references */
   const char		*name,		/* job-name */
 			*username,	/* job-originating-user-name */
 			*format;	/* document-format */
@@ -499,16 +585,17 @@ struct server_job_s			/**** Job data ****/
 			completed;	/* time-at-completed value */
   int			impressions,	/* job-impressions value */
 			impcompleted;	/* job-impressions-completed value */
-  ipp_t			*attrs,		/* Job attributes */
-			*doc_attrs;	/* Document attributes */
+  ipp_t			*attrs;		/* Job attributes */
+  unsigned char		*packed;	/* Packed attributes of completed job */
+  size_t		packedlen;	/* Length of packed attributes */
   int			cancel;		/* Non-zero when job canceled */
-  char			*filename;	/* Print file name */
+  cups_array_t		*documents;	/* Documents in job */
+  bool			last_document;	/* No more documents will be added? */
   int			fd;		/* Print file descriptor */
-  int			transform_pid;	/* Transform process ID, if any */
+  double		transform_wait;	/* Seconds spent waiting for a transform slot */
   server_printer_t	*printer;	/* Printer */
   int			num_resources,	/* Number of job resources */
-			resources[SERVER_RESOURCES_MAX];
-					/* Job resource IDs */
+			*resources;	/* Job resource IDs, if any */
 };
 
 struct server_resource_s		/**** Resource data ****/
@@ -521,6 +608,7 @@ struct server_resource_s		/**** Resource data ****/
 			*filename,	/* Local filename */
 			*format,	/* MIME media type */
 			*type;		/* Resource type */
+  server_blob_t		*blob;		/* Shared data file, if any */
   int			use,		/* Use count */
 			fd,		/* Resource file descriptor */
 			cancel;		/* Cancel pending */
@@ -571,6 +659,12 @@ typedef struct server_client_s		/**** Client data ****/
   int			fetch_compression,
 					/* Compress file? */
 			fetch_file;	/* File to fetch */
+  char			*page;		/* Web page being cached, if any */
+  size_t		page_used,	/* Bytes used in web page */
+			page_size;	/* Size of web page buffer */
+  int			retry_after;	/* Retry-After value for response, if any */
+  server_lane_t		lane;		/* Request lane */
+  bool			lane_slot;	/* Holding a read lane slot? */
 } server_client_t;
 
 typedef struct server_listener_s	/**** Listener data ****/
@@ -578,6 +672,7 @@ typedef struct server_listener_s	/**** Listener data ****/
   int			fd;		/* Listener socket */
   char			host[256];	/* Hostname, if any */
   int			port;		/* Port number */
+  int			thread;		/* Accept thread (0 = main loop) */
 } server_listener_t;
 
 
@@ -616,13 +711,17 @@ VAR int			SystemConfigChanges VALUE(0);
 VAR size_t		SystemNumSettings VALUE(0);
 VAR cups_option_t	*SystemSettings	VALUE(NULL);
 
+VAR int			AcceptThreads	VALUE(1);
+VAR int			ArchiveJobs	VALUE(0);
 VAR char		*BinDir		VALUE(NULL);
+VAR int			ClientThreads	VALUE(8);
 VAR char		*ConfigDirectory VALUE(NULL);
 VAR char		*DataDirectory	VALUE(NULL);
 VAR int			DefaultPort	VALUE(0);
 VAR server_printer_t	*DefaultPrinter	VALUE(NULL);
 VAR http_encryption_t	Encryption	VALUE(HTTP_ENCRYPTION_IF_REQUESTED);
 VAR cups_array_t	*FileDirectories VALUE(NULL);
+VAR int			KeepAliveTimeout VALUE(30);
 VAR int			KeepFiles	VALUE(0);
 VAR char		*KeychainPath	VALUE(NULL);
 VAR cups_array_t	*Listeners	VALUE(NULL);
@@ -630,13 +729,21 @@ VAR char		*LogFile	VALUE(NULL);
 VAR server_loglevel_t	LogLevel	VALUE(SERVER_LOGLEVEL_NONE);
 VAR int			MaxJobs		VALUE(100),
                         MaxCompletedJobs VALUE(100),
+                        MaxReadRequests	VALUE(0),
+                        MaxTransforms	VALUE(0),
                         NextPrinterId	VALUE(1);
 VAR cups_array_t	*Printers	VALUE(NULL);
+VAR bool		PrintersLoading	VALUE(false);
 VAR cups_rwlock_t	PrintersRWLock	VALUE(CUPS_RWLOCK_INITIALIZER);
+VAR server_rate_t	RateLimits[SERVER_LIMIT_MAX];
 VAR int			RelaxedConformance VALUE(0);
 VAR char		*ServerName	VALUE(NULL);
 VAR char		*SpoolDirectory	VALUE(NULL);
+VAR size_t		SpoolMemory	VALUE(0),
+			SpoolMemoryThreshold VALUE(1048576);
 VAR char		*StateDirectory	VALUE(NULL);
+VAR char		*TransformCPUs	VALUE(NULL);
+VAR int			TransformNice	VALUE(0);
 
 VAR cups_dnssd_t	*DNSSDContext	VALUE(NULL);
 VAR int			DNSSDEnabled	VALUE(1);
@@ -649,11 +756,12 @@ VAR bool		DNSSDUpdate	VALUE(false);
 VAR cups_rwlock_t	ResourcesRWLock	VALUE(CUPS_RWLOCK_INITIALIZER);
 VAR cups_array_t	*ResourcesByFilename VALUE(NULL);
 VAR cups_array_t	*ResourcesById	VALUE(NULL);
-VAR cups_array_t	*ResourcesByPath VALUE(NULL);
 VAR int			NextResourceId 	VALUE(1);
 
 VAR cups_mutex_t	NotificationMutex VALUE(CUPS_MUTEX_INITIALIZER);
 VAR cups_cond_t		NotificationCondition VALUE(CUPS_COND_INITIALIZER);
+VAR cups_mutex_t	StreamMutex	VALUE(CUPS_MUTEX_INITIALIZER);
+VAR cups_cond_t		StreamCondition	VALUE(CUPS_COND_INITIALIZER);
 VAR cups_rwlock_t	SubscriptionsRWLock VALUE(CUPS_RWLOCK_INITIALIZER);
 VAR cups_array_t	*Subscriptions	VALUE(NULL);
 VAR int			NextSubscriptionId VALUE(1);
@@ -663,26 +771,39 @@ VAR int			NextSubscriptionId VALUE(1);
  * Functions...
  */
 
+extern void		serverAddDocumentEventNoLock(server_job_t *job, server_document_t *doc, server_event_t event, const char *message, ...) _CUPS_FORMAT(4, 5);
 extern void		serverAddEventNoLock(server_printer_t *printer, server_job_t *job, server_resource_t *res, server_event_t event, const char *message, ...) _CUPS_FORMAT(5, 6);
+extern void		serverAddJobReference(server_job_t *job);
 extern void		serverAddPrinter(server_printer_t *printer);
-extern void		serverAddResourceFile(server_resource_t *res, const char *filename, const char *format);
+extern void		serverAddResourceFile(server_resource_t *res, const char *filename, const char *format, const unsigned char *digest);
 extern void		serverAddStringsFileNoLock(server_printer_t *printer, const char *language, server_resource_t *resource);
 extern void		serverAllocatePrinterResource(server_printer_t *printer, server_resource_t *resource);
+extern void		serverArchiveJobNoLock(server_job_t *job);
 extern http_status_t	serverAuthenticateClient(server_client_t *client);
 extern bool		serverAuthorizeUser(server_client_t *client, const char *owner, gid_t group, const char *scope);
 
 extern int		serverCancelJob(server_job_t *job);
 extern void		serverCheckJobs(server_printer_t *printer);
+extern bool		serverCheckRateLimit(server_client_t *client, server_limit_t limit);
 extern void             serverCleanAllJobs(void);
 extern void		serverCleanJobs(server_printer_t *printer);
+extern void		serverCleanRateLimits(void);
+extern void		serverCloseHistory(server_printer_t *printer);
+extern void		serverCloseJob(server_job_t *job);
+extern void		serverCompactJobNoLock(server_job_t *job);
 extern void		serverCopyAttributes(ipp_t *to, ipp_t *from, cups_array_t *ra, cups_array_t *pa, ipp_tag_t group_tag, bool quickcopy);
+extern void		serverCopyClientStatus(ipp_t *ipp, cups_array_t *ra);
 extern void		serverCopyJobStateReasons(ipp_t *ipp, ipp_tag_t group_tag, server_job_t *job);
 extern void		serverCopyPrinterStateReasons(ipp_t *ipp, ipp_tag_t group_tag, server_printer_t *printer);
+extern void		serverCopyRateLimitStatus(ipp_t *ipp, cups_array_t *ra);
+extern void		serverCopyRequestStatus(ipp_t *ipp, cups_array_t *ra);
+extern void		serverCopyTransformStatus(ipp_t *ipp, cups_array_t *ra);
 extern server_client_t	*serverCreateClient(int sock);
 extern server_device_t	*serverCreateDevice(server_client_t *client);
 extern server_device_t	*serverCreateDevicePinfo(server_pinfo_t *pinfo, const char *uuid);
+extern server_document_t *serverCreateDocument(server_job_t *job, const char *format, bool streaming);
 extern server_job_t	*serverCreateJob(server_client_t *client);
-extern void		serverCreateJobFilename(server_job_t *job, const char *format, char *fname, size_t fnamesize);
+extern void		serverCreateJobFilename(server_job_t *job, int number, const char *format, char *fname, size_t fnamesize);
 extern int		serverCreateListeners(const char *host, int port);
 extern server_printer_t	*serverCreatePrinter(const char *resource, const char *name, const char *info, server_pinfo_t *pinfo, int dupe_pinfo);
 extern server_resource_t *serverCreateResource(const char *resource, const char *filename, const char *format, const char *name, const char *info, const char *type, const char *language);
@@ -702,20 +823,35 @@ extern void		serverDisablePrinter(server_printer_t *printer);
 extern void		serverEnablePrinter(server_printer_t *printer);
 
 extern server_device_t	*serverFindDevice(server_client_t *client);
+extern server_document_t *serverFindDocument(server_job_t *job, int number);
 extern server_job_t	*serverFindJob(server_client_t *client, int job_id);
+extern server_job_t	*serverFindJobNoLock(server_printer_t *printer, int job_id);
 extern server_printer_t	*serverFindPrinter(const char *resource);
+extern cups_array_t	*serverFindPrintersNoLock(const char *geo_location, double geo_distance, const char *location, const char *service_type);
 extern server_resource_t *serverFindResourceById(int id);
 extern server_resource_t *serverFindResourceByPath(const char *resource);
 extern server_resource_t *serverFindResourceByFilename(const char *filename);
 extern server_subscription_t *serverFindSubscription(server_client_t *client, int sub_id);
+extern void		serverFinishRequest(server_client_t *client);
 
+extern server_joblist_t	*serverGetJobList(server_printer_t *printer);
 extern server_jreason_t	serverGetJobStateReasonsBits(ipp_attribute_t *attr);
 extern server_event_t	serverGetNotifyEventsBits(ipp_attribute_t *attr);
+extern server_limit_t	serverGetOperationLimit(ipp_op_t op);
 extern const char	*serverGetNotifySubscribedEvent(server_event_t event);
 extern server_preason_t	serverGetPrinterStateReasonsBits(ipp_attribute_t *attr);
+extern double		serverGetTime(void);
 
+extern uint32_t		serverHashString(const char *s, ssize_t slen, bool ignore_case);
 extern int		serverHoldJob(server_job_t *job, ipp_attribute_t *hold_until);
 
+extern void		serverInitTransforms(void);
+extern void		serverInvalidateWebPages(server_printer_t *printer, bool deleted);
+extern bool		serverIsSupportedIntegerNoLock(server_printer_t *printer, const char *name, int value);
+extern bool		serverIsSupportedMediaSizeNoLock(server_printer_t *printer, int x_value, int y_value);
+extern bool		serverIsSupportedResolutionNoLock(server_printer_t *printer, int xres, int yres, ipp_res_t units);
+extern bool		serverIsSupportedStringNoLock(server_printer_t *printer, const char *name, const char *value);
+
 extern int		serverLoadAttributes(const char *filename, server_pinfo_t *pinfo);
 extern void		serverLog(server_loglevel_t level, const char *format, ...) _CUPS_FORMAT(2, 3);
 extern void		serverLogAttributes(server_client_t *client, const char *title, ipp_t *ipp, int type);
@@ -725,31 +861,55 @@ extern void		serverLogPrinter(server_loglevel_t level, server_printer_t *printer
 
 extern char		*serverMakeVCARD(const char *user, const char *name, const char *location, const char *email, const char *phone, char *buffer, size_t bufsize);
 
+extern int		serverOpenDocument(server_job_t *job, server_document_t *doc);
+extern void		serverOpenHistory(server_printer_t *printer);
+
+extern unsigned char	*serverPackAttributes(ipp_t *ipp, size_t *packedlen);
 extern void		serverPausePrinter(server_printer_t *printer, int immediately);
+extern void		serverPrepareDocument(server_job_t *job, server_document_t *doc, const char *format);
 extern void		*serverProcessClient(server_client_t *client);
 extern int		serverProcessHTTP(server_client_t *client);
 extern int		serverProcessIPP(server_client_t *client);
 extern void		*serverProcessJob(server_job_t *job);
 
+extern ipp_t		*serverReadHistoryNoLock(server_printer_t *printer, int *last_id, int first_job_id, const char *username, ipp_jstate_t job_state, int job_comparison);
 extern int		serverRegisterPrinter(server_printer_t *printer);
 extern int		serverReleaseJob(server_job_t *job);
+extern void		serverReleaseJobList(server_joblist_t *list);
+extern void		serverRemoveJobReference(server_job_t *job);
+extern void		serverRemovePrinterNoLock(server_printer_t *printer);
 extern int		serverRespondHTTP(server_client_t *client, http_status_t code, const char *content_coding, const char *type, size_t length);
 extern void		serverRespondIPP(server_client_t *client, ipp_status_t status, const char *message, ...) _CUPS_FORMAT(3, 4);
 extern void		serverRespondUnsupported(server_client_t *client, ipp_attribute_t *attr);
 extern void		serverRestartPrinter(server_printer_t *printer);
 extern void		serverResumePrinter(server_printer_t *printer);
+extern void		serverResumeRequest(server_client_t *client);
 extern void		serverRun(void);
 
-extern void		serverSaveSystem(void);
+extern void		serverSaveSystem(bool all);
+extern void		serverSaveSystemLater(server_printer_t *printer);
+extern void		serverSHA256Finish(server_sha256_t *ctx, unsigned char *digest);
+extern void		serverSHA256Init(server_sha256_t *ctx);
+extern void		serverSHA256Update(server_sha256_t *ctx, const void *data, size_t datalen);
 extern void		serverSetResourceState(server_resource_t *resource, ipp_rstate_t state, const char *message, ...) _CUPS_FORMAT(3, 4);
+extern bool		serverStartRequest(server_client_t *client);
+extern void		serverStopDocument(server_job_t *job, server_document_t *doc);
 extern void		serverStopJob(server_job_t *job);
+extern void		serverStopTransforms(server_job_t *job);
 
 extern char		*serverTimeString(time_t tv, char *buffer, size_t bufsize);
-extern int		serverTransformJob(server_client_t *client, server_job_t *job, const char *command, const char *format, server_transform_t mode);
+extern int		serverTransformJob(server_client_t *client, server_job_t *job, server_document_t *doc, const char *command, const char *format, server_transform_t mode);
 
+extern ipp_t		*serverUnpackAttributes(const unsigned char *packed, size_t packedlen);
 extern void		serverUnregisterPrinter(server_printer_t *printer);
 extern void		serverUpdateDeviceAttributesNoLock(server_printer_t *printer);
 extern void		serverUpdateDeviceStateNoLock(server_printer_t *printer);
+extern void		serverUpdateJobData(server_job_t *job, server_document_t *doc, size_t bytes, bool done);
+extern void		serverUpdateJobListNoLock(server_printer_t *printer);
+extern void		serverUpdatePrinterIndex(server_printer_t *printer);
+extern void		serverUpdatePrinterSupportedNoLock(server_printer_t *printer);
+
+extern off_t		serverWaitJobData(server_job_t *job, server_document_t *doc, off_t offset);
 
 
 #endif // !IPPSERVER_H
@@ -9,6 +9,80 @@
  */
 
 #include "ippserver.h"
+#ifdef __linux__
+#  include <sys/mman.h>
+#endif /* __linux__ */
+
+
+/*
+ * Local globals...
+ */
+
+static cups_mutex_t	joblist_mutex = CUPS_MUTEX_INITIALIZER;
+					/* Mutex for job list references */
+static size_t		spool_memory_used = 0;
+					/* Bytes of documents spooled in memory */
+static const char * const job_status_attrs[] =
+{					/* Job Status attributes kept for completed jobs */
+  "date-time-at-creation",
+  "document-format",
+  "document-format-detected",
+  "document-format-supplied",
+  "job-id",
+  "job-k-octets",
+  "job-name",
+  "job-originating-user-name",
+  "job-printer-uri",
+  "job-uri",
+  "job-uuid",
+  "time-at-creation"
+};
+
+
+/*
+ * Local types...
+ */
+
+typedef struct server_packbuf_s		/**** Packed attribute buffer ****/
+{
+  unsigned char		*data;		/* Buffer */
+  size_t		used,		/* Bytes used */
+			size;		/* Size of buffer */
+} server_packbuf_t;
+
+
+/*
+ * Local functions...
+ */
+
+static void		free_job(server_job_t *job);
+static int		get_job_uri_id(server_printer_t *printer, const char *uri);
+static void		index_job(server_printer_t *printer, server_job_t *job);
+static void		process_document(server_job_t *job, server_document_t *doc);
+static ssize_t		read_packed(server_packbuf_t *buf, ipp_uchar_t *buffer, size_t bytes);
+static void		release_document(server_job_t *job, server_document_t *doc);
+#ifndef _WIN32
+static void		spill_document(server_job_t *job, server_document_t *doc);
+#endif /* !_WIN32 */
+static server_document_t *wait_document(server_job_t *job, int number);
+static ssize_t		write_packed(server_packbuf_t *buf, ipp_uchar_t *buffer, size_t bytes);
+
+
+/*
+ * 'serverAddJobReference()' - Keep a job in memory while it is being used.
+ *
+ * Background threads that use a job without holding any locks must call
+ * @link serverRemoveJobReference@ when they are done.
+ */
+
+void
+serverAddJobReference(
+    server_job_t *job)			/* I - Job */
+{
+  cupsMutexLock(&joblist_mutex);
+  job->refcount ++;
+  cupsMutexUnlock(&joblist_mutex);
+}
 
 
 /*
@@ -142,6 +216,7 @@ serverCleanJobs(server_printer_t *printer)	/* I - Printer */
 {
   server_job_t	*job;			/* Current job */
   time_t	cleantime;		/* Clean time */
+  bool		changed = false;	/* Were any jobs removed? */
 
 
   serverLogPrinter(SERVER_LOGLEVEL_DEBUG, printer, "Cleaning jobs, %u completed jobs in memory...", (unsigned)cupsArrayGetCount(printer->completed_jobs));
@@ -168,18 +243,137 @@ serverCleanJobs(server_printer_t *printer)	/* I - Printer */
       cupsRWUnlock(&job->rwlock);
 
       serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Cleaning job #%d.", job->id);
+      serverArchiveJobNoLock(job);
       cupsArrayRemove(printer->completed_jobs, job);
       cupsArrayRemove(printer->jobs, job); /* Last since removing a job from here calls serverDeleteJob() */
+
+      changed = true;
     }
     else if (job->completed)
       serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Not cleaning job #%d - completed on %ld.", job->id, (long)job->completed);
     else
       break;
   }
+
+  if (changed)
+    serverUpdateJobListNoLock(printer);
+
   cupsRWUnlock(&(printer->rwlock));
 }
 
 
+/*
+ * 'serverCloseJob()' - Mark that no more documents will be added to a job.
+ */
+
+void
+serverCloseJob(server_job_t *job)	/* I - Job */
+{
+  cupsMutexLock(&StreamMutex);
+
+  job->last_document = true;
+
+  cupsCondBroadcast(&StreamCondition);
+  cupsMutexUnlock(&StreamMutex);
+}
+
+
+/*
+ * 'serverCompactJobNoLock()' - Compact a completed job for the job history.
+ *
+ * Only the Job Status attributes needed by Get-Jobs are kept in the job's
+ * attributes.  The remaining job and document attributes are packed into an
+ * IPP message buffer that @link serverUnpackAttributes@ decodes on demand.
+ */
+
+void
+serverCompactJobNoLock(
+    server_job_t *job)			/* I - Job */
+{
+  ipp_attribute_t	*attr;		/* Current attribute */
+  const char		*name;		/* Attribute name */
+  size_t		i;		/* Looping var */
+  ipp_t			*status,	/* Job Status attributes */
+			*other;		/* Other job attributes */
+  server_document_t	*doc;		/* Current document */
+  size_t		bytes;		/* Total packed bytes */
+
+
+  if (job->packed || job->state < IPP_JSTATE_CANCELED)
+    return;
+
+ /*
+  * Split the job attributes...
+  */
+
+  status = ippNew();
+  other  = ippNew();
+
+  for (attr = ippGetFirstAttribute(job->attrs); attr; attr = ippGetNextAttribute(job->attrs))
+  {
+    if ((name = ippGetName(attr)) == NULL)
+      continue;
+
+    for (i = 0; i < (sizeof(job_status_attrs) / sizeof(job_status_attrs[0])); i ++)
+    {
+      if (!strcmp(name, job_status_attrs[i]))
+        break;
+    }
+
+    ippCopyAttribute(i < (sizeof(job_status_attrs) / sizeof(job_status_attrs[0])) ? status : other, attr, false);
+  }
+
+  job->packed = serverPackAttributes(other, &job->packedlen);
+
+  ippDelete(other);
+
+  if (!job->packed)
+  {
+    ippDelete(status);
+    return;
+  }
+
+  ippDelete(job->attrs);
+  job->attrs = status;
+
+ /*
+  * Point the cached strings at the retained attributes...
+  */
+
+  job->name     = ippGetString(ippFindAttribute(status, "job-name", IPP_TAG_NAME), 0, NULL);
+  job->username = ippGetString(ippFindAttribute(status, "job-originating-user-name", IPP_TAG_NAME), 0, NULL);
+
+  if ((attr = ippFindAttribute(status, "document-format-detected", IPP_TAG_MIMETYPE)) != NULL || (attr = ippFindAttribute(status, "document-format-supplied", IPP_TAG_MIMETYPE)) != NULL || (attr = ippFindAttribute(status, "document-format", IPP_TAG_MIMETYPE)) != NULL)
+    job->format = ippGetString(attr, 0, NULL);
+  else if (job->format)
+    job->format = "application/octet-stream";
+
+ /*
+  * Pack the document attributes...
+  */
+
+  bytes = job->packedlen;
+
+  for (doc = (server_document_t *)cupsArrayGetFirst(job->documents); doc; doc = (server_document_t *)cupsArrayGetNext(job->documents))
+  {
+    release_document(job, doc);
+
+    if (!doc->attrs || (doc->packed = serverPackAttributes(doc->attrs, &doc->packedlen)) == NULL)
+      continue;
+
+    ippDelete(doc->attrs);
+    doc->attrs = NULL;
+    bytes      += doc->packedlen;
+  }
+
+  free(job->resources);
+  job->resources     = NULL;
+  job->num_resources = 0;
+
+  serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Packed %u bytes of attributes for job history.", (unsigned)bytes);
+}
+
+
 /*
  * 'serverCopyJobStateReasons()' - Copy printer-state-reasons values.
  */
@@ -223,6 +417,85 @@ serverCopyJobStateReasons(
 }
 
 
+/*
+ * 'serverCreateDocument()' - Add a new document to a job.
+ *
+ * The caller writes the document data to the returned document's filename
+ * and then calls @link serverUpdateJobData@ with `done` set to `true`.
+ *
+ * `NULL` is also returned when the job is no longer accepting documents, for
+ * example after the last document has been received or the processing thread
+ * gave up waiting for the next one.
+ */
+
+server_document_t *			/* O - Document or `NULL` on error */
+serverCreateDocument(
+    server_job_t *job,			/* I - Job */
+    const char   *format,		/* I - MIME media type */
+    bool         streaming)		/* I - Process while receiving data? */
+{
+  server_document_t	*doc;		/* Document */
+  char			filename[1024];	/* Document filename */
+
+
+  if ((doc = calloc(1, sizeof(server_document_t))) == NULL)
+  {
+    serverLogJob(SERVER_LOGLEVEL_ERROR, job, "Unable to allocate memory for document: %s", strerror(errno));
+    return (NULL);
+  }
+
+  cupsRWLockWrite(&job->rwlock);
+
+ /*
+  * Documents are added with StreamMutex held so that the processing thread
+  * can check for them without the job lock...
+  */
+
+  cupsMutexLock(&StreamMutex);
+
+  if (job->last_document || job->cancel)
+  {
+    cupsMutexUnlock(&StreamMutex);
+    cupsRWUnlock(&job->rwlock);
+
+    serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Job is not accepting documents.");
+
+    free(doc);
+    return (NULL);
+  }
+
+  doc->number    = (int)cupsArrayGetCount(job->documents) + 1;
+  doc->format    = strdup(format);
+  doc->attrs     = ippNew();
+  doc->state     = IPP_JSTATE_PENDING;
+  doc->created   = time(NULL);
+  doc->incoming  = true;
+  doc->streaming = streaming;
+  doc->memfd     = -1;
+
+  serverCreateJobFilename(job, doc->number, format, filename, sizeof(filename));
+  doc->filename = strdup(filename);
+
+  cupsArrayAdd(job->documents, doc);
+
+  cupsMutexUnlock(&StreamMutex);
+
+  serverAddDocumentEventNoLock(job, doc, SERVER_EVENT_DOCUMENT_CREATED, "Document #%d created.", doc->number);
+
+  cupsRWUnlock(&job->rwlock);
+
+ /*
+  * Wake up the processing thread...
+  */
+
+  cupsMutexLock(&StreamMutex);
+  cupsCondBroadcast(&StreamCondition);
+  cupsMutexUnlock(&StreamMutex);
+
+  return (doc);
+}
+
+
 /*
  * 'serverCreateJob()' - Create a new job object from a Print-Job or Create-Job
  *                  request.
@@ -260,7 +533,9 @@ serverCreateJob(
   }
 
   job->printer    = client->printer;
+  job->refcount   = 1;
   job->attrs      = ippNew();
+  job->documents  = cupsArrayNew(NULL, NULL, NULL, 0, NULL, NULL);
   job->state      = IPP_JSTATE_HELD;
   job->fd         = -1;
 
@@ -330,6 +605,9 @@ serverCreateJob(
 
   cupsArrayAdd(client->printer->jobs, job);
   cupsArrayAdd(client->printer->active_jobs, job);
+  index_job(client->printer, job);
+
+  serverUpdateJobListNoLock(client->printer);
 
   cupsRWUnlock(&(client->printer->rwlock));
 
@@ -343,6 +621,7 @@ serverCreateJob(
 
 void serverCreateJobFilename(
     server_job_t   *job,		/* I - Job */
+    int            number,		/* I - Document number */
     const char     *format,		/* I - Format or NULL */
     char           *fname,		/* I - Filename buffer */
     size_t         fnamesize)		/* I - Size of filename buffer */
@@ -414,39 +693,82 @@ void serverCreateJobFilename(
     ext = "prn";
 
  /*
-  * Create a filename with the job-id, job-name, and document-format (extension)...
+  * Create a filename with the job-id, document-number, job-name, and
+  * document-format (extension)...
   */
 
-  snprintf(fname, fnamesize, "%s/%s/%d-%s.%s", SpoolDirectory, job->printer->name, job->id, name, ext);
+  if (number > 1)
+    snprintf(fname, fnamesize, "%s/%s/%d-%d-%s.%s", SpoolDirectory, job->printer->name, job->id, number, name, ext);
+  else
+    snprintf(fname, fnamesize, "%s/%s/%d-%s.%s", SpoolDirectory, job->printer->name, job->id, name, ext);
 }
 
 
 /*
  * 'serverDeleteJob()' - Remove from the printer and free all memory used by a job
  *                  object.
+ *
+ * The memory is not freed until any job list snapshots and background
+ * transforms using the job have been released.
  */
 
 void
 serverDeleteJob(server_job_t *job)		/* I - Job */
 {
+  int			refcount;	/* Remaining references */
+
+
   serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Removing job #%d from history.", job->id);
 
-  cupsRWLockWrite(&job->rwlock);
+ /*
+  * Remove the job from the printer's job-id index; the caller holds the
+  * printer write lock...
+  */
 
-  ippDelete(job->attrs);
-  ippDelete(job->doc_attrs);
+  if (job->id >= job->printer->job_index_base && (size_t)(job->id - job->printer->job_index_base) < job->printer->job_index_alloc && job->printer->job_index[job->id - job->printer->job_index_base] == job)
+    job->printer->job_index[job->id - job->printer->job_index_base] = NULL;
 
-  if (job->filename)
-  {
-    if (!KeepFiles)
-      unlink(job->filename);
+ /*
+  * Stop any document transforms that are still running - they hold their own
+  * reference to the job, so there is no need to wait for them here...
+  */
 
-    free(job->filename);
-  }
+  serverStopTransforms(job);
 
-  cupsRWDestroy(&job->rwlock);
+ /*
+  * Drop the reference from the printer's jobs array; the job is freed once
+  * all job list snapshots and transforms using it have been released...
+  */
 
-  free(job);
+  cupsMutexLock(&joblist_mutex);
+  refcount = -- job->refcount;
+  cupsMutexUnlock(&joblist_mutex);
+
+  if (refcount == 0)
+    free_job(job);
+}
+
+
+/*
+ * 'serverFindDocument()' - Find a document in a job.
+ */
+
+server_document_t *			/* O - Document or `NULL` */
+serverFindDocument(
+    server_job_t *job,			/* I - Job */
+    int          number)		/* I - Document number */
+{
+  server_document_t	*doc = NULL;	/* Document */
+
+
+  if (number > 0)
+  {
+    cupsRWLockRead(&job->rwlock);
+    doc = (server_document_t *)cupsArrayGetElement(job->documents, (size_t)(number - 1));
+    cupsRWUnlock(&job->rwlock);
+  }
+
+  return (doc);
 }
 
 
@@ -460,44 +782,74 @@ serverFindJob(
     int             job_id)		/* I - Job ID to find or 0 to lookup */
 {
   ipp_attribute_t	*attr;		/* job-id or job-uri attribute */
-  server_job_t		key,		/* Job search key */
-			*job;		/* Matching job, if any */
+  server_printer_t	*printer = client->printer;
+					/* Printer */
+  server_job_t		*job;		/* Matching job, if any */
 
 
-  if (job_id > 0)
+  if (job_id <= 0)
   {
-    key.id = job_id;
+    if ((attr = ippFindAttribute(client->request, "job-uri", IPP_TAG_URI)) != NULL)
+      job_id = get_job_uri_id(printer, ippGetString(attr, 0, NULL));
+    else if ((attr = ippFindAttribute(client->request, "job-id", IPP_TAG_INTEGER)) != NULL)
+      job_id = ippGetInteger(attr, 0);
   }
-  else if ((attr = ippFindAttribute(client->request, "job-uri", IPP_TAG_URI)) != NULL)
-  {
-    const char	*uri = ippGetString(attr, 0, NULL);
-					/* job-uri value */
-    char	scheme[32],		/* URI scheme */
-		userpass[256],		/* username:password */
-		host[256],		/* Hostname/IP */
-		resource[1024];		/* Resource path */
-    int		port;			/* Port number */
 
-    if (httpSeparateURI(HTTP_URI_CODING_ALL, uri, scheme, sizeof(scheme), userpass, sizeof(userpass), host, sizeof(host), &port, resource, sizeof(resource)) >= HTTP_URI_STATUS_OK &&
-        !strncmp(resource, client->printer->resource, client->printer->resourcelen) &&
-        resource[client->printer->resourcelen] == '/')
-      key.id = atoi(resource + client->printer->resourcelen + 1);
-    else
-      return (NULL);
-  }
-  else if ((attr = ippFindAttribute(client->request, "job-id", IPP_TAG_INTEGER)) != NULL)
-  {
-    key.id = ippGetInteger(attr, 0);
-  }
+  if (job_id <= 0)
+    return (NULL);
 
-  cupsRWLockRead(&(client->printer->rwlock));
-  job = (server_job_t *)cupsArrayFind(client->printer->jobs, &key);
-  cupsRWUnlock(&(client->printer->rwlock));
+  cupsRWLockRead(&printer->rwlock);
+  job = serverFindJobNoLock(printer, job_id);
+  cupsRWUnlock(&printer->rwlock);
 
   return (job);
 }
 
 
+/*
+ * 'serverFindJobNoLock()' - Find a job by job-id.
+ *
+ * The caller must hold the printer lock.
+ */
+
+server_job_t *				/* O - Job or `NULL` */
+serverFindJobNoLock(
+    server_printer_t *printer,		/* I - Printer */
+    int              job_id)		/* I - Job ID */
+{
+  if (job_id >= printer->job_index_base && (size_t)(job_id - printer->job_index_base) < printer->job_index_alloc)
+    return (printer->job_index[job_id - printer->job_index_base]);
+  else
+    return (NULL);
+}
+
+
+/*
+ * 'serverGetJobList()' - Get a snapshot of a printer's jobs.
+ *
+ * The snapshot is not changed by subsequent job creation or cleanup, and the
+ * jobs in it remain allocated until the snapshot is released with
+ * @link serverReleaseJobList@.  The printer lock does not need to be held.
+ */
+
+server_joblist_t *			/* O - Job list */
+serverGetJobList(
+    server_printer_t *printer)		/* I - Printer */
+{
+  server_joblist_t	*list;		/* Job list */
+
+
+  cupsMutexLock(&joblist_mutex);
+
+  if ((list = printer->joblist) != NULL)
+    list->refcount ++;
+
+  cupsMutexUnlock(&joblist_mutex);
+
+  return (list);
+}
+
+
 /*
  * 'serverGetJobStateReasonsBits()' - Get the bits associates with "job-state-reasons" values.
  */
@@ -661,6 +1013,100 @@ serverHoldJob(
 }
 
 
+/*
+ * 'serverOpenDocument()' - Open the spool file for a document's data.
+ *
+ * Small documents are spooled to an anonymous memory file when "SpoolMemory"
+ * is set, otherwise the data goes to a file in the spool directory.  The
+ * memory file is available to transforms as "/proc/PID/fd/N" and moves to
+ * the spool directory once the document grows past "SpoolMemoryThreshold" or
+ * the total memory budget is exceeded.
+ */
+
+int					/* O - File descriptor or -1 on error */
+serverOpenDocument(
+    server_job_t      *job,		/* I - Job */
+    server_document_t *doc)		/* I - Document */
+{
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+  if (SpoolMemory > 0 && !KeepFiles && !doc->streaming)
+  {
+    bool	use_memory;		/* Spool to memory? */
+    char	name[256],		/* Memory file name */
+		filename[256];		/* Memory file path */
+    int		fd;			/* Write file descriptor */
+
+
+    cupsMutexLock(&StreamMutex);
+    use_memory = spool_memory_used < SpoolMemory;
+    cupsMutexUnlock(&StreamMutex);
+
+    if (use_memory)
+    {
+      snprintf(name, sizeof(name), "ippserver-%d-%d-%d", job->printer->id, job->id, doc->number);
+
+      if ((doc->memfd = memfd_create(name, MFD_CLOEXEC)) < 0)
+      {
+        serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Unable to create memory spool file for document #%d: %s", doc->number, strerror(errno));
+      }
+      else if ((fd = dup(doc->memfd)) < 0)
+      {
+        close(doc->memfd);
+        doc->memfd = -1;
+      }
+      else
+      {
+        snprintf(filename, sizeof(filename), "/proc/%d/fd/%d", (int)getpid(), doc->memfd);
+
+        cupsRWLockWrite(&job->rwlock);
+        free(doc->filename);
+        doc->filename = strdup(filename);
+        cupsRWUnlock(&job->rwlock);
+
+        serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Spooling document #%d in memory as \"%s\".", doc->number, filename);
+
+        return (fd);
+      }
+    }
+  }
+#endif /* __linux__ && MFD_CLOEXEC */
+
+  return (open(doc->filename, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0600));
+}
+
+
+/*
+ * 'serverPackAttributes()' - Pack attributes into an IPP message buffer.
+ */
+
+unsigned char *				/* O - Packed attributes or `NULL` on error */
+serverPackAttributes(
+    ipp_t  *ipp,			/* I - Attributes */
+    size_t *packedlen)			/* O - Length of packed attributes */
+{
+  server_packbuf_t	buf;		/* Packed attribute buffer */
+  unsigned char		*data;		/* Trimmed buffer */
+
+
+  memset(&buf, 0, sizeof(buf));
+
+  ippSetState(ipp, IPP_STATE_IDLE);
+
+  if (ippWriteIO(&buf, (ipp_io_cb_t)write_packed, true, NULL, ipp) != IPP_STATE_DATA)
+  {
+    free(buf.data);
+    return (NULL);
+  }
+
+  if ((data = realloc(buf.data, buf.used)) == NULL)
+    data = buf.data;
+
+  *packedlen = buf.used;
+
+  return (data);
+}
+
+
 /*
  * 'serverProcessJob()' - Process a print job.
  */
@@ -668,6 +1114,10 @@ serverHoldJob(
 void *					/* O - Thread exit status */
 serverProcessJob(server_job_t *job)	/* I - Job */
 {
+  int			number;		/* Document number */
+  server_document_t	*doc;		/* Current document */
+
+
   cupsRWLockWrite(&job->rwlock);
 
   job->state                   = IPP_JSTATE_PROCESSING;
@@ -692,36 +1142,39 @@ serverProcessJob(server_job_t *job)	/* I - Job */
   job->printer->state_reasons &= (server_preason_t)~SERVER_PREASON_MEDIA_NEEDED;
   cupsRWUnlock(&job->printer->rwlock);
 
-  if (job->printer->pinfo.command)
+  if (!job->printer->pinfo.command && job->printer->pinfo.proxy_group != SERVER_GROUP_NONE)
   {
    /*
-    * Execute a command with the job spool file and wait for it to complete...
+    * Wait for all of the documents since the proxy fetches the job once, then
+    * prepare the job for the proxy...
     */
 
-    serverTransformJob(NULL, job, job->printer->pinfo.command, job->printer->pinfo.output_format, SERVER_TRANSFORM_COMMAND);
-  }
-  else if (job->printer->pinfo.proxy_group != SERVER_GROUP_NONE)
-  {
-   /*
-    * Prepare the job for the proxy...
-    */
+    for (number = 1; (doc = wait_document(job, number)) != NULL; number ++)
+    {
+      while (doc->incoming && !job->cancel)
+        serverWaitJobData(job, doc, doc->received);
+    }
 
     cupsRWLockWrite(&job->rwlock);
 
-    job->state         = IPP_JSTATE_STOPPED;
-    job->state_reasons |= SERVER_JREASON_JOB_FETCHABLE;
+    if (!job->cancel && job->state == IPP_JSTATE_PROCESSING)
+    {
+      job->state         = IPP_JSTATE_STOPPED;
+      job->state_reasons |= SERVER_JREASON_JOB_FETCHABLE;
 
-    serverAddEventNoLock(job->printer, job, NULL, SERVER_EVENT_JOB_STATE_CHANGED | SERVER_EVENT_JOB_FETCHABLE, "Job fetchable.");
+      serverAddEventNoLock(job->printer, job, NULL, SERVER_EVENT_JOB_STATE_CHANGED | SERVER_EVENT_JOB_FETCHABLE, "Job fetchable.");
+    }
 
     cupsRWUnlock(&job->rwlock);
   }
   else
   {
    /*
-    * Sleep for a semi-random amount of time to simulate job processing.
+    * Process each document as it arrives...
     */
 
-    sleep((unsigned)(1 + (time(NULL) & 3)));
+    for (number = 1; (doc = wait_document(job, number)) != NULL; number ++)
+      process_document(job, doc);
   }
 
   cupsRWLockWrite(&job->rwlock);
@@ -763,11 +1216,22 @@ serverProcessJob(server_job_t *job)	/* I - Job */
   {
     job->completed = time(NULL);
 
+    for (doc = (server_document_t *)cupsArrayGetFirst(job->documents); doc; doc = (server_document_t *)cupsArrayGetNext(job->documents))
+    {
+      if (doc->state < IPP_JSTATE_CANCELED)
+      {
+        doc->state     = job->state;
+        doc->completed = job->completed;
+      }
+    }
+
     serverAddEventNoLock(job->printer, job, NULL, SERVER_EVENT_JOB_STATE_CHANGED | SERVER_EVENT_JOB_COMPLETED, job->state == IPP_JSTATE_COMPLETED ? "Job completed." : job->state == IPP_JSTATE_ABORTED ? "Job aborted." : "Job canceled.");
 
     cupsArrayAdd(job->printer->completed_jobs, job);
     cupsArrayRemove(job->printer->active_jobs, job);
 
+    serverCompactJobNoLock(job);
+
     if (MaxCompletedJobs > 0)
     {
      /*
@@ -781,9 +1245,12 @@ serverProcessJob(server_job_t *job)	/* I - Job */
 	if (tjob == job)
 	  tjob = (server_job_t *)cupsArrayGetNext(job->printer->completed_jobs);
 
+	serverArchiveJobNoLock(tjob);
 	cupsArrayRemove(job->printer->completed_jobs, tjob);
 	cupsArrayRemove(job->printer->jobs, tjob); /* Removing here calls serverDeleteJob */
       }
+
+      serverUpdateJobListNoLock(job->printer);
     }
   }
 
@@ -829,3 +1296,720 @@ serverReleaseJob(server_job_t *job)	/* I - Job to release */
 
   return (1);
 }
+
+
+/*
+ * 'serverReleaseJobList()' - Release a snapshot of a printer's jobs.
+ */
+
+void
+serverReleaseJobList(
+    server_joblist_t *list)		/* I - Job list */
+{
+  size_t	i,			/* Looping var */
+		num_free;		/* Number of jobs to free */
+
+
+  if (!list)
+    return;
+
+  cupsMutexLock(&joblist_mutex);
+
+  if (-- list->refcount > 0)
+  {
+    cupsMutexUnlock(&joblist_mutex);
+    return;
+  }
+
+ /*
+  * Drop our job references, collecting the jobs that are no longer used...
+  */
+
+  for (i = 0, num_free = 0; i < list->num_jobs; i ++)
+  {
+    if (-- list->jobs[i]->refcount == 0)
+      list->jobs[num_free ++] = list->jobs[i];
+  }
+
+  cupsMutexUnlock(&joblist_mutex);
+
+  for (i = 0; i < num_free; i ++)
+    free_job(list->jobs[i]);
+
+  free(list->jobs);
+  free(list);
+}
+
+
+/*
+ * 'serverRemoveJobReference()' - Release a reference from @link serverAddJobReference@.
+ */
+
+void
+serverRemoveJobReference(
+    server_job_t *job)			/* I - Job */
+{
+  int	refcount;			/* Remaining references */
+
+
+  cupsMutexLock(&joblist_mutex);
+  refcount = -- job->refcount;
+  cupsMutexUnlock(&joblist_mutex);
+
+  if (refcount == 0)
+    free_job(job);
+}
+
+
+/*
+ * 'serverUnpackAttributes()' - Decode packed job or document attributes.
+ *
+ * The caller must free the returned attributes with `ippDelete`.
+ */
+
+ipp_t *					/* O - Attributes or `NULL` */
+serverUnpackAttributes(
+    const unsigned char *packed,	/* I - Packed attributes */
+    size_t              packedlen)	/* I - Length of packed attributes */
+{
+  server_packbuf_t	buf;		/* Packed attribute buffer */
+  ipp_t			*ipp;		/* Attributes */
+
+
+  if (!packed)
+    return (NULL);
+
+  buf.data = (unsigned char *)packed;
+  buf.used = 0;
+  buf.size = packedlen;
+
+  ipp = ippNew();
+
+  if (ippReadIO(&buf, (ipp_io_cb_t)read_packed, true, NULL, ipp) != IPP_STATE_DATA)
+  {
+    serverLog(SERVER_LOGLEVEL_ERROR, "Unable to unpack attributes: %s", cupsGetErrorString());
+    ippDelete(ipp);
+    return (NULL);
+  }
+
+  return (ipp);
+}
+
+
+/*
+ * 'serverUpdateJobData()' - Record document data received for a job.
+ */
+
+void
+serverUpdateJobData(
+    server_job_t      *job,		/* I - Job */
+    server_document_t *doc,		/* I - Document */
+    size_t            bytes,		/* I - Number of bytes received */
+    bool              done)		/* I - `true` when all data has been received */
+{
+  bool	spill = false;			/* Move memory spool file to disk? */
+
+
+  cupsMutexLock(&StreamMutex);
+
+  doc->received += (off_t)bytes;
+
+  if (doc->memfd >= 0)
+  {
+    spool_memory_used += bytes;
+    spill             = !done && !doc->spill_failed && ((size_t)doc->received > SpoolMemoryThreshold || spool_memory_used > SpoolMemory);
+  }
+
+  if (done)
+  {
+    doc->incoming = false;
+
+    serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Received %ld bytes for document #%d.", (long)doc->received, doc->number);
+  }
+
+  cupsCondBroadcast(&StreamCondition);
+  cupsMutexUnlock(&StreamMutex);
+
+#ifndef _WIN32
+  if (spill)
+    spill_document(job, doc);
+#endif /* !_WIN32 */
+}
+
+
+/*
+ * 'serverUpdateJobListNoLock()' - Publish a new snapshot of a printer's jobs.
+ *
+ * This must be called with the printer write lock held after adding or
+ * removing jobs.  Readers using the previous snapshot are not affected.
+ */
+
+void
+serverUpdateJobListNoLock(
+    server_printer_t *printer)		/* I - Printer */
+{
+  size_t		i;		/* Looping var */
+  server_joblist_t	*list,		/* New job list */
+			*old;		/* Old job list */
+
+
+  if ((list = calloc(1, sizeof(server_joblist_t))) == NULL)
+    return;
+
+  list->refcount = 1;
+  list->num_jobs = cupsArrayGetCount(printer->jobs);
+
+  if (list->num_jobs > 0 && (list->jobs = calloc(list->num_jobs, sizeof(server_job_t *))) == NULL)
+  {
+    free(list);
+    return;
+  }
+
+  for (i = 0; i < list->num_jobs; i ++)
+    list->jobs[i] = (server_job_t *)cupsArrayGetElement(printer->jobs, i);
+
+  cupsMutexLock(&joblist_mutex);
+
+  for (i = 0; i < list->num_jobs; i ++)
+    list->jobs[i]->refcount ++;
+
+  old              = printer->joblist;
+  printer->joblist = list;
+
+  cupsMutexUnlock(&joblist_mutex);
+
+  serverReleaseJobList(old);
+}
+
+
+/*
+ * 'serverWaitJobData()' - Wait for more document data for a job.
+ *
+ * This function returns once more than "offset" bytes have been received, all
+ * data has been received, or the job or document is canceled.  A return value
+ * less than or equal to "offset" means there is no more data.
+ */
+
+off_t					/* O - Number of bytes received */
+serverWaitJobData(
+    server_job_t      *job,		/* I - Job */
+    server_document_t *doc,		/* I - Document */
+    off_t             offset)		/* I - Number of bytes already read */
+{
+  off_t	received;			/* Number of bytes received */
+
+
+  cupsMutexLock(&StreamMutex);
+
+  while (doc->incoming && doc->received <= offset && !job->cancel && !doc->cancel)
+    cupsCondWait(&StreamCondition, &StreamMutex, 1.0);
+
+  received = doc->received;
+
+  cupsMutexUnlock(&StreamMutex);
+
+  return (received);
+}
+
+
+/*
+ * 'free_job()' - Free all memory used by a job object.
+ */
+
+static void
+free_job(server_job_t *job)		/* I - Job */
+{
+  server_document_t	*doc;		/* Current document */
+
+
+  cupsRWLockWrite(&job->rwlock);
+
+  ippDelete(job->attrs);
+  free(job->packed);
+  free(job->resources);
+
+  for (doc = (server_document_t *)cupsArrayGetFirst(job->documents); doc; doc = (server_document_t *)cupsArrayGetNext(job->documents))
+  {
+    if (doc->memfd >= 0)
+    {
+      close(doc->memfd);
+
+      cupsMutexLock(&StreamMutex);
+      spool_memory_used -= (size_t)doc->received;
+      cupsMutexUnlock(&StreamMutex);
+    }
+    else if (!KeepFiles)
+      unlink(doc->filename);
+
+    if (doc->prepared && !KeepFiles)
+      unlink(doc->prepared);
+
+    ippDelete(doc->attrs);
+    free(doc->packed);
+    free(doc->format);
+    free(doc->filename);
+    free(doc->prepared);
+    free(doc);
+  }
+
+  cupsArrayDelete(job->documents);
+
+  cupsRWDestroy(&job->rwlock);
+
+  free(job);
+}
+
+
+/*
+ * 'get_job_uri_id()' - Get the job-id from a job-uri value.
+ *
+ * URIs of the form "ipp[s]://host[:port]/printer-resource/NNN" are parsed
+ * directly.  Anything else is separated with `httpSeparateURI`.
+ */
+
+static int				/* O - Job ID or 0 if not a job on this printer */
+get_job_uri_id(
+    server_printer_t *printer,		/* I - Printer */
+    const char       *uri)		/* I - job-uri value */
+{
+  const char	*resptr;		/* Pointer to resource path */
+  char		*end;			/* End of job-id */
+  long		id;			/* job-id value */
+  char		scheme[32],		/* URI scheme */
+		userpass[256],		/* username:password */
+		host[256],		/* Hostname/IP */
+		resource[1024];		/* Resource path */
+  int		port;			/* Port number */
+
+
+  if (!uri)
+    return (0);
+
+ /*
+  * Fast path: skip the scheme and host and compare the resource path...
+  */
+
+  if ((resptr = strstr(uri, "://")) != NULL && (resptr = strchr(resptr + 3, '/')) != NULL && !strncmp(resptr, printer->resource, printer->resourcelen) && resptr[printer->resourcelen] == '/' && isdigit(resptr[printer->resourcelen + 1] & 255))
+  {
+    id = strtol(resptr + printer->resourcelen + 1, &end, 10);
+
+    if (!*end && id > 0 && id <= INT_MAX)
+      return ((int)id);
+  }
+
+ /*
+  * Slow path: separate the URI...
+  */
+
+  if (httpSeparateURI(HTTP_URI_CODING_ALL, uri, scheme, sizeof(scheme), userpass, sizeof(userpass), host, sizeof(host), &port, resource, sizeof(resource)) >= HTTP_URI_STATUS_OK && !strncmp(resource, printer->resource, printer->resourcelen) && resource[printer->resourcelen] == '/')
+    return (atoi(resource + printer->resourcelen + 1));
+
+  return (0);
+}
+
+
+/*
+ * 'index_job()' - Add a job to the printer's job-id index.
+ *
+ * The index is a vector of jobs covering the range of job-ids from the oldest
+ * job still in memory.  Leading empty entries are dropped before the vector is
+ * grown.  The caller must hold the printer write lock.
+ */
+
+static void
+index_job(server_printer_t *printer,	/* I - Printer */
+          server_job_t     *job)	/* I - Job */
+{
+  size_t	first,			/* First used entry */
+		alloc;			/* New allocation */
+  server_job_t	**temp;			/* New index */
+
+
+  if (!printer->job_index)
+  {
+    if ((printer->job_index = calloc(64, sizeof(server_job_t *))) == NULL)
+      return;
+
+    printer->job_index_alloc = 64;
+    printer->job_index_base  = job->id;
+  }
+
+  if (job->id < printer->job_index_base)
+  {
+   /*
+    * Extend the index down to this job-id...
+    */
+
+    first = (size_t)(printer->job_index_base - job->id);
+    alloc = printer->job_index_alloc + first;
+
+    if ((temp = realloc(printer->job_index, alloc * sizeof(server_job_t *))) == NULL)
+      return;
+
+    memmove(temp + first, temp, printer->job_index_alloc * sizeof(server_job_t *));
+    memset(temp, 0, first * sizeof(server_job_t *));
+
+    printer->job_index       = temp;
+    printer->job_index_alloc = alloc;
+    printer->job_index_base  = job->id;
+  }
+
+  while ((size_t)(job->id - printer->job_index_base) >= printer->job_index_alloc)
+  {
+   /*
+    * Slide the index past any removed jobs, then grow it as needed...
+    */
+
+    for (first = 0; first < printer->job_index_alloc && !printer->job_index[first]; first ++);
+
+    if (first == printer->job_index_alloc)
+    {
+      printer->job_index_base = job->id;
+    }
+    else if (first > 0)
+    {
+      memmove(printer->job_index, printer->job_index + first, (printer->job_index_alloc - first) * sizeof(server_job_t *));
+      memset(printer->job_index + printer->job_index_alloc - first, 0, first * sizeof(server_job_t *));
+
+      printer->job_index_base += (int)first;
+    }
+    else
+    {
+      alloc = 2 * printer->job_index_alloc;
+
+      if ((temp = realloc(printer->job_index, alloc * sizeof(server_job_t *))) == NULL)
+        return;
+
+      memset(temp + printer->job_index_alloc, 0, printer->job_index_alloc * sizeof(server_job_t *));
+
+      printer->job_index       = temp;
+      printer->job_index_alloc = alloc;
+    }
+  }
+
+  printer->job_index[job->id - printer->job_index_base] = job;
+}
+
+
+/*
+ * 'process_document()' - Process a single document in a job.
+ */
+
+static void
+process_document(
+    server_job_t      *job,		/* I - Job */
+    server_document_t *doc)		/* I - Document */
+{
+  int	status = 0;			/* Processing status */
+
+
+  cupsRWLockWrite(&job->rwlock);
+
+  if (doc->state >= IPP_JSTATE_CANCELED)
+  {
+   /*
+    * Document was canceled before we got to it...
+    */
+
+    release_document(job, doc);
+
+    cupsRWUnlock(&job->rwlock);
+    return;
+  }
+
+  doc->state      = IPP_JSTATE_PROCESSING;
+  doc->processing = time(NULL);
+
+  serverAddDocumentEventNoLock(job, doc, SERVER_EVENT_DOCUMENT_STATE_CHANGED, "Document #%d processing.", doc->number);
+
+  cupsRWUnlock(&job->rwlock);
+
+  if (job->printer->pinfo.command)
+  {
+   /*
+    * Execute a command with the document spool file and wait for it to
+    * complete...
+    */
+
+    status = serverTransformJob(NULL, job, doc, job->printer->pinfo.command, job->printer->pinfo.output_format, SERVER_TRANSFORM_COMMAND);
+  }
+  else
+  {
+   /*
+    * Wait for any streamed document data since we aren't piping it to a
+    * command, then sleep for a semi-random amount of time to simulate
+    * document processing.
+    */
+
+    while (doc->incoming && !job->cancel && !doc->cancel)
+      serverWaitJobData(job, doc, doc->received);
+
+    if (!job->cancel && !doc->cancel)
+      sleep((unsigned)(1 + (time(NULL) & 3)));
+  }
+
+  cupsRWLockWrite(&job->rwlock);
+
+  if (doc->state >= IPP_JSTATE_CANCELED)
+  {
+   /*
+    * Document was canceled or aborted while processing and the event has
+    * already been sent...
+    */
+
+    release_document(job, doc);
+
+    cupsRWUnlock(&job->rwlock);
+    return;
+  }
+
+  if (job->cancel || doc->cancel)
+    doc->state = IPP_JSTATE_CANCELED;
+  else if (status)
+    doc->state = IPP_JSTATE_ABORTED;
+  else
+    doc->state = IPP_JSTATE_COMPLETED;
+
+  doc->completed = time(NULL);
+
+  serverAddDocumentEventNoLock(job, doc, SERVER_EVENT_DOCUMENT_STATE_CHANGED | SERVER_EVENT_DOCUMENT_COMPLETED, doc->state == IPP_JSTATE_COMPLETED ? "Document #%d completed." : doc->state == IPP_JSTATE_ABORTED ? "Document #%d aborted." : "Document #%d canceled.", doc->number);
+
+  release_document(job, doc);
+
+  cupsRWUnlock(&job->rwlock);
+}
+
+
+/*
+ * 'read_packed()' - Read from a packed attribute buffer.
+ */
+
+static ssize_t				/* O - Number of bytes read */
+read_packed(server_packbuf_t *buf,	/* I - Packed attribute buffer */
+            ipp_uchar_t      *buffer,	/* I - Read buffer */
+            size_t           bytes)	/* I - Number of bytes to read */
+{
+  if (bytes > (buf->size - buf->used))
+    bytes = buf->size - buf->used;
+
+  memcpy(buffer, buf->data + buf->used, bytes);
+  buf->used += bytes;
+
+  return ((ssize_t)bytes);
+}
+
+
+/*
+ * 'wait_document()' - Wait for a document to be ready for processing.
+ *
+ * Documents are ready once all of their data has arrived, or immediately for
+ * streamed documents.  `NULL` is returned when the job is canceled or there
+ * are no more documents.  If the next document does not arrive within the
+ * multiple-operation-time-out, the job is closed and aborted.
+ */
+
+static server_document_t *		/* O - Document or `NULL` */
+wait_document(server_job_t *job,	/* I - Job */
+              int          number)	/* I - Document number */
+{
+  server_document_t	*doc = NULL;	/* Document */
+  time_t		timeout = 0;	/* Time to give up on the next document */
+  bool			timed_out = false;
+					/* Did the next document time out? */
+
+
+  cupsMutexLock(&StreamMutex);
+
+  while (!job->cancel)
+  {
+   /*
+    * Documents are only added with StreamMutex held, so look for the next one
+    * without taking the job lock (job->rwlock is always locked first)...
+    */
+
+    if ((doc = (server_document_t *)cupsArrayGetElement(job->documents, (size_t)(number - 1))) != NULL && (!doc->incoming || doc->streaming))
+      break;
+    else if (!doc && job->last_document)
+      break;
+
+    if (doc)
+    {
+      timeout = 0;
+    }
+    else if (!timeout)
+    {
+      timeout = time(NULL) + SERVER_MULTIPLE_OPERATION_TIME_OUT;
+    }
+    else if (time(NULL) >= timeout)
+    {
+      job->last_document = true;
+      timed_out          = true;
+      break;
+    }
+
+    doc = NULL;
+
+    cupsCondWait(&StreamCondition, &StreamMutex, 1.0);
+  }
+
+  cupsMutexUnlock(&StreamMutex);
+
+  if (timed_out)
+  {
+    serverLogJob(SERVER_LOGLEVEL_INFO, job, "No document received within %d seconds, aborting job.", SERVER_MULTIPLE_OPERATION_TIME_OUT);
+
+    cupsRWLockWrite(&job->rwlock);
+
+    job->state         = IPP_JSTATE_ABORTED;
+    job->state_reasons |= SERVER_JREASON_ABORTED_BY_SYSTEM;
+
+    cupsRWUnlock(&job->rwlock);
+  }
+
+  return (doc);
+}
+
+
+/*
+ * 'release_document()' - Release the memory spool file of a finished document.
+ *
+ * The caller must hold the job write lock.
+ */
+
+static void
+release_document(
+    server_job_t      *job,		/* I - Job */
+    server_document_t *doc)		/* I - Document */
+{
+  char	filename[1024];			/* Spool filename */
+
+
+  if (doc->memfd < 0)
+    return;
+
+  cupsMutexLock(&StreamMutex);
+  close(doc->memfd);
+  doc->memfd        = -1;
+  spool_memory_used -= (size_t)doc->received;
+  cupsMutexUnlock(&StreamMutex);
+
+ /*
+  * The "/proc" filename no longer refers to the document, so point it at the
+  * (non-existent) spool file instead...
+  */
+
+  serverCreateJobFilename(job, doc->number, doc->format, filename, sizeof(filename));
+  free(doc->filename);
+  doc->filename = strdup(filename);
+
+  serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Released memory spool file for document #%d.", doc->number);
+}
+
+
+#ifndef _WIN32
+/*
+ * 'spill_document()' - Move a memory spool file to the spool directory.
+ *
+ * This is called from the thread receiving the document, after the data has
+ * been written to "job->fd", so the write descriptor can be swapped in place.
+ * If the copy fails, the document stays in memory and no further attempts are
+ * made.
+ */
+
+static void
+spill_document(
+    server_job_t      *job,		/* I - Job */
+    server_document_t *doc)		/* I - Document */
+{
+  int		fd;			/* Spool file */
+  char		filename[1024],		/* Spool filename */
+		buffer[65536];		/* Copy buffer */
+  ssize_t	bytes;			/* Bytes read */
+  off_t		offset = 0;		/* Offset in memory file */
+
+
+  serverCreateJobFilename(job, doc->number, doc->format, filename, sizeof(filename));
+
+  if ((fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0600)) < 0)
+  {
+    serverLogJob(SERVER_LOGLEVEL_ERROR, job, "Unable to create \"%s\": %s", filename, strerror(errno));
+    goto spill_failed;
+  }
+
+  while ((bytes = pread(doc->memfd, buffer, sizeof(buffer), offset)) > 0)
+  {
+    if (write(fd, buffer, (size_t)bytes) < bytes)
+    {
+      bytes = -1;
+      break;
+    }
+
+    offset += bytes;
+  }
+
+  if (bytes < 0 || dup2(fd, job->fd) < 0)
+  {
+    serverLogJob(SERVER_LOGLEVEL_ERROR, job, "Unable to move document #%d to \"%s\": %s", doc->number, filename, strerror(errno));
+    close(fd);
+    unlink(filename);
+    goto spill_failed;
+  }
+
+  close(fd);
+
+  serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Moved document #%d from memory to \"%s\".", doc->number, filename);
+
+  cupsRWLockWrite(&job->rwlock);
+  free(doc->filename);
+  doc->filename = strdup(filename);
+  cupsRWUnlock(&job->rwlock);
+
+  cupsMutexLock(&StreamMutex);
+  close(doc->memfd);
+  doc->memfd        = -1;
+  spool_memory_used -= (size_t)doc->received;
+  cupsMutexUnlock(&StreamMutex);
+
+  return;
+
+ /*
+  * If we get here the document stays in memory - don't try again for every
+  * chunk of data that follows...
+  */
+
+  spill_failed:
+
+  cupsMutexLock(&StreamMutex);
+  doc->spill_failed = true;
+  cupsMutexUnlock(&StreamMutex);
+}
+#endif /* !_WIN32 */
+
+
+/*
+ * 'write_packed()' - Write to a packed attribute buffer.
+ */
+
+static ssize_t				/* O - Number of bytes written or -1 on error */
+write_packed(server_packbuf_t *buf,	/* I - Packed attribute buffer */
+             ipp_uchar_t      *buffer,	/* I - Write buffer */
+             size_t           bytes)	/* I - Number of bytes to write */
+{
+  if ((buf->used + bytes) > buf->size)
+  {
+    size_t		size = buf->size + bytes + 1024;
+					/* New size of buffer */
+    unsigned char	*data;		/* New buffer */
+
+    if ((data = realloc(buf->data, size)) == NULL)
+      return (-1);
+
+    buf->data = data;
+    buf->size = size;
+  }
+
+  memcpy(buf->data + buf->used, buffer, bytes);
+  buf->used += bytes;
+
+  return ((ssize_t)bytes);
+}
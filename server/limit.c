@@ -0,0 +1,571 @@
+/*
+ * Rate limits and request lanes for sample IPP server implementation.
+ *
+ * Copyright © 2026 by the Printer Working Group
+ *
+ * Licensed under Apache License v2.0.  See the file "LICENSE" for more
+ * information.
+ *
+ * Each client address and authenticated username gets a token bucket for each
+ * class of request (read, job, and admin).  Buckets refill at the configured
+ * rate up to the configured burst, and a request is admitted only when both
+ * the address and the username (if any) have a token available.
+ *
+ * Admitted IPP requests are then sorted into lanes.  Read requests share a
+ * limited number of execution slots ("MaxReadRequests"), while job submission
+ * and job control/administration requests never wait behind them.
+ */
+
+#include "ippserver.h"
+
+
+/*
+ * Local constants...
+ */
+
+#define LANE_RETRY	5		/* Retry-After seconds when the read lane is full */
+#define LANE_TIMEOUT	10.0		/* Seconds to wait for a read lane slot */
+#define LIMIT_IDLE	300		/* Seconds before an idle bucket is removed */
+
+
+/*
+ * Local types...
+ */
+
+typedef struct server_bucket_s		/**** Token buckets for an address or user ****/
+{
+  char			type;		/* 'a' for address, 'u' for username */
+  char			name[256];	/* Address or username */
+  double		tokens[SERVER_LIMIT_MAX],
+					/* Available tokens */
+			updated[SERVER_LIMIT_MAX];
+					/* Time of last refill */
+  time_t		used;		/* Time of last request */
+} server_bucket_t;
+
+typedef struct server_opclass_s		/**** Operation limit class and lane ****/
+{
+  ipp_op_t		op;		/* Operation code */
+  server_limit_t	limit;		/* Rate limit class */
+  server_lane_t		lane;		/* Request lane */
+} server_opclass_t;
+
+
+/*
+ * Local globals...
+ */
+
+static cups_array_t	*limit_buckets = NULL;
+					/* Token buckets */
+static cups_mutex_t	limit_mutex = CUPS_MUTEX_INITIALIZER;
+					/* Mutex for token buckets */
+static unsigned		limit_rejected[SERVER_LIMIT_MAX] = { 0 };
+					/* Number of rejected requests */
+static const char * const limit_names[SERVER_LIMIT_MAX] =
+{					/* Names of limit classes */
+  "read",
+  "job",
+  "admin"
+};
+static cups_mutex_t	lane_mutex = CUPS_MUTEX_INITIALIZER;
+					/* Mutex for request lanes */
+static cups_cond_t	lane_cond = CUPS_COND_INITIALIZER;
+					/* Condition for read lane slots */
+static int		lane_active = 0,/* Number of running read requests */
+			lane_queued = 0;/* Number of waiting read requests */
+static double		lane_wait_max[SERVER_LANE_MAX] = { 0.0 },
+					/* Longest wait in milliseconds */
+			lane_wait_total[SERVER_LANE_MAX] = { 0.0 };
+					/* Total wait in milliseconds */
+static const char * const lane_names[SERVER_LANE_MAX] =
+{					/* Names of lanes */
+  "read",
+  "job",
+  "control"
+};
+static const server_opclass_t opclasses[] =
+{					/* Operations that are not plain reads */
+  { IPP_OP_PRINT_JOB,				SERVER_LIMIT_JOB,	SERVER_LANE_JOB },
+  { IPP_OP_PRINT_URI,				SERVER_LIMIT_JOB,	SERVER_LANE_JOB },
+  { IPP_OP_VALIDATE_JOB,			SERVER_LIMIT_JOB,	SERVER_LANE_JOB },
+  { IPP_OP_CREATE_JOB,				SERVER_LIMIT_JOB,	SERVER_LANE_JOB },
+  { IPP_OP_SEND_DOCUMENT,			SERVER_LIMIT_JOB,	SERVER_LANE_JOB },
+  { IPP_OP_SEND_URI,				SERVER_LIMIT_JOB,	SERVER_LANE_JOB },
+  { IPP_OP_CANCEL_JOB,				SERVER_LIMIT_JOB,	SERVER_LANE_CONTROL },
+  { IPP_OP_HOLD_JOB,				SERVER_LIMIT_JOB,	SERVER_LANE_CONTROL },
+  { IPP_OP_RELEASE_JOB,				SERVER_LIMIT_JOB,	SERVER_LANE_CONTROL },
+  { IPP_OP_PAUSE_PRINTER,			SERVER_LIMIT_ADMIN,	SERVER_LANE_CONTROL },
+  { IPP_OP_RESUME_PRINTER,			SERVER_LIMIT_ADMIN,	SERVER_LANE_CONTROL },
+  { IPP_OP_SET_PRINTER_ATTRIBUTES,		SERVER_LIMIT_ADMIN,	SERVER_LANE_CONTROL },
+  { IPP_OP_SET_JOB_ATTRIBUTES,			SERVER_LIMIT_JOB,	SERVER_LANE_CONTROL },
+  { IPP_OP_GET_NOTIFICATIONS,			SERVER_LIMIT_READ,	SERVER_LANE_CONTROL },
+					/* Can wait for events, so never holds a read slot */
+  { IPP_OP_ENABLE_PRINTER,			SERVER_LIMIT_ADMIN,	SERVER_LANE_CONTROL },
+  { IPP_OP_DISABLE_PRINTER,			SERVER_LIMIT_ADMIN,	SERVER_LANE_CONTROL },
+  { IPP_OP_PAUSE_PRINTER_AFTER_CURRENT_JOB,	SERVER_LIMIT_ADMIN,	SERVER_LANE_CONTROL },
+  { IPP_OP_HOLD_NEW_JOBS,			SERVER_LIMIT_ADMIN,	SERVER_LANE_CONTROL },
+  { IPP_OP_RELEASE_HELD_NEW_JOBS,		SERVER_LIMIT_ADMIN,	SERVER_LANE_CONTROL },
+  { IPP_OP_RESTART_PRINTER,			SERVER_LIMIT_ADMIN,	SERVER_LANE_CONTROL },
+  { IPP_OP_SHUTDOWN_PRINTER,			SERVER_LIMIT_ADMIN,	SERVER_LANE_CONTROL },
+  { IPP_OP_STARTUP_PRINTER,			SERVER_LIMIT_ADMIN,	SERVER_LANE_CONTROL },
+  { IPP_OP_CANCEL_CURRENT_JOB,			SERVER_LIMIT_ADMIN,	SERVER_LANE_CONTROL },
+  { IPP_OP_CANCEL_DOCUMENT,			SERVER_LIMIT_JOB,	SERVER_LANE_CONTROL },
+  { IPP_OP_SET_DOCUMENT_ATTRIBUTES,		SERVER_LIMIT_JOB,	SERVER_LANE_CONTROL },
+  { IPP_OP_VALIDATE_DOCUMENT,			SERVER_LIMIT_JOB,	SERVER_LANE_JOB },
+  { IPP_OP_CANCEL_JOBS,				SERVER_LIMIT_ADMIN,	SERVER_LANE_CONTROL },
+  { IPP_OP_CANCEL_MY_JOBS,			SERVER_LIMIT_JOB,	SERVER_LANE_CONTROL },
+  { IPP_OP_CLOSE_JOB,				SERVER_LIMIT_JOB,	SERVER_LANE_CONTROL },
+  { IPP_OP_ACKNOWLEDGE_DOCUMENT,			SERVER_LIMIT_JOB,	SERVER_LANE_CONTROL },
+  { IPP_OP_ACKNOWLEDGE_IDENTIFY_PRINTER,	SERVER_LIMIT_JOB,	SERVER_LANE_CONTROL },
+  { IPP_OP_ACKNOWLEDGE_JOB,			SERVER_LIMIT_JOB,	SERVER_LANE_CONTROL },
+  { IPP_OP_FETCH_DOCUMENT,			SERVER_LIMIT_JOB,	SERVER_LANE_JOB },
+					/* Sends document data, so never holds a read slot */
+  { IPP_OP_FETCH_JOB,				SERVER_LIMIT_JOB,	SERVER_LANE_JOB },
+  { IPP_OP_GET_OUTPUT_DEVICE_ATTRIBUTES,	SERVER_LIMIT_JOB,	SERVER_LANE_CONTROL },
+  { IPP_OP_UPDATE_ACTIVE_JOBS,			SERVER_LIMIT_JOB,	SERVER_LANE_CONTROL },
+  { IPP_OP_DEREGISTER_OUTPUT_DEVICE,		SERVER_LIMIT_JOB,	SERVER_LANE_CONTROL },
+  { IPP_OP_UPDATE_DOCUMENT_STATUS,		SERVER_LIMIT_JOB,	SERVER_LANE_CONTROL },
+  { IPP_OP_UPDATE_JOB_STATUS,			SERVER_LIMIT_JOB,	SERVER_LANE_CONTROL },
+  { IPP_OP_UPDATE_OUTPUT_DEVICE_ATTRIBUTES,	SERVER_LIMIT_JOB,	SERVER_LANE_CONTROL },
+  { IPP_OP_REGISTER_OUTPUT_DEVICE,		SERVER_LIMIT_JOB,	SERVER_LANE_CONTROL },
+  { IPP_OP_ALLOCATE_PRINTER_RESOURCES,		SERVER_LIMIT_ADMIN,	SERVER_LANE_CONTROL },
+  { IPP_OP_CANCEL_RESOURCE,			SERVER_LIMIT_ADMIN,	SERVER_LANE_CONTROL },
+  { IPP_OP_CREATE_PRINTER,			SERVER_LIMIT_ADMIN,	SERVER_LANE_CONTROL },
+  { IPP_OP_CREATE_RESOURCE,			SERVER_LIMIT_ADMIN,	SERVER_LANE_CONTROL },
+  { IPP_OP_DEALLOCATE_PRINTER_RESOURCES,	SERVER_LIMIT_ADMIN,	SERVER_LANE_CONTROL },
+  { IPP_OP_DELETE_PRINTER,			SERVER_LIMIT_ADMIN,	SERVER_LANE_CONTROL },
+  { IPP_OP_DISABLE_ALL_PRINTERS,		SERVER_LIMIT_ADMIN,	SERVER_LANE_CONTROL },
+  { IPP_OP_ENABLE_ALL_PRINTERS,			SERVER_LIMIT_ADMIN,	SERVER_LANE_CONTROL },
+  { IPP_OP_INSTALL_RESOURCE,			SERVER_LIMIT_ADMIN,	SERVER_LANE_CONTROL },
+  { IPP_OP_PAUSE_ALL_PRINTERS,			SERVER_LIMIT_ADMIN,	SERVER_LANE_CONTROL },
+  { IPP_OP_PAUSE_ALL_PRINTERS_AFTER_CURRENT_JOB, SERVER_LIMIT_ADMIN,	SERVER_LANE_CONTROL },
+  { IPP_OP_RESTART_ONE_PRINTER,			SERVER_LIMIT_ADMIN,	SERVER_LANE_CONTROL },
+  { IPP_OP_RESTART_SYSTEM,			SERVER_LIMIT_ADMIN,	SERVER_LANE_CONTROL },
+  { IPP_OP_RESUME_ALL_PRINTERS,			SERVER_LIMIT_ADMIN,	SERVER_LANE_CONTROL },
+  { IPP_OP_SEND_RESOURCE_DATA,			SERVER_LIMIT_ADMIN,	SERVER_LANE_CONTROL },
+  { IPP_OP_SET_RESOURCE_ATTRIBUTES,		SERVER_LIMIT_ADMIN,	SERVER_LANE_CONTROL },
+  { IPP_OP_SET_SYSTEM_ATTRIBUTES,		SERVER_LIMIT_ADMIN,	SERVER_LANE_CONTROL },
+  { IPP_OP_SHUTDOWN_ALL_PRINTERS,		SERVER_LIMIT_ADMIN,	SERVER_LANE_CONTROL },
+  { IPP_OP_SHUTDOWN_ONE_PRINTER,		SERVER_LIMIT_ADMIN,	SERVER_LANE_CONTROL },
+  { IPP_OP_STARTUP_ALL_PRINTERS,		SERVER_LIMIT_ADMIN,	SERVER_LANE_CONTROL },
+  { IPP_OP_STARTUP_ONE_PRINTER,			SERVER_LIMIT_ADMIN,	SERVER_LANE_CONTROL }
+};
+
+
+/*
+ * Local functions...
+ */
+
+static bool		acquire_slot(double timeout);
+static int		compare_buckets(server_bucket_t *a, server_bucket_t *b);
+static server_bucket_t	*find_bucket(char type, const char *name, time_t curtime);
+static const server_opclass_t *get_opclass(ipp_op_t op);
+static double		take_token(server_bucket_t *bucket, server_limit_t limit, double curtime);
+
+
+/*
+ * 'serverCheckRateLimit()' - Check whether a client may make another request.
+ *
+ * When the request is over the limit, the number of seconds to wait is stored
+ * in the client's "retry_after" member for the Retry-After header.
+ */
+
+bool					/* O - `true` if allowed, `false` if over the limit */
+serverCheckRateLimit(
+    server_client_t *client,		/* I - Client */
+    server_limit_t  limit)		/* I - Limit class */
+{
+  bool			ret = true;	/* Return value */
+  double		curtime,	/* Current time */
+			wait,		/* Seconds to wait for a token */
+			uwait = 0.0;	/* Seconds to wait for username token */
+  server_bucket_t	*abucket,	/* Address bucket */
+			*ubucket = NULL;/* Username bucket */
+
+
+  if (RateLimits[limit].rate <= 0.0)
+    return (true);
+
+  curtime = serverGetTime();
+
+  cupsMutexLock(&limit_mutex);
+
+  if ((abucket = find_bucket('a', client->hostname, (time_t)curtime)) != NULL && client->username[0])
+    ubucket = find_bucket('u', client->username, (time_t)curtime);
+
+ /*
+  * Only take tokens when both buckets have one, so a rejected request doesn't
+  * use up the other budget...
+  */
+
+  wait = abucket ? take_token(abucket, limit, curtime) : 0.0;
+
+  if (wait <= 0.0 && ubucket && (uwait = take_token(ubucket, limit, curtime)) > 0.0)
+  {
+    abucket->tokens[limit] += 1.0;
+    wait = uwait;
+  }
+
+  if (wait > 0.0)
+  {
+    limit_rejected[limit] ++;
+    client->retry_after = (int)wait + 1;
+    ret                 = false;
+  }
+
+  cupsMutexUnlock(&limit_mutex);
+
+  if (!ret)
+    serverLogClient(SERVER_LOGLEVEL_INFO, client, "Over %s rate limit, retry in %d second(s).", limit_names[limit], client->retry_after);
+
+  return (ret);
+}
+
+
+/*
+ * 'serverCleanRateLimits()' - Remove idle token buckets.
+ */
+
+void
+serverCleanRateLimits(void)
+{
+  server_bucket_t	*bucket;	/* Current bucket */
+  time_t		idletime = time(NULL) - LIMIT_IDLE;
+					/* Oldest time to keep */
+
+
+  cupsMutexLock(&limit_mutex);
+
+  for (bucket = (server_bucket_t *)cupsArrayGetFirst(limit_buckets); bucket; bucket = (server_bucket_t *)cupsArrayGetNext(limit_buckets))
+  {
+    if (bucket->used < idletime)
+      cupsArrayRemove(limit_buckets, bucket);
+  }
+
+  cupsMutexUnlock(&limit_mutex);
+}
+
+
+/*
+ * 'serverCopyRateLimitStatus()' - Copy the rate limit counters.
+ */
+
+void
+serverCopyRateLimitStatus(
+    ipp_t        *ipp,			/* I - IPP message */
+    cups_array_t *ra)			/* I - Requested attributes */
+{
+  cupsMutexLock(&limit_mutex);
+
+  if (!ra || cupsArrayFind(ra, "smi2699-rejected-admin-requests"))
+    ippAddInteger(ipp, IPP_TAG_SYSTEM, IPP_TAG_INTEGER, "smi2699-rejected-admin-requests", (int)limit_rejected[SERVER_LIMIT_ADMIN]);
+
+  if (!ra || cupsArrayFind(ra, "smi2699-rejected-job-requests"))
+    ippAddInteger(ipp, IPP_TAG_SYSTEM, IPP_TAG_INTEGER, "smi2699-rejected-job-requests", (int)limit_rejected[SERVER_LIMIT_JOB]);
+
+  if (!ra || cupsArrayFind(ra, "smi2699-rejected-read-requests"))
+    ippAddInteger(ipp, IPP_TAG_SYSTEM, IPP_TAG_INTEGER, "smi2699-rejected-read-requests", (int)limit_rejected[SERVER_LIMIT_READ]);
+
+  cupsMutexUnlock(&limit_mutex);
+}
+
+
+/*
+ * 'serverCopyRequestStatus()' - Copy the request lane counters.
+ */
+
+void
+serverCopyRequestStatus(
+    ipp_t        *ipp,			/* I - IPP message */
+    cups_array_t *ra)			/* I - Requested attributes */
+{
+  int	lane;				/* Current lane */
+  char	name[256];			/* Attribute name */
+
+
+  cupsMutexLock(&lane_mutex);
+
+  if (!ra || cupsArrayFind(ra, "smi2699-max-read-requests"))
+    ippAddInteger(ipp, IPP_TAG_SYSTEM, IPP_TAG_INTEGER, "smi2699-max-read-requests", MaxReadRequests);
+
+  if (!ra || cupsArrayFind(ra, "smi2699-read-requests-active"))
+    ippAddInteger(ipp, IPP_TAG_SYSTEM, IPP_TAG_INTEGER, "smi2699-read-requests-active", lane_active);
+
+  if (!ra || cupsArrayFind(ra, "smi2699-read-requests-queued"))
+    ippAddInteger(ipp, IPP_TAG_SYSTEM, IPP_TAG_INTEGER, "smi2699-read-requests-queued", lane_queued);
+
+  for (lane = SERVER_LANE_READ; lane < SERVER_LANE_MAX; lane ++)
+  {
+    snprintf(name, sizeof(name), "smi2699-%s-request-wait-time-max", lane_names[lane]);
+    if (!ra || cupsArrayFind(ra, name))
+      ippAddInteger(ipp, IPP_TAG_SYSTEM, IPP_TAG_INTEGER, name, (int)lane_wait_max[lane]);
+
+    snprintf(name, sizeof(name), "smi2699-%s-request-wait-time-total", lane_names[lane]);
+    if (!ra || cupsArrayFind(ra, name))
+      ippAddInteger(ipp, IPP_TAG_SYSTEM, IPP_TAG_INTEGER, name, lane_wait_total[lane] < INT_MAX ? (int)lane_wait_total[lane] : INT_MAX);
+  }
+
+  cupsMutexUnlock(&lane_mutex);
+}
+
+
+/*
+ * 'serverFinishRequest()' - Release the lane used by an IPP request.
+ *
+ * It is safe to call this function more than once for the same request.
+ */
+
+void
+serverFinishRequest(
+    server_client_t *client)		/* I - Client */
+{
+  if (!client->lane_slot)
+    return;
+
+  cupsMutexLock(&lane_mutex);
+
+  lane_active --;
+  cupsCondSignal(&lane_cond);
+
+  cupsMutexUnlock(&lane_mutex);
+
+  client->lane_slot = false;
+}
+
+
+/*
+ * 'serverGetOperationLimit()' - Get the rate limit class for an operation.
+ */
+
+server_limit_t				/* O - Limit class */
+serverGetOperationLimit(ipp_op_t op)	/* I - Operation code */
+{
+  const server_opclass_t *opclass = get_opclass(op);
+					/* Operation class */
+
+
+  return (opclass ? opclass->limit : SERVER_LIMIT_READ);
+}
+
+
+/*
+ * 'serverResumeRequest()' - Get a read lane slot back for a streamed response.
+ *
+ * Streamed responses release their slot with serverFinishRequest while
+ * writing to the client.  Since part of the response has already been sent,
+ * this function waits for a slot without a timeout.
+ */
+
+void
+serverResumeRequest(
+    server_client_t *client)		/* I - Client */
+{
+  if (client->lane != SERVER_LANE_READ || MaxReadRequests <= 0 || client->lane_slot)
+    return;
+
+  cupsMutexLock(&lane_mutex);
+  client->lane_slot = acquire_slot(0.0);
+  cupsMutexUnlock(&lane_mutex);
+}
+
+
+/*
+ * 'serverStartRequest()' - Wait for a lane to run an IPP request.
+ *
+ * Read requests wait up to 10 seconds for one of the "MaxReadRequests" slots.
+ * When no slot becomes available, the number of seconds to wait is stored in
+ * the client's "retry_after" member for the Retry-After header.  Job
+ * submission and job control/administration requests start immediately.
+ */
+
+bool					/* O - `true` if started, `false` if the read lane is busy */
+serverStartRequest(
+    server_client_t *client)		/* I - Client */
+{
+  const server_opclass_t *opclass = get_opclass(client->operation_id);
+					/* Operation class */
+  double	start = serverGetTime(),	/* Start of wait */
+		wait;			/* Wait in milliseconds */
+
+
+  client->lane = opclass ? opclass->lane : SERVER_LANE_READ;
+
+  cupsMutexLock(&lane_mutex);
+
+  if (client->lane == SERVER_LANE_READ && MaxReadRequests > 0 && (client->lane_slot = acquire_slot(LANE_TIMEOUT)) == false)
+  {
+    cupsMutexUnlock(&lane_mutex);
+
+    client->retry_after = LANE_RETRY;
+
+    serverLogClient(SERVER_LOGLEVEL_INFO, client, "No %s lane slot after %.0f seconds, retry in %d second(s).", lane_names[client->lane], LANE_TIMEOUT, client->retry_after);
+
+    return (false);
+  }
+
+  wait = 1000.0 * (serverGetTime() - start);
+
+  if (wait > lane_wait_max[client->lane])
+    lane_wait_max[client->lane] = wait;
+
+  lane_wait_total[client->lane] += wait;
+
+  cupsMutexUnlock(&lane_mutex);
+
+  if (wait >= 1000.0)
+    serverLogClient(SERVER_LOGLEVEL_DEBUG, client, "Waited %.0fms in the %s lane.", wait, lane_names[client->lane]);
+
+  return (true);
+}
+
+
+/*
+ * 'acquire_slot()' - Wait for a read lane slot.
+ *
+ * The caller must hold the lane mutex.
+ */
+
+static bool				/* O - `true` if a slot was taken, `false` on timeout */
+acquire_slot(double timeout)		/* I - Seconds to wait or 0.0 for no timeout */
+{
+  double	deadline = serverGetTime() + timeout,
+					/* Time to give up */
+		remaining = 0.0;	/* Seconds remaining */
+
+
+  lane_queued ++;
+
+  while (lane_active >= MaxReadRequests)
+  {
+    if (timeout > 0.0 && (remaining = deadline - serverGetTime()) <= 0.0)
+    {
+      lane_queued --;
+      return (false);
+    }
+
+    cupsCondWait(&lane_cond, &lane_mutex, remaining);
+  }
+
+  lane_queued --;
+  lane_active ++;
+
+  return (true);
+}
+
+
+/*
+ * 'compare_buckets()' - Compare two token buckets.
+ */
+
+static int				/* O - Result of comparison */
+compare_buckets(server_bucket_t *a,	/* I - First bucket */
+                server_bucket_t *b)	/* I - Second bucket */
+{
+  if (a->type != b->type)
+    return (a->type - b->type);
+  else
+    return (strcmp(a->name, b->name));
+}
+
+
+/*
+ * 'find_bucket()' - Find or create the token buckets for an address or user.
+ *
+ * The caller must hold the limit mutex.
+ */
+
+static server_bucket_t *		/* O - Bucket or `NULL` on error */
+find_bucket(char       type,		/* I - 'a' for address, 'u' for username */
+            const char *name,		/* I - Address or username */
+            time_t     curtime)		/* I - Current time */
+{
+  server_bucket_t	key,		/* Search key */
+			*bucket;	/* Bucket */
+  int			i;		/* Looping var */
+
+
+  if (!limit_buckets && (limit_buckets = cupsArrayNew((cups_array_cb_t)compare_buckets, NULL, NULL, 0, NULL, (cups_afree_cb_t)free)) == NULL)
+    return (NULL);
+
+  key.type = type;
+  cupsCopyString(key.name, name, sizeof(key.name));
+
+  if ((bucket = (server_bucket_t *)cupsArrayFind(limit_buckets, &key)) == NULL)
+  {
+   /*
+    * New address or user, start with a full set of buckets...
+    */
+
+    if ((bucket = (server_bucket_t *)calloc(1, sizeof(server_bucket_t))) == NULL)
+      return (NULL);
+
+    bucket->type = type;
+    cupsCopyString(bucket->name, name, sizeof(bucket->name));
+
+    for (i = 0; i < SERVER_LIMIT_MAX; i ++)
+    {
+      bucket->tokens[i]  = RateLimits[i].burst;
+      bucket->updated[i] = (double)curtime;
+    }
+
+    cupsArrayAdd(limit_buckets, bucket);
+  }
+
+  bucket->used = curtime;
+
+  return (bucket);
+}
+
+
+/*
+ * 'get_opclass()' - Get the limit class and lane for an operation.
+ */
+
+static const server_opclass_t *		/* O - Operation class or `NULL` for a read */
+get_opclass(ipp_op_t op)		/* I - Operation code */
+{
+  size_t	i;			/* Looping var */
+
+
+  for (i = 0; i < (sizeof(opclasses) / sizeof(opclasses[0])); i ++)
+  {
+    if (opclasses[i].op == op)
+      return (opclasses + i);
+  }
+
+  return (NULL);
+}
+
+
+/*
+ * 'take_token()' - Refill a bucket and take a token from it.
+ *
+ * The caller must hold the limit mutex.
+ */
+
+static double				/* O - 0.0 if a token was taken, otherwise seconds until one is available */
+take_token(server_bucket_t *bucket,	/* I - Bucket */
+           server_limit_t  limit,	/* I - Limit class */
+           double          curtime)	/* I - Current time */
+{
+  server_rate_t	*rate = RateLimits + limit;
+					/* Rate limit */
+
+
+  if (curtime > bucket->updated[limit])
+  {
+    bucket->tokens[limit] += rate->rate * (curtime - bucket->updated[limit]);
+    if (bucket->tokens[limit] > rate->burst)
+      bucket->tokens[limit] = rate->burst;
+
+    bucket->updated[limit] = curtime;
+  }
+
+  if (bucket->tokens[limit] >= 1.0)
+  {
+    bucket->tokens[limit] -= 1.0;
+    return (0.0);
+  }
+
+  return ((1.0 - bucket->tokens[limit]) / rate->rate);
+}
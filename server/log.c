@@ -10,6 +10,9 @@
 
 #include "ippserver.h"
 #include <stdarg.h>
+#ifdef _WIN32
+#  include <sys/timeb.h>
+#endif /* _WIN32 */
 
 
 /*
@@ -28,6 +31,32 @@ static ssize_t	safe_vsnprintf(char *buffer, size_t bufsize, const char *format,
 static void	server_log_to_file(server_loglevel_t level, const char *format, va_list ap);
 
 
+/*
+ * 'serverGetTime()' - Return the current time in fractional seconds.
+ */
+
+double					/* O - Time in seconds */
+serverGetTime(void)
+{
+#ifdef _WIN32
+  struct _timeb curtime;		/* Current time */
+
+
+  _ftime(&curtime);
+
+  return ((double)curtime.time + 0.001 * curtime.millitm);
+
+#else
+  struct timeval curtime;		/* Current time */
+
+
+  gettimeofday(&curtime, NULL);
+
+  return ((double)curtime.tv_sec + 0.000001 * curtime.tv_usec);
+#endif /* _WIN32 */
+}
+
+
 /*
  * 'serverLog()' - Log a message.
  */
@@ -10,6 +10,9 @@
 
 #define IPPSERVER_MAIN_C
 #include "ippserver.h"
+#ifndef _WIN32
+#  include <signal.h>
+#endif /* !_WIN32 */
 
 
 /*
@@ -309,10 +312,19 @@ main(int  argc,				/* I - Number of command-line args */
     printer->is_accepting = 1;
 
     serverAddPrinter(printer);
+
+    if (StateDirectory)
+      serverSaveSystem(false);
   }
 
-  if (StateDirectory)
-    serverSaveSystem();
+#ifndef _WIN32
+ /*
+  * Ignore SIGPIPE so that writes to a job processing command that has exited
+  * return an error instead...
+  */
+
+  signal(SIGPIPE, SIG_IGN);
+#endif /* !_WIN32 */
 
  /*
   * Enter the server main loop...
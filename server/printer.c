@@ -11,16 +11,45 @@
 #include "ippserver.h"
 
 
+/*
+ * Local types...
+ */
+
+struct server_caps_s			/**** Shared capability attributes ****/
+{
+  size_t		hash;		/* Hash of serialized attributes */
+  char			*key;		/* Serialized attributes */
+  ipp_t			*attrs;		/* Capability attributes (read-only) */
+  size_t		use;		/* Number of printers using them */
+};
+
+
+/*
+ * Local globals...
+ */
+
+static cups_array_t	*printer_caps = NULL;
+					/* Shared capability attributes */
+static cups_mutex_t	printer_caps_mutex = CUPS_MUTEX_INITIALIZER;
+					/* Mutex for shared capabilities */
+
+
 /*
  * Local functions...
  */
 
+static void		add_supported(cups_array_t *supported, const char *name, ipp_attribute_t *attr);
 static int		compare_active_jobs(server_job_t *a, server_job_t *b);
+static int		compare_caps(server_caps_t *a, server_caps_t *b);
 static int		compare_completed_jobs(server_job_t *a, server_job_t *b);
 static int		compare_jobs(server_job_t *a, server_job_t *b);
 static ipp_t		*create_media_col(const char *media, const char *source, const char *type, int width, int length, int margins);
 static ipp_t		*create_media_size(int width, int length);
 static void		dnssd_callback(cups_dnssd_service_t *service, server_printer_t *printer, cups_dnssd_flags_t flags);
+static size_t		hash_supported(const char *key, void *data);
+static bool		is_capability(ipp_attribute_t *attr);
+static void		release_caps(server_printer_t *printer);
+static void		share_caps(server_printer_t *printer);
 
 
 /*
@@ -815,7 +844,9 @@ serverCreatePrinter(
   }
   else
   {
+    cupsRWLockWrite(&PrintersRWLock);
     printer->id = NextPrinterId ++;
+    cupsRWUnlock(&PrintersRWLock);
 
     ippAddInteger(pinfo->attrs, IPP_TAG_PRINTER, IPP_TAG_INTEGER, "printer-id", printer->id);
   }
@@ -828,6 +859,7 @@ serverCreatePrinter(
   printer->dns_sd_serial  = 1;
   printer->start_time     = time(NULL);
   printer->config_time    = printer->start_time;
+  printer->config_dirty   = true;
   printer->state          = IPP_PSTATE_STOPPED;
   printer->state_reasons  = SERVER_PREASON_PAUSED;
   printer->state_time     = printer->start_time;
@@ -837,6 +869,8 @@ serverCreatePrinter(
   printer->next_job_id    = 1;
   printer->pinfo          = *pinfo;
 
+  serverUpdateJobListNoLock(printer);
+
   if (dupe_pinfo)
   {
     printer->pinfo.icon             = pinfo->icon ? strdup(pinfo->icon) : NULL;
@@ -1305,10 +1339,10 @@ serverCreatePrinter(
   }
 
   /* multiple-document-jobs-supported */
-  ippAddBoolean(printer->pinfo.attrs, IPP_TAG_PRINTER, "multiple-document-jobs-supported", 0);
+  ippAddBoolean(printer->pinfo.attrs, IPP_TAG_PRINTER, "multiple-document-jobs-supported", 1);
 
   /* multiple-operation-time-out */
-  ippAddInteger(printer->pinfo.attrs, IPP_TAG_PRINTER, IPP_TAG_INTEGER, "multiple-operation-time-out", 60);
+  ippAddInteger(printer->pinfo.attrs, IPP_TAG_PRINTER, IPP_TAG_INTEGER, "multiple-operation-time-out", SERVER_MULTIPLE_OPERATION_TIME_OUT);
 
   /* multiple-operation-time-out-action */
   ippAddString(printer->pinfo.attrs, IPP_TAG_PRINTER, IPP_CONST_TAG(IPP_TAG_KEYWORD), "multiple-operation-time-out-action", NULL, "abort-job");
@@ -1772,11 +1806,16 @@ serverCreatePrinter(
   snprintf(title, sizeof(title), "[Printer %s]", printer->name);
   serverLogAttributes(NULL, title, printer->pinfo.attrs, 0);
 
+  share_caps(printer);
+  serverUpdatePrinterSupportedNoLock(printer);
+  serverOpenHistory(printer);
+
  /*
-  * Register the printer with Bonjour...
+  * Register the printer with Bonjour - printers created at startup are
+  * registered in the background once they are all loaded...
   */
 
-  if (!serverRegisterPrinter(printer))
+  if (!PrintersLoading && !serverRegisterPrinter(printer))
     goto bad_printer;
 
  /*
@@ -1879,6 +1918,24 @@ serverDeletePrinter(
 {
   int			i;		/* Looping var */
   server_device_t	*device;	/* Current device */
+  server_job_t		*job;		/* Current job */
+
+  serverInvalidateWebPages(printer, true);
+
+ /*
+  * Stop any background document transforms and wait for them to finish
+  * without holding the printer lock, since they update printer attributes...
+  */
+
+  cupsRWLockRead(&printer->rwlock);
+  for (job = (server_job_t *)cupsArrayGetFirst(printer->jobs); job; job = (server_job_t *)cupsArrayGetNext(printer->jobs))
+    serverStopTransforms(job);
+  cupsRWUnlock(&printer->rwlock);
+
+  cupsMutexLock(&StreamMutex);
+  while (printer->num_preparing > 0)
+    cupsCondWait(&StreamCondition, &StreamMutex, 1.0);
+  cupsMutexUnlock(&StreamMutex);
 
   cupsRWLockWrite(&printer->rwlock);
 
@@ -1915,9 +1972,16 @@ serverDeletePrinter(
   ippDelete(printer->pinfo.attrs);
   ippDelete(printer->dev_attrs);
 
+  release_caps(printer);
+  serverCloseHistory(printer);
+
+  cupsArrayDelete(printer->supported);
+
   cupsArrayDelete(printer->active_jobs);
   cupsArrayDelete(printer->completed_jobs);
   cupsArrayDelete(printer->jobs);
+  serverReleaseJobList(printer->joblist);
+  free(printer->job_index);
 
   free(printer->identify_message);
 
@@ -1942,6 +2006,8 @@ serverDisablePrinter(
   serverAddEventNoLock(printer, NULL, NULL, SERVER_EVENT_PRINTER_STATE_CHANGED, "No longer accepting jobs.");
 
   cupsRWUnlock(&printer->rwlock);
+
+  serverSaveSystemLater(printer);
 }
 
 
@@ -1960,6 +2026,8 @@ serverEnablePrinter(
   serverAddEventNoLock(printer, NULL, NULL, SERVER_EVENT_PRINTER_STATE_CHANGED, "Now accepting jobs.");
 
   cupsRWUnlock(&printer->rwlock);
+
+  serverSaveSystemLater(printer);
 }
 
 
@@ -1997,6 +2065,133 @@ serverGetPrinterStateReasonsBits(
 }
 
 
+/*
+ * 'serverIsSupportedIntegerNoLock()' - Check whether an integer or enum value
+ *                                      is supported by a printer.
+ *
+ * Note: Caller MUST lock the printer object before using.
+ */
+
+bool					/* O - `true` if supported, `false` otherwise */
+serverIsSupportedIntegerNoLock(
+    server_printer_t *printer,		/* I - Printer */
+    const char       *name,		/* I - "xxx-supported" attribute name */
+    int              value)		/* I - Value */
+{
+  char	key[256];			/* Index key */
+
+
+  snprintf(key, sizeof(key), "%s\t%d", name, value);
+
+  return (cupsArrayFind(printer->supported, key) != NULL);
+}
+
+
+/*
+ * 'serverIsSupportedMediaSizeNoLock()' - Check whether a media size is
+ *                                        supported by a printer.
+ *
+ * Any size is accepted when the printer does not report
+ * "media-size-supported".
+ *
+ * Note: Caller MUST lock the printer object before using.
+ */
+
+bool					/* O - `true` if supported, `false` otherwise */
+serverIsSupportedMediaSizeNoLock(
+    server_printer_t *printer,		/* I - Printer */
+    int              x_value,		/* I - Width in hundredths of millimeters */
+    int              y_value)		/* I - Length in hundredths of millimeters */
+{
+  size_t		i,		/* Looping var */
+			count;		/* Number of values */
+  char			key[256];	/* Index key */
+  ipp_attribute_t	*supported,	/* "media-size-supported" attribute */
+			*x_dim,		/* x-dimension */
+			*y_dim;		/* y-dimension */
+  ipp_t			*size;		/* media-size collection */
+
+
+  if (!cupsArrayFind(printer->supported, "media-size-supported"))
+    return (true);
+
+  snprintf(key, sizeof(key), "media-size-supported\t%dx%d", x_value, y_value);
+  if (cupsArrayFind(printer->supported, key))
+    return (true);
+
+  if (!cupsArrayFind(printer->supported, "media-size-supported\trange"))
+    return (false);
+
+ /*
+  * Custom size ranges are not indexed, so check them the slow way...
+  */
+
+  if ((supported = ippFindAttribute(printer->dev_attrs, "media-size-supported", IPP_TAG_BEGIN_COLLECTION)) == NULL)
+    supported = ippFindAttribute(printer->pinfo.attrs, "media-size-supported", IPP_TAG_BEGIN_COLLECTION);
+
+  for (i = 0, count = ippGetCount(supported); i < count; i ++)
+  {
+    size  = ippGetCollection(supported, i);
+    x_dim = ippFindAttribute(size, "x-dimension", IPP_TAG_ZERO);
+    y_dim = ippFindAttribute(size, "y-dimension", IPP_TAG_ZERO);
+
+    if (ippContainsInteger(x_dim, x_value) && ippContainsInteger(y_dim, y_value))
+      return (true);
+  }
+
+  return (false);
+}
+
+
+/*
+ * 'serverIsSupportedResolutionNoLock()' - Check whether a resolution is
+ *                                         supported by a printer.
+ *
+ * Note: Caller MUST lock the printer object before using.
+ */
+
+bool					/* O - `true` if supported, `false` otherwise */
+serverIsSupportedResolutionNoLock(
+    server_printer_t *printer,		/* I - Printer */
+    int              xres,		/* I - Horizontal resolution */
+    int              yres,		/* I - Vertical resolution */
+    ipp_res_t        units)		/* I - Resolution units */
+{
+  char	key[256];			/* Index key */
+
+
+  snprintf(key, sizeof(key), "printer-resolution-supported\t%dx%d%s", xres, yres, units == IPP_RES_PER_INCH ? "dpi" : "dpcm");
+
+  return (cupsArrayFind(printer->supported, key) != NULL);
+}
+
+
+/*
+ * 'serverIsSupportedStringNoLock()' - Check whether a keyword, name, or MIME
+ *                                     media type value is supported by a
+ *                                     printer.
+ *
+ * Note: Caller MUST lock the printer object before using.
+ */
+
+bool					/* O - `true` if supported, `false` otherwise */
+serverIsSupportedStringNoLock(
+    server_printer_t *printer,		/* I - Printer */
+    const char       *name,		/* I - "xxx-supported" attribute name */
+    const char       *value)		/* I - Value */
+{
+  char	key[1024];			/* Index key */
+
+
+  if (!value)
+    return (false);
+
+  snprintf(key, sizeof(key), "%s\t%s", name, value);
+
+  return (cupsArrayFind(printer->supported, key) != NULL);
+}
+
+
 /*
  * 'serverPausePrinter()' - Stop processing jobs for a printer.
  */
@@ -2029,6 +2224,8 @@ serverPausePrinter(
   }
 
   cupsRWUnlock(&printer->rwlock);
+
+  serverSaveSystemLater(printer);
 }
 
 
@@ -2306,6 +2503,7 @@ serverResumePrinter(
 
     cupsRWUnlock(&printer->rwlock);
 
+    serverSaveSystemLater(printer);
     serverCheckJobs(printer);
   }
 }
@@ -2331,6 +2529,148 @@ serverUnregisterPrinter(
 }
 
 
+/*
+ * 'serverUpdatePrinterSupportedNoLock()' - Update the index of supported
+ *                                          values for a printer.
+ *
+ * The index holds one "name<TAB>value" string for every value of every
+ * "xxx-supported" attribute so that job validation does not need to scan
+ * long lists like "media-supported".  Output device values take precedence
+ * for the attributes that a proxy can report.
+ *
+ * Note: Caller MUST lock the printer object for writing before using.
+ */
+
+void
+serverUpdatePrinterSupportedNoLock(
+    server_printer_t *printer)		/* I - Printer */
+{
+  size_t		i;		/* Looping var */
+  ipp_attribute_t	*attr;		/* Current attribute */
+  const char		*name;		/* Attribute name */
+  size_t		namelen;	/* Length of name */
+  cups_array_t		*supported;	/* New index */
+  static const struct
+  {
+    const char	*name;			/* Attribute name */
+    ipp_tag_t	value_tag;		/* Value tag */
+  }			device_attrs[] =/* Attributes reported by output devices */
+  {
+    { "media-size-supported",		IPP_TAG_BEGIN_COLLECTION },
+    { "media-supported",		IPP_TAG_KEYWORD },
+    { "printer-resolution-supported",	IPP_TAG_RESOLUTION },
+    { "sides-supported",		IPP_TAG_KEYWORD }
+  };
+
+
+  supported = cupsArrayNew((cups_array_cb_t)strcmp, NULL, (cups_ahash_cb_t)hash_supported, 4096, (cups_acopy_cb_t)strdup, (cups_afree_cb_t)free);
+
+  for (attr = ippGetFirstAttribute(printer->pinfo.attrs); attr; attr = ippGetNextAttribute(printer->pinfo.attrs))
+  {
+    if ((name = ippGetName(attr)) == NULL || (namelen = strlen(name)) < 10 || strcmp(name + namelen - 10, "-supported"))
+      continue;
+
+    for (i = 0; i < (sizeof(device_attrs) / sizeof(device_attrs[0])); i ++)
+    {
+      if (!strcmp(name, device_attrs[i].name))
+        break;
+    }
+
+    if (i < (sizeof(device_attrs) / sizeof(device_attrs[0])) && ippFindAttribute(printer->dev_attrs, name, device_attrs[i].value_tag))
+      continue;
+
+    add_supported(supported, name, attr);
+  }
+
+  for (i = 0; i < (sizeof(device_attrs) / sizeof(device_attrs[0])); i ++)
+  {
+    if ((attr = ippFindAttribute(printer->dev_attrs, device_attrs[i].name, device_attrs[i].value_tag)) != NULL)
+      add_supported(supported, device_attrs[i].name, attr);
+  }
+
+  cupsArrayDelete(printer->supported);
+  printer->supported = supported;
+
+  serverLogPrinter(SERVER_LOGLEVEL_DEBUG, printer, "Indexed %u supported values.", (unsigned)cupsArrayGetCount(supported));
+}
+
+
+/*
+ * 'add_supported()' - Add the values of a "xxx-supported" attribute to an
+ *                     index.
+ */
+
+static void
+add_supported(
+    cups_array_t    *supported,		/* I - Index */
+    const char      *name,		/* I - Attribute name */
+    ipp_attribute_t *attr)		/* I - Attribute */
+{
+  size_t		i,		/* Looping var */
+			count;		/* Number of values */
+  char			key[1024];	/* Index key */
+  int			xres,		/* Horizontal resolution */
+			yres;		/* Vertical resolution */
+  ipp_res_t		units;		/* Resolution units */
+  ipp_t			*size;		/* media-size collection */
+  ipp_attribute_t	*x_dim,		/* x-dimension */
+			*y_dim;		/* y-dimension */
+
+
+  if (!cupsArrayFind(supported, (void *)name))
+    cupsArrayAdd(supported, (void *)name);
+
+  for (i = 0, count = ippGetCount(attr); i < count; i ++)
+  {
+    switch (ippGetValueTag(attr))
+    {
+      case IPP_TAG_INTEGER :
+      case IPP_TAG_ENUM :
+          snprintf(key, sizeof(key), "%s\t%d", name, ippGetInteger(attr, i));
+          break;
+
+      case IPP_TAG_TEXT :
+      case IPP_TAG_NAME :
+      case IPP_TAG_TEXTLANG :
+      case IPP_TAG_NAMELANG :
+      case IPP_TAG_KEYWORD :
+      case IPP_TAG_URI :
+      case IPP_TAG_URISCHEME :
+      case IPP_TAG_CHARSET :
+      case IPP_TAG_LANGUAGE :
+      case IPP_TAG_MIMETYPE :
+          snprintf(key, sizeof(key), "%s\t%s", name, ippGetString(attr, i, NULL));
+          break;
+
+      case IPP_TAG_RESOLUTION :
+          xres = ippGetResolution(attr, i, &yres, &units);
+          snprintf(key, sizeof(key), "%s\t%dx%d%s", name, xres, yres, units == IPP_RES_PER_INCH ? "dpi" : "dpcm");
+          break;
+
+      case IPP_TAG_BEGIN_COLLECTION :
+          if (strcmp(name, "media-size-supported"))
+            return;
+
+          size  = ippGetCollection(attr, i);
+          x_dim = ippFindAttribute(size, "x-dimension", IPP_TAG_ZERO);
+          y_dim = ippFindAttribute(size, "y-dimension", IPP_TAG_ZERO);
+
+          if (ippGetValueTag(x_dim) == IPP_TAG_INTEGER && ippGetValueTag(y_dim) == IPP_TAG_INTEGER)
+            snprintf(key, sizeof(key), "%s\t%dx%d", name, ippGetInteger(x_dim, 0), ippGetInteger(y_dim, 0));
+          else
+            snprintf(key, sizeof(key), "%s\trange", name);
+          break;
+
+      default :
+          return;
+    }
+
+    if (!cupsArrayFind(supported, key))
+      cupsArrayAdd(supported, key);
+  }
+}
+
+
 /*
  * 'compare_active_jobs()' - Compare two active jobs.
  */
@@ -2349,6 +2689,23 @@ compare_active_jobs(server_job_t *a,	/* I - First job */
 }
 
 
+/*
+ * 'compare_caps()' - Compare two sets of capability attributes.
+ */
+
+static int				/* O - Result of comparison */
+compare_caps(server_caps_t *a,		/* I - First capabilities */
+             server_caps_t *b)		/* I - Second capabilities */
+{
+  if (a->hash < b->hash)
+    return (-1);
+  else if (a->hash > b->hash)
+    return (1);
+  else
+    return (strcmp(a->key, b->key));
+}
+
+
 /*
  * 'compare_completed_jobs()' - Compare two completed jobs.
  */
@@ -2469,3 +2826,202 @@ dnssd_callback(
     printer->dns_sd_collision = true;
   }
 }
+
+
+/*
+ * 'hash_supported()' - Compute the hash of a supported value index key.
+ */
+
+static size_t				/* O - Hash value */
+hash_supported(const char *key,		/* I - Index key */
+               void       *data)	/* I - Callback data (unused) */
+{
+  (void)data;
+
+  return (serverHashString(key, -1, false) % 4096);
+}
+
+
+/*
+ * 'is_capability()' - Determine whether an attribute is a static capability.
+ *
+ * Capabilities are the "xxx-supported", "xxx-database", and "xxx-default"
+ * attributes.  URI values are excluded since they contain the printer's own
+ * resource path.
+ */
+
+static bool				/* O - `true` if a capability, `false` otherwise */
+is_capability(ipp_attribute_t *attr)	/* I - Attribute */
+{
+  const char	*name;			/* Attribute name */
+  size_t	namelen;		/* Length of name */
+
+
+  if ((name = ippGetName(attr)) == NULL || ippGetGroupTag(attr) != IPP_TAG_PRINTER || ippGetValueTag(attr) == IPP_TAG_URI)
+    return (false);
+
+  namelen = strlen(name);
+
+  return ((namelen > 10 && !strcmp(name + namelen - 10, "-supported")) || (namelen > 9 && !strcmp(name + namelen - 9, "-database")) || (namelen > 8 && !strcmp(name + namelen - 8, "-default")));
+}
+
+
+/*
+ * 'release_caps()' - Release a printer's shared capability attributes.
+ *
+ * The printer's own attributes must be deleted first since they reference the
+ * shared values.
+ */
+
+static void
+release_caps(server_printer_t *printer)	/* I - Printer */
+{
+  server_caps_t	*caps;			/* Shared capabilities */
+
+
+  if ((caps = printer->caps) == NULL)
+    return;
+
+  printer->caps = NULL;
+
+  cupsMutexLock(&printer_caps_mutex);
+
+  if (-- caps->use == 0)
+  {
+    cupsArrayRemove(printer_caps, caps);
+
+    ippDelete(caps->attrs);
+    free(caps->key);
+    free(caps);
+  }
+
+  cupsMutexUnlock(&printer_caps_mutex);
+}
+
+
+/*
+ * 'share_caps()' - Share a printer's capability attributes with other printers.
+ *
+ * Printers with the same capabilities reference a single read-only copy of the
+ * capability values.  The printer's own attribute list holds quick copies of
+ * the shared attributes, so any later change (Set-Printer-Attributes, status
+ * updates from the output device, etc.) replaces the printer's copy of the
+ * attribute without touching the shared values.
+ */
+
+static void
+share_caps(server_printer_t *printer)	/* I - Printer */
+{
+  ipp_attribute_t	*attr,		/* Current attribute */
+			*cattr;		/* Current shared attribute */
+  server_caps_t		key,		/* Search key */
+			*caps;		/* Shared capabilities */
+  char			*keyptr;	/* Pointer into key */
+  size_t		keylen = 0,	/* Length of key */
+			keysize = 0,	/* Size of key buffer */
+			len;		/* Length of current attribute */
+  ipp_t			*attrs;		/* New printer attributes */
+
+
+ /*
+  * Serialize the capability attributes...
+  */
+
+  memset(&key, 0, sizeof(key));
+
+  for (attr = ippGetFirstAttribute(printer->pinfo.attrs); attr; attr = ippGetNextAttribute(printer->pinfo.attrs))
+  {
+    if (!is_capability(attr))
+      continue;
+
+    len = strlen(ippGetName(attr)) + strlen(ippTagString(ippGetValueTag(attr))) + ippAttributeString(attr, NULL, 0) + 3;
+
+    if ((keylen + len) >= keysize)
+    {
+      keysize = keylen + len + 4096;
+
+      if ((keyptr = realloc(key.key, keysize)) == NULL)
+      {
+        serverLogPrinter(SERVER_LOGLEVEL_ERROR, printer, "Unable to allocate memory for capabilities: %s", strerror(errno));
+        free(key.key);
+        return;
+      }
+
+      key.key = keyptr;
+    }
+
+    keylen += (size_t)snprintf(key.key + keylen, keysize - keylen, "%s/%s=", ippGetName(attr), ippTagString(ippGetValueTag(attr)));
+    keylen += ippAttributeString(attr, key.key + keylen, keysize - keylen);
+
+    key.key[keylen ++] = '\n';
+    key.key[keylen]    = '\0';
+  }
+
+  if (!key.key)
+    return;
+
+  key.hash = serverHashString(key.key, (ssize_t)keylen, false);
+
+ /*
+  * Find or create the shared attributes...
+  */
+
+  cupsMutexLock(&printer_caps_mutex);
+
+  if (!printer_caps)
+    printer_caps = cupsArrayNew((cups_array_cb_t)compare_caps, NULL, NULL, 0, NULL, NULL);
+
+  if ((caps = (server_caps_t *)cupsArrayFind(printer_caps, &key)) != NULL)
+  {
+    free(key.key);
+  }
+  else if ((caps = (server_caps_t *)calloc(1, sizeof(server_caps_t))) != NULL)
+  {
+    caps->hash  = key.hash;
+    caps->key   = key.key;
+    caps->attrs = ippNew();
+
+    for (attr = ippGetFirstAttribute(printer->pinfo.attrs); attr; attr = ippGetNextAttribute(printer->pinfo.attrs))
+    {
+      if (is_capability(attr))
+        ippCopyAttribute(caps->attrs, attr, false);
+    }
+
+    cupsArrayAdd(printer_caps, caps);
+  }
+  else
+  {
+    cupsMutexUnlock(&printer_caps_mutex);
+    serverLogPrinter(SERVER_LOGLEVEL_ERROR, printer, "Unable to allocate memory for capabilities: %s", strerror(errno));
+    free(key.key);
+    return;
+  }
+
+  caps->use ++;
+
+ /*
+  * Rebuild the printer attributes using quick copies of the shared values.
+  * Capability attributes appear in the same order in both lists...
+  */
+
+  attrs = ippNew();
+
+  for (attr = ippGetFirstAttribute(printer->pinfo.attrs), cattr = ippGetFirstAttribute(caps->attrs); attr; attr = ippGetNextAttribute(printer->pinfo.attrs))
+  {
+    if (is_capability(attr) && cattr)
+    {
+      ippCopyAttribute(attrs, cattr, true);
+      cattr = ippGetNextAttribute(caps->attrs);
+    }
+    else
+      ippCopyAttribute(attrs, attr, false);
+  }
+
+  serverLogPrinter(SERVER_LOGLEVEL_DEBUG, printer, "Using %s capabilities (%u printers).", caps->use > 1 ? "shared" : "new", (unsigned)caps->use);
+
+  cupsMutexUnlock(&printer_caps_mutex);
+
+  ippDelete(printer->pinfo.attrs);
+  printer->pinfo.attrs = attrs;
+  printer->caps        = caps;
+}
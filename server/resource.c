@@ -11,27 +11,108 @@
 #include "ippserver.h"
 
 
+/*
+ * Local constants...
+ */
+
+#define RESOURCE_SHARDS	16		/* Number of lookup table shards */
+
+
+/*
+ * Local macros...
+ */
+
+#define SHA256_ROTR(x,n)	(((x) >> (n)) | ((x) << (32 - (n))))
+#define SHARD_INITIALIZER	{ CUPS_RWLOCK_INITIALIZER, NULL, NULL }
+
+
+/*
+ * Local types...
+ */
+
+struct server_blob_s			/**** Shared resource data ****/
+{
+  unsigned char		digest[32];	/* SHA-256 digest of data */
+  char			*filename;	/* Local filename */
+  size_t		use;		/* Number of resources using it */
+};
+
+typedef struct server_rshard_s		/**** Resource lookup shard ****/
+{
+  cups_rwlock_t		rwlock;		/* Lock for this shard */
+  cups_array_t		*ids,		/* Resources by ID */
+			*paths;		/* Resources by path */
+} server_rshard_t;
+
+
+/*
+ * Local globals...
+ */
+
+static cups_array_t	*blobs = NULL;	/* Shared resource data by digest */
+static cups_mutex_t	blobs_mutex = CUPS_MUTEX_INITIALIZER;
+					/* Mutex for shared resource data */
+static server_rshard_t	shards[RESOURCE_SHARDS] =
+{					/* Lookup tables by ID and path */
+  SHARD_INITIALIZER, SHARD_INITIALIZER, SHARD_INITIALIZER, SHARD_INITIALIZER,
+  SHARD_INITIALIZER, SHARD_INITIALIZER, SHARD_INITIALIZER, SHARD_INITIALIZER,
+  SHARD_INITIALIZER, SHARD_INITIALIZER, SHARD_INITIALIZER, SHARD_INITIALIZER,
+  SHARD_INITIALIZER, SHARD_INITIALIZER, SHARD_INITIALIZER, SHARD_INITIALIZER
+};
+static const uint32_t	sha256_k[64] =	/* SHA-256 round constants */
+{
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+
 /*
  * Local functions...
  */
 
+static int	compare_blobs(server_blob_t *a, server_blob_t *b);
 static int	compare_filenames(server_resource_t *a, server_resource_t *b);
 static int	compare_ids(server_resource_t *a, server_resource_t *b);
 static int	compare_resources(server_resource_t *a, server_resource_t *b);
+static server_rshard_t *path_shard(const char *resource);
+static void	publish_path(server_resource_t *res);
+static void	release_blob(server_blob_t *blob);
+static const char *share_blob(server_resource_t *res, const char *filename, const unsigned char *digest);
+static void	sha256_transform(server_sha256_t *ctx, const unsigned char *block);
 
 
 /*
  * 'serverAddResourceFile()' - Add the file associated with a resource.
+ *
+ * When a digest is supplied the file is spooled data, and resources with
+ * identical data share a single file - the new file is removed if another
+ * resource already holds the same data.
  */
 
 void
 serverAddResourceFile(
-    server_resource_t *res,		/* I - Resource */
-    const char        *filename,	/* I - File */
-    const char        *format)		/* I - MIME media type */
+    server_resource_t   *res,		/* I - Resource */
+    const char          *filename,	/* I - File */
+    const char          *format,	/* I - MIME media type */
+    const unsigned char *digest)	/* I - SHA-256 digest of file or `NULL` */
 {
   struct stat	resinfo;		/* Resource info */
+  char		path[1024];		/* Resource path */
+
 
+  if (digest)
+    filename = share_blob(res, filename, digest);
+
+  if (!res->resource)
+    serverCreateResourceFilename(res, format, "/ipp/resource", path, sizeof(path));
+  else
+    path[0] = '\0';
 
   cupsRWLockWrite(&res->rwlock);
 
@@ -39,21 +120,8 @@ serverAddResourceFile(
   res->format   = strdup(format);
   res->state    = IPP_RSTATE_AVAILABLE;
 
-  cupsRWLockWrite(&ResourcesRWLock);
-
-  cupsArrayAdd(ResourcesByFilename, res);
-
-  if (!res->resource)
-  {
-    char path[1024];			/* Resource path */
-
-    serverCreateResourceFilename(res, format, "/ipp/resource", path, sizeof(path));
-
+  if (path[0])
     res->resource = strdup(path);
-    cupsArrayAdd(ResourcesByPath, res);
-  }
-
-  cupsRWUnlock(&ResourcesRWLock);
 
   ippAddString(res->attrs, IPP_TAG_RESOURCE, IPP_TAG_MIMETYPE, "resource-format", NULL, res->format);
 
@@ -65,6 +133,21 @@ serverAddResourceFile(
   serverAddEventNoLock(NULL, NULL, res, SERVER_EVENT_RESOURCE_STATE_CHANGED, "Resource %d now available.", res->id);
 
   cupsRWUnlock(&res->rwlock);
+
+ /*
+  * Update the lookup tables, which are never locked while holding the
+  * resource lock...
+  */
+
+  if (!res->blob)
+  {
+    cupsRWLockWrite(&ResourcesRWLock);
+    cupsArrayAdd(ResourcesByFilename, res);
+    cupsRWUnlock(&ResourcesRWLock);
+  }
+
+  if (path[0])
+    publish_path(res);
 }
 
 
@@ -136,6 +219,7 @@ serverCreateResource(
     const char *language)		/* I - Resource language or `NULL` */
 {
   server_resource_t	*res;		/* Resource */
+  server_rshard_t	*shard;		/* Lookup table shard */
   char			uuid[64];	/* resource-uuid value */
   time_t		curtime = time(NULL);
 					/* Current system time */
@@ -190,10 +274,11 @@ serverCreateResource(
   }
 
   cupsRWLockWrite(&ResourcesRWLock);
+  res->id = NextResourceId ++;
+  cupsRWUnlock(&ResourcesRWLock);
 
   res->fd    = -1;
   res->attrs = ippNew();
-  res->id    = NextResourceId ++;
   res->state = filename ? IPP_RSTATE_INSTALLED : IPP_RSTATE_PENDING;
   res->type  = strdup(type);
 
@@ -201,10 +286,9 @@ serverCreateResource(
     res->resource = strdup(resource);
 
   cupsRWInit(&res->rwlock);
-  cupsRWLockWrite(&res->rwlock);
 
  /*
-  * Add resource attributes and add the object to the resources arrays...
+  * Add resource attributes before the object is visible to other threads...
   */
 
   ippAddDate(res->attrs, IPP_TAG_RESOURCE, "date-time-at-creation", ippTimeToDate(curtime));
@@ -245,25 +329,36 @@ serverCreateResource(
 
   ippAddOutOfBand(res->attrs, IPP_TAG_RESOURCE, IPP_TAG_NOVALUE, "time-at-canceled");
 
+ /*
+  * Then publish it in the ID and path lookup tables and the list used for
+  * enumeration...
+  */
+
+  shard = shards + res->id % RESOURCE_SHARDS;
+
+  cupsRWLockWrite(&shard->rwlock);
+  if (!shard->ids)
+    shard->ids = cupsArrayNew((cups_array_cb_t)compare_ids, NULL, NULL, 0, NULL, NULL);
+  cupsArrayAdd(shard->ids, res);
+  cupsRWUnlock(&shard->rwlock);
+
+  if (res->resource)
+    publish_path(res);
+
+  cupsRWLockWrite(&ResourcesRWLock);
   if (!ResourcesByFilename)
     ResourcesByFilename = cupsArrayNew((cups_array_cb_t)compare_filenames, NULL, NULL, 0, NULL, NULL);
   if (!ResourcesById)
     ResourcesById = cupsArrayNew((cups_array_cb_t)compare_ids, NULL, NULL, 0, NULL, NULL);
-  if (!ResourcesByPath)
-    ResourcesByPath = cupsArrayNew((cups_array_cb_t)compare_resources, NULL, NULL, 0, NULL, NULL);
-
   cupsArrayAdd(ResourcesById, res);
-  if (res->resource)
-    cupsArrayAdd(ResourcesByPath, res);
-
   cupsRWUnlock(&ResourcesRWLock);
 
+  cupsRWLockWrite(&res->rwlock);
   serverAddEventNoLock(NULL, NULL, res, SERVER_EVENT_RESOURCE_CREATED | SERVER_EVENT_RESOURCE_STATE_CHANGED, "Resource %d created.", res->id);
-
   cupsRWUnlock(&res->rwlock);
 
   if (filename)
-    serverAddResourceFile(res, filename, format);
+    serverAddResourceFile(res, filename, format, NULL);
 
   return (res);
 }
@@ -277,15 +372,37 @@ void
 serverDeleteResource(
     server_resource_t *res)		/* I - Resource */
 {
+  server_rshard_t	*shard;		/* Lookup table shard */
+
+
+  shard = shards + res->id % RESOURCE_SHARDS;
+
+  cupsRWLockWrite(&shard->rwlock);
+  cupsArrayRemove(shard->ids, res);
+  cupsRWUnlock(&shard->rwlock);
+
+  if (res->resource)
+  {
+    shard = path_shard(res->resource);
+
+    cupsRWLockWrite(&shard->rwlock);
+    cupsArrayRemove(shard->paths, res);
+    cupsRWUnlock(&shard->rwlock);
+  }
+
   cupsRWLockWrite(&ResourcesRWLock);
 
-  if (res->filename)
+  if (res->filename && !res->blob)
     cupsArrayRemove(ResourcesByFilename, res);
   cupsArrayRemove(ResourcesById, res);
-  cupsArrayRemove(ResourcesByPath, res);
+
+  cupsRWUnlock(&ResourcesRWLock);
 
   cupsRWLockWrite(&res->rwlock);
 
+  if (res->blob)
+    release_blob(res->blob);
+
   ippDelete(res->attrs);
 
   free(res->filename);
@@ -297,8 +414,6 @@ serverDeleteResource(
   cupsRWDestroy(&res->rwlock);
 
   free(res);
-
-  cupsRWUnlock(&ResourcesRWLock);
 }
 
 
@@ -333,13 +448,15 @@ serverFindResourceById(int id)		/* I - Resource ID */
 {
   server_resource_t	key,		/* Search key */
 			*res;		/* Matching resource */
+  server_rshard_t	*shard = shards + (unsigned)id % RESOURCE_SHARDS;
+					/* Lookup table shard */
 
 
   key.id = id;
 
-  cupsRWLockRead(&ResourcesRWLock);
-  res = (server_resource_t *)cupsArrayFind(ResourcesById, &key);
-  cupsRWUnlock(&ResourcesRWLock);
+  cupsRWLockRead(&shard->rwlock);
+  res = (server_resource_t *)cupsArrayFind(shard->ids, &key);
+  cupsRWUnlock(&shard->rwlock);
 
   return (res);
 }
@@ -355,18 +472,161 @@ serverFindResourceByPath(
 {
   server_resource_t	key,		/* Search key */
 			*res;		/* Matching resource */
+  server_rshard_t	*shard = path_shard(resource);
+					/* Lookup table shard */
 
 
   key.resource = (char *)resource;
 
-  cupsRWLockRead(&ResourcesRWLock);
-  res = (server_resource_t *)cupsArrayFind(ResourcesByPath, &key);
-  cupsRWUnlock(&ResourcesRWLock);
+  cupsRWLockRead(&shard->rwlock);
+  res = (server_resource_t *)cupsArrayFind(shard->paths, &key);
+  cupsRWUnlock(&shard->rwlock);
 
   return (res);
 }
 
 
+/*
+ * 'serverHashString()' - Compute the 32-bit FNV-1a hash of a string.
+ *
+ * A negative length hashes up to the nul terminator.
+ */
+
+uint32_t				/* O - Hash value */
+serverHashString(
+    const char *s,			/* I - String or data */
+    ssize_t    slen,			/* I - Length of string/data or `-1` for nul-terminated */
+    bool       ignore_case)		/* I - Hash as lowercase? */
+{
+  uint32_t	hash = 2166136261U;	/* FNV-1a hash */
+  int		ch;			/* Current character */
+
+
+  while (slen < 0 ? *s != '\0' : slen -- > 0)
+  {
+    ch = *s++ & 255;
+
+    if (ignore_case)
+      ch = tolower(ch);
+
+    hash ^= (uint32_t)ch;
+    hash *= 16777619U;
+  }
+
+  return (hash);
+}
+
+
+/*
+ * 'serverSHA256Finish()' - Finish a SHA-256 hash.
+ */
+
+void
+serverSHA256Finish(
+    server_sha256_t *ctx,		/* I - Hash state */
+    unsigned char   *digest)		/* O - 32-byte digest */
+{
+  int		i;			/* Looping var */
+  uint64_t	bits = ctx->length * 8;	/* Length of data in bits */
+
+
+ /*
+  * Pad the data with a 1 bit, zeros, and the 64-bit length...
+  */
+
+  ctx->block[ctx->used ++] = 0x80;
+
+  if (ctx->used > 56)
+  {
+    memset(ctx->block + ctx->used, 0, sizeof(ctx->block) - ctx->used);
+    sha256_transform(ctx, ctx->block);
+    ctx->used = 0;
+  }
+
+  memset(ctx->block + ctx->used, 0, 56 - ctx->used);
+
+  for (i = 0; i < 8; i ++)
+    ctx->block[56 + i] = (unsigned char)(bits >> (56 - 8 * i));
+
+  sha256_transform(ctx, ctx->block);
+
+ /*
+  * Copy the final state in big-endian order...
+  */
+
+  for (i = 0; i < 32; i ++)
+    digest[i] = (unsigned char)(ctx->state[i / 4] >> (24 - 8 * (i & 3)));
+}
+
+
+/*
+ * 'serverSHA256Init()' - Start a SHA-256 hash.
+ */
+
+void
+serverSHA256Init(server_sha256_t *ctx)	/* I - Hash state */
+{
+  static const uint32_t	initial[8] =	/* Initial hash state */
+  {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+  };
+
+
+  memcpy(ctx->state, initial, sizeof(ctx->state));
+  ctx->length = 0;
+  ctx->used   = 0;
+}
+
+
+/*
+ * 'serverSHA256Update()' - Add data to a SHA-256 hash.
+ */
+
+void
+serverSHA256Update(
+    server_sha256_t *ctx,		/* I - Hash state */
+    const void      *data,		/* I - Data */
+    size_t          datalen)		/* I - Length of data */
+{
+  const unsigned char	*dataptr = (const unsigned char *)data;
+					/* Pointer into data */
+  size_t		bytes;		/* Bytes to copy */
+
+
+  ctx->length += datalen;
+
+  if (ctx->used > 0)
+  {
+   /*
+    * Fill the partial block first...
+    */
+
+    if ((bytes = sizeof(ctx->block) - ctx->used) > datalen)
+      bytes = datalen;
+
+    memcpy(ctx->block + ctx->used, dataptr, bytes);
+    ctx->used += bytes;
+    dataptr   += bytes;
+    datalen   -= bytes;
+
+    if (ctx->used < sizeof(ctx->block))
+      return;
+
+    sha256_transform(ctx, ctx->block);
+    ctx->used = 0;
+  }
+
+  for (; datalen >= sizeof(ctx->block); dataptr += sizeof(ctx->block), datalen -= sizeof(ctx->block))
+    sha256_transform(ctx, dataptr);
+
+  if (datalen > 0)
+  {
+    memcpy(ctx->block, dataptr, datalen);
+    ctx->used = datalen;
+  }
+}
+
+
 /*
  * 'serverSetResourceState()' - Set the state of a resource.
  */
@@ -428,6 +688,18 @@ serverSetResourceState(
 }
 
 
+/*
+ * 'compare_blobs()' - Compare two shared data digests.
+ */
+
+static int				/* O - Result of comparison */
+compare_blobs(server_blob_t *a,		/* I - First shared data */
+              server_blob_t *b)		/* I - Second shared data */
+{
+  return (memcmp(a->digest, b->digest, sizeof(a->digest)));
+}
+
+
 /*
  * 'compare_filenames()' - Compare two resource filenames.
  */
@@ -465,3 +737,169 @@ compare_resources(
 {
   return (strcmp(a->resource, b->resource));
 }
+
+
+/*
+ * 'path_shard()' - Return the lookup table shard for a resource path.
+ */
+
+static server_rshard_t *		/* O - Lookup table shard */
+path_shard(const char *resource)	/* I - Resource path */
+{
+  return (shards + serverHashString(resource, -1, false) % RESOURCE_SHARDS);
+}
+
+
+/*
+ * 'publish_path()' - Add a resource to the path lookup table.
+ */
+
+static void
+publish_path(server_resource_t *res)	/* I - Resource */
+{
+  server_rshard_t	*shard = path_shard(res->resource);
+					/* Lookup table shard */
+
+
+  cupsRWLockWrite(&shard->rwlock);
+
+  if (!shard->paths)
+    shard->paths = cupsArrayNew((cups_array_cb_t)compare_resources, NULL, NULL, 0, NULL, NULL);
+
+  cupsArrayAdd(shard->paths, res);
+
+  cupsRWUnlock(&shard->rwlock);
+}
+
+
+/*
+ * 'release_blob()' - Release shared resource data.
+ *
+ * The file is removed when the last resource using it is deleted.
+ */
+
+static void
+release_blob(server_blob_t *blob)	/* I - Shared data */
+{
+  cupsMutexLock(&blobs_mutex);
+
+  if (-- blob->use == 0)
+  {
+    cupsArrayRemove(blobs, blob);
+
+    unlink(blob->filename);
+    free(blob->filename);
+    free(blob);
+  }
+
+  cupsMutexUnlock(&blobs_mutex);
+}
+
+
+/*
+ * 'share_blob()' - Share resource data with other resources.
+ *
+ * Returns the filename to use for the resource, which is the existing file
+ * when another resource already has the same data.
+ */
+
+static const char *			/* O - Filename to use */
+share_blob(
+    server_resource_t   *res,		/* I - Resource */
+    const char          *filename,	/* I - New file */
+    const unsigned char *digest)	/* I - SHA-256 digest of file */
+{
+  server_blob_t	key,			/* Search key */
+		*blob;			/* Shared data */
+
+
+  memcpy(key.digest, digest, sizeof(key.digest));
+
+  cupsMutexLock(&blobs_mutex);
+
+  if (!blobs)
+    blobs = cupsArrayNew((cups_array_cb_t)compare_blobs, NULL, NULL, 0, NULL, NULL);
+
+  if ((blob = (server_blob_t *)cupsArrayFind(blobs, &key)) != NULL)
+  {
+    if (strcmp(filename, blob->filename))
+      unlink(filename);
+
+    serverLog(SERVER_LOGLEVEL_DEBUG, "Resource %d shares \"%s\" (%u resources).", res->id, blob->filename, (unsigned)blob->use + 1);
+  }
+  else if ((blob = (server_blob_t *)calloc(1, sizeof(server_blob_t))) != NULL)
+  {
+    memcpy(blob->digest, digest, sizeof(blob->digest));
+    blob->filename = strdup(filename);
+
+    cupsArrayAdd(blobs, blob);
+  }
+  else
+  {
+    cupsMutexUnlock(&blobs_mutex);
+    serverLog(SERVER_LOGLEVEL_ERROR, "Unable to allocate memory for resource data: %s", strerror(errno));
+    return (filename);
+  }
+
+  blob->use ++;
+  res->blob = blob;
+
+  cupsMutexUnlock(&blobs_mutex);
+
+  return (blob->filename);
+}
+
+
+/*
+ * 'sha256_transform()' - Hash a single 64-byte block.
+ */
+
+static void
+sha256_transform(
+    server_sha256_t     *ctx,		/* I - Hash state */
+    const unsigned char *block)		/* I - 64-byte block */
+{
+  int		i;			/* Looping var */
+  uint32_t	w[64],			/* Message schedule */
+		a, b, c, d, e, f, g, h,	/* Working variables */
+		t1, t2;			/* Temporary values */
+
+
+  for (i = 0; i < 16; i ++, block += 4)
+    w[i] = ((uint32_t)block[0] << 24) | ((uint32_t)block[1] << 16) | ((uint32_t)block[2] << 8) | (uint32_t)block[3];
+
+  for (; i < 64; i ++)
+    w[i] = w[i - 16] + (SHA256_ROTR(w[i - 15], 7) ^ SHA256_ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3)) + w[i - 7] + (SHA256_ROTR(w[i - 2], 17) ^ SHA256_ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10));
+
+  a = ctx->state[0];
+  b = ctx->state[1];
+  c = ctx->state[2];
+  d = ctx->state[3];
+  e = ctx->state[4];
+  f = ctx->state[5];
+  g = ctx->state[6];
+  h = ctx->state[7];
+
+  for (i = 0; i < 64; i ++)
+  {
+    t1 = h + (SHA256_ROTR(e, 6) ^ SHA256_ROTR(e, 11) ^ SHA256_ROTR(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+    t2 = (SHA256_ROTR(a, 2) ^ SHA256_ROTR(a, 13) ^ SHA256_ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+    h  = g;
+    g  = f;
+    f  = e;
+    e  = d + t1;
+    d  = c;
+    c  = b;
+    b  = a;
+    a  = t1 + t2;
+  }
+
+  ctx->state[0] += a;
+  ctx->state[1] += b;
+  ctx->state[2] += c;
+  ctx->state[3] += d;
+  ctx->state[4] += e;
+  ctx->state[5] += f;
+  ctx->state[6] += g;
+  ctx->state[7] += h;
+}
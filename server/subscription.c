@@ -15,27 +15,24 @@
 // Local functions...
 //
 
+static void	add_event(server_printer_t *printer, server_job_t *job, server_document_t *doc, server_resource_t *res, server_event_t event, const char *text);
 static int	compare_subscriptions(server_subscription_t *a, server_subscription_t *b);
 
 
 //
-// 'serverAddEventNoLock()' - Add an event to a subscription.
+// 'serverAddDocumentEventNoLock()' - Add a document event to a subscription.
 //
 // Note: Printer, job, resource, and subscription objects are not locked.
 //
 
 void
-serverAddEventNoLock(
-    server_printer_t  *printer,		// I - Printer, if any
-    server_job_t      *job,		// I - Job, if any
-    server_resource_t *res,		// I - Resource, if any
+serverAddDocumentEventNoLock(
+    server_job_t      *job,		// I - Job
+    server_document_t *doc,		// I - Document
     server_event_t    event,		// I - Event
     const char        *message,		// I - Printf-style notify-text message
     ...)				// I - Additional printf arguments
 {
-  server_subscription_t *sub;		// Current subscription
-  ipp_t			*n;		// Notify event attributes
-  ipp_attribute_t	*attr;		// Event attribute
   char			text[1024];	// notify-text value
   va_list		ap;		// Argument pointer
 
@@ -49,86 +46,39 @@ serverAddEventNoLock(
   else
     text[0] = '\0';
 
-  serverLog(SERVER_LOGLEVEL_DEBUG, "serverAddEventNoLock(printer=%p(%s), job=%p(%d), event=0x%x, message=\"%s\")", (void *)printer, printer ? printer->name : "(null)", (void *)job, job ? job->id : -1, event, text);
-
-  cupsRWLockRead(&SubscriptionsRWLock);
-
-  for (sub = (server_subscription_t *)cupsArrayGetFirst(Subscriptions); sub; sub = (server_subscription_t *)cupsArrayGetNext(Subscriptions))
-  {
-    serverLog(SERVER_LOGLEVEL_DEBUG, "serverAddEvent: sub->id=%d, sub->mask=0x%x, sub->job=%p(%d)", sub->id, sub->mask, (void *)sub->job, sub->job ? sub->job->id : -1);
-
-    if (sub->mask & event && (!sub->job || job == sub->job) && (!sub->printer || printer == sub->printer) && (!sub->resource || res == sub->resource))
-    {
-      char uri[1024];			// URI value
+  add_event(job->printer, job, doc, NULL, event, text);
+}
 
-      cupsRWLockWrite(&sub->rwlock);
 
-      n = ippNew();
-      ippAddString(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_CHARSET, "notify-charset", NULL, sub->charset);
-      ippAddString(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_LANGUAGE, "notify-natural-language", NULL, sub->language);
-      if (printer)
-      {
-        httpAssembleURI(HTTP_URI_CODING_ALL, uri, sizeof(uri), Encryption == HTTP_ENCRYPTION_NEVER ? "ipp" : "ipps", NULL, ServerName, DefaultPort, printer->resource);
-	ippAddString(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_URI, "notify-printer-uri", NULL, uri);
-      }
-      else
-      {
-        httpAssembleURI(HTTP_URI_CODING_ALL, uri, sizeof(uri), Encryption == HTTP_ENCRYPTION_NEVER ? "ipp" : "ipps", NULL, ServerName, DefaultPort, "/ipp/system");
-	ippAddString(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_URI, "notify-system-uri", NULL, uri);
-      }
-
-      if (job)
-	ippAddInteger(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_INTEGER, sub->job ? "notify-job-id" : "job-id", job->id);
-      if (res)
-	ippAddInteger(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_INTEGER, "notify-resource-id", res->id);
-      ippAddInteger(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_INTEGER, "notify-subscription-id", sub->id);
-      ippAddString(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_URI, "notify-subscription-uuid", NULL, sub->uuid);
-      ippAddInteger(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_INTEGER, "notify-sequence-number", ++ sub->last_sequence);
-      ippAddString(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_KEYWORD, "notify-subscribed-event", NULL, serverGetNotifySubscribedEvent(event));
-      ippAddString(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_TEXT, "notify-text", NULL, text);
-      if (sub->userdata)
-      {
-        attr = ippCopyAttribute(n, sub->userdata, 0);
-        ippSetGroupTag(n, &attr, IPP_TAG_EVENT_NOTIFICATION);
-      }
-      if (job && (event & SERVER_EVENT_JOB_ALL))
-      {
-	ippAddInteger(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_ENUM, "job-state", (int)job->state);
-	serverCopyJobStateReasons(n, IPP_TAG_EVENT_NOTIFICATION, job);
-	if (event == SERVER_EVENT_JOB_CREATED)
-	{
-	  ippAddString(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_NAME, "job-name", NULL, job->name);
-	  ippAddString(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_NAME, "job-originating-user-name", NULL, job->username);
-	}
-      }
-      if (!sub->job && printer && (event & SERVER_EVENT_PRINTER_ALL))
-      {
-	ippAddBoolean(n, IPP_TAG_EVENT_NOTIFICATION, "printer-is-accepting-jobs", printer->is_accepting);
-	ippAddInteger(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_ENUM, "printer-state", (int)printer->state);
-	serverCopyPrinterStateReasons(n, IPP_TAG_EVENT_NOTIFICATION, printer);
-      }
-      if (printer)
-	ippAddInteger(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_INTEGER, "printer-up-time", (int)(time(NULL) - printer->start_time));
-      else
-	ippAddInteger(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_INTEGER, "system-up-time", (int)(time(NULL) - SystemStartTime));
+//
+// 'serverAddEventNoLock()' - Add an event to a subscription.
+//
+// Note: Printer, job, resource, and subscription objects are not locked.
+//
 
-      cupsArrayAdd(sub->events, n);
-      if (cupsArrayGetCount(sub->events) > 100)
-      {
-        n = (ipp_t *)cupsArrayGetFirst(sub->events);
-	cupsArrayRemove(sub->events, n);
-	ippDelete(n);
-	sub->first_sequence ++;
-      }
+void
+serverAddEventNoLock(
+    server_printer_t  *printer,		// I - Printer, if any
+    server_job_t      *job,		// I - Job, if any
+    server_resource_t *res,		// I - Resource, if any
+    server_event_t    event,		// I - Event
+    const char        *message,		// I - Printf-style notify-text message
+    ...)				// I - Additional printf arguments
+{
+  char			text[1024];	// notify-text value
+  va_list		ap;		// Argument pointer
 
-      cupsRWUnlock(&sub->rwlock);
 
-      serverLog(SERVER_LOGLEVEL_DEBUG, "Broadcasting new event.");
-      cupsCondBroadcast(&NotificationCondition);
-    }
+  if (message)
+  {
+    va_start(ap, message);
+    vsnprintf(text, sizeof(text), message, ap);
+    va_end(ap);
   }
+  else
+    text[0] = '\0';
 
-  cupsRWUnlock(&SubscriptionsRWLock);
+  add_event(printer, job, NULL, res, event, text);
 }
 
 
@@ -377,6 +327,115 @@ serverGetNotifySubscribedEvent(
 }
 
 
+//
+// 'add_event()' - Add an event to matching subscriptions.
+//
+
+static void
+add_event(
+    server_printer_t  *printer,		// I - Printer, if any
+    server_job_t      *job,		// I - Job, if any
+    server_document_t *doc,		// I - Document, if any
+    server_resource_t *res,		// I - Resource, if any
+    server_event_t    event,		// I - Event
+    const char        *text)		// I - notify-text message
+{
+  server_subscription_t *sub;		// Current subscription
+  ipp_t			*n;		// Notify event attributes
+  ipp_attribute_t	*attr;		// Event attribute
+
+
+  serverLog(SERVER_LOGLEVEL_DEBUG, "add_event(printer=%p(%s), job=%p(%d), event=0x%x, message=\"%s\")", (void *)printer, printer ? printer->name : "(null)", (void *)job, job ? job->id : -1, event, text);
+
+  // Any event may change what the web interface shows...
+  serverInvalidateWebPages(printer ? printer : job ? job->printer : NULL, false);
+
+  cupsRWLockRead(&SubscriptionsRWLock);
+
+  for (sub = (server_subscription_t *)cupsArrayGetFirst(Subscriptions); sub; sub = (server_subscription_t *)cupsArrayGetNext(Subscriptions))
+  {
+    serverLog(SERVER_LOGLEVEL_DEBUG, "serverAddEvent: sub->id=%d, sub->mask=0x%x, sub->job=%p(%d)", sub->id, sub->mask, (void *)sub->job, sub->job ? sub->job->id : -1);
+
+    if (sub->mask & event && (!sub->job || job == sub->job) && (!sub->printer || printer == sub->printer) && (!sub->resource || res == sub->resource))
+    {
+      char uri[1024];			// URI value
+
+      cupsRWLockWrite(&sub->rwlock);
+
+      n = ippNew();
+      ippAddString(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_CHARSET, "notify-charset", NULL, sub->charset);
+      ippAddString(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_LANGUAGE, "notify-natural-language", NULL, sub->language);
+      if (printer)
+      {
+        httpAssembleURI(HTTP_URI_CODING_ALL, uri, sizeof(uri), Encryption == HTTP_ENCRYPTION_NEVER ? "ipp" : "ipps", NULL, ServerName, DefaultPort, printer->resource);
+	ippAddString(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_URI, "notify-printer-uri", NULL, uri);
+      }
+      else
+      {
+        httpAssembleURI(HTTP_URI_CODING_ALL, uri, sizeof(uri), Encryption == HTTP_ENCRYPTION_NEVER ? "ipp" : "ipps", NULL, ServerName, DefaultPort, "/ipp/system");
+	ippAddString(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_URI, "notify-system-uri", NULL, uri);
+      }
+
+      if (job)
+	ippAddInteger(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_INTEGER, sub->job ? "notify-job-id" : "job-id", job->id);
+      if (res)
+	ippAddInteger(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_INTEGER, "notify-resource-id", res->id);
+      ippAddInteger(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_INTEGER, "notify-subscription-id", sub->id);
+      ippAddString(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_URI, "notify-subscription-uuid", NULL, sub->uuid);
+      ippAddInteger(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_INTEGER, "notify-sequence-number", ++ sub->last_sequence);
+      ippAddString(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_KEYWORD, "notify-subscribed-event", NULL, serverGetNotifySubscribedEvent(event));
+      ippAddString(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_TEXT, "notify-text", NULL, text);
+      if (sub->userdata)
+      {
+        attr = ippCopyAttribute(n, sub->userdata, 0);
+        ippSetGroupTag(n, &attr, IPP_TAG_EVENT_NOTIFICATION);
+      }
+      if (job && (event & SERVER_EVENT_JOB_ALL))
+      {
+	ippAddInteger(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_ENUM, "job-state", (int)job->state);
+	serverCopyJobStateReasons(n, IPP_TAG_EVENT_NOTIFICATION, job);
+	if (event == SERVER_EVENT_JOB_CREATED)
+	{
+	  ippAddString(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_NAME, "job-name", NULL, job->name);
+	  ippAddString(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_NAME, "job-originating-user-name", NULL, job->username);
+	}
+      }
+      if (doc && (event & SERVER_EVENT_DOCUMENT_ALL))
+      {
+	ippAddInteger(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_INTEGER, "document-number", doc->number);
+	ippAddInteger(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_ENUM, "document-state", (int)doc->state);
+      }
+      if (!sub->job && printer && (event & SERVER_EVENT_PRINTER_ALL))
+      {
+	ippAddBoolean(n, IPP_TAG_EVENT_NOTIFICATION, "printer-is-accepting-jobs", printer->is_accepting);
+	ippAddInteger(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_ENUM, "printer-state", (int)printer->state);
+	serverCopyPrinterStateReasons(n, IPP_TAG_EVENT_NOTIFICATION, printer);
+      }
+      if (printer)
+	ippAddInteger(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_INTEGER, "printer-up-time", (int)(time(NULL) - printer->start_time));
+      else
+	ippAddInteger(n, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_INTEGER, "system-up-time", (int)(time(NULL) - SystemStartTime));
+
+      cupsArrayAdd(sub->events, n);
+      if (cupsArrayGetCount(sub->events) > 100)
+      {
+        n = (ipp_t *)cupsArrayGetFirst(sub->events);
+	cupsArrayRemove(sub->events, n);
+	ippDelete(n);
+	sub->first_sequence ++;
+      }
+
+      cupsRWUnlock(&sub->rwlock);
+
+      serverLog(SERVER_LOGLEVEL_DEBUG, "Broadcasting new event.");
+      cupsCondBroadcast(&NotificationCondition);
+    }
+  }
+
+  cupsRWUnlock(&SubscriptionsRWLock);
+}
+
+
 //
 // 'compare_subscriptions()' - Compare two subscriptions.
 //
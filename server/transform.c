@@ -10,24 +10,292 @@
 
 #include "ippserver.h"
 
-#ifdef _WIN32
-#  include <sys/timeb.h>
-#else
+#ifndef _WIN32
 #  include <signal.h>
 #  include <spawn.h>
+#  include <sys/resource.h>
 #endif /* _WIN32 */
+#ifdef __linux__
+#  include <sched.h>
+#endif /* __linux__ */
+
+
+/*
+ * Local types...
+ */
+
+typedef struct server_twait_s		/**** Transform queue entry ****/
+{
+  server_job_t		*job;		/* Job waiting for a transform slot */
+  int			printer_id;	/* Printer ID for fair queuing */
+  bool			granted;	/* Has a slot been granted? */
+} server_twait_t;
+
+typedef struct server_tfeed_s		/**** Streaming document feed ****/
+{
+  server_job_t		*job;		/* Job being streamed */
+  server_document_t	*doc;		/* Document being streamed */
+  int			infd,		/* Spool file */
+			outfd;		/* Pipe to command */
+} server_tfeed_t;
+
+typedef struct server_tprep_s		/**** Document preparation ****/
+{
+  server_job_t		*job;		/* Job */
+  server_document_t	*doc;		/* Document to transform */
+  const char		*format;	/* Destination MIME media type */
+} server_tprep_t;
+
+
+/*
+ * Local globals...
+ */
+
+static cups_mutex_t	transform_mutex = CUPS_MUTEX_INITIALIZER;
+					/* Mutex for transform scheduler */
+static cups_cond_t	transform_cond = CUPS_COND_INITIALIZER;
+					/* Condition for granted slots */
+static cups_array_t	*transform_queue = NULL;
+					/* Waiting transforms, in arrival order */
+static int		transform_active = 0,
+					/* Number of running transforms */
+			transform_last_printer = 0;
+					/* Printer ID of last granted slot */
+static unsigned		transform_count = 0;
+					/* Number of transforms started */
+static double		transform_wait_total = 0.0,
+					/* Total queue wait time in seconds */
+			transform_wait_max = 0.0;
+					/* Maximum queue wait time in seconds */
+#ifdef __linux__
+static cpu_set_t	transform_cpus;	/* CPU affinity for transforms */
+static bool		transform_use_cpus = false;
+					/* Use CPU affinity? */
+#endif /* __linux__ */
 
 
 /*
  * Local functions...
  */
 
+static int	acquire_transform(server_job_t *job);
 #ifdef _WIN32
 static int	asprintf(char **s, const char *format, ...);
+#else
+static void	*feed_transform(server_tfeed_t *feed);
 #endif /* _WIN32 */
+static void	grant_transforms(void);
+#ifndef _WIN32
+static void	*prepare_document(server_tprep_t *prep);
+#endif /* !_WIN32 */
 static void	process_attr_message(server_job_t *job, char *message, server_transform_t mode);
 static void	process_state_message(server_job_t *job, char *message);
-static double	time_seconds(void);
+static void	release_transform(void);
+#ifndef _WIN32
+static int	spawn_transform(const char *command, posix_spawn_file_actions_t *actions, char **argv, char **envp, int infd, int outfd, int errfd);
+#endif /* !_WIN32 */
+
+
+/*
+ * 'serverCopyTransformStatus()' - Copy the transform scheduler status.
+ */
+
+void
+serverCopyTransformStatus(
+    ipp_t        *ipp,			/* I - IPP message */
+    cups_array_t *ra)			/* I - Requested attributes */
+{
+  cupsMutexLock(&transform_mutex);
+
+  if (!ra || cupsArrayFind(ra, "smi2699-max-transforms"))
+    ippAddInteger(ipp, IPP_TAG_SYSTEM, IPP_TAG_INTEGER, "smi2699-max-transforms", MaxTransforms);
+
+  if (!ra || cupsArrayFind(ra, "smi2699-transform-wait-time-max"))
+    ippAddInteger(ipp, IPP_TAG_SYSTEM, IPP_TAG_INTEGER, "smi2699-transform-wait-time-max", (int)(1000.0 * transform_wait_max));
+
+  if (!ra || cupsArrayFind(ra, "smi2699-transform-wait-time-total"))
+    ippAddInteger(ipp, IPP_TAG_SYSTEM, IPP_TAG_INTEGER, "smi2699-transform-wait-time-total", (int)(1000.0 * transform_wait_total));
+
+  if (!ra || cupsArrayFind(ra, "smi2699-transforms-active"))
+    ippAddInteger(ipp, IPP_TAG_SYSTEM, IPP_TAG_INTEGER, "smi2699-transforms-active", transform_active);
+
+  if (!ra || cupsArrayFind(ra, "smi2699-transforms-started"))
+    ippAddInteger(ipp, IPP_TAG_SYSTEM, IPP_TAG_INTEGER, "smi2699-transforms-started", (int)transform_count);
+
+  if (!ra || cupsArrayFind(ra, "smi2699-transforms-queued"))
+    ippAddInteger(ipp, IPP_TAG_SYSTEM, IPP_TAG_INTEGER, "smi2699-transforms-queued", (int)cupsArrayGetCount(transform_queue));
+
+  cupsMutexUnlock(&transform_mutex);
+}
+
+
+/*
+ * 'serverInitTransforms()' - Initialize the transform scheduler.
+ */
+
+void
+serverInitTransforms(void)
+{
+ /*
+  * Default to one transform per online CPU...
+  */
+
+  if (MaxTransforms <= 0)
+  {
+#ifdef _WIN32
+    SYSTEM_INFO	info;			/* System information */
+
+    GetSystemInfo(&info);
+    MaxTransforms = (int)info.dwNumberOfProcessors;
+
+#else
+    MaxTransforms = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif /* _WIN32 */
+
+    if (MaxTransforms <= 0)
+      MaxTransforms = 1;
+  }
+
+  serverLog(SERVER_LOGLEVEL_INFO, "Running up to %d transforms at a time.", MaxTransforms);
+
+#ifdef __linux__
+ /*
+  * Convert the TransformCPUs list ("N" or "N-M" separated by commas) to a CPU
+  * set...
+  */
+
+  CPU_ZERO(&transform_cpus);
+
+  if (TransformCPUs)
+  {
+    const char	*ptr;			/* Pointer into list */
+    char	*end;			/* End of number */
+    long	first, last;		/* CPU range */
+
+    for (ptr = TransformCPUs; *ptr;)
+    {
+      first = last = strtol(ptr, &end, 10);
+      if (*end == '-')
+        last = strtol(end + 1, &end, 10);
+
+      for (; first <= last && first < CPU_SETSIZE; first ++)
+      {
+        CPU_SET((int)first, &transform_cpus);
+        transform_use_cpus = true;
+      }
+
+      if (*end == ',')
+        ptr = end + 1;
+      else
+        break;
+    }
+  }
+#endif /* __linux__ */
+}
+
+
+/*
+ * 'serverPrepareDocument()' - Start transforming a document for fetching.
+ *
+ * The transform runs in the background so that the next document in a job is
+ * ready by the time the output device fetches it.
+ */
+
+void
+serverPrepareDocument(
+    server_job_t      *job,		/* I - Job */
+    server_document_t *doc,		/* I - Document */
+    const char        *format)		/* I - Destination MIME media type */
+{
+#ifdef _WIN32
+  (void)job;
+  (void)doc;
+  (void)format;
+
+#else
+  server_tprep_t	*prep;		/* Preparation data */
+  cups_thread_t		t;		/* Preparation thread */
+
+
+  if (!strcmp(doc->format, format))
+    return;
+
+  cupsMutexLock(&StreamMutex);
+
+  if (doc->preparing || doc->prepared || doc->incoming || doc->state >= IPP_JSTATE_CANCELED || job->cancel)
+  {
+    cupsMutexUnlock(&StreamMutex);
+    return;
+  }
+
+  doc->preparing = true;
+  job->printer->num_preparing ++;
+
+  cupsMutexUnlock(&StreamMutex);
+
+ /*
+  * The preparation thread holds a reference to the job so that deleting the
+  * job never has to wait for the transform...
+  */
+
+  serverAddJobReference(job);
+
+  if ((prep = calloc(1, sizeof(server_tprep_t))) != NULL)
+  {
+    prep->job    = job;
+    prep->doc    = doc;
+    prep->format = format;
+
+    if ((t = cupsThreadCreate((cups_thread_func_t)prepare_document, prep)) != 0)
+    {
+      cupsThreadDetach(t);
+      return;
+    }
+
+    free(prep);
+  }
+
+  serverLogJob(SERVER_LOGLEVEL_ERROR, job, "Unable to start transform of document #%d.", doc->number);
+
+  cupsMutexLock(&StreamMutex);
+  doc->preparing = false;
+  job->printer->num_preparing --;
+  cupsCondBroadcast(&StreamCondition);
+  cupsMutexUnlock(&StreamMutex);
+
+  serverRemoveJobReference(job);
+#endif /* _WIN32 */
+}
+
+
+/*
+ * 'serverStopDocument()' - Stop processing/transforming a document.
+ */
+
+void
+serverStopDocument(
+    server_job_t      *job,		/* I - Job */
+    server_document_t *doc)		/* I - Document to stop */
+{
+  cupsRWLockWrite(&job->rwlock);
+  cupsMutexLock(&StreamMutex);
+
+  doc->cancel = true;
+
+#ifndef _WIN32 /* TODO: Figure out a way to kill a spawned process on Windows */
+  if (doc->transform_pid)
+    kill(doc->transform_pid, SIGTERM);
+#endif /* !_WIN32 */
+
+ /*
+  * Wake up anything waiting on the document data...
+  */
+
+  cupsCondBroadcast(&StreamCondition);
+
+  cupsMutexUnlock(&StreamMutex);
+  cupsRWUnlock(&job->rwlock);
+}
 
 
 /*
@@ -37,6 +305,9 @@ static double	time_seconds(void);
 void
 serverStopJob(server_job_t *job)	/* I - Job to stop */
 {
+  server_document_t	*doc;		/* Current document */
+
+
   if (job->state != IPP_JSTATE_PROCESSING)
     return;
 
@@ -46,8 +317,15 @@ serverStopJob(server_job_t *job)	/* I - Job to stop */
   job->state_reasons |= SERVER_JREASON_JOB_STOPPED;
 
 #ifndef _WIN32 /* TODO: Figure out a way to kill a spawned process on Windows */
-  if (job->transform_pid)
-    kill(job->transform_pid, SIGTERM);
+  cupsMutexLock(&StreamMutex);
+
+  for (doc = (server_document_t *)cupsArrayGetFirst(job->documents); doc; doc = (server_document_t *)cupsArrayGetNext(job->documents))
+  {
+    if (doc->transform_pid)
+      kill(doc->transform_pid, SIGTERM);
+  }
+
+  cupsMutexUnlock(&StreamMutex);
 #endif /* !_WIN32 */
   cupsRWUnlock(&job->rwlock);
 
@@ -55,6 +333,43 @@ serverStopJob(server_job_t *job)	/* I - Job to stop */
 }
 
 
+/*
+ * 'serverStopTransforms()' - Cancel a job and stop all of its transforms.
+ *
+ * This only needs the job's document list to stay the same, so it can be
+ * called with or without the job and printer locks held.
+ */
+
+void
+serverStopTransforms(
+    server_job_t *job)			/* I - Job */
+{
+#ifndef _WIN32 /* TODO: Figure out a way to kill a spawned process on Windows */
+  server_document_t	*doc;		/* Current document */
+  size_t		i,		/* Looping var */
+			count;		/* Number of documents */
+#endif /* !_WIN32 */
+
+
+  cupsMutexLock(&StreamMutex);
+
+  job->cancel = 1;
+
+#ifndef _WIN32
+  for (i = 0, count = cupsArrayGetCount(job->documents); i < count; i ++)
+  {
+    doc = (server_document_t *)cupsArrayGetElement(job->documents, i);
+
+    if (doc->transform_pid)
+      kill(doc->transform_pid, SIGTERM);
+  }
+#endif /* !_WIN32 */
+
+  cupsCondBroadcast(&StreamCondition);
+  cupsMutexUnlock(&StreamMutex);
+}
+
+
 /*
  * 'serverTransformJob()' - Generate printer-ready document data for a Job.
  */
@@ -63,6 +378,7 @@ int					/* O - 0 on success, non-zero on error */
 serverTransformJob(
     server_client_t    *client,		/* I - Client connection (if any) */
     server_job_t       *job,		/* I - Job to transform */
+    server_document_t  *doc,		/* I - Document to transform */
     const char         *command,	/* I - Command to run */
     const char         *format,		/* I - Destination MIME media type */
     server_transform_t mode)		/* I - Transform mode */
@@ -84,8 +400,12 @@ serverTransformJob(
 		*ptr;			/* Pointer into filename */
 #else
   posix_spawn_file_actions_t actions;	/* Spawn file actions */
-  int		mystdout[2] = {-1, -1},	/* Pipe for stdout */
+  int		mystdin[2] = {-1, -1},	/* Pipe for stdin */
+		mystdout[2] = {-1, -1},	/* Pipe for stdout */
 		mystderr[2] = {-1, -1};	/* Pipe for stderr */
+  bool		streaming;		/* Stream document to command? */
+  server_tfeed_t feed;			/* Streaming document feed */
+  cups_thread_t	feed_thread = 0;	/* Streaming feed thread */
   struct pollfd	polldata[2];		/* Poll data */
   int		pollcount;		/* Number of pipes to poll */
   char		data[32768],		/* Data from stdout */
@@ -103,8 +423,25 @@ serverTransformJob(
     command = fullcommand;
   }
 
-  serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Running command \"%s %s\".", command, job->filename);
-  start = time_seconds();
+#ifdef _WIN32
+ /*
+  * Streaming is not supported on Windows, so wait for all of the document
+  * data before taking a transform slot...
+  */
+
+  while (doc->incoming && !job->cancel)
+    serverWaitJobData(job, doc, doc->received);
+#endif /* _WIN32 */
+
+  if (acquire_transform(job))
+    return (-1);
+
+#ifndef _WIN32
+  streaming = doc->incoming;
+#endif /* !_WIN32 */
+
+  serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Running command \"%s %s\".", command, doc->filename);
+  start = serverGetTime();
 
  /*
   * Setup the command-line arguments...
@@ -112,7 +449,7 @@ serverTransformJob(
 
 #if _WIN32
   // Convert job filename from C:/foo/bar to C:\foo\bar
-  cupsCopyString(filename, job->filename, sizeof(filename));
+  cupsCopyString(filename, doc->filename, sizeof(filename));
   for (ptr = filename; *ptr; ptr ++)
   {
     if (*ptr == '/')
@@ -124,9 +461,10 @@ serverTransformJob(
   myargv[2] = NULL;
 
 #else
-  // Use job filename as-is...
+  // Use job filename as-is, or standard input if the document is still being
+  // received...
   myargv[0] = (char *)command;
-  myargv[1] = job->filename;
+  myargv[1] = streaming ? "/dev/stdin" : doc->filename;
   myargv[2] = NULL;
 #endif // _WIN32
 
@@ -144,7 +482,7 @@ serverTransformJob(
     goto transform_failure;
   }
 
-  if (asprintf(myenvp + myenvc, "CONTENT_TYPE=%s", job->format) > 0)
+  if (asprintf(myenvp + myenvc, "CONTENT_TYPE=%s", doc->format) > 0)
     myenvc ++;
 
   if (job->printer->pinfo.device_uri && asprintf(myenvp + myenvc, "DEVICE_URI=%s", job->printer->pinfo.device_uri) > 0)
@@ -233,7 +571,7 @@ serverTransformJob(
   else
     myenvp[myenvc ++] = strdup("SERVER_LOGLEVEL=error");
 
-  for (attr = ippGetFirstAttribute(job->doc_attrs); attr && myenvc < (int)(sizeof(myenvp) / sizeof(myenvp[0]) - 1); attr = ippGetNextAttribute(job->doc_attrs))
+  for (attr = ippGetFirstAttribute(doc->attrs); attr && myenvc < (int)(sizeof(myenvp) / sizeof(myenvp[0]) - 1); attr = ippGetNextAttribute(doc->attrs))
   {
    /*
     * Convert "attribute-name" to "IPP_ATTRIBUTE_NAME=" and then add the
@@ -275,7 +613,7 @@ serverTransformJob(
     if (!name)
       continue;
 
-    if (ippFindAttribute(job->doc_attrs, name, IPP_TAG_ZERO))
+    if (ippFindAttribute(doc->attrs, name, IPP_TAG_ZERO))
       continue;
 
     valptr = val;
@@ -325,7 +663,7 @@ serverTransformJob(
 
     if (mode == SERVER_TRANSFORM_TO_FILE)
     {
-      serverCreateJobFilename(job, format, line, sizeof(line));
+      serverCreateJobFilename(job, doc->number, format, line, sizeof(line));
       mystdout[1] = open(line, O_WRONLY | O_CREAT | O_TRUNC | O_EXCL | O_BINARY, 0666);
     }
     else
@@ -344,8 +682,36 @@ serverTransformJob(
     goto transform_failure;
   }
 
+  if (streaming)
+  {
+   /*
+    * Feed the document to the command's standard input as it arrives...
+    */
+
+    if (pipe(mystdin))
+    {
+      serverLogJob(SERVER_LOGLEVEL_ERROR, job, "Unable to create pipe for stdin: %s", strerror(errno));
+      goto transform_failure;
+    }
+
+    fcntl(mystdin[1], F_SETFD, FD_CLOEXEC);
+
+    if ((feed.infd = open(doc->filename, O_RDONLY | O_BINARY)) < 0)
+    {
+      serverLogJob(SERVER_LOGLEVEL_ERROR, job, "Unable to open job file: %s", strerror(errno));
+      goto transform_failure;
+    }
+
+    feed.job   = job;
+    feed.doc   = doc;
+    feed.outfd = mystdin[1];
+  }
+
   posix_spawn_file_actions_init(&actions);
-  posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY | O_BINARY, 0);
+  if (mystdin[0] < 0)
+    posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY | O_BINARY, 0);
+  else
+    posix_spawn_file_actions_adddup2(&actions, mystdin[0], 0);
   if (mystdout[1] < 0)
     posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY | O_BINARY, 0);
   else
@@ -356,16 +722,41 @@ serverTransformJob(
   else
     posix_spawn_file_actions_adddup2(&actions, mystderr[1], 2);
 
-  if (posix_spawn(&pid, command, &actions, NULL, myargv, myenvp))
+  if ((pid = spawn_transform(command, &actions, myargv, myenvp, mystdin[0], mystdout[1], mystderr[1])) < 0)
   {
     serverLogJob(SERVER_LOGLEVEL_ERROR, job, "Unable to start job processing command: %s", strerror(errno));
 
     posix_spawn_file_actions_destroy(&actions);
 
+    if (mystdin[0] >= 0)
+      close(feed.infd);
+
     goto transform_failure;
   }
 
-  job->transform_pid = pid;
+  cupsMutexLock(&StreamMutex);
+
+  doc->transform_pid = pid;
+
+  if (job->cancel || doc->cancel)
+    kill(pid, SIGTERM);
+
+  cupsMutexUnlock(&StreamMutex);
+
+  if (mystdin[0] >= 0)
+  {
+    close(mystdin[0]);
+    mystdin[0] = -1;
+    mystdin[1] = -1;			/* Closed by feed_transform() */
+
+    if ((feed_thread = cupsThreadCreate((cups_thread_func_t)feed_transform, &feed)) == 0)
+    {
+      serverLogJob(SERVER_LOGLEVEL_ERROR, job, "Unable to create streaming thread: %s", strerror(errno));
+      close(feed.infd);
+      close(feed.outfd);
+      kill(pid, SIGTERM);
+    }
+  }
 
   serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Started job processing command, pid=%d", pid);
 
@@ -480,10 +871,18 @@ serverTransformJob(
   while (wait(&status) < 0);
 #  endif /* HAVE_WAITPID */
 
-  job->transform_pid = 0;
+  cupsMutexLock(&StreamMutex);
+  if (doc->transform_pid == pid)
+    doc->transform_pid = 0;
+  cupsMutexUnlock(&StreamMutex);
+
+  if (feed_thread)
+    cupsThreadWait(feed_thread);
 #endif /* _WIN32 */
 
-  end = time_seconds();
+  release_transform();
+
+  end = serverGetTime();
   serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Total transform time is %.3f seconds.", end - start);
 
 #ifdef _WIN32
@@ -509,6 +908,11 @@ serverTransformJob(
   transform_failure:
 
   #ifndef _WIN32
+  if (mystdin[0] >= 0)
+    close(mystdin[0]);
+  if (mystdin[1] >= 0)
+    close(mystdin[1]);
+
   if (mystdout[0] >= 0)
     close(mystdout[0]);
   if (mystdout[1] >= 0)
@@ -523,10 +927,77 @@ serverTransformJob(
   while (myenvc > 0)
     free(myenvp[-- myenvc]);
 
+  release_transform();
+
   return (-1);
 }
 
 
+/*
+ * 'acquire_transform()' - Wait for a transform slot.
+ *
+ * Slots are granted round-robin by printer so that a busy printer cannot
+ * starve the others.
+ */
+
+static int				/* O - 0 on success, -1 if canceled */
+acquire_transform(server_job_t *job)	/* I - Job */
+{
+  server_twait_t	wait;		/* Queue entry */
+  double		start,		/* Start of wait */
+			elapsed;	/* Time spent waiting */
+
+
+  wait.job        = job;
+  wait.printer_id = job->printer->id;
+  wait.granted    = false;
+
+  start = serverGetTime();
+
+  cupsMutexLock(&transform_mutex);
+
+  if (!transform_queue)
+    transform_queue = cupsArrayNew(NULL, NULL, NULL, 0, NULL, NULL);
+
+  cupsArrayAdd(transform_queue, &wait);
+  grant_transforms();
+
+  if (!wait.granted)
+  {
+    serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Waiting for transform slot (%d active, %d queued).", transform_active, (int)cupsArrayGetCount(transform_queue));
+
+    while (!wait.granted && !job->cancel)
+      cupsCondWait(&transform_cond, &transform_mutex, 1.0);
+
+    if (!wait.granted)
+    {
+      cupsArrayRemove(transform_queue, &wait);
+      cupsMutexUnlock(&transform_mutex);
+
+      serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Canceled while waiting for transform slot.");
+      return (-1);
+    }
+  }
+
+  elapsed = serverGetTime() - start;
+
+  transform_count ++;
+  transform_wait_total += elapsed;
+  if (elapsed > transform_wait_max)
+    transform_wait_max = elapsed;
+
+  cupsMutexUnlock(&transform_mutex);
+
+  cupsRWLockWrite(&job->rwlock);
+  job->transform_wait += elapsed;
+  cupsRWUnlock(&job->rwlock);
+
+  serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Waited %.3f seconds for transform slot.", elapsed);
+
+  return (0);
+}
+
+
 #ifdef _WIN32
 /*
  * 'asprintf()' - Format and allocate a string.
@@ -556,6 +1027,164 @@ asprintf(char       **s,		/* O - Allocated string or `NULL` on error */
 #endif /* _WIN32 */
 
 
+#ifndef _WIN32
+/*
+ * 'feed_transform()' - Copy streamed document data to a command.
+ */
+
+static void *				/* O - Thread exit status */
+feed_transform(server_tfeed_t *feed)	/* I - Streaming document feed */
+{
+  off_t		offset = 0,		/* Bytes copied so far */
+		received;		/* Bytes received so far */
+  ssize_t	bytes,			/* Bytes read */
+		written;		/* Bytes written */
+  char		buffer[65536],		/* Copy buffer */
+		*bufptr;		/* Pointer into buffer */
+
+
+  while ((received = serverWaitJobData(feed->job, feed->doc, offset)) > offset)
+  {
+    while (offset < received)
+    {
+      if ((bytes = read(feed->infd, buffer, sizeof(buffer))) <= 0)
+      {
+        if (bytes < 0 && errno == EINTR)
+          continue;
+
+        serverLogJob(SERVER_LOGLEVEL_ERROR, feed->job, "Unable to read job file: %s", bytes < 0 ? strerror(errno) : "Unexpected end of file");
+        goto feed_done;
+      }
+
+      for (bufptr = buffer; bytes > 0; bytes -= written, bufptr += written)
+      {
+        if ((written = write(feed->outfd, bufptr, (size_t)bytes)) < 0)
+        {
+          if (errno == EINTR)
+          {
+            written = 0;
+            continue;
+          }
+
+          serverLogJob(SERVER_LOGLEVEL_DEBUG, feed->job, "Unable to write to job processing command: %s", strerror(errno));
+          goto feed_done;
+        }
+
+        offset += written;
+      }
+    }
+  }
+
+  serverLogJob(SERVER_LOGLEVEL_DEBUG, feed->job, "Streamed %ld bytes to job processing command.", (long)offset);
+
+  feed_done:
+
+  close(feed->infd);
+  close(feed->outfd);
+
+  return (NULL);
+}
+#endif /* !_WIN32 */
+
+
+/*
+ * 'grant_transforms()' - Grant free transform slots to waiting jobs.
+ *
+ * The transform mutex must be held by the caller.
+ */
+
+static void
+grant_transforms(void)
+{
+  size_t		i,		/* Looping var */
+			count;		/* Number of waiting transforms */
+  server_twait_t	*wait,		/* Current queue entry */
+			*next,		/* Next entry after last printer */
+			*first;		/* First entry overall */
+  bool			granted = false;/* Did we grant any slots? */
+
+
+  while (transform_active < MaxTransforms && (count = cupsArrayGetCount(transform_queue)) > 0)
+  {
+   /*
+    * Pick the oldest entry for the next printer ID after the last one we
+    * served, wrapping around to the lowest printer ID...
+    */
+
+    for (i = 0, next = NULL, first = NULL; i < count; i ++)
+    {
+      wait = (server_twait_t *)cupsArrayGetElement(transform_queue, i);
+
+      if (!first || wait->printer_id < first->printer_id)
+        first = wait;
+
+      if (wait->printer_id > transform_last_printer && (!next || wait->printer_id < next->printer_id))
+        next = wait;
+    }
+
+    if (!next)
+      next = first;
+
+    cupsArrayRemove(transform_queue, next);
+
+    next->granted          = true;
+    transform_last_printer = next->printer_id;
+    transform_active ++;
+    granted = true;
+  }
+
+  if (granted)
+    cupsCondBroadcast(&transform_cond);
+}
+
+
+#ifndef _WIN32
+/*
+ * 'prepare_document()' - Transform a document to a file for fetching.
+ */
+
+static void *				/* O - Thread exit status */
+prepare_document(server_tprep_t *prep)	/* I - Preparation data */
+{
+  server_job_t		*job = prep->job;
+					/* Job */
+  server_document_t	*doc = prep->doc;
+					/* Document */
+  char			filename[1024];	/* Transformed document file */
+  int			status;		/* Transform status */
+
+
+  serverCreateJobFilename(job, doc->number, prep->format, filename, sizeof(filename));
+  unlink(filename);
+
+  serverLogJob(SERVER_LOGLEVEL_DEBUG, job, "Preparing document #%d as \"%s\".", doc->number, prep->format);
+
+  if ((status = serverTransformJob(NULL, job, doc, "ipptransform", prep->format, SERVER_TRANSFORM_TO_FILE)) != 0)
+    unlink(filename);
+
+  cupsMutexLock(&StreamMutex);
+
+  if (!status)
+  {
+    doc->prepared        = strdup(filename);
+    doc->prepared_format = prep->format;
+  }
+
+  doc->preparing = false;
+  job->printer->num_preparing --;
+
+  cupsCondBroadcast(&StreamCondition);
+  cupsMutexUnlock(&StreamMutex);
+
+  serverRemoveJobReference(job);
+
+  free(prep);
+
+  return (NULL);
+}
+#endif /* !_WIN32 */
+
+
 /*
  * 'process_attr_message()' - Process an ATTR: message from a command.
  */
@@ -775,26 +1404,93 @@ process_state_message(
 
 
 /*
- * 'time_seconds()' - Return the current time in fractional seconds.
+ * 'release_transform()' - Release a transform slot.
  */
 
-static double				/* O - Time in seconds */
-time_seconds(void)
+static void
+release_transform(void)
 {
-#ifdef _WIN32
-  struct _timeb curtime;		/* Current time */
+  cupsMutexLock(&transform_mutex);
 
+  if (transform_active > 0)
+    transform_active --;
 
-  _ftime(&curtime);
+  grant_transforms();
 
-  return ((double)curtime.time + 0.001 * curtime.millitm);
+  cupsMutexUnlock(&transform_mutex);
+}
 
-#else
-  struct timeval curtime;		/* Current time */
 
+#ifndef _WIN32
+/*
+ * 'spawn_transform()' - Start a transform command.
+ *
+ * posix_spawn() cannot set the priority or CPU affinity of the new process,
+ * so when either is configured the command is started with fork() and the
+ * limits are applied in the child before exec, where anything the command
+ * starts inherits them.
+ */
 
-  gettimeofday(&curtime, NULL);
+static int				/* O - Process ID or -1 on error */
+spawn_transform(
+    const char                 *command,/* I - Command to run */
+    posix_spawn_file_actions_t *actions,/* I - File actions for posix_spawn */
+    char                       **argv,	/* I - Command-line arguments */
+    char                       **envp,	/* I - Environment variables */
+    int                        infd,	/* I - Standard input or -1 for /dev/null */
+    int                        outfd,	/* I - Standard output or -1 for /dev/null */
+    int                        errfd)	/* I - Standard error or -1 for /dev/null */
+{
+  int		pid,			/* Process ID */
+		error;			/* posix_spawn() error */
+  bool		limits = TransformNice > 0;
+					/* Apply priority/affinity? */
 
-  return ((double)curtime.tv_sec + 0.000001 * curtime.tv_usec);
-#endif /* _WIN32 */
+
+#  ifdef __linux__
+  if (transform_use_cpus)
+    limits = true;
+#  endif /* __linux__ */
+
+  if (!limits)
+  {
+    if ((error = posix_spawn(&pid, command, actions, NULL, argv, envp)) != 0)
+    {
+      errno = error;
+      return (-1);
+    }
+
+    return (pid);
+  }
+
+  if ((pid = fork()) == 0)
+  {
+   /*
+    * Child comes here, only use async-signal-safe functions...
+    */
+
+    if (TransformNice > 0)
+      setpriority(PRIO_PROCESS, 0, TransformNice);
+
+#  ifdef __linux__
+    if (transform_use_cpus)
+      sched_setaffinity(0, sizeof(transform_cpus), &transform_cpus);
+#  endif /* __linux__ */
+
+    if (infd < 0)
+      infd = open("/dev/null", O_RDONLY | O_BINARY);
+    if (outfd < 0)
+      outfd = open("/dev/null", O_WRONLY | O_BINARY);
+    if (errfd < 0)
+      errfd = open("/dev/null", O_WRONLY | O_BINARY);
+
+    if (dup2(infd, 0) < 0 || dup2(outfd, 1) < 0 || dup2(errfd, 2) < 0)
+      _exit(127);
+
+    execve(command, argv, envp);
+    _exit(127);
+  }
+
+  return (pid);
 }
+#endif /* !_WIN32 */